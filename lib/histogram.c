@@ -0,0 +1,118 @@
+/**
+ *  Copyright (C) 2026 UxPlay contributors
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "histogram.h"
+
+#define HALF_COUNT (HISTOGRAM_SUB_COUNT / 2)
+
+static int
+histogram_index(uint64_t value)
+{
+    int msb, shift, index;
+
+    if (value < HISTOGRAM_SUB_COUNT) {
+        return (int) value;
+    }
+    msb = 63 - __builtin_clzll(value);
+    shift = msb - (HISTOGRAM_SUB_BITS - 1);
+    index = HISTOGRAM_SUB_COUNT + (shift - 1) * HALF_COUNT + (int) ((value >> shift) - HALF_COUNT);
+    return index < HISTOGRAM_BUCKETS ? index : HISTOGRAM_BUCKETS - 1;
+}
+
+/* largest value that maps to a bucket */
+static uint64_t
+histogram_bucket_value(int index)
+{
+    int shift;
+    uint64_t sub;
+
+    if (index < HISTOGRAM_SUB_COUNT) {
+        return (uint64_t) index;
+    }
+    shift = (index - HISTOGRAM_SUB_COUNT) / HALF_COUNT + 1;
+    sub = (uint64_t) ((index - HISTOGRAM_SUB_COUNT) % HALF_COUNT + HALF_COUNT);
+    return ((sub + 1) << shift) - 1;
+}
+
+void
+histogram_reset(histogram_t *histogram)
+{
+    assert(histogram);
+
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        atomic_store_explicit(&histogram->counts[i], 0, memory_order_relaxed);
+    }
+    atomic_store_explicit(&histogram->count, 0, memory_order_relaxed);
+    atomic_store_explicit(&histogram->sum, 0, memory_order_relaxed);
+    atomic_store_explicit(&histogram->max, 0, memory_order_relaxed);
+}
+
+void
+histogram_record(histogram_t *histogram, uint64_t value)
+{
+    uint_fast64_t max;
+
+    atomic_fetch_add_explicit(&histogram->counts[histogram_index(value)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&histogram->count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&histogram->sum, value, memory_order_relaxed);
+    max = atomic_load_explicit(&histogram->max, memory_order_relaxed);
+    while (value > max &&
+           !atomic_compare_exchange_weak_explicit(&histogram->max, &max, value,
+                                                  memory_order_relaxed, memory_order_relaxed));
+}
+
+/* Percentiles are approximate: recording may race with the snapshot */
+void
+histogram_summarize(histogram_t *histogram, histogram_summary_t *summary)
+{
+    uint64_t counts[HISTOGRAM_BUCKETS];
+    uint64_t total = 0;
+    uint64_t targets[3];
+    uint64_t *results[3];
+    uint64_t seen = 0;
+    int next = 0;
+
+    assert(histogram);
+    assert(summary);
+
+    memset(summary, 0, sizeof(histogram_summary_t));
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        counts[i] = atomic_load_explicit(&histogram->counts[i], memory_order_relaxed);
+        total += counts[i];
+    }
+    summary->max = atomic_load_explicit(&histogram->max, memory_order_relaxed);
+    summary->count = total;
+    if (total == 0) {
+        return;
+    }
+    summary->mean = atomic_load_explicit(&histogram->sum, memory_order_relaxed) / total;
+
+    targets[0] = (total * 50 + 99) / 100;
+    targets[1] = (total * 90 + 99) / 100;
+    targets[2] = (total * 99 + 99) / 100;
+    results[0] = &summary->p50;
+    results[1] = &summary->p90;
+    results[2] = &summary->p99;
+    for (int i = 0; i < HISTOGRAM_BUCKETS && next < 3; i++) {
+        seen += counts[i];
+        while (next < 3 && seen >= targets[next]) {
+            uint64_t value = histogram_bucket_value(i);
+            *results[next++] = (value < summary->max) ? value : summary->max;
+        }
+    }
+}
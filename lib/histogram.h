@@ -0,0 +1,51 @@
+/**
+ *  Copyright (C) 2026 UxPlay contributors
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ */
+
+/* Log-linear (HDR style) histogram of unsigned values, typically latencies
+ * in microseconds. Values below 32 are exact; above that each power of two
+ * is split into 16 buckets, a relative error below 6.25%.  Recording is a
+ * few relaxed atomic adds, so it is safe from any thread without locks. */
+
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+#define HISTOGRAM_SUB_BITS    5
+#define HISTOGRAM_SUB_COUNT   (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_MAGNITUDES  40
+#define HISTOGRAM_BUCKETS     (HISTOGRAM_SUB_COUNT + HISTOGRAM_MAGNITUDES * (HISTOGRAM_SUB_COUNT / 2))
+
+typedef struct histogram_s {
+    atomic_uint_fast64_t counts[HISTOGRAM_BUCKETS];
+    atomic_uint_fast64_t count;
+    atomic_uint_fast64_t sum;
+    atomic_uint_fast64_t max;
+} histogram_t;
+
+typedef struct histogram_summary_s {
+    uint64_t count;
+    uint64_t mean;
+    uint64_t p50;
+    uint64_t p90;
+    uint64_t p99;
+    uint64_t max;
+} histogram_summary_t;
+
+void histogram_reset(histogram_t *histogram);
+void histogram_record(histogram_t *histogram, uint64_t value);
+void histogram_summarize(histogram_t *histogram, histogram_summary_t *summary);
+
+#endif
@@ -19,38 +19,246 @@
 #include <string.h>
 #include <assert.h>
 #include <stdio.h>
+#include <stdint.h>
 
 #include "http_request.h"
 #include "llhttp/llhttp.h"
 
+/* Every string and the body of a request live in a per-connection arena.
+ * The first chunk is embedded in the request, so a typical RTSP request is
+ * parsed without touching the heap; larger requests add chunks that are
+ * kept for reuse, up to HTTP_REQUEST_ARENA_KEEP bytes, when the request
+ * is reset. */
+#define HTTP_REQUEST_ARENA_INLINE 4096
+#define HTTP_REQUEST_ARENA_CHUNK  8192
+#define HTTP_REQUEST_ARENA_KEEP   65536
+#define HTTP_REQUEST_MAX_HEADERS  32
+
+#define ARENA_ALIGN(n) (((n) + sizeof(void *) - 1) & ~(sizeof(void *) - 1))
+
+typedef struct http_arena_chunk_s {
+    struct http_arena_chunk_s *next;
+    size_t size;
+    size_t used;
+    char *data;
+} http_arena_chunk_t;
+
+typedef struct http_slice_s {
+    char *ptr;      /* NUL terminated inside the arena */
+    size_t len;
+} http_slice_t;
+
+/* Known header names, indexed by http_header_t */
+static const char *const http_header_names[HTTP_HEADER_COUNT] = {
+    "CSeq",
+    "Content-Type",
+    "Content-Length",
+    "DACP-ID",
+    "Active-Remote",
+    "Transport",
+    "User-Agent",
+    "RTP-Info",
+    "Session",
+    "Range",
+    "X-Apple-ProtocolVersion",
+    "X-Apple-Device-ID",
+    "X-Apple-Session-ID",
+    "X-Apple-Stream-ID",
+    "Apple-Challenge",
+    "Client-Instance",
+    "Connection",
+    "Audio-Latency",
+};
+
+/* Perfect hash of the lowercased names above: h = len; h = h*10 + c; slot = h % 64.
+ * The table must be regenerated if http_header_names changes. */
+#define HTTP_HEADER_HASH_SIZE 64
+static const signed char http_header_slots[HTTP_HEADER_HASH_SIZE] = {
+    10, -1, -1, 15, -1, -1, -1,  0, -1, -1, 13,  9, -1, -1, -1, -1,
+     8, -1, 12, -1, -1, -1, -1, -1, -1, -1, -1,  7, -1, -1, -1, -1,
+    -1,  4,  3, -1, -1, -1, -1, -1, -1, -1, 11, 14,  2, -1, -1, -1,
+    -1, -1, -1, -1,  5, -1, -1, 17, 16,  1, -1, -1,  6, -1, -1, -1,
+};
+
+static inline unsigned char
+ascii_tolower(unsigned char c)
+{
+    return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+static int
+ascii_casecmp(const char *a, const char *b, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        if (ascii_tolower(a[i]) != ascii_tolower(b[i])) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Returns the http_header_t of a header name, or -1 if it is not a known one */
+static int
+http_header_lookup(const char *name, size_t len)
+{
+    uint32_t hash = (uint32_t) len;
+    int header;
+
+    for (size_t i = 0; i < len; i++) {
+        hash = hash * 10 + ascii_tolower(name[i]);
+    }
+    header = http_header_slots[hash % HTTP_HEADER_HASH_SIZE];
+    if (header < 0 || strlen(http_header_names[header]) != len ||
+        ascii_casecmp(http_header_names[header], name, len)) {
+        return -1;
+    }
+    return header;
+}
+
 struct http_request_s {
     llhttp_t parser;
     llhttp_settings_t parser_settings;
 
     const char *method;
-    char *url;
+    http_slice_t url;
 
-    char **headers;
+    /* name, value, name, value, ... */
+    http_slice_t *headers;
     int headers_size;
-    int headers_index;
+    int headers_capacity;
+    http_slice_t headers_inline[2 * HTTP_REQUEST_MAX_HEADERS];
+
+    /* 1 + index of the value of each known header, 0 when absent */
+    unsigned short known[HTTP_HEADER_COUNT];
 
     char *data;
     int datalen;
+    int datacap;
 
     int complete;
+
+    /* heap allocations made for the current request */
+    int allocations;
+
+    http_arena_chunk_t *chunk;      /* chunk currently allocated from */
+    char *last;                     /* most recent string, may grow in place */
+    http_arena_chunk_t first_chunk;
+    char first_chunk_data[HTTP_REQUEST_ARENA_INLINE];
 };
 
+/* Returns NULL when out of memory, which the callbacks turn into a parse error */
+static char *
+arena_alloc(http_request_t *request, size_t size)
+{
+    http_arena_chunk_t *chunk = request->chunk;
+    char *ptr;
+
+    /* keep allocations pointer aligned */
+    size = ARENA_ALIGN(size);
+    request->last = NULL;
+    while (chunk->size - chunk->used < size) {
+        if (!chunk->next) {
+            size_t chunk_size = size > HTTP_REQUEST_ARENA_CHUNK ? size : HTTP_REQUEST_ARENA_CHUNK;
+            http_arena_chunk_t *next = malloc(sizeof(http_arena_chunk_t) + chunk_size);
+            if (!next) {
+                return NULL;
+            }
+            request->allocations++;
+            next->next = NULL;
+            next->size = chunk_size;
+            next->used = 0;
+            next->data = (char *) (next + 1);
+            chunk->next = next;
+        }
+        chunk = chunk->next;
+        request->chunk = chunk;
+    }
+    ptr = chunk->data + chunk->used;
+    chunk->used += size;
+    return ptr;
+}
+
+/* Append a fragment to a string, in place when it is the last allocation.
+ * Returns -1 when out of memory. */
+static int
+arena_append(http_request_t *request, http_slice_t *slice, const char *at, size_t length)
+{
+    http_arena_chunk_t *chunk = request->chunk;
+    char *ptr;
+
+    if (slice->ptr && slice->ptr == request->last &&
+        (size_t) (slice->ptr - chunk->data) + slice->len + length + 1 <= chunk->size) {
+        memcpy(slice->ptr + slice->len, at, length);
+        slice->len += length;
+        slice->ptr[slice->len] = '\0';
+        chunk->used = ARENA_ALIGN((size_t) (slice->ptr - chunk->data) + slice->len + 1);
+        return 0;
+    }
+
+    ptr = arena_alloc(request, slice->len + length + 1);
+    if (!ptr) {
+        return -1;
+    }
+    if (slice->len) {
+        memcpy(ptr, slice->ptr, slice->len);
+    }
+    memcpy(ptr + slice->len, at, length);
+    slice->ptr = ptr;
+    slice->len += length;
+    slice->ptr[slice->len] = '\0';
+    request->last = ptr;
+    return 0;
+}
+
+static void
+arena_reset(http_request_t *request)
+{
+    http_arena_chunk_t *chunk = &request->first_chunk;
+    size_t kept = chunk->size;
+
+    /* Rewind every chunk, releasing those beyond the retention limit */
+    while (chunk) {
+        chunk->used = 0;
+        if (chunk->next && kept + chunk->next->size > HTTP_REQUEST_ARENA_KEEP) {
+            http_arena_chunk_t *next = chunk->next;
+            chunk->next = next->next;
+            free(next);
+            continue;
+        }
+        if (chunk->next) {
+            kept += chunk->next->size;
+        }
+        chunk = chunk->next;
+    }
+    request->chunk = &request->first_chunk;
+    request->last = NULL;
+}
+
 static int
 on_url(llhttp_t *parser, const char *at, size_t length)
 {
     http_request_t *request = parser->data;
-    int urllen = request->url ? strlen(request->url) : 0;
 
-    request->url = realloc(request->url, urllen+length+1);
-    assert(request->url);
+    return arena_append(request, &request->url, at, length);
+}
 
-    request->url[urllen] = '\0';
-    strncat(request->url, at, length);
+static int
+next_header_slot(http_request_t *request)
+{
+    if (request->headers_size == request->headers_capacity) {
+        /* More headers than fit inline: move the table into the arena */
+        int capacity = request->headers_capacity * 2;
+        http_slice_t *headers = (http_slice_t *) arena_alloc(request, capacity * sizeof(http_slice_t));
+        if (!headers) {
+            return -1;
+        }
+        memcpy(headers, request->headers, request->headers_size * sizeof(http_slice_t));
+        request->headers = headers;
+        request->headers_capacity = capacity;
+    }
+    request->headers[request->headers_size].ptr = NULL;
+    request->headers[request->headers_size].len = 0;
+    request->headers_size++;
     return 0;
 }
 
@@ -59,58 +267,64 @@ on_header_field(llhttp_t *parser, const char *at, size_t length)
 {
     http_request_t *request = parser->data;
 
-    /* Check if our index is a value */
-    if (request->headers_index%2 == 1) {
-        request->headers_index++;
+    /* Start a new field-value pair unless continuing a field */
+    if (request->headers_size % 2 == 0 && next_header_slot(request) == -1) {
+        return -1;
     }
 
-    /* Allocate space for new field-value pair */
-    if (request->headers_index == request->headers_size) {
-        request->headers_size += 2;
-        request->headers = realloc(request->headers,
-                                   request->headers_size*sizeof(char*));
-        assert(request->headers);
-        request->headers[request->headers_index] = NULL;
-        request->headers[request->headers_index+1] = NULL;
-    }
+    return arena_append(request, &request->headers[request->headers_size - 1], at, length);
+}
 
-    /* Allocate space in the current header string */
-    if (request->headers[request->headers_index] == NULL) {
-        request->headers[request->headers_index] = calloc(1, length+1);
-    } else {
-        request->headers[request->headers_index] = realloc(
-                request->headers[request->headers_index],
-                strlen(request->headers[request->headers_index])+length+1
-        );
+static int
+on_header_value(llhttp_t *parser, const char *at, size_t length)
+{
+    http_request_t *request = parser->data;
+
+    /* Start the value unless continuing one */
+    if (request->headers_size % 2 == 1 && next_header_slot(request) == -1) {
+        return -1;
     }
-    assert(request->headers[request->headers_index]);
 
-    strncat(request->headers[request->headers_index], at, length);
-    return 0;
+    return arena_append(request, &request->headers[request->headers_size - 1], at, length);
 }
 
 static int
-on_header_value(llhttp_t *parser, const char *at, size_t length)
+on_headers_complete(llhttp_t *parser)
 {
     http_request_t *request = parser->data;
 
-    /* Check if our index is a field */
-    if (request->headers_index%2 == 0) {
-        request->headers_index++;
+    /* A header field without a value */
+    if (request->headers_size % 2 == 1) {
+        char *empty;
+        if (next_header_slot(request) == -1 || !(empty = arena_alloc(request, 1))) {
+            llhttp_set_error_reason(parser, "Out of memory");
+            return -1;
+        }
+        empty[0] = '\0';
+        request->headers[request->headers_size - 1].ptr = empty;
     }
 
-    /* Allocate space in the current header string */
-    if (request->headers[request->headers_index] == NULL) {
-        request->headers[request->headers_index] = calloc(1, length+1);
-    } else {
-        request->headers[request->headers_index] = realloc(
-                request->headers[request->headers_index],
-                strlen(request->headers[request->headers_index])+length+1
-        );
+    /* Intern the known header names; the first occurrence wins */
+    for (int i = 0; i < request->headers_size; i += 2) {
+        int header = http_header_lookup(request->headers[i].ptr, request->headers[i].len);
+        if (header >= 0 && !request->known[header]) {
+            request->known[header] = i + 2;
+        }
     }
-    assert(request->headers[request->headers_index]);
 
-    strncat(request->headers[request->headers_index], at, length);
+    /* Presize the body so on_body does not have to grow it for the usual
+     * requests; Content-Length is not trusted beyond one arena chunk, a
+     * larger body grows as its data actually arrives */
+    if ((parser->flags & F_CONTENT_LENGTH) && parser->content_length > 0) {
+        request->datacap = parser->content_length < HTTP_REQUEST_ARENA_CHUNK ?
+                           (int) parser->content_length : HTTP_REQUEST_ARENA_CHUNK;
+        request->data = arena_alloc(request, request->datacap);
+        if (!request->data) {
+            request->datacap = 0;
+            llhttp_set_error_reason(parser, "Out of memory");
+            return -1;
+        }
+    }
     return 0;
 }
 
@@ -119,8 +333,28 @@ on_body(llhttp_t *parser, const char *at, size_t length)
 {
     http_request_t *request = parser->data;
 
-    request->data = realloc(request->data, request->datalen+length);
-    assert(request->data);
+    if (length > (size_t) (INT32_MAX / 2 - request->datalen)) {
+        return -1;
+    }
+    if (request->datalen + (int) length > request->datacap) {
+        /* Chunked, unannounced or larger than presized body */
+        int datacap = 2 * (request->datalen + (int) length);
+        char *data;
+        if ((parser->flags & F_CONTENT_LENGTH) &&
+            parser->content_length <= (uint64_t) (datacap - request->datalen - (int) length)) {
+            /* content_length counts down the bytes still to come */
+            datacap = request->datalen + (int) length + (int) parser->content_length;
+        }
+        data = arena_alloc(request, datacap);
+        if (!data) {
+            return -1;
+        }
+        if (request->datalen) {
+            memcpy(data, request->data, request->datalen);
+        }
+        request->data = data;
+        request->datacap = datacap;
+    }
 
     memcpy(request->data+request->datalen, at, length);
     request->datalen += length;
@@ -134,7 +368,26 @@ on_message_complete(llhttp_t *parser)
 
     request->method = llhttp_method_name(request->parser.method);
     request->complete = 1;
-    return 0;
+
+    /* Stop here so that a pipelined request is not parsed into this one */
+    return HPE_PAUSED;
+}
+
+static void
+http_request_clear(http_request_t *request)
+{
+    request->method = NULL;
+    request->url.ptr = NULL;
+    request->url.len = 0;
+    request->headers = request->headers_inline;
+    request->headers_size = 0;
+    request->headers_capacity = 2 * HTTP_REQUEST_MAX_HEADERS;
+    request->data = NULL;
+    request->datalen = 0;
+    request->datacap = 0;
+    request->complete = 0;
+    request->allocations = 0;
+    memset(request->known, 0, sizeof(request->known));
 }
 
 http_request_t *
@@ -147,10 +400,16 @@ http_request_init(void)
         return NULL;
     }
 
+    request->first_chunk.size = sizeof(request->first_chunk_data);
+    request->first_chunk.data = request->first_chunk_data;
+    request->chunk = &request->first_chunk;
+    http_request_clear(request);
+
     llhttp_settings_init(&request->parser_settings);
     request->parser_settings.on_url = &on_url;
     request->parser_settings.on_header_field = &on_header_field;
     request->parser_settings.on_header_value = &on_header_value;
+    request->parser_settings.on_headers_complete = &on_headers_complete;
     request->parser_settings.on_body = &on_body;
     request->parser_settings.on_message_complete = &on_message_complete;
 
@@ -161,17 +420,28 @@ http_request_init(void)
 }
 
 void
-http_request_destroy(http_request_t *request)
+http_request_reset(http_request_t *request)
 {
-    int i;
+    assert(request);
+
+    arena_reset(request);
+    http_request_clear(request);
 
+    /* RTSP/1.0 is not keep-alive for llhttp, which would ignore further
+     * messages: start every request from a fresh parser state */
+    llhttp_reset(&request->parser);
+}
+
+void
+http_request_destroy(http_request_t *request)
+{
     if (request) {
-        free(request->url);
-        for (i=0; i<request->headers_size; i++) {
-            free(request->headers[i]);
+        http_arena_chunk_t *chunk = request->first_chunk.next;
+        while (chunk) {
+            http_arena_chunk_t *next = chunk->next;
+            free(chunk);
+            chunk = next;
         }
-        free(request->headers);
-        free(request->data);
         free(request);
     }
 }
@@ -185,7 +455,20 @@ http_request_add_data(http_request_t *request, const char *data, int datalen)
 
     ret = llhttp_execute(&request->parser,
                               data, datalen);
-    return ret;
+    if (ret == HPE_PAUSED) {
+        /* Paused at the end of a message: report how much was consumed */
+        int consumed = llhttp_get_error_pos(&request->parser) - data;
+        llhttp_resume(&request->parser);
+        return consumed;
+    }
+    return datalen;
+}
+
+int
+http_request_get_allocations(http_request_t *request)
+{
+    assert(request);
+    return request->allocations;
 }
 
 int
@@ -227,19 +510,42 @@ const char *
 http_request_get_url(http_request_t *request)
 {
     assert(request);
-    return request->url;
+    return request->url.ptr;
+}
+
+const char *
+http_request_get_known_header(http_request_t *request, http_header_t header)
+{
+    assert(request);
+    assert(header >= 0 && header < HTTP_HEADER_COUNT);
+
+    if (!request->known[header]) {
+        return NULL;
+    }
+    return request->headers[request->known[header] - 1].ptr;
 }
 
+/* Header names are case-insensitive */
 const char *
 http_request_get_header(http_request_t *request, const char *name)
 {
+    size_t len;
+    int header;
     int i;
 
     assert(request);
+    assert(name);
+
+    len = strlen(name);
+    header = http_header_lookup(name, len);
+    if (header >= 0) {
+        return http_request_get_known_header(request, header);
+    }
 
+    /* Not a known header: fall back to a scan */
     for (i=0; i<request->headers_size; i+=2) {
-        if (!strcmp(request->headers[i], name)) {
-            return request->headers[i+1];
+        if (request->headers[i].len == len && !ascii_casecmp(request->headers[i].ptr, name, len)) {
+            return request->headers[i+1].ptr;
         }
     }
     return NULL;
@@ -265,7 +571,7 @@ http_request_get_header_string(http_request_t *request, char **header_str)
     }
     int len = 0;
     for (int i = 0; i < request->headers_size; i++) {
-        len += strlen(request->headers[i]);
+        len += request->headers[i].len;
         if (i%2 == 0) {
             len += 2;
         } else {
@@ -277,13 +583,13 @@ http_request_get_header_string(http_request_t *request, char **header_str)
     *header_str = str;
     char *p = str;
     for (int i = 0; i < request->headers_size; i++) {
-        sprintf(p,"%s", request->headers[i]);
-        p += strlen(request->headers[i]);
+        memcpy(p, request->headers[i].ptr, request->headers[i].len);
+        p += request->headers[i].len;
         if (i%2 == 0) {
-            sprintf(p, ": ");
+            memcpy(p, ": ", 2);
             p +=2;
         } else {
-            sprintf(p, "\n");
+            *p = '\n';
             p++;
         }
     }
@@ -17,8 +17,32 @@
 
 typedef struct http_request_s http_request_t;
 
+/* Header names interned at parse time, see http_request_get_known_header() */
+typedef enum http_header_e {
+    HTTP_HEADER_CSEQ,
+    HTTP_HEADER_CONTENT_TYPE,
+    HTTP_HEADER_CONTENT_LENGTH,
+    HTTP_HEADER_DACP_ID,
+    HTTP_HEADER_ACTIVE_REMOTE,
+    HTTP_HEADER_TRANSPORT,
+    HTTP_HEADER_USER_AGENT,
+    HTTP_HEADER_RTP_INFO,
+    HTTP_HEADER_SESSION,
+    HTTP_HEADER_RANGE,
+    HTTP_HEADER_X_APPLE_PROTOCOL_VERSION,
+    HTTP_HEADER_X_APPLE_DEVICE_ID,
+    HTTP_HEADER_X_APPLE_SESSION_ID,
+    HTTP_HEADER_X_APPLE_STREAM_ID,
+    HTTP_HEADER_APPLE_CHALLENGE,
+    HTTP_HEADER_CLIENT_INSTANCE,
+    HTTP_HEADER_CONNECTION,
+    HTTP_HEADER_AUDIO_LATENCY,
+    HTTP_HEADER_COUNT
+} http_header_t;
+
 
 http_request_t *http_request_init(void);
+void http_request_reset(http_request_t *request);
 
 int http_request_add_data(http_request_t *request, const char *data, int datalen);
 int http_request_is_complete(http_request_t *request);
@@ -29,8 +53,10 @@ const char *http_request_get_error_description(http_request_t *request);
 const char *http_request_get_method(http_request_t *request);
 const char *http_request_get_url(http_request_t *request);
 const char *http_request_get_header(http_request_t *request, const char *name);
+const char *http_request_get_known_header(http_request_t *request, http_header_t header);
 const char *http_request_get_data(http_request_t *request, int *datalen);
 int http_request_get_header_string(http_request_t *request, char **header_str);
+int http_request_get_allocations(http_request_t *request);
 
 void http_request_destroy(http_request_t *request);
 
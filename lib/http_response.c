@@ -10,6 +10,9 @@
  *  but WITHOUT ANY WARRANTY; without even the implied warranty of
  *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
  *  Lesser General Public License for more details.
+ *
+ *==================================================================
+ * modified by fduncanh 2023
  */
 
 #include <stdlib.h>
@@ -24,9 +27,20 @@ struct http_response_s {
     int complete;
     int disconnect;
 
+    /* status line and headers */
     char *data;
     int data_size;
     int data_length;
+
+    /* body, referenced rather than copied into data */
+    const char *body;
+    int body_length;
+    http_response_free_t body_free;
+    void *body_opaque;
+
+    /* unsent part of the response, see http_response_get_iovec() */
+    struct iovec iov[2];
+    int iov_index;
 };
 
 
@@ -40,12 +54,13 @@ http_response_add_data(http_response_t *response, const char *data, int datalen)
     assert(datalen > 0);
 
     newdatasize = response->data_size;
-    while (response->data_size+datalen > newdatasize) {
+    while (response->data_length+datalen > newdatasize) {
         newdatasize *= 2;
     }
     if (newdatasize != response->data_size) {
         response->data = realloc(response->data, newdatasize);
         assert(response->data);
+        response->data_size = newdatasize;
     }
     memcpy(response->data+response->data_length, data, datalen);
     response->data_length += datalen;
@@ -91,6 +106,9 @@ void
 http_response_destroy(http_response_t *response)
 {
     if (response) {
+        if (response->body_free) {
+            response->body_free(response->body_opaque);
+        }
         free(response->data);
         free(response);
     }
@@ -109,6 +127,36 @@ http_response_add_header(http_response_t *response, const char *name, const char
     http_response_add_data(response, "\r\n", 2);
 }
 
+/* Append preformatted "Name: value\r\n" lines */
+void
+http_response_add_header_block(http_response_t *response, const char *block, int len)
+{
+    assert(response);
+    assert(block);
+    assert(!response->complete);
+
+    if (len > 0) {
+        http_response_add_data(response, block, len);
+    }
+}
+
+void
+http_response_set_body(http_response_t *response, const char *data, int datalen,
+                       http_response_free_t free_data, void *opaque)
+{
+    assert(response);
+    assert(!response->complete);
+    assert(datalen==0 || (data && datalen > 0));
+
+    if (response->body_free) {
+        response->body_free(response->body_opaque);
+    }
+    response->body = data;
+    response->body_length = datalen;
+    response->body_free = free_data;
+    response->body_opaque = opaque;
+}
+
 void
 http_response_finish(http_response_t *response, const char *data, int datalen)
 {
@@ -116,24 +164,34 @@ http_response_finish(http_response_t *response, const char *data, int datalen)
     assert(datalen==0 || (data && datalen > 0));
 
     if (data && datalen > 0) {
+        /* The caller keeps ownership of data: take a copy */
+        char *copy = malloc(datalen);
+        assert(copy);
+        memcpy(copy, data, datalen);
+        http_response_set_body(response, copy, datalen, free, copy);
+    }
+
+    if (response->body && response->body_length > 0) {
         const char *hdrname = "Content-Length";
         char hdrvalue[16];
 
         memset(hdrvalue, 0, sizeof(hdrvalue));
-        snprintf(hdrvalue, sizeof(hdrvalue)-1, "%d", datalen);
+        snprintf(hdrvalue, sizeof(hdrvalue)-1, "%d", response->body_length);
 
         /* Add Content-Length header first */
         http_response_add_data(response, hdrname, strlen(hdrname));
         http_response_add_data(response, ": ", 2);
         http_response_add_data(response, hdrvalue, strlen(hdrvalue));
-        http_response_add_data(response, "\r\n\r\n", 4);
-
-        /* Add data to the end of response */
-        http_response_add_data(response, data, datalen);
-    } else {
-        /* Add extra end of line after headers */
         http_response_add_data(response, "\r\n", 2);
     }
+    /* Add extra end of line after headers */
+    http_response_add_data(response, "\r\n", 2);
+
+    response->iov[0].iov_base = response->data;
+    response->iov[0].iov_len = response->data_length;
+    response->iov[1].iov_base = (void *) response->body;
+    response->iov[1].iov_len = response->body ? response->body_length : 0;
+    response->iov_index = 0;
     response->complete = 1;
 }
 
@@ -154,7 +212,7 @@ http_response_get_disconnect(http_response_t *response)
 }
 
 const char *
-http_response_get_data(http_response_t *response, int *datalen)
+http_response_get_headers(http_response_t *response, int *datalen)
 {
     assert(response);
     assert(datalen);
@@ -163,3 +221,44 @@ http_response_get_data(http_response_t *response, int *datalen)
     *datalen = response->data_length;
     return response->data;
 }
+
+const char *
+http_response_get_body(http_response_t *response, int *datalen)
+{
+    assert(response);
+    assert(datalen);
+
+    *datalen = response->body_length;
+    return response->body;
+}
+
+int
+http_response_get_iovec(http_response_t *response, struct iovec **iov)
+{
+    assert(response);
+    assert(iov);
+    assert(response->complete);
+
+    *iov = &response->iov[response->iov_index];
+    return 2 - response->iov_index;
+}
+
+int
+http_response_advance(http_response_t *response, size_t written)
+{
+    assert(response);
+    assert(response->complete);
+
+    while (response->iov_index < 2) {
+        struct iovec *iov = &response->iov[response->iov_index];
+        if (written < iov->iov_len) {
+            iov->iov_base = (char *) iov->iov_base + written;
+            iov->iov_len -= written;
+            return 1;
+        }
+        written -= iov->iov_len;
+        iov->iov_len = 0;
+        response->iov_index++;
+    }
+    return 0;
+}
@@ -15,17 +15,37 @@
 #ifndef HTTP_RESPONSE_H
 #define HTTP_RESPONSE_H
 
+#include <stddef.h>
+#ifndef WIN32
+#include <sys/uio.h>
+#else
+struct iovec {
+    void *iov_base;
+    size_t iov_len;
+};
+#endif
+
 typedef struct http_response_s http_response_t;
+typedef void (*http_response_free_t)(void *opaque);
 
 http_response_t *http_response_init(const char *protocol, int code, const char *message);
 
 void http_response_add_header(http_response_t *response, const char *name, const char *value);
+void http_response_add_header_block(http_response_t *response, const char *block, int len);
+void http_response_set_body(http_response_t *response, const char *data, int datalen,
+                            http_response_free_t free_data, void *opaque);
 void http_response_finish(http_response_t *response, const char *data, int datalen);
 
 void http_response_set_disconnect(http_response_t *response, int disconnect);
 int http_response_get_disconnect(http_response_t *response);
 
-const char *http_response_get_data(http_response_t *response, int *datalen);
+const char *http_response_get_headers(http_response_t *response, int *datalen);
+const char *http_response_get_body(http_response_t *response, int *datalen);
+
+/* Unsent part of a finished response, for writev() */
+int http_response_get_iovec(http_response_t *response, struct iovec **iov);
+/* Marks bytes as sent, returns 0 once the whole response is out */
+int http_response_advance(http_response_t *response, size_t written);
 
 void http_response_destroy(http_response_t *response);
 
@@ -25,24 +25,84 @@
 #include "http_request.h"
 #include "compat.h"
 #include "logger.h"
+#include "netpoll.h"
+#include "histogram.h"
+#include "utils.h"
+
+/* Responses a connection may have waiting for the socket before
+ * we stop reading further requests from it */
+#define HTTPD_MAX_QUEUED 8
+
+typedef struct httpd_queued_s {
+    http_response_t *response;
+    uint64_t start_ns;      /* when the request was complete */
+} httpd_queued_t;
 
 struct http_connection_s {
     int connected;
+    int closing;
 
     int socket_fd;
     void *user_data;
     http_request_t *request;
+    uint64_t request_ns;
+
+    /* A worker is running conn_request for this connection. Requests of
+     * one connection are handled one at a time, in order; bytes of the
+     * next request that arrive meanwhile wait in pending. */
+    int busy;
+    char *pending;
+    int pending_len;
+
+    /* Ring of responses not yet fully written, oldest first */
+    httpd_queued_t *queue;
+    int queue_size;
+    int queue_head;
+    int queue_len;
+    int want_write;
 };
 typedef struct http_connection_s http_connection_t;
 
+/* Work handed to the worker pool: a request, or the destruction of the
+ * handler state of a closed connection (which may join RTP threads) */
+typedef struct httpd_job_s {
+    struct httpd_job_s *next;
+    http_connection_t *connection;
+    void *user_data;
+    http_response_t *response;
+} httpd_job_t;
+
 struct httpd_s {
     logger_t *logger;
     httpd_callbacks_t callbacks;
 
     int max_connections;
     int open_connections;
+    int loopback;
+    int nohold;
     http_connection_t *connections;
 
+    /* Readiness notification for server and connection sockets */
+    netpoll_t *netpoll;
+
+    /* Worker pool running the conn_request and conn_destroy callbacks */
+    int num_workers;
+    int workers_running;
+    int workers_quit;
+    thread_handle_t *workers;
+    mutex_handle_t jobs_mutex;
+    cond_handle_t jobs_cond;
+    httpd_job_t *jobs_head;
+    httpd_job_t *jobs_tail;
+    httpd_job_t *done;
+    /* Signalled with jobs_mutex held when a job is done or a destroy job
+     * has finished; destroys_pending counts queued and running destroys */
+    cond_handle_t done_cond;
+    int destroys_pending;
+
+    /* Time from complete request to fully written response, in usecs */
+    histogram_t response_latency;
+
     /* These variables only edited mutex locked */
     int running;
     int joined;
@@ -55,13 +115,15 @@ struct httpd_s {
 };
 
 httpd_t *
-httpd_init(logger_t *logger, httpd_callbacks_t *callbacks, int max_connections)
+httpd_init(logger_t *logger, httpd_callbacks_t *callbacks, int max_connections, int workers,
+           int nohold)
 {
     httpd_t *httpd;
 
     assert(logger);
     assert(callbacks);
     assert(max_connections > 0);
+    assert(workers >= 0);
 
     /* Allocate the httpd_t structure */
     httpd = calloc(1, sizeof(httpd_t));
@@ -70,12 +132,37 @@ httpd_init(logger_t *logger, httpd_callbacks_t *callbacks, int max_connections)
     }
 
     httpd->max_connections = max_connections;
+    httpd->nohold = nohold;
     httpd->connections = calloc(max_connections, sizeof(http_connection_t));
     if (!httpd->connections) {
         free(httpd);
         return NULL;
     }
 
+    /* Room for every connection plus the IPv4 and IPv6 server sockets */
+    httpd->netpoll = netpoll_init(max_connections + 2);
+    if (!httpd->netpoll) {
+        free(httpd->connections);
+        free(httpd);
+        return NULL;
+    }
+
+    /* With no workers requests are handled on the httpd thread */
+    httpd->num_workers = workers;
+    if (workers) {
+        httpd->workers = calloc(workers, sizeof(thread_handle_t));
+        if (!httpd->workers) {
+            netpoll_destroy(httpd->netpoll);
+            free(httpd->connections);
+            free(httpd);
+            return NULL;
+        }
+    }
+    MUTEX_CREATE(httpd->jobs_mutex);
+    COND_CREATE(httpd->jobs_cond);
+    COND_CREATE(httpd->done_cond);
+    histogram_reset(&httpd->response_latency);
+
     /* Use the logger provided */
     httpd->logger = logger;
 
@@ -95,23 +182,173 @@ httpd_destroy(httpd_t *httpd)
     if (httpd) {
         httpd_stop(httpd);
 
+        netpoll_destroy(httpd->netpoll);
+        COND_DESTROY(httpd->done_cond);
+        COND_DESTROY(httpd->jobs_cond);
+        MUTEX_DESTROY(httpd->jobs_mutex);
+        free(httpd->workers);
         free(httpd->connections);
         free(httpd);
     }
 }
 
 static void
-httpd_remove_connection(httpd_t *httpd, http_connection_t *connection)
+httpd_update_accept(httpd_t *httpd)
+{
+    /* Stop polling the server sockets while all connection slots are in use;
+     * pending clients wait in the listen backlog until a slot is freed */
+    int events = (httpd->open_connections < httpd->max_connections) ? NETPOLL_IN : 0;
+    if (httpd->server_fd4 != -1) {
+        netpoll_mod(httpd->netpoll, httpd->server_fd4, events, &httpd->server_fd4);
+    }
+    if (httpd->server_fd6 != -1) {
+        netpoll_mod(httpd->netpoll, httpd->server_fd6, events, &httpd->server_fd6);
+    }
+}
+
+static void
+httpd_push_job(httpd_t *httpd, httpd_job_t *job)
+{
+    job->next = NULL;
+    MUTEX_LOCK(httpd->jobs_mutex);
+    if (httpd->jobs_tail) {
+        httpd->jobs_tail->next = job;
+    } else {
+        httpd->jobs_head = job;
+    }
+    httpd->jobs_tail = job;
+    COND_SIGNAL(httpd->jobs_cond);
+    MUTEX_UNLOCK(httpd->jobs_mutex);
+}
+
+static THREAD_RETVAL
+httpd_worker_thread(void *arg)
+{
+    httpd_t *httpd = arg;
+
+    while (1) {
+        httpd_job_t *job;
+
+        MUTEX_LOCK(httpd->jobs_mutex);
+        while (!httpd->jobs_head && !httpd->workers_quit) {
+            pthread_cond_wait(&httpd->jobs_cond, &httpd->jobs_mutex);
+        }
+        /* queued jobs are finished before quitting */
+        job = httpd->jobs_head;
+        if (!job) {
+            MUTEX_UNLOCK(httpd->jobs_mutex);
+            break;
+        }
+        httpd->jobs_head = job->next;
+        if (!httpd->jobs_head) {
+            httpd->jobs_tail = NULL;
+        }
+        MUTEX_UNLOCK(httpd->jobs_mutex);
+
+        if (!job->connection) {
+            httpd->callbacks.conn_destroy(job->user_data);
+            free(job);
+            MUTEX_LOCK(httpd->jobs_mutex);
+            httpd->destroys_pending--;
+            COND_SIGNAL(httpd->done_cond);
+            MUTEX_UNLOCK(httpd->jobs_mutex);
+            continue;
+        }
+
+        httpd->callbacks.conn_request(job->user_data, job->connection->request, &job->response);
+
+        /* hand the response back to the httpd thread */
+        MUTEX_LOCK(httpd->jobs_mutex);
+        job->next = httpd->done;
+        httpd->done = job;
+        COND_SIGNAL(httpd->done_cond);
+        MUTEX_UNLOCK(httpd->jobs_mutex);
+        netpoll_wakeup(httpd->netpoll);
+    }
+    return 0;
+}
+
+static void
+httpd_start_workers(httpd_t *httpd)
+{
+    httpd->workers_quit = 0;
+    httpd->workers_running = 0;
+    for (int i = 0; i < httpd->num_workers; i++) {
+        THREAD_CREATE(httpd->workers[i], httpd_worker_thread, httpd);
+        if (!httpd->workers[i]) {
+            logger_log(httpd->logger, LOGGER_ERR, "httpd could not start worker thread %d", i);
+            break;
+        }
+        httpd->workers_running++;
+    }
+}
+
+static void
+httpd_stop_workers(httpd_t *httpd)
+{
+    MUTEX_LOCK(httpd->jobs_mutex);
+    httpd->workers_quit = 1;
+    pthread_cond_broadcast(&httpd->jobs_cond);
+    MUTEX_UNLOCK(httpd->jobs_mutex);
+    for (int i = 0; i < httpd->workers_running; i++) {
+        THREAD_JOIN(httpd->workers[i]);
+    }
+    httpd->workers_running = 0;
+}
+
+/* Frees what a closed connection still holds once no worker uses it */
+static void
+httpd_release_connection(httpd_t *httpd, http_connection_t *connection)
 {
+    assert(!connection->busy);
+
     if (connection->request) {
         http_request_destroy(connection->request);
         connection->request = NULL;
     }
-    httpd->callbacks.conn_destroy(connection->user_data);
+    while (connection->queue_len) {
+        http_response_destroy(connection->queue[connection->queue_head].response);
+        connection->queue_head = (connection->queue_head + 1) % connection->queue_size;
+        connection->queue_len--;
+    }
+    free(connection->queue);
+    connection->queue = NULL;
+    connection->queue_size = 0;
+    connection->queue_head = 0;
+    free(connection->pending);
+    connection->pending = NULL;
+    connection->pending_len = 0;
+
+    if (httpd->workers_running) {
+        httpd_job_t *job = calloc(1, sizeof(httpd_job_t));
+        assert(job);
+        job->user_data = connection->user_data;
+        MUTEX_LOCK(httpd->jobs_mutex);
+        httpd->destroys_pending++;
+        MUTEX_UNLOCK(httpd->jobs_mutex);
+        httpd_push_job(httpd, job);
+    } else {
+        httpd->callbacks.conn_destroy(connection->user_data);
+    }
+    connection->user_data = NULL;
+}
+
+static void
+httpd_remove_connection(httpd_t *httpd, http_connection_t *connection)
+{
+    netpoll_del(httpd->netpoll, connection->socket_fd);
     shutdown(connection->socket_fd, SHUT_WR);
     closesocket(connection->socket_fd);
+    connection->want_write = 0;
+    connection->closing = 0;
     connection->connected = 0;
     httpd->open_connections--;
+    httpd_update_accept(httpd);
+
+    /* The slot stays in use until the worker finishes its request */
+    if (!connection->busy) {
+        httpd_release_connection(httpd, connection);
+    }
 }
 
 static int
@@ -121,29 +358,76 @@ httpd_add_connection(httpd_t *httpd, int fd, unsigned char *local, int local_len
     int i;
 
     for (i=0; i<httpd->max_connections; i++) {
-        if (!httpd->connections[i].connected) {
+        if (!httpd->connections[i].connected && !httpd->connections[i].busy) {
             break;
         }
     }
     if (i == httpd->max_connections) {
-        /* This code should never be reached, we do not select server_fds when full */
+        /* This code should never be reached, we do not poll server_fds when full */
         logger_log(httpd->logger, LOGGER_INFO, "Max connections reached");
         return -1;
     }
 
+    if (netpoll_set_nonblocking(fd) == -1) {
+        logger_log(httpd->logger, LOGGER_ERR, "Error setting socket %d non-blocking", fd);
+        return -1;
+    }
+
     user_data = httpd->callbacks.conn_init(httpd->callbacks.opaque, local, local_len, remote, remote_len);
     if (!user_data) {
         logger_log(httpd->logger, LOGGER_ERR, "Error initializing HTTP request handler");
         return -1;
     }
 
+    /* The connection pointer travels with each event, no lookup is needed on dispatch */
+    if (netpoll_add(httpd->netpoll, fd, NETPOLL_IN | NETPOLL_ET, &httpd->connections[i]) == -1) {
+        logger_log(httpd->logger, LOGGER_ERR, "Error polling socket %d", fd);
+        httpd->callbacks.conn_destroy(user_data);
+        return -1;
+    }
+
     httpd->open_connections++;
     httpd->connections[i].socket_fd = fd;
     httpd->connections[i].connected = 1;
     httpd->connections[i].user_data = user_data;
+    httpd_update_accept(httpd);
     return 0;
 }
 
+#ifdef NOHOLD
+static void httpd_process_done(httpd_t *httpd);
+
+/* Wait until the workers have given back every removed connection and
+ * have run all pending conn_destroy callbacks */
+static void
+httpd_wait_released(httpd_t *httpd)
+{
+    if (!httpd->workers_running) {
+        /* conn_destroy already ran on this thread */
+        return;
+    }
+    while (1) {
+        int busy = 0;
+
+        httpd_process_done(httpd);
+        for (int i = 0; i < httpd->max_connections; i++) {
+            if (!httpd->connections[i].connected && httpd->connections[i].busy) {
+                busy = 1;
+            }
+        }
+        MUTEX_LOCK(httpd->jobs_mutex);
+        if (!busy && !httpd->destroys_pending) {
+            MUTEX_UNLOCK(httpd->jobs_mutex);
+            break;
+        }
+        if (!httpd->done) {
+            pthread_cond_wait(&httpd->done_cond, &httpd->jobs_mutex);
+        }
+        MUTEX_UNLOCK(httpd->jobs_mutex);
+    }
+}
+#endif
+
 static int
 httpd_accept_connection(httpd_t *httpd, int server_fd, int is_ipv6)
 {
@@ -158,7 +442,12 @@ httpd_accept_connection(httpd_t *httpd, int server_fd, int is_ipv6)
     remote_saddrlen = sizeof(remote_saddr);
     fd = accept(server_fd, (struct sockaddr *)&remote_saddr, &remote_saddrlen);
     if (fd == -1) {
-        /* FIXME: Error happened */
+        int err = SOCKET_GET_ERROR();
+        if (err == SOCKET_ERRORNAME(EAGAIN) || err == SOCKET_ERRORNAME(EWOULDBLOCK) ||
+            err == SOCKET_ERRORNAME(EINTR) || err == SOCKET_ERRORNAME(ECONNABORTED)) {
+            /* client went away before we got to it */
+            return 0;
+        }
         return -1;
     }
 
@@ -178,15 +467,18 @@ httpd_accept_connection(httpd_t *httpd, int server_fd, int is_ipv6)
 #ifdef NOHOLD
     /* remove existing connections to make way for new connections:
      * this will only occur if max_connections > 2 */
-    if (httpd->open_connections >= 2)  {
+    if (httpd->nohold && httpd->open_connections >= 2)  {
         logger_log(httpd->logger, LOGGER_INFO, "Destroying current connections to allow connection by new client");
         for (int i = 0; i<httpd->max_connections; i++) {
             http_connection_t *connection = &httpd->connections[i];
             if (!connection->connected) {
                 continue;
             }
-	    httpd_remove_connection(httpd, connection);
+            httpd_remove_connection(httpd, connection);
         }
+        /* The new client must not get ahead of the teardown of the old
+         * session, whose RTP sockets may still hold the ports it needs */
+        httpd_wait_released(httpd);
     }
 #endif
     
@@ -199,158 +491,318 @@ httpd_accept_connection(httpd_t *httpd, int server_fd, int is_ipv6)
     return 1;
 }
 
-static THREAD_RETVAL
-httpd_thread(void *arg)
+static int
+httpd_writev(int fd, struct iovec *iov, int iovcnt)
 {
-    httpd_t *httpd = arg;
-    char buffer[1024];
-    int i;
-
-    assert(httpd);
+#if defined(WIN32)
+    /* No writev(): send the first buffer, the caller loops for the rest */
+    (void) iovcnt;
+    return send(fd, iov[0].iov_base, (int) iov[0].iov_len, 0);
+#elif defined(MSG_NOSIGNAL)
+    struct msghdr msg;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = iovcnt;
+    return sendmsg(fd, &msg, MSG_NOSIGNAL);
+#else
+    return writev(fd, iov, iovcnt);
+#endif
+}
 
-    while (1) {
-        fd_set rfds;
-        struct timeval tv;
-        int nfds=0;
+/* Write queued responses until done or the socket is full.
+ * Returns -1 if the connection was removed. */
+static int
+httpd_flush_connection(httpd_t *httpd, http_connection_t *connection)
+{
+    while (connection->queue_len) {
+        httpd_queued_t *queued = &connection->queue[connection->queue_head];
+        http_response_t *response = queued->response;
+        struct iovec *iov;
+        int iovcnt;
         int ret;
 
-        MUTEX_LOCK(httpd->run_mutex);
-        if (!httpd->running) {
-            MUTEX_UNLOCK(httpd->run_mutex);
-            break;
-        }
-        MUTEX_UNLOCK(httpd->run_mutex);
-
-        /* Set timeout value to 5ms */
-        tv.tv_sec = 1;
-        tv.tv_usec = 5000;
-
-        /* Get the correct nfds value and set rfds */
-        FD_ZERO(&rfds);
-        if (httpd->open_connections < httpd->max_connections) {
-            if (httpd->server_fd4 != -1) {
-                FD_SET(httpd->server_fd4, &rfds);
-                if (nfds <= httpd->server_fd4) {
-                    nfds = httpd->server_fd4+1;
-                }
+        iovcnt = http_response_get_iovec(response, &iov);
+        ret = httpd_writev(connection->socket_fd, iov, iovcnt);
+        if (ret == -1) {
+            int err = SOCKET_GET_ERROR();
+            if (err == SOCKET_ERRORNAME(EINTR)) {
+                continue;
             }
-            if (httpd->server_fd6 != -1) {
-                FD_SET(httpd->server_fd6, &rfds);
-                if (nfds <= httpd->server_fd6) {
-                    nfds = httpd->server_fd6+1;
+            if (err == SOCKET_ERRORNAME(EAGAIN) || err == SOCKET_ERRORNAME(EWOULDBLOCK)) {
+                /* Client is not reading: wait for the socket to drain */
+                if (!connection->want_write) {
+                    netpoll_mod(httpd->netpoll, connection->socket_fd, NETPOLL_IN | NETPOLL_OUT | NETPOLL_ET, connection);
+                    connection->want_write = 1;
                 }
+                return 0;
             }
+            logger_log(httpd->logger, LOGGER_ERR, "httpd error %d in sending data", err);
+            httpd_remove_connection(httpd, connection);
+            return -1;
         }
-        for (i=0; i<httpd->max_connections; i++) {
-            int socket_fd;
-            if (!httpd->connections[i].connected) {
-                continue;
-            }
-            socket_fd = httpd->connections[i].socket_fd;
-            FD_SET(socket_fd, &rfds);
-            if (nfds <= socket_fd) {
-                nfds = socket_fd+1;
-            }
+        if (http_response_advance(response, ret)) {
+            continue;
         }
 
-        ret = select(nfds, &rfds, NULL, NULL, &tv);
-        if (ret == 0) {
-            /* Timeout happened */
+        /* Response fully written */
+        histogram_record(&httpd->response_latency, (utils_monotonic_ns() - queued->start_ns) / 1000);
+        queued->response = NULL;
+        connection->queue_head = (connection->queue_head + 1) % connection->queue_size;
+        connection->queue_len--;
+        if (http_response_get_disconnect(response)) {
+            http_response_destroy(response);
+            logger_log(httpd->logger, LOGGER_INFO, "Disconnecting on software request");
+            httpd_remove_connection(httpd, connection);
+            return -1;
+        }
+        http_response_destroy(response);
+    }
+    if (connection->want_write) {
+        netpoll_mod(httpd->netpoll, connection->socket_fd, NETPOLL_IN | NETPOLL_ET, connection);
+        connection->want_write = 0;
+    }
+    return 0;
+}
+
+static int
+httpd_queue_response(httpd_t *httpd, http_connection_t *connection, http_response_t *response)
+{
+    int tail;
+
+    if (connection->queue_len == connection->queue_size) {
+        /* Pipelined requests in one read can overshoot HTTPD_MAX_QUEUED */
+        int size = connection->queue_size ? 2 * connection->queue_size : HTTPD_MAX_QUEUED;
+        httpd_queued_t *queue = malloc(size * sizeof(httpd_queued_t));
+        assert(queue);
+        for (int i = 0; i < connection->queue_len; i++) {
+            queue[i] = connection->queue[(connection->queue_head + i) % connection->queue_size];
+        }
+        free(connection->queue);
+        connection->queue = queue;
+        connection->queue_size = size;
+        connection->queue_head = 0;
+    }
+    tail = (connection->queue_head + connection->queue_len) % connection->queue_size;
+    connection->queue[tail].response = response;
+    connection->queue[tail].start_ns = connection->request_ns;
+    connection->queue_len++;
+    if (http_response_get_disconnect(response)) {
+        /* Nothing after this response will be answered */
+        connection->closing = 1;
+    }
+    return httpd_flush_connection(httpd, connection);
+}
+
+/* Queue the response to the request just handled and rewind the arena.
+ * Returns -1 if the connection was removed. */
+static int
+httpd_request_done(httpd_t *httpd, http_connection_t *connection, http_response_t *response)
+{
+    logger_log(httpd->logger, LOGGER_DEBUG, "httpd request used %d heap allocations",
+               http_request_get_allocations(connection->request));
+    http_request_reset(connection->request);
+
+    if (!response) {
+        logger_log(httpd->logger, LOGGER_WARNING, "httpd didn't get response");
+        return 0;
+    }
+    return httpd_queue_response(httpd, connection, response);
+}
+
+/* Feed received bytes to the parser, handling each complete request.
+ * Stops after a request is handed to a worker, since the next one must
+ * wait for its answer. Returns the bytes consumed, or -1 if the
+ * connection was removed. */
+static int
+httpd_parse_data(httpd_t *httpd, http_connection_t *connection, const char *data, int len)
+{
+    int offset = 0;
+
+    /* A buffer may hold the end of one request and the start of the next */
+    while (offset < len && !connection->closing) {
+        /* Parse HTTP request from data read from connection */
+        offset += http_request_add_data(connection->request, data + offset, len - offset);
+        if (http_request_has_error(connection->request)) {
+            logger_log(httpd->logger, LOGGER_ERR, "httpd error in parsing: %s", http_request_get_error_name(connection->request));
+            httpd_remove_connection(httpd, connection);
+            return -1;
+        }
+        if (!http_request_is_complete(connection->request)) {
+            logger_log(httpd->logger, LOGGER_DEBUG, "Request not complete, waiting for more data...");
             continue;
-        } else if (ret == -1) {
-            logger_log(httpd->logger, LOGGER_ERR, "httpd error in select");
-            break;
         }
 
-        if (httpd->open_connections < httpd->max_connections &&
-            httpd->server_fd4 != -1 && FD_ISSET(httpd->server_fd4, &rfds)) {
-            ret = httpd_accept_connection(httpd, httpd->server_fd4, 0);
-            if (ret == -1) {
-                logger_log(httpd->logger, LOGGER_ERR, "httpd error in accept ipv4");
-                break;
-            } else if (ret == 0) {
-                continue;
+        connection->request_ns = utils_monotonic_ns();
+        if (httpd->workers_running) {
+            httpd_job_t *job = calloc(1, sizeof(httpd_job_t));
+            assert(job);
+            job->connection = connection;
+            job->user_data = connection->user_data;
+            connection->busy = 1;
+            httpd_push_job(httpd, job);
+            break;
+        } else {
+            http_response_t *response = NULL;
+            // Callback the received data to raop
+            httpd->callbacks.conn_request(connection->user_data, connection->request, &response);
+            if (httpd_request_done(httpd, connection, response) == -1) {
+                return -1;
             }
         }
-        if (httpd->open_connections < httpd->max_connections &&
-            httpd->server_fd6 != -1 && FD_ISSET(httpd->server_fd6, &rfds)) {
-            ret = httpd_accept_connection(httpd, httpd->server_fd6, 1);
-            if (ret == -1) {
-                logger_log(httpd->logger, LOGGER_ERR, "httpd error in accept ipv6");
-                break;
-            } else if (ret == 0) {
-                continue;
-            }
+    }
+    return offset;
+}
+
+static void
+httpd_read_connection(httpd_t *httpd, http_connection_t *connection)
+{
+    char buffer[1024];
+    int ret;
+
+    /* Edge-triggered: keep reading until the socket reports EAGAIN, until
+     * responses back up, or until a worker has the request; reading is
+     * resumed when the queue drains or the worker is done */
+    while (connection->connected && !connection->closing && !connection->busy &&
+           connection->queue_len < HTTPD_MAX_QUEUED) {
+        int used;
+
+        /* The request and its arena live as long as the connection */
+        if (!connection->request) {
+            connection->request = http_request_init();
+            assert(connection->request);
         }
-        for (i=0; i<httpd->max_connections; i++) {
-            http_connection_t *connection = &httpd->connections[i];
 
-            if (!connection->connected) {
-                continue;
+        /* Bytes that followed a request given to a worker come first */
+        if (connection->pending_len) {
+            used = httpd_parse_data(httpd, connection, connection->pending, connection->pending_len);
+            if (used == -1) {
+                return;
             }
-            if (!FD_ISSET(connection->socket_fd, &rfds)) {
+            connection->pending_len -= used;
+            memmove(connection->pending, connection->pending + used, connection->pending_len);
+            continue;
+        }
+
+        ret = recv(connection->socket_fd, buffer, sizeof(buffer), 0);
+        if (ret == 0) {
+            logger_log(httpd->logger, LOGGER_INFO, "Connection closed for socket %d", connection->socket_fd);
+            httpd_remove_connection(httpd, connection);
+            return;
+        } else if (ret == -1) {
+            int err = SOCKET_GET_ERROR();
+            if (err == SOCKET_ERRORNAME(EAGAIN) || err == SOCKET_ERRORNAME(EWOULDBLOCK)) {
+                return;
+            } else if (err == SOCKET_ERRORNAME(EINTR)) {
                 continue;
             }
+            logger_log(httpd->logger, LOGGER_INFO, "Connection error %d for socket %d", err, connection->socket_fd);
+            httpd_remove_connection(httpd, connection);
+            return;
+        }
+        logger_log(httpd->logger, LOGGER_DEBUG, "httpd received %d bytes on socket %d", ret, connection->socket_fd);
 
-            /* If not in the middle of request, allocate one */
-            if (!connection->request) {
-                connection->request = http_request_init();
-                assert(connection->request);
-            }
+        used = httpd_parse_data(httpd, connection, buffer, ret);
+        if (used == -1) {
+            return;
+        }
+        if (used < ret && connection->busy) {
+            /* pending is empty here, so this is its whole content */
+            char *pending = realloc(connection->pending, ret - used);
+            assert(pending);
+            memcpy(pending, buffer + used, ret - used);
+            connection->pending = pending;
+            connection->pending_len = ret - used;
+        }
+    }
+}
 
-            logger_log(httpd->logger, LOGGER_DEBUG, "httpd receiving on socket %d", connection->socket_fd);
-            ret = recv(connection->socket_fd, buffer, sizeof(buffer), 0);
-            if (ret == 0) {
-                logger_log(httpd->logger, LOGGER_INFO, "Connection closed for socket %d", connection->socket_fd);
-                httpd_remove_connection(httpd, connection);
-                continue;
+/* Deliver the responses of requests the workers have finished */
+static void
+httpd_process_done(httpd_t *httpd)
+{
+    httpd_job_t *done, *job;
+
+    MUTEX_LOCK(httpd->jobs_mutex);
+    done = httpd->done;
+    httpd->done = NULL;
+    MUTEX_UNLOCK(httpd->jobs_mutex);
+
+    while (done) {
+        http_connection_t *connection;
+
+        /* The list is newest first, but there is at most one job per connection */
+        job = done;
+        done = job->next;
+        connection = job->connection;
+        connection->busy = 0;
+        if (!connection->connected) {
+            /* Removed while the worker was busy: finish cleaning up */
+            if (job->response) {
+                http_response_destroy(job->response);
             }
+            httpd_release_connection(httpd, connection);
+        } else if (httpd_request_done(httpd, connection, job->response) == 0) {
+            httpd_read_connection(httpd, connection);
+        }
+        free(job);
+    }
+}
+
+static THREAD_RETVAL
+httpd_thread(void *arg)
+{
+    httpd_t *httpd = arg;
+    netpoll_event_t events[16];
+    int i;
+
+    assert(httpd);
+
+    while (1) {
+        int ret;
 
-            /* Parse HTTP request from data read from connection */
-            http_request_add_data(connection->request, buffer, ret);
-            if (http_request_has_error(connection->request)) {
-                logger_log(httpd->logger, LOGGER_ERR, "httpd error in parsing: %s", http_request_get_error_name(connection->request));
-                httpd_remove_connection(httpd, connection);
+        MUTEX_LOCK(httpd->run_mutex);
+        if (!httpd->running) {
+            MUTEX_UNLOCK(httpd->run_mutex);
+            break;
+        }
+        MUTEX_UNLOCK(httpd->run_mutex);
+
+        /* No timeout needed: httpd_stop() and the workers wake us up */
+        ret = netpoll_wait(httpd->netpoll, events, sizeof(events) / sizeof(events[0]), -1);
+        if (ret == -1) {
+            logger_log(httpd->logger, LOGGER_ERR, "httpd error in netpoll_wait %d", SOCKET_GET_ERROR());
+            break;
+        }
+
+        httpd_process_done(httpd);
+
+        for (i = 0; i < ret; i++) {
+            void *data = events[i].data;
+
+            if (data == &httpd->server_fd4 || data == &httpd->server_fd6) {
+                int is_ipv6 = (data == &httpd->server_fd6);
+                if (httpd->open_connections >= httpd->max_connections) {
+                    continue;
+                }
+                if (httpd_accept_connection(httpd, *(int *) data, is_ipv6) == -1) {
+                    logger_log(httpd->logger, LOGGER_ERR, "httpd error in accept %s", is_ipv6 ? "ipv6" : "ipv4");
+                }
                 continue;
             }
 
-            /* If request is finished, process and deallocate */
-            if (http_request_is_complete(connection->request)) {
-                http_response_t *response = NULL;
-                // Callback the received data to raop
-                httpd->callbacks.conn_request(connection->user_data, connection->request, &response);
-                http_request_destroy(connection->request);
-                connection->request = NULL;
-
-                if (response) {
-                    const char *data;
-                    int datalen;
-                    int written;
-                    int ret;
-
-                    /* Get response data and datalen */
-                    data = http_response_get_data(response, &datalen);
-
-                    written = 0;
-                    while (written < datalen) {
-                        ret = send(connection->socket_fd, data+written, datalen-written, 0);
-                        if (ret == -1) {
-                            logger_log(httpd->logger, LOGGER_ERR, "httpd error in sending data");
-                            break;
-                        }
-                        written += ret;
-                    }
-
-                    if (http_response_get_disconnect(response)) {
-                        logger_log(httpd->logger, LOGGER_INFO, "Disconnecting on software request");
-                        httpd_remove_connection(httpd, connection);
-                    }
-                } else {
-                    logger_log(httpd->logger, LOGGER_WARNING, "httpd didn't get response");
+            /* An earlier event in this batch may have closed the connection */
+            http_connection_t *connection = data;
+            if (connection->connected && (events[i].events & NETPOLL_OUT)) {
+                int backlogged = (connection->queue_len >= HTTPD_MAX_QUEUED);
+                if (httpd_flush_connection(httpd, connection) == 0 &&
+                    backlogged && connection->queue_len < HTTPD_MAX_QUEUED) {
+                    /* reading stopped while the queue was full */
+                    httpd_read_connection(httpd, connection);
                 }
-                http_response_destroy(response);
-            } else {
-                logger_log(httpd->logger, LOGGER_DEBUG, "Request not complete, waiting for more data...");
+            }
+            if (connection->connected && (events[i].events & (NETPOLL_IN | NETPOLL_ERR))) {
+                httpd_read_connection(httpd, connection);
             }
         }
     }
@@ -366,13 +818,20 @@ httpd_thread(void *arg)
         httpd_remove_connection(httpd, connection);
     }
 
+    /* Workers finish their queue, then the requests they were still
+     * handling release their connections */
+    httpd_stop_workers(httpd);
+    httpd_process_done(httpd);
+
     /* Close server sockets since they are not used any more */
     if (httpd->server_fd4 != -1) {
+        netpoll_del(httpd->netpoll, httpd->server_fd4);
         shutdown(httpd->server_fd4, SHUT_RDWR);
         closesocket(httpd->server_fd4);
         httpd->server_fd4 = -1;
     }
     if (httpd->server_fd6 != -1) {
+        netpoll_del(httpd->netpoll, httpd->server_fd6);
         shutdown(httpd->server_fd6, SHUT_RDWR);
         closesocket(httpd->server_fd6);
         httpd->server_fd6 = -1;
@@ -388,6 +847,13 @@ httpd_thread(void *arg)
     return 0;
 }
 
+void
+httpd_set_loopback(httpd_t *httpd, int loopback)
+{
+    assert(httpd);
+    httpd->loopback = loopback;
+}
+
 int
 httpd_start(httpd_t *httpd, unsigned short *port)
 {
@@ -403,7 +869,11 @@ httpd_start(httpd_t *httpd, unsigned short *port)
         return 0;
     }
 
-    httpd->server_fd4 = netutils_init_socket(port, 0, 0);
+    if (httpd->loopback) {
+        httpd->server_fd4 = netutils_init_loopback_socket(port, 0, 0);
+    } else {
+        httpd->server_fd4 = netutils_init_socket(port, 0, 0);
+    }
     if (httpd->server_fd4 == -1) {
         logger_log(httpd->logger, LOGGER_ERR, "Error initialising socket %d", SOCKET_GET_ERROR());
         MUTEX_UNLOCK(httpd->run_mutex);
@@ -429,11 +899,28 @@ httpd_start(httpd_t *httpd, unsigned short *port)
         MUTEX_UNLOCK(httpd->run_mutex);
         return -2;
     }
+    if ((httpd->server_fd4 != -1 && (netpoll_set_nonblocking(httpd->server_fd4) == -1 ||
+         netpoll_add(httpd->netpoll, httpd->server_fd4, NETPOLL_IN, &httpd->server_fd4) == -1)) ||
+        (httpd->server_fd6 != -1 && (netpoll_set_nonblocking(httpd->server_fd6) == -1 ||
+         netpoll_add(httpd->netpoll, httpd->server_fd6, NETPOLL_IN, &httpd->server_fd6) == -1))) {
+        logger_log(httpd->logger, LOGGER_ERR, "Error polling server socket(s)");
+        if (httpd->server_fd4 != -1) {
+            netpoll_del(httpd->netpoll, httpd->server_fd4);
+            closesocket(httpd->server_fd4);
+        }
+        if (httpd->server_fd6 != -1) {
+            netpoll_del(httpd->netpoll, httpd->server_fd6);
+            closesocket(httpd->server_fd6);
+        }
+        MUTEX_UNLOCK(httpd->run_mutex);
+        return -2;
+    }
     logger_log(httpd->logger, LOGGER_INFO, "Initialized server socket(s)");
 
     /* Set values correctly and create new thread */
     httpd->running = 1;
     httpd->joined = 0;
+    httpd_start_workers(httpd);
     THREAD_CREATE(httpd->thread, httpd_thread, httpd);
     MUTEX_UNLOCK(httpd->run_mutex);
 
@@ -467,6 +954,7 @@ httpd_stop(httpd_t *httpd)
     httpd->running = 0;
     MUTEX_UNLOCK(httpd->run_mutex);
 
+    netpoll_wakeup(httpd->netpoll);
     THREAD_JOIN(httpd->thread);
 
     MUTEX_LOCK(httpd->run_mutex);
@@ -474,3 +962,11 @@ httpd_stop(httpd_t *httpd)
     MUTEX_UNLOCK(httpd->run_mutex);
 }
 
+void
+httpd_get_response_latency(httpd_t *httpd, histogram_summary_t *summary)
+{
+    assert(httpd);
+    assert(summary);
+
+    histogram_summarize(&httpd->response_latency, summary);
+}
@@ -20,6 +20,7 @@
 #include "http_response.h"
 
 typedef struct httpd_s httpd_t;
+struct histogram_summary_s;
 
 struct httpd_callbacks_s {
 	void* opaque;
@@ -30,14 +31,24 @@ struct httpd_callbacks_s {
 typedef struct httpd_callbacks_s httpd_callbacks_t;
 
 
-httpd_t *httpd_init(logger_t *logger, httpd_callbacks_t *callbacks, int max_connections);
+/* conn_request runs on one of 'workers' threads (on the httpd thread if 0);
+ * requests of one connection are still handled one at a time, in order.
+ * With nohold set, a NOHOLD build drops the current clients for a new one */
+httpd_t *httpd_init(logger_t *logger, httpd_callbacks_t *callbacks, int max_connections, int workers,
+                    int nohold);
 
 int httpd_is_running(httpd_t *httpd);
 
+/* Listen on 127.0.0.1 only; takes effect at the next httpd_start() */
+void httpd_set_loopback(httpd_t *httpd, int loopback);
+
 int httpd_start(httpd_t *httpd, unsigned short *port);
 void httpd_stop(httpd_t *httpd);
 
 void httpd_destroy(httpd_t *httpd);
 
+/* Request to response-written latency in microseconds */
+void httpd_get_response_latency(httpd_t *httpd, struct histogram_summary_s *summary);
+
 
 #endif
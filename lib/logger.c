@@ -15,50 +15,482 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
 #include <assert.h>
+#include <stdatomic.h>
 
 #include "logger.h"
 #include "compat.h"
+#include "metrics.h"
+
+/* The real functions behind the level-gating macros */
+#undef logger_enabled
+#undef logger_log
+#undef logger_log_lazy
+
+/* Messages are not written by the thread that logs them: each thread
+ * formats into its own single-producer ring, and a sink thread per logger
+ * hands them to the callback (or stderr) in the order they were logged.
+ * A full ring drops the message and counts it, so a slow terminal can
+ * never block the audio, mirror, NTP or httpd threads. */
+
+#define LOGGER_MSG_SIZE    4096
+#define LOGGER_RING_SIZE   (64 * 1024)          /* per thread and logger, power of two */
+#define LOGGER_RING_MASK   (LOGGER_RING_SIZE - 1)
+#define LOGGER_ALIGN(n)    (((n) + 15) & ~((size_t) 15))
+#define LOGGER_TLS_SLOTS   4                    /* loggers a thread can log to without churn */
+#define LOGGER_SINK_WAIT_MS 100
+
+typedef struct logger_record_s {
+	uint64_t seq;
+	int32_t level;
+	int32_t len;        /* text length including NUL; -1 pads to the end of the ring */
+} logger_record_t;
+
+typedef struct logger_ring_s {
+	struct logger_ring_s *next;
+	atomic_size_t head;     /* advanced by the owning thread */
+	atomic_size_t tail;     /* advanced by the sink thread */
+	atomic_uint dropped;
+	atomic_int orphaned;    /* the owning thread has exited */
+	char data[LOGGER_RING_SIZE];
+} logger_ring_t;
 
 struct logger_s {
-	mutex_handle_t lvl_mutex;
 	mutex_handle_t cb_mutex;
 
-	int level;
+	/* read on every call, from every thread */
+	atomic_int level;
 	void *cls;
 	logger_callback_t callback;
+
+	unsigned int id;
+	struct logger_s *next;
+	atomic_uint_fast64_t seq;
+	atomic_uint_fast64_t dropped;
+
+	mutex_handle_t rings_mutex;
+	logger_ring_t *_Atomic rings;
+
+	int async;
+	int quit;
+	atomic_int sink_waiting;
+	mutex_handle_t wait_mutex;
+	cond_handle_t wait_cond;
+	cond_handle_t flush_cond;
+	thread_handle_t thread;
 };
 
+/* Each thread keeps its rings in thread-specific data, keyed by logger
+ * id rather than pointer so that a recycled address is never matched */
+typedef struct logger_tls_s {
+	unsigned int id[LOGGER_TLS_SLOTS];
+	logger_ring_t *ring[LOGGER_TLS_SLOTS];
+	int evict;
+} logger_tls_t;
+
+static pthread_mutex_t loggers_mutex = PTHREAD_MUTEX_INITIALIZER;
+static logger_t *loggers = NULL;
+static unsigned int loggers_next_id = 1;
+static pthread_key_t loggers_key;
+static pthread_once_t loggers_once = PTHREAD_ONCE_INIT;
+
+static void logger_output(logger_t *logger, int level, const char *buffer);
+
+/* Hand a ring over to the sink thread, which frees it once drained.
+ * Must be called with loggers_mutex held. */
+static void
+logger_orphan_ring(unsigned int id, logger_ring_t *ring)
+{
+	for (logger_t *logger = loggers; logger; logger = logger->next) {
+		if (logger->id == id) {
+			atomic_store_explicit(&ring->orphaned, 1, memory_order_release);
+			return;
+		}
+	}
+	/* the logger is gone, and has freed the ring itself */
+}
+
+static void
+logger_thread_exit(void *arg)
+{
+	logger_tls_t *tls = arg;
+
+	pthread_mutex_lock(&loggers_mutex);
+	for (int i = 0; i < LOGGER_TLS_SLOTS; i++) {
+		if (tls->id[i]) {
+			logger_orphan_ring(tls->id[i], tls->ring[i]);
+		}
+	}
+	pthread_mutex_unlock(&loggers_mutex);
+	free(tls);
+}
+
+static void logger_flush_all(void);
+
+static void
+logger_key_create(void)
+{
+	pthread_key_create(&loggers_key, logger_thread_exit);
+	/* do not lose the last messages before an exit() */
+	atexit(logger_flush_all);
+}
+
+static logger_ring_t *
+logger_get_ring(logger_t *logger)
+{
+	logger_tls_t *tls = pthread_getspecific(loggers_key);
+	logger_ring_t *ring;
+	int slot;
+
+	if (tls) {
+		for (int i = 0; i < LOGGER_TLS_SLOTS; i++) {
+			if (tls->id[i] == logger->id) {
+				return tls->ring[i];
+			}
+		}
+	} else {
+		tls = calloc(1, sizeof(logger_tls_t));
+		if (!tls) {
+			return NULL;
+		}
+		pthread_setspecific(loggers_key, tls);
+	}
+
+	/* First message from this thread to this logger */
+	ring = calloc(1, sizeof(logger_ring_t));
+	if (!ring) {
+		return NULL;
+	}
+	for (slot = 0; slot < LOGGER_TLS_SLOTS; slot++) {
+		if (!tls->id[slot]) {
+			break;
+		}
+	}
+	if (slot == LOGGER_TLS_SLOTS) {
+		slot = tls->evict;
+		tls->evict = (tls->evict + 1) % LOGGER_TLS_SLOTS;
+		pthread_mutex_lock(&loggers_mutex);
+		logger_orphan_ring(tls->id[slot], tls->ring[slot]);
+		pthread_mutex_unlock(&loggers_mutex);
+	}
+	tls->id[slot] = logger->id;
+	tls->ring[slot] = ring;
+
+	MUTEX_LOCK(logger->rings_mutex);
+	ring->next = atomic_load_explicit(&logger->rings, memory_order_relaxed);
+	atomic_store_explicit(&logger->rings, ring, memory_order_release);
+	MUTEX_UNLOCK(logger->rings_mutex);
+	return ring;
+}
+
+/* Producer side: only the owning thread writes a ring */
+static int
+logger_ring_write(logger_ring_t *ring, uint64_t seq, int level, const char *msg, size_t len)
+{
+	size_t need = LOGGER_ALIGN(sizeof(logger_record_t) + len + 1);
+	size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+	size_t offset = head & LOGGER_RING_MASK;
+	size_t to_end = LOGGER_RING_SIZE - offset;
+	size_t total = (need > to_end ? to_end + need : need);
+	logger_record_t record;
+
+	if (LOGGER_RING_SIZE - (head - tail) < total) {
+		return -1;
+	}
+	if (need > to_end) {
+		/* records are never split: skip to the start of the ring */
+		record.seq = 0;
+		record.level = 0;
+		record.len = -1;
+		memcpy(ring->data + offset, &record, sizeof(record));
+		head += to_end;
+		offset = 0;
+	}
+	record.seq = seq;
+	record.level = level;
+	record.len = (int32_t) len + 1;
+	memcpy(ring->data + offset, &record, sizeof(record));
+	memcpy(ring->data + offset + sizeof(record), msg, len);
+	ring->data[offset + sizeof(record) + len] = '\0';
+	atomic_store_explicit(&ring->head, head + need, memory_order_release);
+	return 0;
+}
+
+/* Sink side: the oldest unread record of a ring, or NULL if empty */
+static logger_record_t *
+logger_ring_peek(logger_ring_t *ring)
+{
+	size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+	size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+	logger_record_t *record;
+
+	if (tail == head) {
+		return NULL;
+	}
+	record = (logger_record_t *) (ring->data + (tail & LOGGER_RING_MASK));
+	if (record->len == -1) {
+		tail += LOGGER_RING_SIZE - (tail & LOGGER_RING_MASK);
+		atomic_store_explicit(&ring->tail, tail, memory_order_release);
+		if (tail == head) {
+			return NULL;
+		}
+		record = (logger_record_t *) (ring->data + (tail & LOGGER_RING_MASK));
+	}
+	return record;
+}
+
+static void
+logger_ring_pop(logger_ring_t *ring, logger_record_t *record)
+{
+	size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+	tail += LOGGER_ALIGN(sizeof(logger_record_t) + record->len);
+	atomic_store_explicit(&ring->tail, tail, memory_order_release);
+}
+
+/* Write out everything queued, oldest first across all threads.
+ * Returns the number of messages written. */
+static int
+logger_drain(logger_t *logger)
+{
+	logger_ring_t *rings, *ring, **prev;
+	unsigned int dropped = 0;
+	int count = 0;
+
+	rings = atomic_load_explicit(&logger->rings, memory_order_acquire);
+	while (1) {
+		logger_ring_t *oldest = NULL;
+		logger_record_t *oldest_record = NULL;
+
+		for (ring = rings; ring; ring = ring->next) {
+			logger_record_t *record = logger_ring_peek(ring);
+			if (record && (!oldest_record || record->seq < oldest_record->seq)) {
+				oldest = ring;
+				oldest_record = record;
+			}
+		}
+		if (!oldest) {
+			break;
+		}
+		logger_output(logger, oldest_record->level, (char *) (oldest_record + 1));
+		logger_ring_pop(oldest, oldest_record);
+		count++;
+	}
+
+	/* Report drops, and free the rings of threads that have exited.
+	 * Producers only ever prepend, so the list is edited under the lock. */
+	MUTEX_LOCK(logger->rings_mutex);
+	prev = NULL;
+	ring = atomic_load_explicit(&logger->rings, memory_order_relaxed);
+	while (ring) {
+		logger_ring_t *next = ring->next;
+		dropped += atomic_exchange_explicit(&ring->dropped, 0, memory_order_relaxed);
+		if (atomic_load_explicit(&ring->orphaned, memory_order_acquire) && !logger_ring_peek(ring)) {
+			if (prev) {
+				*prev = next;
+			} else {
+				atomic_store_explicit(&logger->rings, next, memory_order_release);
+			}
+			free(ring);
+		} else {
+			prev = &ring->next;
+		}
+		ring = next;
+	}
+	MUTEX_UNLOCK(logger->rings_mutex);
+
+	if (dropped) {
+		char msg[64];
+		atomic_fetch_add_explicit(&logger->dropped, dropped, memory_order_relaxed);
+		snprintf(msg, sizeof(msg), "logger: %u messages dropped", dropped);
+		logger_output(logger, LOGGER_WARNING, msg);
+	}
+	return count;
+}
+
+/* Called from other threads than the sink: the lock keeps logger_drain()
+ * from freeing a ring while it is being looked at. */
+static int
+logger_pending(logger_t *logger)
+{
+	int pending = 0;
+
+	MUTEX_LOCK(logger->rings_mutex);
+	for (logger_ring_t *ring = atomic_load_explicit(&logger->rings, memory_order_acquire); ring; ring = ring->next) {
+		if (atomic_load_explicit(&ring->tail, memory_order_relaxed) !=
+		    atomic_load_explicit(&ring->head, memory_order_acquire)) {
+			pending = 1;
+			break;
+		}
+	}
+	MUTEX_UNLOCK(logger->rings_mutex);
+	return pending;
+}
+
+static THREAD_RETVAL
+logger_sink_thread(void *arg)
+{
+	logger_t *logger = arg;
+
+	while (1) {
+		int count = logger_drain(logger);
+
+		MUTEX_LOCK(logger->wait_mutex);
+		if (!count) {
+			pthread_cond_broadcast(&logger->flush_cond);
+		}
+		if (logger->quit) {
+			MUTEX_UNLOCK(logger->wait_mutex);
+			break;
+		}
+		if (!count) {
+			/* announce the sleep, then look once more to not miss a wakeup */
+			atomic_store(&logger->sink_waiting, 1);
+			if (!logger_pending(logger)) {
+				struct timespec wait_time;
+				clock_gettime(CLOCK_REALTIME, &wait_time);
+				wait_time.tv_nsec += LOGGER_SINK_WAIT_MS * 1000000L;
+				if (wait_time.tv_nsec >= 1000000000L) {
+					wait_time.tv_sec++;
+					wait_time.tv_nsec -= 1000000000L;
+				}
+				pthread_cond_timedwait(&logger->wait_cond, &logger->wait_mutex, &wait_time);
+			}
+			atomic_store(&logger->sink_waiting, 0);
+		}
+		MUTEX_UNLOCK(logger->wait_mutex);
+	}
+	logger_drain(logger);
+	return 0;
+}
+
+static void
+logger_wake_sink(logger_t *logger)
+{
+	/* only the first message after the sink goes idle pays for the signal */
+	if (atomic_load_explicit(&logger->sink_waiting, memory_order_relaxed) &&
+	    atomic_exchange(&logger->sink_waiting, 0)) {
+		MUTEX_LOCK(logger->wait_mutex);
+		COND_SIGNAL(logger->wait_cond);
+		MUTEX_UNLOCK(logger->wait_mutex);
+	}
+}
+
 logger_t *
 logger_init()
 {
 	logger_t *logger = calloc(1, sizeof(logger_t));
 	assert(logger);
 
-	MUTEX_CREATE(logger->lvl_mutex);
 	MUTEX_CREATE(logger->cb_mutex);
+	MUTEX_CREATE(logger->rings_mutex);
+	MUTEX_CREATE(logger->wait_mutex);
+	COND_CREATE(logger->wait_cond);
+	COND_CREATE(logger->flush_cond);
 
-	logger->level = LOGGER_WARNING;
+	atomic_init(&logger->level, LOGGER_WARNING);
 	logger->callback = NULL;
+
+	pthread_once(&loggers_once, logger_key_create);
+	pthread_mutex_lock(&loggers_mutex);
+	logger->id = loggers_next_id++;
+	logger->next = loggers;
+	loggers = logger;
+	pthread_mutex_unlock(&loggers_mutex);
+
+	/* Without a sink thread messages are written synchronously */
+	THREAD_CREATE(logger->thread, logger_sink_thread, logger);
+	logger->async = (logger->thread != 0);
 	return logger;
 }
 
 void
 logger_destroy(logger_t *logger)
 {
-	MUTEX_DESTROY(logger->lvl_mutex);
+	logger_ring_t *ring;
+
+	/* From here on no thread will hand its rings over to us */
+	pthread_mutex_lock(&loggers_mutex);
+	for (logger_t **prev = &loggers; *prev; prev = &(*prev)->next) {
+		if (*prev == logger) {
+			*prev = logger->next;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&loggers_mutex);
+
+	if (logger->async) {
+		MUTEX_LOCK(logger->wait_mutex);
+		logger->quit = 1;
+		COND_SIGNAL(logger->wait_cond);
+		MUTEX_UNLOCK(logger->wait_mutex);
+		THREAD_JOIN(logger->thread);
+	}
+
+	ring = atomic_load(&logger->rings);
+	while (ring) {
+		logger_ring_t *next = ring->next;
+		free(ring);
+		ring = next;
+	}
+	COND_DESTROY(logger->flush_cond);
+	COND_DESTROY(logger->wait_cond);
+	MUTEX_DESTROY(logger->wait_mutex);
+	MUTEX_DESTROY(logger->rings_mutex);
 	MUTEX_DESTROY(logger->cb_mutex);
 	free(logger);
 }
 
+void
+logger_flush(logger_t *logger)
+{
+	assert(logger);
+
+	if (!logger->async) {
+		return;
+	}
+	MUTEX_LOCK(logger->wait_mutex);
+	while (logger_pending(logger) && !logger->quit) {
+		COND_SIGNAL(logger->wait_cond);
+		pthread_cond_wait(&logger->flush_cond, &logger->wait_mutex);
+	}
+	MUTEX_UNLOCK(logger->wait_mutex);
+}
+
+static void
+logger_flush_all(void)
+{
+	pthread_mutex_lock(&loggers_mutex);
+	for (logger_t *logger = loggers; logger; logger = logger->next) {
+		logger_flush(logger);
+	}
+	pthread_mutex_unlock(&loggers_mutex);
+}
+
+unsigned long long
+logger_get_dropped(logger_t *logger)
+{
+	assert(logger);
+
+	return atomic_load_explicit(&logger->dropped, memory_order_relaxed);
+}
+
 void
 logger_set_level(logger_t *logger, int level)
 {
 	assert(logger);
 
-	MUTEX_LOCK(logger->lvl_mutex);
-	logger->level = level;
-	MUTEX_UNLOCK(logger->lvl_mutex);
+	atomic_store_explicit(&logger->level, level, memory_order_relaxed);
+}
+
+int
+logger_enabled(logger_t *logger, int level)
+{
+	return level <= atomic_load_explicit(&logger->level, memory_order_relaxed);
 }
 
 void
@@ -102,24 +534,9 @@ logger_utf8_to_local(const char *str)
 	return ret;
 }
 
-void
-logger_log(logger_t *logger, int level, const char *fmt, ...)
+static void
+logger_output(logger_t *logger, int level, const char *buffer)
 {
-	char buffer[4096];
-	va_list ap;
-
-	MUTEX_LOCK(logger->lvl_mutex);
-	if (level > logger->level) {
-		MUTEX_UNLOCK(logger->lvl_mutex);
-		return;
-	}
-	MUTEX_UNLOCK(logger->lvl_mutex);
-
-	buffer[sizeof(buffer)-1] = '\0';
-	va_start(ap, fmt);
-	vsnprintf(buffer, sizeof(buffer)-1, fmt, ap);
-	va_end(ap);
-
 	MUTEX_LOCK(logger->cb_mutex);
 	if (logger->callback) {
 		logger->callback(logger->cls, level, buffer);
@@ -137,3 +554,74 @@ logger_log(logger_t *logger, int level, const char *fmt, ...)
 	}
 }
 
+/* Queue a message for the sink thread.  When the thread's ring is full,
+ * debug and info messages are dropped (and counted), but warnings and
+ * errors are written out here, possibly ahead of older queued messages. */
+static void
+logger_write(logger_t *logger, int level, const char *msg, size_t len)
+{
+	logger_ring_t *ring;
+
+	if (logger->async && len < LOGGER_RING_SIZE / 4 && (ring = logger_get_ring(logger))) {
+		uint64_t seq = atomic_fetch_add_explicit(&logger->seq, 1, memory_order_relaxed);
+		if (logger_ring_write(ring, seq, level, msg, len) == 0) {
+			logger_wake_sink(logger);
+			return;
+		}
+		if (level > LOGGER_WARNING) {
+			atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+			metrics_count(METRICS_LOG_DROPS, 1);
+			return;
+		}
+		logger_wake_sink(logger);
+	}
+	/* no sink thread, or a huge (debug) dump: write it out here */
+	logger_output(logger, level, msg);
+}
+
+void
+logger_log(logger_t *logger, int level, const char *fmt, ...)
+{
+	char buffer[LOGGER_MSG_SIZE];
+	va_list ap;
+
+	if (!logger_enabled(logger, level)) {
+		return;
+	}
+
+	buffer[sizeof(buffer)-1] = '\0';
+	va_start(ap, fmt);
+	vsnprintf(buffer, sizeof(buffer)-1, fmt, ap);
+	va_end(ap);
+
+	logger_write(logger, level, buffer, strlen(buffer));
+}
+
+void
+logger_log_lazy(logger_t *logger, int level, const char *prefix,
+                logger_formatter_t formatter, const void *data, int datalen)
+{
+	char *str;
+
+	if (!logger_enabled(logger, level)) {
+		return;
+	}
+
+	str = formatter(data, datalen);
+	if (!str) {
+		return;
+	}
+	if (prefix && *prefix) {
+		/* the formatted data can be longer than logger_log() allows */
+		size_t len = strlen(prefix) + strlen(str) + 1;
+		char *msg = malloc(len);
+		if (msg) {
+			snprintf(msg, len, "%s%s", prefix, str);
+			logger_write(logger, level, msg, len - 1);
+			free(msg);
+		}
+	} else {
+		logger_write(logger, level, str, strlen(str));
+	}
+	free(str);
+}
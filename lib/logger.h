@@ -29,17 +29,47 @@ extern "C" {
 #define LOGGER_INFO        6       /* informational */
 #define LOGGER_DEBUG       7       /* debug-level messages */
 
+/* Messages less severe than UXPLAY_MIN_LOG_LEVEL are compiled out, e.g.
+ * -DUXPLAY_MIN_LOG_LEVEL=LOGGER_INFO removes all debug output and the
+ * code that prepares it from a production build */
+#ifndef UXPLAY_MIN_LOG_LEVEL
+#define UXPLAY_MIN_LOG_LEVEL LOGGER_DEBUG
+#endif
+#define LOGGER_COMPILED_IN(level) ((level) <= UXPLAY_MIN_LOG_LEVEL)
+
 typedef void (*logger_callback_t)(void *cls, int level, const char *msg);
 
+/* Builds a message from data (returning a malloc'ed string, or NULL);
+ * only called if the message will actually be logged */
+typedef char *(*logger_formatter_t)(const void *data, int datalen);
+
 typedef struct logger_s logger_t;
 
+/* Messages are written out by a background thread, in the order logged;
+ * logger_flush() waits until everything queued has been written */
 logger_t *logger_init();
 void logger_destroy(logger_t *logger);
+void logger_flush(logger_t *logger);
+
+/* Messages lost because a thread logged faster than they could be written */
+unsigned long long logger_get_dropped(logger_t *logger);
 
 void logger_set_level(logger_t *logger, int level);
 void logger_set_callback(logger_t *logger, logger_callback_t callback, void *cls);
 
+/* Cheap check, without locking, for guarding expensive debug output */
+int logger_enabled(logger_t *logger, int level);
+
 void logger_log(logger_t *logger, int level, const char *fmt, ...);
+void logger_log_lazy(logger_t *logger, int level, const char *prefix,
+                     logger_formatter_t formatter, const void *data, int datalen);
+
+#define logger_enabled(logger, level) \
+	(LOGGER_COMPILED_IN(level) && logger_enabled(logger, level))
+#define logger_log(logger, level, ...) \
+	do { if (LOGGER_COMPILED_IN(level)) logger_log(logger, level, __VA_ARGS__); } while (0)
+#define logger_log_lazy(logger, level, prefix, formatter, data, datalen) \
+	do { if (LOGGER_COMPILED_IN(level)) logger_log_lazy(logger, level, prefix, formatter, data, datalen); } while (0)
 
 #ifdef __cplusplus
 }
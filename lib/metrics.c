@@ -0,0 +1,245 @@
+/**
+ *  Copyright (C) 2026 UxPlay contributors
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ */
+
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <assert.h>
+
+#include "metrics.h"
+#include "histogram.h"
+#include "trace.h"
+#include "utils.h"
+
+#define METRICS_MAX_LATENCY_NS  10000000000LL
+#define METRICS_MARKS           64          /* buffers in flight between appsrc and sink */
+#define METRICS_PTS_TOLERANCE   2000000ULL  /* audioresample may shift pts slightly */
+#define METRICS_NO_KEY          0           /* marks store pts + 1, so zeroed memory is empty */
+
+typedef struct metrics_mark_s {
+    atomic_uint_fast64_t key;
+    atomic_uint_fast64_t push_ns;
+    atomic_uint_fast64_t stage_ns;  /* when the buffer passed its last probe */
+    atomic_int stage;               /* the stage that ended there, METRICS_STAGE_APPSRC at the push */
+} metrics_mark_t;
+
+typedef struct metrics_stream_data_s {
+    histogram_t stages[METRICS_STAGE_COUNT];
+    metrics_mark_t marks[METRICS_MARKS];
+    atomic_uint mark_index;
+} metrics_stream_data_t;
+
+static metrics_stream_data_t metrics[METRICS_STREAM_COUNT];
+
+/* trace instants for the stages timed inside the pipelines (value: usecs) */
+static const char *const trace_names[METRICS_STREAM_COUNT][METRICS_STAGE_COUNT] = {
+    [METRICS_AUDIO] = {
+        [METRICS_STAGE_QUEUE] = "audio queue",
+        [METRICS_STAGE_DECODE] = "audio decode",
+        [METRICS_STAGE_CONVERT] = "audio convert",
+    },
+    [METRICS_VIDEO] = {
+        [METRICS_STAGE_QUEUE] = "video queue",
+        [METRICS_STAGE_PARSE] = "video parse",
+        [METRICS_STAGE_DECODE] = "video decode",
+        [METRICS_STAGE_CONVERT] = "video convert",
+    },
+};
+static atomic_uint_fast64_t counters[METRICS_COUNTER_COUNT];
+static atomic_int_fast64_t gauges[METRICS_GAUGE_COUNT];
+
+static void
+metrics_clear_marks(metrics_stream_data_t *data)
+{
+    for (int i = 0; i < METRICS_MARKS; i++) {
+        atomic_store(&data->marks[i].key, METRICS_NO_KEY);
+    }
+}
+
+void
+metrics_count(metrics_counter_t counter, uint64_t n)
+{
+    assert(counter < METRICS_COUNTER_COUNT);
+    atomic_fetch_add_explicit(&counters[counter], n, memory_order_relaxed);
+}
+
+uint64_t
+metrics_get_counter(metrics_counter_t counter)
+{
+    assert(counter < METRICS_COUNTER_COUNT);
+    return atomic_load_explicit(&counters[counter], memory_order_relaxed);
+}
+
+void
+metrics_set_gauge(metrics_gauge_t gauge, int64_t value)
+{
+    assert(gauge < METRICS_GAUGE_COUNT);
+    atomic_store_explicit(&gauges[gauge], value, memory_order_relaxed);
+}
+
+void
+metrics_add_gauge(metrics_gauge_t gauge, int64_t delta)
+{
+    assert(gauge < METRICS_GAUGE_COUNT);
+    atomic_fetch_add_explicit(&gauges[gauge], delta, memory_order_relaxed);
+}
+
+int64_t
+metrics_get_gauge(metrics_gauge_t gauge)
+{
+    assert(gauge < METRICS_GAUGE_COUNT);
+    return atomic_load_explicit(&gauges[gauge], memory_order_relaxed);
+}
+
+void
+metrics_record_latency(metrics_stream_t stream, metrics_stage_t stage, int64_t nsecs)
+{
+    assert(stream < METRICS_STREAM_COUNT && stage < METRICS_STAGE_COUNT);
+    if (nsecs > METRICS_MAX_LATENCY_NS) {
+        return;
+    }
+    if (nsecs < 0) {
+        nsecs = 0;
+    }
+    histogram_record(&metrics[stream].stages[stage], (uint64_t) nsecs / 1000);
+}
+
+void
+metrics_get_latency(metrics_stream_t stream, metrics_stage_t stage, metrics_latency_t *latency)
+{
+    histogram_summary_t summary;
+
+    assert(stream < METRICS_STREAM_COUNT && stage < METRICS_STAGE_COUNT);
+    assert(latency);
+    histogram_summarize(&metrics[stream].stages[stage], &summary);
+    latency->count = summary.count;
+    latency->mean = summary.mean;
+    latency->p50 = summary.p50;
+    latency->p90 = summary.p90;
+    latency->p99 = summary.p99;
+    latency->max = summary.max;
+}
+
+void
+metrics_reset_latency(void)
+{
+    for (int i = 0; i < METRICS_STREAM_COUNT; i++) {
+        for (int j = 0; j < METRICS_STAGE_COUNT; j++) {
+            histogram_reset(&metrics[i].stages[j]);
+        }
+        metrics_clear_marks(&metrics[i]);
+    }
+}
+
+void
+metrics_mark_push(metrics_stream_t stream, uint64_t pts)
+{
+    metrics_stream_data_t *data;
+    metrics_mark_t *mark;
+    uint64_t now;
+
+    assert(stream < METRICS_STREAM_COUNT);
+    if (pts == UINT64_MAX) {
+        return;    /* GST_CLOCK_TIME_NONE */
+    }
+    data = &metrics[stream];
+    mark = &data->marks[atomic_fetch_add_explicit(&data->mark_index, 1, memory_order_relaxed) % METRICS_MARKS];
+    /* invalidate first so a concurrent metrics_mark_sink() never pairs the
+     * new push time with the old pts */
+    atomic_store_explicit(&mark->key, METRICS_NO_KEY, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    now = utils_monotonic_ns();
+    atomic_store_explicit(&mark->push_ns, now, memory_order_relaxed);
+    atomic_store_explicit(&mark->stage_ns, now, memory_order_relaxed);
+    atomic_store_explicit(&mark->stage, METRICS_STAGE_APPSRC, memory_order_relaxed);
+    atomic_store_explicit(&mark->key, pts + 1, memory_order_release);
+}
+
+/* the mark pushed with the pts nearest to pts (within METRICS_PTS_TOLERANCE), or NULL */
+static metrics_mark_t *
+metrics_find_mark(metrics_stream_data_t *data, uint64_t pts, uint64_t *found_key)
+{
+    metrics_mark_t *best = NULL;
+    uint64_t best_diff = METRICS_PTS_TOLERANCE + 1;
+
+    for (int i = 0; i < METRICS_MARKS; i++) {
+        uint64_t key = atomic_load_explicit(&data->marks[i].key, memory_order_acquire);
+        uint64_t diff;
+        if (key == METRICS_NO_KEY) {
+            continue;
+        }
+        diff = key - 1 > pts ? key - 1 - pts : pts - (key - 1);
+        if (diff < best_diff) {
+            best = &data->marks[i];
+            *found_key = key;
+            best_diff = diff;
+        }
+    }
+    return best;
+}
+
+static void
+metrics_record_stage(metrics_stream_t stream, metrics_stage_t stage, metrics_mark_t *mark, uint64_t now)
+{
+    uint64_t stage_ns = atomic_exchange_explicit(&mark->stage_ns, now, memory_order_relaxed);
+    int64_t nsecs = (int64_t) (now - stage_ns);
+
+    atomic_store_explicit(&mark->stage, stage, memory_order_relaxed);
+    metrics_record_latency(stream, stage, nsecs);
+    if (trace_names[stream][stage]) {
+        TRACE_INSTANT(trace_names[stream][stage], nsecs / 1000);
+    }
+}
+
+void
+metrics_mark_stage(metrics_stream_t stream, metrics_stage_t stage, uint64_t pts)
+{
+    metrics_mark_t *mark;
+    uint64_t key;
+
+    assert(stream < METRICS_STREAM_COUNT && stage < METRICS_STAGE_COUNT);
+    if (pts == UINT64_MAX) {
+        return;    /* GST_CLOCK_TIME_NONE */
+    }
+    mark = metrics_find_mark(&metrics[stream], pts, &key);
+    if (mark) {
+        metrics_record_stage(stream, stage, mark, utils_monotonic_ns());
+    }
+}
+
+void
+metrics_mark_sink(metrics_stream_t stream, uint64_t pts)
+{
+    metrics_mark_t *best;
+    uint64_t best_key = 0;
+    uint64_t push_ns, now;
+
+    assert(stream < METRICS_STREAM_COUNT);
+    if (pts == UINT64_MAX) {
+        return;    /* GST_CLOCK_TIME_NONE */
+    }
+    best = metrics_find_mark(&metrics[stream], pts, &best_key);
+    if (!best) {
+        return;
+    }
+    push_ns = atomic_load_explicit(&best->push_ns, memory_order_relaxed);
+    /* claim the mark, so buffers split by the pipeline are only counted once */
+    if (!atomic_compare_exchange_strong(&best->key, &best_key, METRICS_NO_KEY)) {
+        return;
+    }
+    now = utils_monotonic_ns();
+    metrics_record_latency(stream, METRICS_STAGE_SINK, (int64_t) (now - push_ns));
+    if (atomic_load_explicit(&best->stage, memory_order_relaxed) != METRICS_STAGE_APPSRC) {
+        metrics_record_stage(stream, METRICS_STAGE_CONVERT, best, now);
+    }
+}
@@ -0,0 +1,128 @@
+/**
+ *  Copyright (C) 2026 UxPlay contributors
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ */
+
+/* Process-wide counters, gauges and latency histograms for the audio and
+ * video paths.  Latency is split into stages so a regression can be pinned
+ * on the network, the decrypt step, the hand-off to GStreamer or the
+ * pipeline itself.  Everything is recorded with relaxed atomics, cheap
+ * enough to stay on in release builds, and read without locks. */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum metrics_stream_e {
+    METRICS_AUDIO,
+    METRICS_VIDEO,
+    METRICS_STREAM_COUNT
+} metrics_stream_t;
+
+typedef enum metrics_stage_e {
+    METRICS_STAGE_NETWORK,     /* sender timestamp to local arrival (audio: relative to lowest transit seen) */
+    METRICS_STAGE_DECRYPT,     /* arrival to decrypted payload */
+    METRICS_STAGE_APPSRC,      /* decrypted to pushed into appsrc (audio includes the jitter buffer) */
+    METRICS_STAGE_SINK,        /* pushed into appsrc to reaching the sink pad */
+    /* METRICS_STAGE_SINK split up, by probes on the sink pads of the pipeline elements */
+    METRICS_STAGE_QUEUE,       /* pushed into appsrc to leaving the queue behind it */
+    METRICS_STAGE_PARSE,       /* through the h264 parser (video only) */
+    METRICS_STAGE_DECODE,      /* through the decoder (not linear PCM audio) */
+    METRICS_STAGE_CONVERT,     /* through the converter and any other elements, to the sink pad */
+    METRICS_STAGE_COUNT
+} metrics_stage_t;
+
+typedef enum metrics_counter_e {
+    METRICS_AUDIO_PACKETS,
+    METRICS_AUDIO_BYTES,
+    METRICS_VIDEO_PACKETS,
+    METRICS_VIDEO_BYTES,
+    METRICS_VIDEO_FRAMES,           /* encrypted VCL payloads, one per frame */
+    METRICS_RESEND_REQUESTS,        /* audio packets asked for again */
+    METRICS_RESEND_RECOVERED,       /* resent audio packets that filled a gap */
+    METRICS_AUDIO_LATE,             /* arrived after their slot was played */
+    METRICS_AUDIO_DUPLICATE,
+    METRICS_AUDIO_OUT_OF_WINDOW,    /* too far ahead, the jitter buffer was flushed */
+    METRICS_DECRYPT_FAILURES,       /* video payloads that did not decrypt to valid h264 */
+    METRICS_INVALID_AUDIO_FRAMES,   /* rejected by the audio renderer */
+    METRICS_APPSRC_PUSH_FAILURES,
+    METRICS_NTP_TIMEOUTS,
+    METRICS_AUDIO_CONGESTION_DROPS, /* audio frames dropped while the audio pipeline was over its latency budget */
+    METRICS_VIDEO_CONGESTION_DROPS, /* video frames dropped while the video pipeline was over its latency budget */
+    METRICS_AUDIO_QUEUE_OVERRUNS,   /* the audio queue was full and leaked a buffer */
+    METRICS_VIDEO_QUEUE_OVERRUNS,   /* the video queue was full and leaked a buffer */
+    METRICS_VIDEO_SINK_DROPS,       /* QoS: video frames dropped by the sink for being too late */
+    METRICS_VIDEO_QOS_DROPS,        /* QoS: video frames dropped upstream of the sink (usually by the decoder) */
+    METRICS_LOG_DROPS,              /* log messages dropped because a thread's log ring was full */
+    METRICS_COUNTER_COUNT
+} metrics_counter_t;
+
+typedef enum metrics_gauge_e {
+    METRICS_AUDIO_BUFFER_FILL,      /* packets held in the audio jitter buffer */
+    METRICS_AUDIO_QUEUE_LEVEL,      /* buffers queued behind the audio appsrc */
+    METRICS_VIDEO_QUEUE_LEVEL,      /* buffers queued behind the video appsrc */
+    METRICS_AUDIO_QUEUE_TIME,       /* duration queued behind the audio appsrc, nsecs */
+    METRICS_VIDEO_QUEUE_TIME,       /* duration queued behind the video appsrc, nsecs */
+    METRICS_AUDIO_CONGESTED,        /* 1 while the audio renderer asks for frames to be dropped */
+    METRICS_VIDEO_CONGESTED,        /* 1 while the video renderer asks for frames to be dropped */
+    METRICS_AUDIO_SWITCH_TIME,      /* last audio format switch: state change plus first buffer to the sink, nsecs */
+    METRICS_VIDEO_QOS_JITTER,       /* QoS: lateness of the last video frame dropped, nsecs */
+    METRICS_VIDEO_PIPELINE_LATENCY, /* minimum latency reported by the video pipeline's latency query, nsecs */
+    METRICS_NTP_OFFSET,             /* remote minus local clock, nsecs */
+    METRICS_NTP_DISPERSION,         /* nsecs */
+    METRICS_NTP_DELAY,              /* round trip, nsecs */
+    METRICS_RTSP_CONNECTIONS,
+    METRICS_GAUGE_COUNT
+} metrics_gauge_t;
+
+void metrics_count(metrics_counter_t counter, uint64_t n);
+uint64_t metrics_get_counter(metrics_counter_t counter);
+void metrics_set_gauge(metrics_gauge_t gauge, int64_t value);
+void metrics_add_gauge(metrics_gauge_t gauge, int64_t delta);
+int64_t metrics_get_gauge(metrics_gauge_t gauge);
+
+/* all values in microseconds */
+typedef struct metrics_latency_s {
+    uint64_t count;
+    uint64_t mean;
+    uint64_t p50;
+    uint64_t p90;
+    uint64_t p99;
+    uint64_t max;
+} metrics_latency_t;
+
+/* nsecs < 0 is recorded as 0; values above 10 s are dropped, they only
+ * appear before the clocks are synchronized */
+void metrics_record_latency(metrics_stream_t stream, metrics_stage_t stage, int64_t nsecs);
+void metrics_get_latency(metrics_stream_t stream, metrics_stage_t stage, metrics_latency_t *latency);
+void metrics_reset_latency(void);
+
+/* The renderers call metrics_mark_push() with the buffer pts just before
+ * gst_app_src_push_buffer(), and metrics_mark_sink() from a probe on the
+ * sink pad; the pair is matched by pts to record METRICS_STAGE_SINK.
+ * Probes in between call metrics_mark_stage() with the stage that ends
+ * there, which records the time since the previous mark of that buffer;
+ * metrics_mark_sink() then records METRICS_STAGE_CONVERT, if any did. */
+void metrics_mark_push(metrics_stream_t stream, uint64_t pts);
+void metrics_mark_stage(metrics_stream_t stream, metrics_stage_t stage, uint64_t pts);
+void metrics_mark_sink(metrics_stream_t stream, uint64_t pts);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,304 @@
+/**
+ *  Copyright (C) 2026 UxPlay contributors
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <assert.h>
+
+#include "metrics_server.h"
+#include "metrics.h"
+#include "httpd.h"
+#include "utils.h"
+
+#define METRICS_SERVER_MAX_CONNECTIONS 4
+#define METRICS_SERVER_TEXT_SIZE       16384
+
+struct metrics_server_s {
+    logger_t *logger;
+    httpd_t *httpd;
+
+    /* Only touched on the httpd thread (no workers), so no locking.
+     * Rates are averaged over the time since the previous scrape. */
+    uint64_t last_scrape_ns;
+    uint64_t last_video_frames;
+    uint64_t last_video_bytes;
+    uint64_t last_audio_bytes;
+
+    /* The reply is rendered here, then copied once into the response */
+    char text[METRICS_SERVER_TEXT_SIZE];
+    int text_len;
+};
+
+typedef struct metrics_counter_info_s {
+    metrics_counter_t counter;
+    const char *name;
+    const char *help;
+} metrics_counter_info_t;
+
+static const metrics_counter_info_t counter_info[] = {
+    { METRICS_AUDIO_PACKETS, "uxplay_audio_packets", "Audio RTP packets received" },
+    { METRICS_AUDIO_BYTES, "uxplay_audio_bytes", "Audio RTP bytes received" },
+    { METRICS_VIDEO_PACKETS, "uxplay_video_packets", "Mirror packets received" },
+    { METRICS_VIDEO_BYTES, "uxplay_video_bytes", "Mirror bytes received" },
+    { METRICS_VIDEO_FRAMES, "uxplay_video_frames", "Video frames received" },
+    { METRICS_RESEND_REQUESTS, "uxplay_audio_resend_requests", "Audio packets requested again" },
+    { METRICS_RESEND_RECOVERED, "uxplay_audio_resend_recovered", "Resent audio packets that filled a gap" },
+    { METRICS_AUDIO_LATE, "uxplay_audio_late_packets", "Audio packets that arrived after being played" },
+    { METRICS_AUDIO_DUPLICATE, "uxplay_audio_duplicate_packets", "Duplicate audio packets" },
+    { METRICS_AUDIO_OUT_OF_WINDOW, "uxplay_audio_out_of_window_packets", "Audio packets that forced a jitter buffer flush" },
+    { METRICS_DECRYPT_FAILURES, "uxplay_video_decrypt_failures", "Video payloads that did not decrypt to valid h264" },
+    { METRICS_INVALID_AUDIO_FRAMES, "uxplay_audio_invalid_frames", "Audio frames rejected by the renderer" },
+    { METRICS_APPSRC_PUSH_FAILURES, "uxplay_appsrc_push_failures", "Buffers refused by appsrc" },
+    { METRICS_NTP_TIMEOUTS, "uxplay_ntp_timeouts", "NTP requests that timed out" },
+    { METRICS_AUDIO_CONGESTION_DROPS, "uxplay_audio_congestion_drops", "Audio frames dropped to keep within the latency budget" },
+    { METRICS_VIDEO_CONGESTION_DROPS, "uxplay_video_congestion_drops", "Video frames dropped to keep within the latency budget" },
+    { METRICS_AUDIO_QUEUE_OVERRUNS, "uxplay_audio_queue_overruns", "Buffers leaked by the full audio queue" },
+    { METRICS_VIDEO_QUEUE_OVERRUNS, "uxplay_video_queue_overruns", "Buffers leaked by the full video queue" },
+    { METRICS_VIDEO_SINK_DROPS, "uxplay_video_sink_drops", "Video frames dropped by the sink for being late" },
+    { METRICS_VIDEO_QOS_DROPS, "uxplay_video_qos_drops", "Video frames dropped upstream of the sink for QoS" },
+    { METRICS_LOG_DROPS, "uxplay_log_drops", "Debug and info log messages dropped while the logger fell behind" },
+};
+
+typedef struct metrics_gauge_info_s {
+    metrics_gauge_t gauge;
+    const char *name;
+    const char *help;
+    double scale;
+} metrics_gauge_info_t;
+
+static const metrics_gauge_info_t gauge_info[] = {
+    { METRICS_AUDIO_BUFFER_FILL, "uxplay_audio_buffer_packets", "Packets held in the audio jitter buffer", 1.0 },
+    { METRICS_AUDIO_QUEUE_LEVEL, "uxplay_audio_queue_buffers", "Buffers queued in the audio pipeline", 1.0 },
+    { METRICS_VIDEO_QUEUE_LEVEL, "uxplay_video_queue_buffers", "Buffers queued in the video pipeline", 1.0 },
+    { METRICS_AUDIO_QUEUE_TIME, "uxplay_audio_queue_seconds", "Duration queued in the audio pipeline", 1e-9 },
+    { METRICS_VIDEO_QUEUE_TIME, "uxplay_video_queue_seconds", "Duration queued in the video pipeline", 1e-9 },
+    { METRICS_AUDIO_CONGESTED, "uxplay_audio_congested", "1 while audio frames are being dropped to catch up", 1.0 },
+    { METRICS_VIDEO_CONGESTED, "uxplay_video_congested", "1 while video frames are being dropped to catch up", 1.0 },
+    { METRICS_AUDIO_SWITCH_TIME, "uxplay_audio_switch_seconds", "Time taken by the last audio format switch", 1e-9 },
+    { METRICS_VIDEO_QOS_JITTER, "uxplay_video_qos_jitter_seconds", "Lateness of the last video frame dropped", 1e-9 },
+    { METRICS_VIDEO_PIPELINE_LATENCY, "uxplay_video_pipeline_latency_seconds", "Latency reported by the video pipeline", 1e-9 },
+    { METRICS_NTP_OFFSET, "uxplay_ntp_offset_seconds", "Remote minus local clock", 1e-9 },
+    { METRICS_NTP_DISPERSION, "uxplay_ntp_dispersion_seconds", "NTP dispersion", 1e-9 },
+    { METRICS_NTP_DELAY, "uxplay_ntp_delay_seconds", "NTP round trip delay", 1e-9 },
+    { METRICS_RTSP_CONNECTIONS, "uxplay_rtsp_connections", "Open RTSP connections", 1.0 },
+};
+
+static const char *stream_names[METRICS_STREAM_COUNT] = { "audio", "video" };
+static const char *stage_names[METRICS_STAGE_COUNT] = { "network", "decrypt", "appsrc", "sink",
+                                                        "queue", "parse", "decode", "convert" };
+
+static void
+metrics_server_printf(metrics_server_t *metrics_server, const char *format, ...)
+{
+    int avail = METRICS_SERVER_TEXT_SIZE - metrics_server->text_len;
+    va_list args;
+    int len;
+
+    if (avail <= 0) {
+        return;
+    }
+    va_start(args, format);
+    len = vsnprintf(metrics_server->text + metrics_server->text_len, avail, format, args);
+    va_end(args);
+    if (len < 0 || len >= avail) {
+        /* drop the partial line rather than emit a malformed one */
+        metrics_server->text[metrics_server->text_len] = '\0';
+        metrics_server->text_len = METRICS_SERVER_TEXT_SIZE;
+        return;
+    }
+    metrics_server->text_len += len;
+}
+
+static void
+metrics_server_gauge(metrics_server_t *metrics_server, const char *name, const char *help, double value)
+{
+    metrics_server_printf(metrics_server, "# HELP %s %s\n# TYPE %s gauge\n%s %.9g\n", name, help, name, name, value);
+}
+
+static void
+metrics_server_render(metrics_server_t *metrics_server, int openmetrics)
+{
+    uint64_t now = utils_monotonic_ns();
+    uint64_t video_frames = metrics_get_counter(METRICS_VIDEO_FRAMES);
+    uint64_t video_bytes = metrics_get_counter(METRICS_VIDEO_BYTES);
+    uint64_t audio_bytes = metrics_get_counter(METRICS_AUDIO_BYTES);
+    double elapsed = 0.0;
+
+    metrics_server->text_len = 0;
+
+    for (size_t i = 0; i < sizeof(counter_info) / sizeof(counter_info[0]); i++) {
+        const metrics_counter_info_t *info = &counter_info[i];
+        /* OpenMetrics names the family without the _total suffix */
+        metrics_server_printf(metrics_server, "# HELP %s%s %s\n# TYPE %s%s counter\n%s_total %llu\n",
+                              info->name, openmetrics ? "" : "_total", info->help,
+                              info->name, openmetrics ? "" : "_total",
+                              info->name, (unsigned long long) metrics_get_counter(info->counter));
+    }
+    for (size_t i = 0; i < sizeof(gauge_info) / sizeof(gauge_info[0]); i++) {
+        const metrics_gauge_info_t *info = &gauge_info[i];
+        metrics_server_gauge(metrics_server, info->name, info->help,
+                             (double) metrics_get_gauge(info->gauge) * info->scale);
+    }
+
+    if (metrics_server->last_scrape_ns) {
+        elapsed = (double) (now - metrics_server->last_scrape_ns) / 1e9;
+    }
+    if (elapsed > 0.0) {
+        metrics_server_gauge(metrics_server, "uxplay_video_frame_rate", "Video frames per second since the last scrape",
+                             (double) (video_frames - metrics_server->last_video_frames) / elapsed);
+        metrics_server_gauge(metrics_server, "uxplay_video_bitrate_bps", "Mirror bits per second since the last scrape",
+                             (double) (video_bytes - metrics_server->last_video_bytes) * 8.0 / elapsed);
+        metrics_server_gauge(metrics_server, "uxplay_audio_bitrate_bps", "Audio bits per second since the last scrape",
+                             (double) (audio_bytes - metrics_server->last_audio_bytes) * 8.0 / elapsed);
+    }
+    metrics_server->last_scrape_ns = now;
+    metrics_server->last_video_frames = video_frames;
+    metrics_server->last_video_bytes = video_bytes;
+    metrics_server->last_audio_bytes = audio_bytes;
+
+    metrics_server_printf(metrics_server, "# HELP uxplay_latency_seconds Per-stage latency\n"
+                          "# TYPE uxplay_latency_seconds summary\n");
+    for (int i = 0; i < METRICS_STREAM_COUNT; i++) {
+        for (int j = 0; j < METRICS_STAGE_COUNT; j++) {
+            char labels[64];
+            metrics_latency_t latency;
+
+            metrics_get_latency((metrics_stream_t) i, (metrics_stage_t) j, &latency);
+            snprintf(labels, sizeof(labels), "stream=\"%s\",stage=\"%s\"", stream_names[i], stage_names[j]);
+            metrics_server_printf(metrics_server,
+                                  "uxplay_latency_seconds{%s,quantile=\"0.5\"} %.6f\n"
+                                  "uxplay_latency_seconds{%s,quantile=\"0.9\"} %.6f\n"
+                                  "uxplay_latency_seconds{%s,quantile=\"0.99\"} %.6f\n"
+                                  "uxplay_latency_seconds_count{%s} %llu\n",
+                                  labels, (double) latency.p50 / 1e6, labels, (double) latency.p90 / 1e6,
+                                  labels, (double) latency.p99 / 1e6, labels, (unsigned long long) latency.count);
+        }
+    }
+    if (openmetrics) {
+        metrics_server_printf(metrics_server, "# EOF\n");
+    }
+}
+
+static void *
+conn_init(void *opaque, unsigned char *local, int locallen, unsigned char *remote, int remotelen)
+{
+    /* stateless: every connection shares the server */
+    return opaque;
+}
+
+static void
+conn_request(void *ptr, http_request_t *request, http_response_t **response)
+{
+    metrics_server_t *metrics_server = ptr;
+    const char *method = http_request_get_method(request);
+    const char *url = http_request_get_url(request);
+    const char *accept;
+    int openmetrics;
+
+    if (!method || strcmp(method, "GET")) {
+        *response = http_response_init("HTTP/1.1", 405, "Method Not Allowed");
+        http_response_add_header(*response, "Allow", "GET");
+        http_response_finish(*response, "Method Not Allowed\n", 19);
+        return;
+    }
+    if (!url || (strcmp(url, "/metrics") && strncmp(url, "/metrics?", 9))) {
+        *response = http_response_init("HTTP/1.1", 404, "Not Found");
+        http_response_finish(*response, "Not Found\n", 10);
+        return;
+    }
+
+    accept = http_request_get_header(request, "Accept");
+    openmetrics = accept && strstr(accept, "application/openmetrics-text") != NULL;
+    metrics_server_render(metrics_server, openmetrics);
+    if (metrics_server->text_len >= METRICS_SERVER_TEXT_SIZE) {
+        logger_log(metrics_server->logger, LOGGER_WARNING, "metrics reply truncated");
+        metrics_server->text_len = strlen(metrics_server->text);
+    }
+
+    *response = http_response_init("HTTP/1.1", 200, "OK");
+    http_response_add_header(*response, "Content-Type", openmetrics ?
+                             "application/openmetrics-text; version=1.0.0; charset=utf-8" :
+                             "text/plain; version=0.0.4; charset=utf-8");
+    http_response_finish(*response, metrics_server->text, metrics_server->text_len);
+}
+
+static void
+conn_destroy(void *ptr)
+{
+}
+
+metrics_server_t *
+metrics_server_init(logger_t *logger)
+{
+    metrics_server_t *metrics_server;
+    httpd_callbacks_t httpd_cbs;
+
+    assert(logger);
+
+    metrics_server = calloc(1, sizeof(metrics_server_t));
+    if (!metrics_server) {
+        return NULL;
+    }
+    metrics_server->logger = logger;
+
+    memset(&httpd_cbs, 0, sizeof(httpd_cbs));
+    httpd_cbs.opaque = metrics_server;
+    httpd_cbs.conn_init = &conn_init;
+    httpd_cbs.conn_request = &conn_request;
+    httpd_cbs.conn_destroy = &conn_destroy;
+
+    /* requests run on the httpd thread, which keeps the rate state unshared;
+     * scrapers never displace each other, even in NOHOLD builds */
+    metrics_server->httpd = httpd_init(logger, &httpd_cbs, METRICS_SERVER_MAX_CONNECTIONS, 0, 0);
+    if (!metrics_server->httpd) {
+        free(metrics_server);
+        return NULL;
+    }
+    return metrics_server;
+}
+
+int
+metrics_server_start(metrics_server_t *metrics_server, unsigned short *port, int loopback_only)
+{
+    int ret;
+
+    assert(metrics_server);
+    assert(port);
+    httpd_set_loopback(metrics_server->httpd, loopback_only);
+    ret = httpd_start(metrics_server->httpd, port);
+    if (ret == 1) {
+        logger_log(metrics_server->logger, LOGGER_INFO, "metrics available at http://%s:%u/metrics",
+                   loopback_only ? "127.0.0.1" : "<host>", *port);
+    }
+    return ret;
+}
+
+void
+metrics_server_stop(metrics_server_t *metrics_server)
+{
+    assert(metrics_server);
+    httpd_stop(metrics_server->httpd);
+}
+
+void
+metrics_server_destroy(metrics_server_t *metrics_server)
+{
+    if (metrics_server) {
+        metrics_server_stop(metrics_server);
+        httpd_destroy(metrics_server->httpd);
+        free(metrics_server);
+    }
+}
@@ -0,0 +1,43 @@
+/**
+ *  Copyright (C) 2026 UxPlay contributors
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ */
+
+/* Optional scrape endpoint: a small httpd instance of its own that answers
+ * GET /metrics with the counters, gauges and latency summaries of metrics.h
+ * in Prometheus text or OpenMetrics format.  It only reads atomics, so a
+ * scrape never waits on a lock that the media threads hold. */
+
+#ifndef METRICS_SERVER_H
+#define METRICS_SERVER_H
+
+#include "logger.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct metrics_server_s metrics_server_t;
+
+metrics_server_t *metrics_server_init(logger_t *logger);
+
+/* *port 0 picks a free port and returns it; loopback_only binds 127.0.0.1 */
+int metrics_server_start(metrics_server_t *metrics_server, unsigned short *port, int loopback_only);
+void metrics_server_stop(metrics_server_t *metrics_server);
+
+void metrics_server_destroy(metrics_server_t *metrics_server);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
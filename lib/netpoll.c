@@ -0,0 +1,525 @@
+/**
+ *  Copyright (C) 2026 UxPlay contributors
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+#include "compat.h"
+#include "netpoll.h"
+
+#if defined(__linux__)
+#  define NETPOLL_EPOLL
+#  include <sys/epoll.h>
+#  include <sys/eventfd.h>
+#elif defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__) || defined(__DragonFly__)
+#  define NETPOLL_KQUEUE
+#  include <sys/event.h>
+#else
+#  define NETPOLL_SELECT
+#endif
+
+#ifndef WIN32
+#include <fcntl.h>
+#endif
+
+#if defined(NETPOLL_SELECT)
+struct netpoll_entry_s {
+    int fd;
+    int events;
+    void *data;
+};
+#endif
+
+struct netpoll_s {
+    int max_fds;
+#if defined(NETPOLL_EPOLL)
+    int epoll_fd;
+    int wakeup_fd;
+#elif defined(NETPOLL_KQUEUE)
+    int kqueue_fd;
+    int wakeup_fds[2];
+#else
+    /* A loopback UDP socket that sends to itself works on every platform
+     * that has select(), including Windows where pipes cannot be selected */
+    int wakeup_fd;
+    int num_entries;
+    struct netpoll_entry_s *entries;
+#endif
+};
+
+int
+netpoll_set_nonblocking(int fd)
+{
+#ifdef WIN32
+    u_long nonblocking = 1;
+    return ioctlsocket(fd, FIONBIO, &nonblocking) == 0 ? 0 : -1;
+#else
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags == -1) {
+        return -1;
+    }
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+#endif
+}
+
+#if defined(NETPOLL_EPOLL)
+
+static unsigned int
+netpoll_epoll_events(int events)
+{
+    unsigned int ret = 0;
+    if (events & NETPOLL_IN) ret |= EPOLLIN | EPOLLRDHUP;
+    if (events & NETPOLL_OUT) ret |= EPOLLOUT;
+    if (events & NETPOLL_ET) ret |= EPOLLET;
+    return ret;
+}
+
+netpoll_t *
+netpoll_init(int max_fds)
+{
+    netpoll_t *netpoll;
+    struct epoll_event ev;
+
+    assert(max_fds > 0);
+
+    netpoll = calloc(1, sizeof(netpoll_t));
+    if (!netpoll) {
+        return NULL;
+    }
+    netpoll->max_fds = max_fds;
+    netpoll->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (netpoll->epoll_fd == -1) {
+        free(netpoll);
+        return NULL;
+    }
+    netpoll->wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (netpoll->wakeup_fd == -1) {
+        close(netpoll->epoll_fd);
+        free(netpoll);
+        return NULL;
+    }
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = netpoll;
+    if (epoll_ctl(netpoll->epoll_fd, EPOLL_CTL_ADD, netpoll->wakeup_fd, &ev) == -1) {
+        close(netpoll->wakeup_fd);
+        close(netpoll->epoll_fd);
+        free(netpoll);
+        return NULL;
+    }
+    return netpoll;
+}
+
+void
+netpoll_destroy(netpoll_t *netpoll)
+{
+    if (netpoll) {
+        close(netpoll->wakeup_fd);
+        close(netpoll->epoll_fd);
+        free(netpoll);
+    }
+}
+
+int
+netpoll_add(netpoll_t *netpoll, int fd, int events, void *data)
+{
+    struct epoll_event ev;
+
+    assert(netpoll);
+    memset(&ev, 0, sizeof(ev));
+    ev.events = netpoll_epoll_events(events);
+    ev.data.ptr = data;
+    return epoll_ctl(netpoll->epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+int
+netpoll_mod(netpoll_t *netpoll, int fd, int events, void *data)
+{
+    struct epoll_event ev;
+
+    assert(netpoll);
+    memset(&ev, 0, sizeof(ev));
+    ev.events = netpoll_epoll_events(events);
+    ev.data.ptr = data;
+    return epoll_ctl(netpoll->epoll_fd, EPOLL_CTL_MOD, fd, &ev);
+}
+
+int
+netpoll_del(netpoll_t *netpoll, int fd)
+{
+    struct epoll_event ev;
+
+    assert(netpoll);
+    /* a non-NULL event is needed by kernels older than 2.6.9 */
+    memset(&ev, 0, sizeof(ev));
+    return epoll_ctl(netpoll->epoll_fd, EPOLL_CTL_DEL, fd, &ev);
+}
+
+int
+netpoll_wait(netpoll_t *netpoll, netpoll_event_t *events, int max_events, int timeout_ms)
+{
+    struct epoll_event ev[32];
+    int count = 0;
+    int ret;
+
+    assert(netpoll);
+    assert(events);
+
+    if (max_events > (int) (sizeof(ev) / sizeof(ev[0]))) {
+        max_events = sizeof(ev) / sizeof(ev[0]);
+    }
+    ret = epoll_wait(netpoll->epoll_fd, ev, max_events, timeout_ms);
+    if (ret == -1) {
+        return (errno == EINTR) ? 0 : -1;
+    }
+    for (int i = 0; i < ret; i++) {
+        if (ev[i].data.ptr == netpoll) {
+            uint64_t value;
+            if (read(netpoll->wakeup_fd, &value, sizeof(value)) < 0) {
+                /* already drained */
+            }
+            continue;
+        }
+        events[count].data = ev[i].data.ptr;
+        events[count].events = 0;
+        if (ev[i].events & EPOLLIN) events[count].events |= NETPOLL_IN;
+        if (ev[i].events & EPOLLOUT) events[count].events |= NETPOLL_OUT;
+        if (ev[i].events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP)) events[count].events |= NETPOLL_ERR;
+        count++;
+    }
+    return count;
+}
+
+void
+netpoll_wakeup(netpoll_t *netpoll)
+{
+    uint64_t value = 1;
+
+    assert(netpoll);
+    if (write(netpoll->wakeup_fd, &value, sizeof(value)) < 0) {
+        /* counter saturated, a wakeup is already pending */
+    }
+}
+
+#elif defined(NETPOLL_KQUEUE)
+
+netpoll_t *
+netpoll_init(int max_fds)
+{
+    netpoll_t *netpoll;
+    struct kevent kev;
+
+    assert(max_fds > 0);
+
+    netpoll = calloc(1, sizeof(netpoll_t));
+    if (!netpoll) {
+        return NULL;
+    }
+    netpoll->max_fds = max_fds;
+    netpoll->kqueue_fd = kqueue();
+    if (netpoll->kqueue_fd == -1) {
+        free(netpoll);
+        return NULL;
+    }
+    if (pipe(netpoll->wakeup_fds) == -1) {
+        close(netpoll->kqueue_fd);
+        free(netpoll);
+        return NULL;
+    }
+    netpoll_set_nonblocking(netpoll->wakeup_fds[0]);
+    netpoll_set_nonblocking(netpoll->wakeup_fds[1]);
+    fcntl(netpoll->wakeup_fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(netpoll->wakeup_fds[1], F_SETFD, FD_CLOEXEC);
+    fcntl(netpoll->kqueue_fd, F_SETFD, FD_CLOEXEC);
+
+    EV_SET(&kev, netpoll->wakeup_fds[0], EVFILT_READ, EV_ADD, 0, 0, netpoll);
+    if (kevent(netpoll->kqueue_fd, &kev, 1, NULL, 0, NULL) == -1) {
+        close(netpoll->wakeup_fds[0]);
+        close(netpoll->wakeup_fds[1]);
+        close(netpoll->kqueue_fd);
+        free(netpoll);
+        return NULL;
+    }
+    return netpoll;
+}
+
+void
+netpoll_destroy(netpoll_t *netpoll)
+{
+    if (netpoll) {
+        close(netpoll->wakeup_fds[0]);
+        close(netpoll->wakeup_fds[1]);
+        close(netpoll->kqueue_fd);
+        free(netpoll);
+    }
+}
+
+static int
+netpoll_kqueue_update(netpoll_t *netpoll, int fd, int events, void *data)
+{
+    struct kevent kev[2];
+    unsigned short flags = (events & NETPOLL_ET) ? EV_CLEAR : 0;
+
+    EV_SET(&kev[0], fd, EVFILT_READ, (events & NETPOLL_IN) ? (EV_ADD | EV_ENABLE | flags) : (EV_ADD | EV_DISABLE), 0, 0, data);
+    EV_SET(&kev[1], fd, EVFILT_WRITE, (events & NETPOLL_OUT) ? (EV_ADD | EV_ENABLE | flags) : (EV_ADD | EV_DISABLE), 0, 0, data);
+    return kevent(netpoll->kqueue_fd, kev, 2, NULL, 0, NULL) == -1 ? -1 : 0;
+}
+
+int
+netpoll_add(netpoll_t *netpoll, int fd, int events, void *data)
+{
+    assert(netpoll);
+    return netpoll_kqueue_update(netpoll, fd, events, data);
+}
+
+int
+netpoll_mod(netpoll_t *netpoll, int fd, int events, void *data)
+{
+    assert(netpoll);
+    return netpoll_kqueue_update(netpoll, fd, events, data);
+}
+
+int
+netpoll_del(netpoll_t *netpoll, int fd)
+{
+    struct kevent kev[2];
+
+    assert(netpoll);
+    EV_SET(&kev[0], fd, EVFILT_READ, EV_DELETE, 0, 0, NULL);
+    EV_SET(&kev[1], fd, EVFILT_WRITE, EV_DELETE, 0, 0, NULL);
+    kevent(netpoll->kqueue_fd, kev, 2, NULL, 0, NULL);
+    return 0;
+}
+
+int
+netpoll_wait(netpoll_t *netpoll, netpoll_event_t *events, int max_events, int timeout_ms)
+{
+    struct kevent kev[32];
+    struct timespec ts, *tsp = NULL;
+    int count = 0;
+    int ret;
+
+    assert(netpoll);
+    assert(events);
+
+    if (max_events > (int) (sizeof(kev) / sizeof(kev[0]))) {
+        max_events = sizeof(kev) / sizeof(kev[0]);
+    }
+    if (timeout_ms >= 0) {
+        ts.tv_sec = timeout_ms / 1000;
+        ts.tv_nsec = (timeout_ms % 1000) * 1000000L;
+        tsp = &ts;
+    }
+    ret = kevent(netpoll->kqueue_fd, NULL, 0, kev, max_events, tsp);
+    if (ret == -1) {
+        return (errno == EINTR) ? 0 : -1;
+    }
+    for (int i = 0; i < ret; i++) {
+        if (kev[i].udata == (void *) netpoll) {
+            char buf[64];
+            while (read(netpoll->wakeup_fds[0], buf, sizeof(buf)) > 0);
+            continue;
+        }
+        events[count].data = (void *) kev[i].udata;
+        events[count].events = (kev[i].filter == EVFILT_WRITE) ? NETPOLL_OUT : NETPOLL_IN;
+        if (kev[i].flags & (EV_EOF | EV_ERROR)) events[count].events |= NETPOLL_ERR;
+        count++;
+    }
+    return count;
+}
+
+void
+netpoll_wakeup(netpoll_t *netpoll)
+{
+    char c = 0;
+
+    assert(netpoll);
+    if (write(netpoll->wakeup_fds[1], &c, 1) < 0) {
+        /* pipe full, a wakeup is already pending */
+    }
+}
+
+#else /* NETPOLL_SELECT */
+
+netpoll_t *
+netpoll_init(int max_fds)
+{
+    netpoll_t *netpoll;
+    struct sockaddr_in sin;
+    socklen_t sinlen = sizeof(sin);
+
+    assert(max_fds > 0);
+
+    netpoll = calloc(1, sizeof(netpoll_t));
+    if (!netpoll) {
+        return NULL;
+    }
+    netpoll->max_fds = max_fds;
+    netpoll->entries = calloc(max_fds, sizeof(struct netpoll_entry_s));
+    if (!netpoll->entries) {
+        free(netpoll);
+        return NULL;
+    }
+
+    netpoll->wakeup_fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (netpoll->wakeup_fd == -1) {
+        goto cleanup;
+    }
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    sin.sin_port = 0;
+    if (bind(netpoll->wakeup_fd, (struct sockaddr *) &sin, sizeof(sin)) == -1 ||
+        getsockname(netpoll->wakeup_fd, (struct sockaddr *) &sin, &sinlen) == -1 ||
+        connect(netpoll->wakeup_fd, (struct sockaddr *) &sin, sinlen) == -1) {
+        closesocket(netpoll->wakeup_fd);
+        goto cleanup;
+    }
+    netpoll_set_nonblocking(netpoll->wakeup_fd);
+    return netpoll;
+
+    cleanup:
+    free(netpoll->entries);
+    free(netpoll);
+    return NULL;
+}
+
+void
+netpoll_destroy(netpoll_t *netpoll)
+{
+    if (netpoll) {
+        closesocket(netpoll->wakeup_fd);
+        free(netpoll->entries);
+        free(netpoll);
+    }
+}
+
+static struct netpoll_entry_s *
+netpoll_find(netpoll_t *netpoll, int fd)
+{
+    for (int i = 0; i < netpoll->num_entries; i++) {
+        if (netpoll->entries[i].fd == fd) {
+            return &netpoll->entries[i];
+        }
+    }
+    return NULL;
+}
+
+int
+netpoll_add(netpoll_t *netpoll, int fd, int events, void *data)
+{
+    assert(netpoll);
+    if (netpoll_find(netpoll, fd) || netpoll->num_entries == netpoll->max_fds) {
+        return -1;
+    }
+    netpoll->entries[netpoll->num_entries].fd = fd;
+    netpoll->entries[netpoll->num_entries].events = events;
+    netpoll->entries[netpoll->num_entries].data = data;
+    netpoll->num_entries++;
+    return 0;
+}
+
+int
+netpoll_mod(netpoll_t *netpoll, int fd, int events, void *data)
+{
+    struct netpoll_entry_s *entry;
+
+    assert(netpoll);
+    entry = netpoll_find(netpoll, fd);
+    if (!entry) {
+        return -1;
+    }
+    entry->events = events;
+    entry->data = data;
+    return 0;
+}
+
+int
+netpoll_del(netpoll_t *netpoll, int fd)
+{
+    struct netpoll_entry_s *entry;
+
+    assert(netpoll);
+    entry = netpoll_find(netpoll, fd);
+    if (!entry) {
+        return -1;
+    }
+    *entry = netpoll->entries[--netpoll->num_entries];
+    return 0;
+}
+
+/* select() is level-triggered; NETPOLL_ET callers drain until EAGAIN anyway */
+int
+netpoll_wait(netpoll_t *netpoll, netpoll_event_t *events, int max_events, int timeout_ms)
+{
+    fd_set rfds, wfds;
+    struct timeval tv, *tvp = NULL;
+    int nfds = netpoll->wakeup_fd + 1;
+    int count = 0;
+    int ret;
+
+    assert(netpoll);
+    assert(events);
+
+    FD_ZERO(&rfds);
+    FD_ZERO(&wfds);
+    FD_SET(netpoll->wakeup_fd, &rfds);
+    for (int i = 0; i < netpoll->num_entries; i++) {
+        struct netpoll_entry_s *entry = &netpoll->entries[i];
+        if (entry->events & NETPOLL_IN) FD_SET(entry->fd, &rfds);
+        if (entry->events & NETPOLL_OUT) FD_SET(entry->fd, &wfds);
+        if (nfds <= entry->fd) {
+            nfds = entry->fd + 1;
+        }
+    }
+    if (timeout_ms >= 0) {
+        tv.tv_sec = timeout_ms / 1000;
+        tv.tv_usec = (timeout_ms % 1000) * 1000;
+        tvp = &tv;
+    }
+
+    ret = select(nfds, &rfds, &wfds, NULL, tvp);
+    if (ret == -1) {
+        return (SOCKET_GET_ERROR() == SOCKET_ERRORNAME(EINTR)) ? 0 : -1;
+    }
+    if (FD_ISSET(netpoll->wakeup_fd, &rfds)) {
+        char buf[64];
+        while (recv(netpoll->wakeup_fd, buf, sizeof(buf), 0) > 0);
+    }
+    for (int i = 0; i < netpoll->num_entries && count < max_events; i++) {
+        struct netpoll_entry_s *entry = &netpoll->entries[i];
+        int ev = 0;
+        if (FD_ISSET(entry->fd, &rfds)) ev |= NETPOLL_IN;
+        if (FD_ISSET(entry->fd, &wfds)) ev |= NETPOLL_OUT;
+        if (ev) {
+            events[count].data = entry->data;
+            events[count].events = ev;
+            count++;
+        }
+    }
+    return count;
+}
+
+void
+netpoll_wakeup(netpoll_t *netpoll)
+{
+    char c = 0;
+
+    assert(netpoll);
+    send(netpoll->wakeup_fd, &c, 1, 0);
+}
+
+#endif
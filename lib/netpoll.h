@@ -0,0 +1,51 @@
+/**
+ *  Copyright (C) 2026 UxPlay contributors
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ */
+
+/* Minimal readiness notification layer used by httpd:
+ * epoll on Linux, kqueue on macOS/BSD, select() elsewhere (Windows).
+ * Each registered fd carries a user pointer that is handed back
+ * unchanged with its events, so dispatch does not need to search. */
+
+#ifndef NETPOLL_H
+#define NETPOLL_H
+
+#define NETPOLL_IN   0x01
+#define NETPOLL_OUT  0x02
+#define NETPOLL_ERR  0x04    /* error or hangup; reported, never requested */
+#define NETPOLL_ET   0x08    /* edge-triggered: caller reads until EAGAIN */
+
+typedef struct netpoll_s netpoll_t;
+
+typedef struct netpoll_event_s {
+    void *data;
+    int events;
+} netpoll_event_t;
+
+netpoll_t *netpoll_init(int max_fds);
+void netpoll_destroy(netpoll_t *netpoll);
+
+int netpoll_add(netpoll_t *netpoll, int fd, int events, void *data);
+int netpoll_mod(netpoll_t *netpoll, int fd, int events, void *data);
+int netpoll_del(netpoll_t *netpoll, int fd);
+
+/* Returns the number of events stored (0 on timeout or wakeup), -1 on error.
+ * timeout_ms < 0 waits forever. */
+int netpoll_wait(netpoll_t *netpoll, netpoll_event_t *events, int max_events, int timeout_ms);
+
+/* Interrupt a netpoll_wait() in progress in another thread */
+void netpoll_wakeup(netpoll_t *netpoll);
+
+int netpoll_set_nonblocking(int fd);
+
+#endif
@@ -84,8 +84,8 @@ netutils_get_address(void *sockaddr, int *length)
     return NULL;
 }
 
-int
-netutils_init_socket(unsigned short *port, int use_ipv6, int use_udp)
+static int
+netutils_bind_socket(unsigned short *port, int use_ipv6, int use_udp, int loopback)
 {
     int family = use_ipv6 ? AF_INET6 : AF_INET;
     int type = use_udp ? SOCK_DGRAM : SOCK_STREAM;
@@ -119,7 +119,7 @@ netutils_init_socket(unsigned short *port, int use_ipv6, int use_udp)
 
         /* Initialize sockaddr for bind */
         sin6ptr->sin6_family = family;
-        sin6ptr->sin6_addr = in6addr_any;
+        sin6ptr->sin6_addr = loopback ? in6addr_loopback : in6addr_any;
         sin6ptr->sin6_port = htons(*port);
 
 #ifndef _WIN32
@@ -145,7 +145,7 @@ netutils_init_socket(unsigned short *port, int use_ipv6, int use_udp)
 
         /* Initialize sockaddr for bind */
         sinptr->sin_family = family;
-        sinptr->sin_addr.s_addr = INADDR_ANY;
+        sinptr->sin_addr.s_addr = loopback ? htonl(INADDR_LOOPBACK) : INADDR_ANY;
         sinptr->sin_port = htons(*port);
 
         socklen = sizeof(*sinptr);
@@ -171,6 +171,18 @@ netutils_init_socket(unsigned short *port, int use_ipv6, int use_udp)
     return -1;
 }
 
+int
+netutils_init_socket(unsigned short *port, int use_ipv6, int use_udp)
+{
+    return netutils_bind_socket(port, use_ipv6, use_udp, 0);
+}
+
+int
+netutils_init_loopback_socket(unsigned short *port, int use_ipv6, int use_udp)
+{
+    return netutils_bind_socket(port, use_ipv6, use_udp, 1);
+}
+
 // Src is the ip address
 int
 netutils_parse_address(int family, const char *src, void *dst, int dstlen)
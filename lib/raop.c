@@ -19,11 +19,14 @@
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
+#include <stdatomic.h>
 
 #include "raop.h"
 #include "raop_rtp.h"
 #include "pairing.h"
 #include "httpd.h"
+#include "histogram.h"
+#include "metrics.h"
 
 #include "global.h"
 #include "fairplay.h"
@@ -33,6 +36,22 @@
 #include "raop_rtp_mirror.h"
 #include "raop_ntp.h"
 
+/* Threads running RTSP handlers, so that slow (crypto) requests from one
+ * client do not hold up the others */
+#define RAOP_RTSP_WORKERS 2
+
+/* Refcounted, ready-to-send response body shared by concurrent responses */
+typedef struct raop_cached_body_s {
+    atomic_int refcount;
+    int len;
+    /* dnssd data the body was built from, to detect re-registration */
+    int txt_len;
+    int name_len;
+    char *txt;
+    char *name;
+    char data[];
+} raop_cached_body_t;
+
 struct raop_s {
     /* Callbacks for audio and video */
     raop_callbacks_t callbacks;
@@ -65,6 +84,13 @@ struct raop_s {
 
     int audio_delay_micros;
     int max_ntp_timeouts;
+
+    /* Replies that only change with the configuration above, built once
+     * and sent as is; see raop_handler_info() and raop_handler_record() */
+    mutex_handle_t cache_mutex;
+    raop_cached_body_t *info_body;
+    char record_headers[96];
+    int record_headers_len;
 };
 
 struct raop_conn_s {
@@ -150,9 +176,36 @@ conn_init(void *opaque, unsigned char *local, int locallen, unsigned char *remot
         raop->callbacks.conn_init(raop->callbacks.cls);
     }
 
+    metrics_add_gauge(METRICS_RTSP_CONNECTIONS, 1);
     return conn;
 }
 
+/* logger_formatter_t for binary plist bodies */
+static char *
+raop_format_plist(const void *data, int datalen) {
+    plist_t root_node = NULL;
+    char *plist_xml = NULL;
+    uint32_t plist_len;
+
+    plist_from_bin((const char *) data, datalen, &root_node);
+    if (root_node) {
+        plist_to_xml(root_node, &plist_xml, &plist_len);
+        plist_free(root_node);
+    }
+    return plist_xml;
+}
+
+/* Choose how to dump an RTSP body from its Content-Type */
+static logger_formatter_t
+raop_body_formatter(const char *header_str) {
+    if (strstr(header_str, "apple-binary-plist")) {
+        return raop_format_plist;
+    } else if (strstr(header_str, "text/parameters")) {
+        return utils_format_text;
+    }
+    return utils_format_hex;
+}
+
 static void
 conn_request(void *ptr, http_request_t *request, http_response_t **response) {
     raop_conn_t *conn = ptr;
@@ -166,41 +219,23 @@ conn_request(void *ptr, http_request_t *request, http_response_t **response) {
 
     method = http_request_get_method(request);
     url = http_request_get_url(request);
-    cseq = http_request_get_header(request, "CSeq");
+    cseq = http_request_get_known_header(request, HTTP_HEADER_CSEQ);
     if (!method || !cseq) {
         return;
     }
-    logger_log(conn->raop->logger, LOGGER_DEBUG, "\n%s %s RTSP/1.0", method, url);
-    char *header_str= NULL; 
-    http_request_get_header_string(request, &header_str);
-    if (header_str) {
-        logger_log(conn->raop->logger, LOGGER_DEBUG, "%s", header_str);
-        bool data_is_plist = (strstr(header_str,"apple-binary-plist") != NULL);
-        bool data_is_text = (strstr(header_str,"text/parameters") != NULL);
-        free(header_str);
-        int request_datalen;
-        const char *request_data = http_request_get_data(request, &request_datalen);
-        if (request_data) {
-            if (request_datalen > 0) {
-	        if (data_is_plist) {
-		    plist_t req_root_node = NULL;
-		    plist_from_bin(request_data, request_datalen, &req_root_node);
-                    char * plist_xml;
-                    uint32_t plist_len;
-                    plist_to_xml(req_root_node, &plist_xml, &plist_len);
-                    logger_log(conn->raop->logger, LOGGER_DEBUG, "%s", plist_xml);
-                    free(plist_xml);
-                    plist_free(req_root_node);
-                } else if (data_is_text) {
-                    char *data_str = utils_data_to_text((char *) request_data, request_datalen);
-                    logger_log(conn->raop->logger, LOGGER_DEBUG, "%s", data_str);                    
-                    free(data_str);
-                } else {
-                    char *data_str =  utils_data_to_string((unsigned char *) request_data, request_datalen, 16);
-                    logger_log(conn->raop->logger, LOGGER_DEBUG, "%s", data_str);
-                    free(data_str);
-                }
+    if (logger_enabled(conn->raop->logger, LOGGER_DEBUG)) {
+        logger_log(conn->raop->logger, LOGGER_DEBUG, "\n%s %s RTSP/1.0", method, url);
+        char *header_str = NULL;
+        http_request_get_header_string(request, &header_str);
+        if (header_str) {
+            logger_log(conn->raop->logger, LOGGER_DEBUG, "%s", header_str);
+            int request_datalen;
+            const char *request_data = http_request_get_data(request, &request_datalen);
+            if (request_data && request_datalen > 0) {
+                logger_log_lazy(conn->raop->logger, LOGGER_DEBUG, NULL, raop_body_formatter(header_str),
+                                request_data, request_datalen);
             }
+            free(header_str);
         }
     }
 
@@ -242,7 +277,7 @@ conn_request(void *ptr, http_request_t *request, http_response_t **response) {
         const char *rtpinfo;
         int next_seq = -1;
 
-        rtpinfo = http_request_get_header(request, "RTP-Info");
+        rtpinfo = http_request_get_known_header(request, HTTP_HEADER_RTP_INFO);
         if (rtpinfo) {
             logger_log(conn->raop->logger, LOGGER_DEBUG, "Flush with RTP-Info: %s", rtpinfo);
             if (!strncmp(rtpinfo, "seq=", 4)) {
@@ -262,11 +297,6 @@ conn_request(void *ptr, http_request_t *request, http_response_t **response) {
         data = http_request_get_data(request, &data_len);
         plist_t req_root_node = NULL;
         plist_from_bin(data, data_len, &req_root_node);
-        char * plist_xml;
-        uint32_t plist_len;
-        plist_to_xml(req_root_node, &plist_xml, &plist_len);
-        logger_log(conn->raop->logger, LOGGER_DEBUG, "%s", plist_xml);
-        free(plist_xml);
         plist_t req_streams_node = plist_dict_get_item(req_root_node, "streams");
         /* Process stream teardown requests */
         if (PLIST_IS_ARRAY(req_streams_node)) {
@@ -318,45 +348,29 @@ conn_request(void *ptr, http_request_t *request, http_response_t **response) {
     }
 
     
-    http_response_finish(*response, response_data, response_datalen);
-
-    int len;
-    const char *data = http_response_get_data(*response, &len);
+    /* The response takes ownership of response_data and sends it without a copy */
     if (response_data && response_datalen > 0) {
-        len -= response_datalen;
+        http_response_set_body(*response, response_data, response_datalen, free, response_data);
     } else {
-        len -= 2;
-    }
-    header_str =  utils_data_to_text(data, len);
-    logger_log(conn->raop->logger, LOGGER_DEBUG, "\n%s", header_str);
-    bool data_is_plist = (strstr(header_str,"apple-binary-plist") != NULL);
-    bool data_is_text = (strstr(header_str,"text/parameters") != NULL);
-    free(header_str);
-    if (response_data) {
-        if (response_datalen > 0) {
-            if (data_is_plist) {
-                plist_t res_root_node = NULL;
-                plist_from_bin(response_data, response_datalen, &res_root_node);
-                char * plist_xml;
-                uint32_t plist_len;
-                plist_to_xml(res_root_node, &plist_xml, &plist_len);
-                plist_free(res_root_node);
-                logger_log(conn->raop->logger, LOGGER_DEBUG, "%s", plist_xml);
-                free(plist_xml);
-            } else if (data_is_text) {
-                char *data_str = utils_data_to_text((char*) response_data, response_datalen);
-                logger_log(conn->raop->logger, LOGGER_DEBUG, "%s", data_str);                    
-                free(data_str);
-            } else {
-                char *data_str = utils_data_to_string((unsigned char *) response_data, response_datalen, 16);
-                logger_log(conn->raop->logger, LOGGER_DEBUG, "%s", data_str);
-                free(data_str);
-            }
-        }
         free(response_data);
         response_data = NULL;
         response_datalen = 0;
     }
+    http_response_finish(*response, NULL, 0);
+
+    if (logger_enabled(conn->raop->logger, LOGGER_DEBUG)) {
+        int len;
+        const char *data = http_response_get_headers(*response, &len);
+        char *header_str = utils_data_to_text(data, len - 2);
+        logger_log(conn->raop->logger, LOGGER_DEBUG, "\n%s", header_str);
+        /* the body may come from a handler or from the reply cache */
+        response_data = (char *) http_response_get_body(*response, &response_datalen);
+        if (response_data && response_datalen > 0) {
+            logger_log_lazy(conn->raop->logger, LOGGER_DEBUG, NULL, raop_body_formatter(header_str),
+                            response_data, response_datalen);
+        }
+        free(header_str);
+    }
 }
 
 static void
@@ -364,6 +378,7 @@ conn_destroy(void *ptr) {
     raop_conn_t *conn = ptr;
 
     logger_log(conn->raop->logger, LOGGER_DEBUG, "Destroying connection");
+    metrics_add_gauge(METRICS_RTSP_CONNECTIONS, -1);
 
     if (conn->raop->callbacks.conn_destroy) {
         conn->raop->callbacks.conn_destroy(conn->raop->callbacks.cls);
@@ -436,7 +451,7 @@ raop_init(int max_clients, raop_callbacks_t *callbacks) {
     httpd_cbs.conn_destroy = &conn_destroy;
 
     /* Initialize the http daemon */
-    httpd = httpd_init(raop->logger, &httpd_cbs, max_clients);
+    httpd = httpd_init(raop->logger, &httpd_cbs, max_clients, RAOP_RTSP_WORKERS, 1);
     if (!httpd) {
         pairing_destroy(pairing);
         free(raop);
@@ -467,6 +482,9 @@ raop_init(int max_clients, raop_callbacks_t *callbacks) {
     raop->max_ntp_timeouts = 0;
     raop->audio_delay_micros = 250000;
 
+    MUTEX_CREATE(raop->cache_mutex);
+    raop_update_record_headers(raop);
+
     return raop;
 }
 
@@ -476,6 +494,8 @@ raop_destroy(raop_t *raop) {
         raop_stop(raop);
         pairing_destroy(raop->pairing);
         httpd_destroy(raop->httpd);
+        raop_invalidate_cache(raop);
+        MUTEX_DESTROY(raop->cache_mutex);
         logger_destroy(raop->logger);
         free(raop);
 
@@ -529,9 +549,14 @@ int raop_set_plist(raop_t *raop, const char *plist_item, const int value) {
             raop->audio_delay_micros = value;
         }
         if (raop->audio_delay_micros != value) retval = 1;
+        raop_update_record_headers(raop);
     }  else {
         retval = -1;
     }	  
+    if (retval != -1) {
+        /* the /info plist advertises the display parameters */
+        raop_invalidate_cache(raop);
+    }
     return retval;
 }
 
@@ -562,6 +587,22 @@ raop_get_port(raop_t *raop) {
     return raop->port;
 }
 
+void
+raop_get_rtsp_latency(raop_t *raop, raop_latency_t *latency) {
+    histogram_summary_t summary;
+
+    assert(raop);
+    assert(latency);
+
+    httpd_get_response_latency(raop->httpd, &summary);
+    latency->count = summary.count;
+    latency->mean = summary.mean;
+    latency->p50 = summary.p50;
+    latency->p90 = summary.p90;
+    latency->p99 = summary.p99;
+    latency->max = summary.max;
+}
+
 void *
 raop_get_callback_cls(raop_t *raop) {
     assert(raop);
@@ -579,6 +620,7 @@ void
 raop_set_dnssd(raop_t *raop, dnssd_t *dnssd) {
     assert(dnssd);
     raop->dnssd = dnssd;
+    raop_invalidate_cache(raop);
 }
 
 
@@ -48,6 +48,21 @@ typedef struct raop_s raop_t;
 
 typedef void (*raop_log_callback_t)(void *cls, int level, const char *msg);
 
+/* Latencies in microseconds, from a complete request to its written response */
+typedef struct raop_latency_s {
+    uint64_t count;
+    uint64_t mean;
+    uint64_t p50;
+    uint64_t p90;
+    uint64_t p99;
+    uint64_t max;
+} raop_latency_t;
+
+/* Threads: conn_init runs on the RTSP server thread; conn_destroy and the
+ * callbacks made while handling a request (conn_teardown, video_flush,
+ * audio_get_format) run on its worker threads, and may run at the same time
+ * for different connections; the others run on the RTP, mirror and NTP
+ * threads.  State shared between them must be synchronized. */
 struct raop_callbacks_s {
     void* cls;
 
@@ -68,6 +83,13 @@ struct raop_callbacks_s {
     void  (*audio_set_progress)(void *cls, unsigned int start, unsigned int curr, unsigned int end);
     void  (*audio_get_format)(void *cls, unsigned char *ct, unsigned short *spf, bool *usingScreen, bool *isMedia, uint64_t *audioFormat);
     void  (*video_report_size)(void *cls, float *width_source, float *height_source, float *width, float *height);
+    /* Optional: a buffer of size bytes (writable at *data) for a video frame to be decrypted into
+     * in place; NULL to use a malloc'd one.  video_process then owns data->buffer */
+    void* (*video_get_buffer)(void *cls, int size, unsigned char **data);
+    /* Optional: true while the renderer is over its latency budget; frames are then
+     * dropped here (video: until the next keyframe) instead of being queued */
+    bool  (*audio_congested)(void *cls);
+    bool  (*video_congested)(void *cls);
 };
 typedef struct raop_callbacks_s raop_callbacks_t;
 raop_ntp_t *raop_ntp_init(logger_t *logger, raop_callbacks_t *callbacks, const unsigned char *remote_addr, int remote_addr_len, unsigned short timing_rport);
@@ -81,6 +103,7 @@ RAOP_API void raop_set_udp_ports(raop_t *raop, unsigned short port[3]);
 RAOP_API void raop_set_tcp_ports(raop_t *raop, unsigned short port[2]);
 RAOP_API unsigned short raop_get_port(raop_t *raop);
 RAOP_API void *raop_get_callback_cls(raop_t *raop);
+RAOP_API void raop_get_rtsp_latency(raop_t *raop, raop_latency_t *latency);
 RAOP_API int raop_start(raop_t *raop, unsigned short *port);
 RAOP_API int raop_is_running(raop_t *raop);
 RAOP_API void raop_stop(raop_t *raop);
@@ -32,6 +32,7 @@
 #include "global.h"
 #include "utils.h"
 #include "byteutils.h"
+#include "metrics.h"
 
 #define RAOP_BUFFER_LENGTH 32
 
@@ -44,6 +45,9 @@ typedef struct {
     uint64_t rtp_timestamp;
     uint64_t ntp_timestamp;
 
+    /* Monotonic time the payload was decrypted */
+    uint64_t decrypted_ns;
+
     /* Payload data */
     unsigned int payload_size;
     void *payload_data;
@@ -209,6 +213,13 @@ raop_buffer_decrypt(raop_buffer_t *raop_buffer, unsigned char *data, unsigned ch
     return 1;
 }
 
+static void
+raop_buffer_publish_fill(raop_buffer_t *raop_buffer)
+{
+    int fill = raop_buffer->is_empty ? 0 : seqnum_cmp(raop_buffer->last_seqnum, raop_buffer->first_seqnum) + 1;
+    metrics_set_gauge(METRICS_AUDIO_BUFFER_FILL, fill > 0 ? fill : 0);
+}
+
 int
 raop_buffer_enqueue(raop_buffer_t *raop_buffer, unsigned char *data, unsigned short datalen, uint64_t *ntp_timestamp, uint64_t *rtp_timestamp, int use_seqnum) {
     unsigned char empty_packet_marker[] = { 0x00, 0x68, 0x34, 0x00 };
@@ -234,11 +245,13 @@ raop_buffer_enqueue(raop_buffer_t *raop_buffer, unsigned char *data, unsigned sh
 
     /* If this packet is too late, just skip it */
     if (!raop_buffer->is_empty && seqnum_cmp(seqnum, raop_buffer->first_seqnum) < 0) {
+        metrics_count(METRICS_AUDIO_LATE, 1);
         return 0;
     }
 
     /* Check that there is always space in the buffer, otherwise flush */
     if (seqnum_cmp(seqnum, raop_buffer->first_seqnum + RAOP_BUFFER_LENGTH) >= 0) {
+        metrics_count(METRICS_AUDIO_OUT_OF_WINDOW, 1);
         raop_buffer_flush(raop_buffer, seqnum);
     }
 
@@ -246,6 +259,7 @@ raop_buffer_enqueue(raop_buffer_t *raop_buffer, unsigned char *data, unsigned sh
     raop_buffer_entry_t *entry = &raop_buffer->entries[seqnum % RAOP_BUFFER_LENGTH];
     if (entry->filled && seqnum_cmp(entry->seqnum, seqnum) == 0) {
         /* Packet resend, we can safely ignore */
+        metrics_count(METRICS_AUDIO_DUPLICATE, 1);
         return 0;
     }
 
@@ -259,6 +273,7 @@ raop_buffer_enqueue(raop_buffer_t *raop_buffer, unsigned char *data, unsigned sh
     int decrypt_ret = raop_buffer_decrypt(raop_buffer, data, entry->payload_data, payload_size, &entry->payload_size);
     assert(decrypt_ret >= 0);
     assert(entry->payload_size <= payload_size);
+    entry->decrypted_ns = utils_monotonic_ns();
 
     /* Update the raop_buffer seqnums */
     if (raop_buffer->is_empty) {
@@ -269,11 +284,13 @@ raop_buffer_enqueue(raop_buffer_t *raop_buffer, unsigned char *data, unsigned sh
     if (seqnum_cmp(seqnum, raop_buffer->last_seqnum) > 0) {
         raop_buffer->last_seqnum = seqnum;
     }
+    raop_buffer_publish_fill(raop_buffer);
     return 1;
 }
 
 void *
-raop_buffer_dequeue(raop_buffer_t *raop_buffer, unsigned int *length, uint64_t *ntp_timestamp, uint64_t *rtp_timestamp, unsigned short *seqnum, int no_resend) {
+raop_buffer_dequeue(raop_buffer_t *raop_buffer, unsigned int *length, uint64_t *ntp_timestamp, uint64_t *rtp_timestamp, unsigned short *seqnum,
+                    uint64_t *decrypted_ns, int no_resend) {
     assert(raop_buffer);
 
     /* Calculate number of entries in the current buffer */
@@ -299,6 +316,7 @@ raop_buffer_dequeue(raop_buffer_t *raop_buffer, unsigned int *length, uint64_t *
 
     /* Update buffer and validate entry */
     raop_buffer->first_seqnum += 1;
+    raop_buffer_publish_fill(raop_buffer);
     if (!entry->filled) {
         return NULL;
     }
@@ -308,6 +326,7 @@ raop_buffer_dequeue(raop_buffer_t *raop_buffer, unsigned int *length, uint64_t *
     *rtp_timestamp = entry->rtp_timestamp;
     *ntp_timestamp = entry->ntp_timestamp;
     *seqnum = entry->seqnum;
+    *decrypted_ns = entry->decrypted_ns;
     *length = entry->payload_size;
     entry->payload_size = 0;
     void* data = entry->payload_data;
@@ -354,4 +373,5 @@ void raop_buffer_flush(raop_buffer_t *raop_buffer, int next_seq) {
         raop_buffer->first_seqnum = next_seq;
         raop_buffer->last_seqnum = next_seq - 1;
     }
+    raop_buffer_publish_fill(raop_buffer);
 }
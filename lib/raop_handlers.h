@@ -30,20 +30,47 @@ typedef void (*raop_handler_t)(raop_conn_t *, http_request_t *,
                                http_response_t *, char **, int *);
 
 static void
-raop_handler_info(raop_conn_t *conn,
-                  http_request_t *request, http_response_t *response,
-                  char **response_data, int *response_datalen)
+raop_cached_body_release(void *opaque)
 {
-    assert(conn->raop->dnssd);
+    raop_cached_body_t *body = opaque;
 
-    int airplay_txt_len = 0;
-    const char *airplay_txt = dnssd_get_airplay_txt(conn->raop->dnssd, &airplay_txt_len);
+    if (body && atomic_fetch_sub(&body->refcount, 1) == 1) {
+        free(body->txt);
+        free(body->name);
+        free(body);
+    }
+}
 
-    int name_len = 0;
-    const char *name = dnssd_get_name(conn->raop->dnssd, &name_len);
+static void
+raop_invalidate_cache(raop_t *raop)
+{
+    MUTEX_LOCK(raop->cache_mutex);
+    raop_cached_body_release(raop->info_body);
+    raop->info_body = NULL;
+    MUTEX_UNLOCK(raop->cache_mutex);
+}
+
+static void
+raop_update_record_headers(raop_t *raop)
+{
+    unsigned int ad = (unsigned int) (((uint64_t) raop->audio_delay_micros) * AUDIO_SAMPLE_RATE / SECOND_IN_USECS);
+
+    MUTEX_LOCK(raop->cache_mutex);
+    raop->record_headers_len = snprintf(raop->record_headers, sizeof(raop->record_headers),
+                                        "Audio-Latency: %u\r\nAudio-Jack-Status: connected; type=analog\r\n", ad);
+    MUTEX_UNLOCK(raop->cache_mutex);
+}
+
+/* Serialize the GET /info reply; called with cache_mutex held */
+static raop_cached_body_t *
+raop_build_info(raop_t *raop, const char *airplay_txt, int airplay_txt_len, const char *name, int name_len)
+{
+    raop_cached_body_t *body;
+    char *plist_bin = NULL;
+    uint32_t plist_len = 0;
 
     int hw_addr_raw_len = 0;
-    const char *hw_addr_raw = dnssd_get_hw_addr(conn->raop->dnssd, &hw_addr_raw_len);
+    const char *hw_addr_raw = dnssd_get_hw_addr(raop->dnssd, &hw_addr_raw_len);
 
     char *hw_addr = calloc(1, 3 * hw_addr_raw_len);
     //int hw_addr_len =
@@ -143,14 +170,14 @@ raop_handler_info(raop_conn_t *conn,
     plist_t displays_0_uuid_node = plist_new_string("e0ff8a27-6738-3d56-8a16-cc53aacee925");
     plist_t displays_0_width_physical_node = plist_new_bool(0);
     plist_t displays_0_height_physical_node = plist_new_bool(0);
-    plist_t displays_0_width_node = plist_new_uint(conn->raop->width);
-    plist_t displays_0_height_node = plist_new_uint(conn->raop->height);
-    plist_t displays_0_width_pixels_node = plist_new_uint(conn->raop->width);
-    plist_t displays_0_height_pixels_node = plist_new_uint(conn->raop->height);
+    plist_t displays_0_width_node = plist_new_uint(raop->width);
+    plist_t displays_0_height_node = plist_new_uint(raop->height);
+    plist_t displays_0_width_pixels_node = plist_new_uint(raop->width);
+    plist_t displays_0_height_pixels_node = plist_new_uint(raop->height);
     plist_t displays_0_rotation_node = plist_new_bool(0);
-    plist_t displays_0_refresh_rate_node = plist_new_uint(conn->raop->refreshRate);
-    plist_t displays_0_max_fps_node = plist_new_uint(conn->raop->maxFPS);
-    plist_t displays_0_overscanned_node = plist_new_bool(conn->raop->overscanned);
+    plist_t displays_0_refresh_rate_node = plist_new_uint(raop->refreshRate);
+    plist_t displays_0_max_fps_node = plist_new_uint(raop->maxFPS);
+    plist_t displays_0_overscanned_node = plist_new_bool(raop->overscanned);
     plist_t displays_0_features = plist_new_uint(14);
 
     plist_dict_set_item(displays_0_node, "uuid", displays_0_uuid_node);
@@ -168,11 +195,61 @@ raop_handler_info(raop_conn_t *conn,
     plist_array_append_item(displays_node, displays_0_node);
     plist_dict_set_item(r_node, "displays", displays_node);
 
-    plist_to_bin(r_node, response_data, (uint32_t *) response_datalen);
+    plist_to_bin(r_node, &plist_bin, &plist_len);
     plist_free(r_node);
-    http_response_add_header(response, "Content-Type", "application/x-apple-binary-plist");
     free(pk);
     free(hw_addr);
+
+    body = malloc(sizeof(raop_cached_body_t) + plist_len);
+    assert(body);
+    atomic_init(&body->refcount, 1);
+    body->len = (int) plist_len;
+    memcpy(body->data, plist_bin, plist_len);
+    free(plist_bin);
+
+    body->txt_len = airplay_txt_len;
+    body->txt = malloc(airplay_txt_len + 1);
+    assert(body->txt);
+    memcpy(body->txt, airplay_txt, airplay_txt_len);
+    body->name_len = name_len;
+    body->name = malloc(name_len + 1);
+    assert(body->name);
+    memcpy(body->name, name, name_len);
+    return body;
+}
+
+static void
+raop_handler_info(raop_conn_t *conn,
+                  http_request_t *request, http_response_t *response,
+                  char **response_data, int *response_datalen)
+{
+    raop_t *raop = conn->raop;
+    raop_cached_body_t *body;
+
+    assert(raop->dnssd);
+
+    int airplay_txt_len = 0;
+    const char *airplay_txt = dnssd_get_airplay_txt(raop->dnssd, &airplay_txt_len);
+
+    int name_len = 0;
+    const char *name = dnssd_get_name(raop->dnssd, &name_len);
+
+    /* Reuse the serialized reply unless dnssd was re-registered since */
+    MUTEX_LOCK(raop->cache_mutex);
+    body = raop->info_body;
+    if (body && (body->txt_len != airplay_txt_len || memcmp(body->txt, airplay_txt, airplay_txt_len) ||
+                 body->name_len != name_len || memcmp(body->name, name, name_len))) {
+        raop_cached_body_release(body);
+        body = raop->info_body = NULL;
+    }
+    if (!body) {
+        body = raop->info_body = raop_build_info(raop, airplay_txt, airplay_txt_len, name, name_len);
+    }
+    atomic_fetch_add(&body->refcount, 1);
+    MUTEX_UNLOCK(raop->cache_mutex);
+
+    http_response_add_header(response, "Content-Type", "application/x-apple-binary-plist");
+    http_response_set_body(response, body->data, body->len, raop_cached_body_release, body);
 }
 
 static void
@@ -301,12 +378,15 @@ raop_handler_fpsetup(raop_conn_t *conn,
     }
 }
 
+static const char raop_options_headers[] =
+    "Public: SETUP, RECORD, PAUSE, FLUSH, TEARDOWN, OPTIONS, GET_PARAMETER, SET_PARAMETER\r\n";
+
 static void
 raop_handler_options(raop_conn_t *conn,
                      http_request_t *request, http_response_t *response,
                      char **response_data, int *response_datalen)
 {
-    http_response_add_header(response, "Public", "SETUP, RECORD, PAUSE, FLUSH, TEARDOWN, OPTIONS, GET_PARAMETER, SET_PARAMETER");
+    http_response_add_header_block(response, raop_options_headers, sizeof(raop_options_headers) - 1);
 }
 
 static void
@@ -324,8 +404,8 @@ raop_handler_setup(raop_conn_t *conn,
 
     data = http_request_get_data(request, &data_len);
 
-    dacp_id = http_request_get_header(request, "DACP-ID");
-    active_remote_header = http_request_get_header(request, "Active-Remote");
+    dacp_id = http_request_get_known_header(request, HTTP_HEADER_DACP_ID);
+    active_remote_header = http_request_get_known_header(request, HTTP_HEADER_ACTIVE_REMOTE);
 
     if (dacp_id && active_remote_header) {
         logger_log(conn->raop->logger, LOGGER_DEBUG, "DACP-ID: %s", dacp_id);
@@ -335,7 +415,7 @@ raop_handler_setup(raop_conn_t *conn,
         }
     }
 
-    transport = http_request_get_header(request, "Transport");
+    transport = http_request_get_known_header(request, HTTP_HEADER_TRANSPORT);
     if (transport) {
         logger_log(conn->raop->logger, LOGGER_DEBUG, "Transport: %s", transport);
         use_udp = strncmp(transport, "RTP/AVP/TCP", 11);
@@ -396,7 +476,7 @@ raop_handler_setup(raop_conn_t *conn,
         logger_log(conn->raop->logger, LOGGER_DEBUG, "32 byte shared ecdh_secret:\n%s", str);
         free(str);
 
-        const char *user_agent = http_request_get_header(request, "User-Agent");
+        const char *user_agent = http_request_get_known_header(request, HTTP_HEADER_USER_AGENT);
         logger_log(conn->raop->logger, LOGGER_INFO, "Client identified as User-Agent: %s", user_agent);	
 
         bool old_protocol = false;
@@ -595,7 +675,7 @@ raop_handler_get_parameter(raop_conn_t *conn,
     const char *data;
     int datalen;
 
-    content_type = http_request_get_header(request, "Content-Type");
+    content_type = http_request_get_known_header(request, HTTP_HEADER_CONTENT_TYPE);
     data = http_request_get_data(request, &datalen);
     if (!strcmp(content_type, "text/parameters")) {
         const char *current = data;
@@ -641,7 +721,7 @@ raop_handler_set_parameter(raop_conn_t *conn,
     const char *data;
     int datalen;
 
-    content_type = http_request_get_header(request, "Content-Type");
+    content_type = http_request_get_known_header(request, HTTP_HEADER_CONTENT_TYPE);
     data = http_request_get_data(request, &datalen);
     if (!strcmp(content_type, "text/parameters")) {
         char *datastr;
@@ -692,10 +772,9 @@ raop_handler_record(raop_conn_t *conn,
                     http_request_t *request, http_response_t *response,
                     char **response_data, int *response_datalen)
 {
-    char audio_latency[12];
-    unsigned int ad = (unsigned int) (((uint64_t) conn->raop->audio_delay_micros) * AUDIO_SAMPLE_RATE / SECOND_IN_USECS);
-    sprintf(audio_latency, "%u", ad);
     logger_log(conn->raop->logger, LOGGER_DEBUG, "raop_handler_record");
-    http_response_add_header(response, "Audio-Latency", audio_latency);
-    http_response_add_header(response, "Audio-Jack-Status", "connected; type=analog");
+    /* Audio-Latency and Audio-Jack-Status, preformatted by raop_set_plist() */
+    MUTEX_LOCK(conn->raop->cache_mutex);
+    http_response_add_header_block(response, conn->raop->record_headers, conn->raop->record_headers_len);
+    MUTEX_UNLOCK(conn->raop->cache_mutex);
 }
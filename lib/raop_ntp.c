@@ -35,6 +35,8 @@
 #include "netutils.h"
 #include "byteutils.h"
 #include "utils.h"
+#include "trace.h"
+#include "metrics.h"
 
 #define SECOND_IN_NSECS 1000000000UL
 #define RAOP_NTP_DATA_COUNT   8
@@ -271,7 +273,8 @@ raop_ntp_thread(void *arg)
     const unsigned  two_pow_n[RAOP_NTP_DATA_COUNT] = {2, 4, 8, 16, 32, 64, 128, 256};
     int timeout_counter = 0;
     bool conn_reset = false;
-      
+
+    TRACE_THREAD_NAME("raop_ntp");
     while (1) {
         MUTEX_LOCK(raop_ntp->run_mutex);
         if (!raop_ntp->running) {
@@ -284,26 +287,32 @@ raop_ntp_thread(void *arg)
         raop_ntp_flush_socket(raop_ntp->tsock);
 
         // Send request
+        TRACE_BEGIN("ntp exchange");
         uint64_t send_time = raop_ntp_get_local_time(raop_ntp);
         byteutils_put_ntp_timestamp(request, 24, send_time);
         int send_len = sendto(raop_ntp->tsock, (char *)request, sizeof(request), 0,
                               (struct sockaddr *) &raop_ntp->remote_saddr, raop_ntp->remote_saddr_len);
         if (send_len < 0) {
+            TRACE_END("ntp exchange");
             logger_log(raop_ntp->logger, LOGGER_ERR, "raop_ntp error sending request");
             continue;
         }
-        char *str = utils_data_to_string(request, send_len, 16);
-        logger_log(raop_ntp->logger, LOGGER_DEBUG, "\nraop_ntp send time type_t=%d send_len = %d, now = %8.6f\n%s",
-                   request[1] &~0x80, send_len, (double) send_time / SECOND_IN_NSECS, str);
-        free(str);
+        if (logger_enabled(raop_ntp->logger, LOGGER_DEBUG)) {
+            char *str = utils_data_to_string(request, send_len, 16);
+            logger_log(raop_ntp->logger, LOGGER_DEBUG, "\nraop_ntp send time type_t=%d send_len = %d, now = %8.6f\n%s",
+                       request[1] &~0x80, send_len, (double) send_time / SECOND_IN_NSECS, str);
+            free(str);
+        }
         if (send_len < 0) {
             logger_log(raop_ntp->logger, LOGGER_ERR, "raop_ntp error sending request");
         } else {
             // Read response
             response_len = recvfrom(raop_ntp->tsock, (char *)response, sizeof(response), 0,
                                     (struct sockaddr *) &raop_ntp->remote_saddr, &raop_ntp->remote_saddr_len);
+            TRACE_END("ntp exchange");
             if (response_len < 0) {
                 timeout_counter++;
+                metrics_count(METRICS_NTP_TIMEOUTS, 1);
                 char time[30];
                 int level = (timeout_counter == 1 ? LOGGER_DEBUG : LOGGER_ERR);
                 ntp_timestamp_to_time(send_time, time, sizeof(time));
@@ -327,10 +336,12 @@ raop_ntp_thread(void *arg)
                 // Local time of the client when the response message leaves the client
                 int64_t t2 = (int64_t) byteutils_get_ntp_timestamp(response, 24);
 
-                char *str = utils_data_to_string(response, response_len, 16);                   
-                logger_log(raop_ntp->logger, LOGGER_DEBUG, "raop_ntp receive time type_t=%d packetlen = %d, now = %8.6f t1 = %8.6f, t2 = %8.6f\n%s",
-                           response[1] &~0x80, response_len, (double) t3 / SECOND_IN_NSECS, (double) t1 / SECOND_IN_NSECS, (double) t2 / SECOND_IN_NSECS, str); 
-                free(str);
+                if (logger_enabled(raop_ntp->logger, LOGGER_DEBUG)) {
+                    char *str = utils_data_to_string(response, response_len, 16);
+                    logger_log(raop_ntp->logger, LOGGER_DEBUG, "raop_ntp receive time type_t=%d packetlen = %d, now = %8.6f t1 = %8.6f, t2 = %8.6f\n%s",
+                               response[1] &~0x80, response_len, (double) t3 / SECOND_IN_NSECS, (double) t1 / SECOND_IN_NSECS, (double) t2 / SECOND_IN_NSECS, str);
+                    free(str);
+                }
 
 		// The iOS client device sends its time in  seconds relative to an arbitrary Epoch (the last boot).
                 // For a little bonus confusion, they add SECONDS_FROM_1900_TO_1970.
@@ -363,6 +374,10 @@ raop_ntp_thread(void *arg)
                 raop_ntp->sync_dispersion = dispersion;
                 raop_ntp->sync_delay = delay;
                 MUTEX_UNLOCK(raop_ntp->sync_params_mutex);
+                /* published separately so readers never contend for sync_params_mutex */
+                metrics_set_gauge(METRICS_NTP_OFFSET, offset);
+                metrics_set_gauge(METRICS_NTP_DISPERSION, (int64_t) dispersion);
+                metrics_set_gauge(METRICS_NTP_DELAY, delay);
 
                 logger_log(raop_ntp->logger, LOGGER_DEBUG, "raop_ntp sync correction = %lld", correction);
             }
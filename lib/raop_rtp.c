@@ -32,6 +32,8 @@
 #include "mirror_buffer.h"
 #include "stream.h"
 #include "utils.h"
+#include "trace.h"
+#include "metrics.h"
 
 #define NO_FLUSH (-42)
 
@@ -229,6 +231,8 @@ raop_rtp_resend_callback(void *opaque, unsigned short seqnum, unsigned short cou
     addrlen = raop_rtp->control_saddr_len;
 
     logger_log(raop_rtp->logger, LOGGER_DEBUG, "raop_rtp got resend request %d %d", seqnum, count);
+    TRACE_INSTANT("audio resend request", count);
+    metrics_count(METRICS_RESEND_REQUESTS, count);
     ourseqnum = raop_rtp->control_seqnum++;
 
     /* Fill the request buffer */
@@ -462,7 +466,12 @@ raop_rtp_thread_udp(void *arg)
     uint64_t delay = 0;
     unsigned short seqnum1 = 0, seqnum2 = 0;
 
+    /* audio timestamps are presentation times, so network latency is measured
+     * as transit above the lowest transit seen (RFC 3550 style) */
+    int64_t min_transit = INT64_MAX;
+
     assert(raop_rtp);
+    TRACE_THREAD_NAME("raop_rtp");
     raop_rtp->ntp_start_time = raop_ntp_get_local_time(raop_rtp->ntp);
     raop_rtp->rtp_clock_started = false;
     for (int i = 0; i < RAOP_RTP_SYNC_DATA_COUNT; i++) {
@@ -529,14 +538,20 @@ raop_rtp_thread_udp(void *arg)
                         ntp_time = (uint64_t) (raop_rtp->rtp_sync_offset + (int64_t) (raop_rtp->rtp_clock_rate * rtp_time));
 		    }
                     logger_log(raop_rtp->logger, LOGGER_DEBUG, "raop_rtp resent audio packet: seqnum=%u", seqnum);
+                    TRACE_INSTANT("audio resent packet", seqnum);
                     int result = raop_buffer_enqueue(raop_rtp->buffer, resent_packet, resent_packetlen, &ntp_time, &rtp_time, 1);
                     assert(result >= 0);
+                    if (result > 0) {
+                        metrics_count(METRICS_RESEND_RECOVERED, 1);
+                    }
                 } else {
                     /* type_c = 0x56 packets  with length 8 have been reported */
-                    char *str = utils_data_to_string(packet, packetlen, 16);
-                    logger_log(raop_rtp->logger, LOGGER_DEBUG, "Received empty resent audio packet length %d, seqnum=%u:\n%s",
-                               packetlen, seqnum, str);
-                    free (str);
+                    if (logger_enabled(raop_rtp->logger, LOGGER_DEBUG)) {
+                        char *str = utils_data_to_string(packet, packetlen, 16);
+                        logger_log(raop_rtp->logger, LOGGER_DEBUG, "Received empty resent audio packet length %d, seqnum=%u:\n%s",
+                                   packetlen, seqnum, str);
+                        free (str);
+                    }
                 }
             } else if (type_c == 0x54 && packetlen >= 20) {
                 /* packet[0] = 0x90 (first sync ?) or 0x80 (subsequent ones)
@@ -558,17 +573,18 @@ raop_rtp_thread_udp(void *arg)
                 uint64_t sync_ntp_raw = byteutils_get_long_be(packet, 8);
                 uint64_t sync_ntp_remote = raop_ntp_timestamp_to_nano_seconds(sync_ntp_raw, true);
                 uint64_t sync_ntp_local = raop_ntp_convert_remote_time(raop_rtp->ntp, sync_ntp_remote);
-                char *str = utils_data_to_string(packet, packetlen, 20);
-                logger_log(raop_rtp->logger, LOGGER_DEBUG,
-                           "raop_rtp sync: client ntp=%8.6f, ntp = %8.6f, ntp_start_time %8.6f\nts_client = %8.6f sync_rtp=%u\n%s",
-                           (double) sync_ntp_remote / SEC, (double) sync_ntp_local / SEC,
-                           (double) raop_rtp->ntp_start_time / SEC, (double) sync_ntp_remote / SEC, sync_rtp, str);
-                free(str);
+                if (logger_enabled(raop_rtp->logger, LOGGER_DEBUG)) {
+                    char *str = utils_data_to_string(packet, packetlen, 20);
+                    logger_log(raop_rtp->logger, LOGGER_DEBUG,
+                               "raop_rtp sync: client ntp=%8.6f, ntp = %8.6f, ntp_start_time %8.6f\nts_client = %8.6f sync_rtp=%u\n%s",
+                               (double) sync_ntp_remote / SEC, (double) sync_ntp_local / SEC,
+                               (double) raop_rtp->ntp_start_time / SEC, (double) sync_ntp_remote / SEC, sync_rtp, str);
+                    free(str);
+                }
                 raop_rtp_sync_clock(raop_rtp, &sync_ntp_remote, &sync_rtp64);		
             } else {
-                char *str = utils_data_to_string(packet, packetlen, 16);
-                logger_log(raop_rtp->logger, LOGGER_DEBUG, "raop_rtp unknown udp control packet\n%s", str);
-                free(str);
+                logger_log_lazy(raop_rtp->logger, LOGGER_DEBUG, "raop_rtp unknown udp control packet\n",
+                                utils_format_hex, packet, packetlen);
             }
         }
 
@@ -614,14 +630,21 @@ raop_rtp_thread_udp(void *arg)
             saddrlen = sizeof(saddr);
             packetlen = recvfrom(raop_rtp->dsock, (char *)packet, sizeof(packet), 0,
                                  (struct sockaddr *)&saddr, &saddrlen);
+            uint64_t received_ns = utils_monotonic_ns();
+            if (packetlen > 0) {
+                metrics_count(METRICS_AUDIO_PACKETS, 1);
+                metrics_count(METRICS_AUDIO_BYTES, packetlen);
+            }
             // rtp payload type
             //int type_d = packet[1] & ~0x80;
             //logger_log(raop_rtp->logger, LOGGER_DEBUG, "raop_rtp_thread_udp type_d 0x%02x, packetlen = %d", type_d, packetlen);
 	    
             if (packetlen < 12)  {
-                char *str = utils_data_to_string(packet, packetlen, 16);                                                                                                                                                                          
-                logger_log(raop_rtp->logger, LOGGER_DEBUG, "Received short type_d = 0x%2x  packet with length %d:\n%s", packet[1] & ~0x80, packetlen, str);                                                                                       
-                free (str);           
+                if (logger_enabled(raop_rtp->logger, LOGGER_DEBUG)) {
+                    char *str = utils_data_to_string(packet, packetlen, 16);
+                    logger_log(raop_rtp->logger, LOGGER_DEBUG, "Received short type_d = 0x%2x  packet with length %d:\n%s", packet[1] & ~0x80, packetlen, str);
+                    free (str);
+                }
                 continue;
 	    }
 
@@ -633,6 +656,12 @@ raop_rtp_thread_udp(void *arg)
 
 	    if (have_synced) {
                 ntp_time = (uint64_t) (raop_rtp->rtp_sync_offset + (int64_t) (raop_rtp->rtp_clock_rate * rtp_time));
+                int64_t transit = ((int64_t) raop_ntp_get_local_time(raop_rtp->ntp)) -
+                    ((int64_t) raop_ntp_convert_remote_time(raop_rtp->ntp, ntp_time));
+                if (transit < min_transit) {
+                    min_transit = transit;
+                }
+                metrics_record_latency(METRICS_AUDIO, METRICS_STAGE_NETWORK, transit - min_transit);
 	    } else if (packetlen == 16 && memcmp(packet + 12, no_data_marker, 4) == 0) {
 	        /* use the special "no_data"  packet to help determine an initial offset before the first rtp sync. 
                  * until the first rtp sync occurs, we don't know the exact client ntp timestamp that matches the client rtp timestamp */
@@ -657,8 +686,13 @@ raop_rtp_thread_udp(void *arg)
 	    } else {
                 no_data_yet = false;
 	    }
+            TRACE_BEGIN("audio enqueue");
             int result = raop_buffer_enqueue(raop_rtp->buffer, packet, packetlen, &ntp_time, &rtp_time, 1);
+            TRACE_END("audio enqueue");
             assert(result >= 0);
+            if (result > 0) {
+                metrics_record_latency(METRICS_AUDIO, METRICS_STAGE_DECRYPT, (int64_t) (utils_monotonic_ns() - received_ns));
+            }
 
 	    if (raop_rtp->ct == 2 && !have_synced) {
                 /* in ALAC Audio-only  mode wait until the first sync before dequeing */
@@ -670,8 +704,17 @@ raop_rtp_thread_udp(void *arg)
                 unsigned short seqnum;
                 uint64_t rtp64_timestamp;
                 uint64_t ntp_timestamp;
-
-                while ((payload = raop_buffer_dequeue(raop_rtp->buffer, &payload_size, &ntp_timestamp, &rtp64_timestamp, &seqnum, no_resend))) {
+                uint64_t decrypted_ns;
+
+                while ((payload = raop_buffer_dequeue(raop_rtp->buffer, &payload_size, &ntp_timestamp, &rtp64_timestamp, &seqnum,
+                                                      &decrypted_ns, no_resend))) {
+                    TRACE_INSTANT("audio dequeue", seqnum);
+                    /* the renderer is over its latency budget: drop frames until it catches up */
+                    if (raop_rtp->callbacks.audio_congested && raop_rtp->callbacks.audio_congested(raop_rtp->callbacks.cls)) {
+                        metrics_count(METRICS_AUDIO_CONGESTION_DROPS, 1);
+                        free(payload);
+                        continue;
+                    }
                     audio_decode_struct audio_data; 
                     audio_data.rtp_time = rtp64_timestamp;
                     audio_data.seqnum = seqnum;
@@ -692,18 +735,25 @@ raop_rtp_thread_udp(void *arg)
                         audio_data.ntp_time_remote = raop_ntp_convert_local_time(raop_rtp->ntp, audio_data.ntp_time_local);
                         audio_data.sync_status = 0;
                     }
+                    TRACE_BEGIN("audio_process");
                     raop_rtp->callbacks.audio_process(raop_rtp->callbacks.cls, raop_rtp->ntp, &audio_data);
+                    TRACE_END("audio_process");
+                    metrics_record_latency(METRICS_AUDIO, METRICS_STAGE_APPSRC, (int64_t) (utils_monotonic_ns() - decrypted_ns));
                     free(payload);
-                    uint64_t ntp_now = raop_ntp_get_local_time(raop_rtp->ntp);
-                    int64_t latency = ((int64_t) ntp_now) - ((int64_t) audio_data.ntp_time_local); 
-                    logger_log(raop_rtp->logger, LOGGER_DEBUG, "raop_rtp audio: now = %8.6f, ntp = %8.6f, latency = %8.6f, rtp_time=%u seqnum = %u",
-                               (double) ntp_now / SEC, (double) audio_data.ntp_time_local / SEC, (double) latency / SEC, (uint32_t) rtp64_timestamp,
-                               seqnum);
+                    if (logger_enabled(raop_rtp->logger, LOGGER_DEBUG)) {
+                        uint64_t ntp_now = raop_ntp_get_local_time(raop_rtp->ntp);
+                        int64_t latency = ((int64_t) ntp_now) - ((int64_t) audio_data.ntp_time_local);
+                        logger_log(raop_rtp->logger, LOGGER_DEBUG, "raop_rtp audio: now = %8.6f, ntp = %8.6f, latency = %8.6f, rtp_time=%u seqnum = %u",
+                                   (double) ntp_now / SEC, (double) audio_data.ntp_time_local / SEC, (double) latency / SEC, (uint32_t) rtp64_timestamp,
+                                   seqnum);
+                    }
                 }
 
                 /* Handle possible resend requests */
                 if (!no_resend) {
+                    TRACE_BEGIN("audio handle resends");
                     raop_buffer_handle_resends(raop_rtp->buffer, raop_rtp_resend_callback, raop_rtp);
+                    TRACE_END("audio handle resends");
                 }
             }
         }
@@ -37,6 +37,8 @@
 #include "mirror_buffer.h"
 #include "stream.h"
 #include "utils.h"
+#include "trace.h"
+#include "metrics.h"
 #include "plist/plist.h"
 
 #ifdef _WIN32
@@ -110,6 +112,8 @@ struct raop_rtp_mirror_s {
     unsigned char* sps_pps;
     bool sps_pps_waiting;
 
+    /* dropping frames for a congested renderer, until the next keyframe */
+    bool congestion_drop;
 };
 
 static int
@@ -182,6 +186,57 @@ raop_rtp_init_mirror_aes(raop_rtp_mirror_t *raop_rtp_mirror, uint64_t *streamCon
     mirror_buffer_init_aes(raop_rtp_mirror->buffer, streamConnectionID);
 }
 
+/* It seems the AirPlay protocol prepends NALs with their size, which we're replacing in place with the 4-byte
+ * start code for the NAL Byte-Stream Format.  Returns false if the data is not a valid sequence of NALs
+ * (usually because decryption failed); *nal_count is set to the number of NALs found */
+bool
+raop_rtp_mirror_nal_to_annexb(logger_t *logger, unsigned char *data, int datalen, int *nal_count)
+{
+    static const unsigned char nal_start_code[4] = { 0x00, 0x00, 0x00, 0x01 };
+    bool valid_data = true;
+    int nalu_size = 0;
+    int nalus_count = 0;
+    int nalu_type;               /* 0x01 non-IDR VCL, 0x05 IDR VCL, 0x06 SEI 0x07 SPS, 0x08 PPS */
+    while (nalu_size < datalen) {
+        int nc_len = byteutils_get_int_be(data, nalu_size);
+        if (nc_len < 0 || nalu_size + 4 > datalen) {
+            valid_data = false;
+            break;
+        }
+        memcpy(data + nalu_size, nal_start_code, 4);
+        nalu_size += 4;
+        nalus_count++;
+        if (data[nalu_size] & 0x80) valid_data = false;  /* first bit of h264 nalu MUST be 0 ("forbidden_zero_bit") */
+        nalu_type = data[nalu_size] & 0x1f;
+        nalu_size += nc_len;
+        if (nalu_type != 1) {
+            logger_log(logger, LOGGER_DEBUG, "nalu_type = %d, nalu_size = %d,  processed bytes %d, payloadsize = %d nalus_count = %d",
+                       nalu_type, nc_len, nalu_size, datalen, nalus_count);
+        }
+    }
+    if (nalu_size != datalen) valid_data = false;
+    *nal_count = nalus_count;
+    return valid_data;
+}
+
+/* True if the length-prefixed NALs of a decrypted payload include an IDR slice */
+static bool
+raop_rtp_mirror_has_idr(unsigned char *data, int datalen)
+{
+    int offset = 0;
+    while (offset + 4 < datalen) {
+        int nc_len = (int) byteutils_get_int_be(data, offset);
+        if (nc_len <= 0 || nc_len > datalen - offset - 4) {
+            return false;
+        }
+        if ((data[offset + 4] & 0x1f) == 5) {
+            return true;
+        }
+        offset += 4 + nc_len;
+    }
+    return false;
+}
+
 //#define DUMP_H264
 
 #define RAOP_PACKET_LEN 32768
@@ -206,6 +261,8 @@ raop_rtp_mirror_thread(void *arg)
     uint64_t ntp_timestamp_local  = 0;
     unsigned char nal_start_code[4] = { 0x00, 0x00, 0x00, 0x01 };
 
+    TRACE_THREAD_NAME("raop_rtp_mirror");
+
 #ifdef DUMP_H264
     // C decrypted
     FILE* file = fopen("/home/pi/Airplay.h264", "wb");
@@ -293,12 +350,14 @@ raop_rtp_mirror_thread(void *arg)
         if (stream_fd != -1 && FD_ISSET(stream_fd, &rfds)) {
 
             // The first 128 bytes are some kind of header for the payload that follows
+            TRACE_BEGIN("mirror header recv");
             while (payload == NULL && readstart < 128) {
                 unsigned char* pos  = packet + readstart;
                 ret = recv(stream_fd, CAST pos, 128 - readstart, 0);
                 if (ret <= 0) break;
                 readstart = readstart + ret;
             }
+            TRACE_END("mirror header recv");
 
             if (payload == NULL && ret == 0) {
                 logger_log(raop_rtp_mirror->logger, LOGGER_ERR, "raop_rtp_mirror tcp socket is closed, got %d bytes of 128 byte header",readstart);
@@ -348,6 +407,7 @@ raop_rtp_mirror_thread(void *arg)
                 readstart = 0;
             }
 
+            TRACE_BEGIN("mirror payload recv");
             while (readstart < payload_size) {
                 // Payload data
                 unsigned char *pos = payload + readstart;
@@ -355,6 +415,8 @@ raop_rtp_mirror_thread(void *arg)
                 if (ret <= 0) break;
                 readstart = readstart + ret;
             }
+            TRACE_END("mirror payload recv");
+            uint64_t received_ns = utils_monotonic_ns();
 
             if (ret == 0) {
                 logger_log(raop_rtp_mirror->logger, LOGGER_ERR, "raop_rtp_mirror tcp socket is closed");
@@ -366,9 +428,13 @@ raop_rtp_mirror_thread(void *arg)
                 break;
             }
 
+            metrics_count(METRICS_VIDEO_PACKETS, 1);
+            metrics_count(METRICS_VIDEO_BYTES, 128 + payload_size);
+
 	    switch (packet[4]) {
             case  0x00:
                 // Normal video data (VCL NAL)
+                metrics_count(METRICS_VIDEO_FRAMES, 1);
 
                 // Conveniently, the video data is already stamped with the remote wall clock time,
                 // so no additional clock syncing needed. The only thing odd here is that the video
@@ -378,8 +444,11 @@ raop_rtp_mirror_thread(void *arg)
                 ntp_timestamp_local = raop_ntp_convert_remote_time(raop_rtp_mirror->ntp, ntp_timestamp_remote);
                 uint64_t ntp_now = raop_ntp_get_local_time(raop_rtp_mirror->ntp);
                 int64_t latency = ((int64_t) ntp_now) - ((int64_t) ntp_timestamp_local);
-                logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp video: now = %8.6f, ntp = %8.6f, latency = %8.6f, ts = %8.6f, %s",
-                           (double) ntp_now / SEC, (double) ntp_timestamp_local / SEC, (double) latency / SEC, (double) ntp_timestamp_remote / SEC, packet_description);
+                metrics_record_latency(METRICS_VIDEO, METRICS_STAGE_NETWORK, latency);
+                if (logger_enabled(raop_rtp_mirror->logger, LOGGER_DEBUG)) {
+                    logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp video: now = %8.6f, ntp = %8.6f, latency = %8.6f, ts = %8.6f, %s",
+                               (double) ntp_now / SEC, (double) ntp_timestamp_local / SEC, (double) latency / SEC, (double) ntp_timestamp_remote / SEC, packet_description);
+                }
 
 #ifdef DUMP_H264
                 fwrite(payload, payload_size, 1, file_source);
@@ -402,45 +471,73 @@ raop_rtp_mirror_thread(void *arg)
                  * PPS + SPS NAL to the current encrypted NAL, and issue a warning message */
 
                 bool prepend_sps_pps = (raop_rtp_mirror->sps_pps_waiting || packet[5] != 0x00);
+
+                /* If the renderer is over its latency budget, drop frames here rather than let them queue.
+                 * The frames after a dropped one are predicted from it, so keep dropping until the next
+                 * keyframe: the frame that follows a SPS + PPS packet, or one holding an IDR slice. The
+                 * payload must still be decrypted, to keep the decryption keystream in step with the sender */
+                bool decrypted = false;
                 if (prepend_sps_pps) {
-                    assert(raop_rtp_mirror->sps_pps);
-                    payload_out = (unsigned char*)  malloc(payload_size + raop_rtp_mirror->sps_pps_len);
-                    payload_decrypted = payload_out + raop_rtp_mirror->sps_pps_len;
-                    memcpy(payload_out, raop_rtp_mirror->sps_pps, raop_rtp_mirror->sps_pps_len);
-                    raop_rtp_mirror->sps_pps_waiting = false;
-                } else {
-                    payload_out = (unsigned char*)  malloc(payload_size);
-                    payload_decrypted = payload_out;
+                    if (raop_rtp_mirror->congestion_drop) {
+                        logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror: keyframe, resume sending video");
+                    }
+                    raop_rtp_mirror->congestion_drop = false;
+                } else if (!raop_rtp_mirror->congestion_drop && raop_rtp_mirror->callbacks.video_congested &&
+                           raop_rtp_mirror->callbacks.video_congested(raop_rtp_mirror->callbacks.cls)) {
+                    logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror: video renderer congested, "
+                               "dropping video until the next keyframe");
+                    raop_rtp_mirror->congestion_drop = true;
                 }
-                // Decrypt data
-                mirror_buffer_decrypt(raop_rtp_mirror->buffer, payload, payload_decrypted, payload_size);
-
-                // It seems the AirPlay protocol prepends NALs with their size, which we're replacing with the 4-byte
-                // start code for the NAL Byte-Stream Format.
-                bool valid_data = true;
-                int nalu_size = 0;
-                int nalus_count = 0;
-                int nalu_type;               /* 0x01 non-IDR VCL, 0x05 IDR VCL, 0x06 SEI 0x07 SPS, 0x08 PPS */
-                while (nalu_size < payload_size) {
-                    int nc_len = byteutils_get_int_be(payload_decrypted, nalu_size);
-                    if (nc_len < 0 || nalu_size + 4 > payload_size) {
-                        valid_data = false;
+                if (raop_rtp_mirror->congestion_drop) {
+                    payload_out = (unsigned char*)  malloc(payload_size);
+                    mirror_buffer_decrypt(raop_rtp_mirror->buffer, payload, payload_out, payload_size);
+                    if (!raop_rtp_mirror_has_idr(payload_out, payload_size)) {
+                        free(payload_out);
+                        metrics_count(METRICS_VIDEO_CONGESTION_DROPS, 1);
                         break;
                     }
-                    memcpy(payload_decrypted + nalu_size, nal_start_code, 4);
-                    nalu_size += 4;
-                    nalus_count++;
-                    if (payload_decrypted[nalu_size] & 0x80) valid_data = false;  /* first bit of h264 nalu MUST be 0 ("forbidden_zero_bit") */
-                    nalu_type = payload_decrypted[nalu_size] & 0x1f;
-                    nalu_size += nc_len;
-                    if (nalu_type != 1) {
-                         logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "nalu_type = %d, nalu_size = %d,  processed bytes %d, payloadsize = %d nalus_count = %d",
-                                    nalu_type, nc_len, nalu_size, payload_size, nalus_count);
+                    logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror: IDR slice, resume sending video");
+                    raop_rtp_mirror->congestion_drop = false;
+                    decrypted = true;
+                }
+
+                int payload_out_size = payload_size + (prepend_sps_pps ? raop_rtp_mirror->sps_pps_len : 0);
+                void *payload_buffer = NULL;
+                if (decrypted) {
+                    payload_decrypted = payload_out;
+                } else {
+                    /* decrypt straight into the renderer's buffer if it lends us one */
+                    if (raop_rtp_mirror->callbacks.video_get_buffer) {
+                        payload_buffer = raop_rtp_mirror->callbacks.video_get_buffer(raop_rtp_mirror->callbacks.cls,
+                                                                                     payload_out_size, &payload_out);
+                    }
+                    if (!payload_buffer) {
+                        payload_out = (unsigned char*)  malloc(payload_out_size);
+                    }
+                    if (prepend_sps_pps) {
+                        assert(raop_rtp_mirror->sps_pps);
+                        payload_decrypted = payload_out + raop_rtp_mirror->sps_pps_len;
+                        memcpy(payload_out, raop_rtp_mirror->sps_pps, raop_rtp_mirror->sps_pps_len);
+                        raop_rtp_mirror->sps_pps_waiting = false;
+                    } else {
+                        payload_decrypted = payload_out;
                     }
-                 }
-                if (nalu_size != payload_size) valid_data = false;
+                    // Decrypt data
+                    TRACE_BEGIN("mirror decrypt");
+                    mirror_buffer_decrypt(raop_rtp_mirror->buffer, payload, payload_decrypted, payload_size);
+                    TRACE_END("mirror decrypt");
+                }
+
+                int nalus_count;
+                TRACE_BEGIN("mirror NAL rewrite");
+                bool valid_data = raop_rtp_mirror_nal_to_annexb(raop_rtp_mirror->logger, payload_decrypted,
+                                                                payload_size, &nalus_count);
+                TRACE_END("mirror NAL rewrite");
+                uint64_t decrypted_ns = utils_monotonic_ns();
+                metrics_record_latency(METRICS_VIDEO, METRICS_STAGE_DECRYPT, (int64_t) (decrypted_ns - received_ns));
                 if(!valid_data) {
                     logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "nalu marked as invalid");
+                    metrics_count(METRICS_DECRYPT_FAILURES, 1);
                     payload_out[0] = 1; /* mark video data as invalid h264 (failed decryption) */
                 }
 #ifdef DUMP_H264
@@ -453,6 +550,7 @@ raop_rtp_mirror_thread(void *arg)
                 h264_data.nal_count = nalus_count;   /*nal_count will be the number of nal units in the packet */
                 h264_data.data_len = payload_size;
                 h264_data.data = payload_out;
+                h264_data.buffer = payload_buffer;
                 if (prepend_sps_pps) {
                     h264_data.data_len += raop_rtp_mirror->sps_pps_len;
                     h264_data.nal_count += 2;
@@ -460,8 +558,13 @@ raop_rtp_mirror_thread(void *arg)
                         logger_log(raop_rtp_mirror->logger, LOGGER_WARNING, "raop_rtp_mirror: prepended sps_pps timestamp does not match that of video payload");
                     }
                 }
+                TRACE_BEGIN("video_process");
                 raop_rtp_mirror->callbacks.video_process(raop_rtp_mirror->callbacks.cls, raop_rtp_mirror->ntp, &h264_data);
-                free(payload_out);
+                TRACE_END("video_process");
+                metrics_record_latency(METRICS_VIDEO, METRICS_STAGE_APPSRC, (int64_t) (utils_monotonic_ns() - decrypted_ns));
+                if (!payload_buffer) {
+                    free(payload_out);
+                }
                 break;
             case 0x01:
                 // The information in the payload contains an SPS and a PPS NAL
@@ -496,25 +599,21 @@ raop_rtp_mirror_thread(void *arg)
                 unsigned char *sequence_parameter_set = payload + 8;
                 short pps_size = byteutils_get_short_be(payload, sps_size + 9);
                 unsigned char *picture_parameter_set = payload + sps_size + 11;
-                int data_size = 6; 
-                char *str = utils_data_to_string(payload, data_size, 16);
-                logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror: sps/pps header size = %d", data_size);		
-                logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror h264 sps/pps header:\n%s", str);
-                free(str);
-                str = utils_data_to_string(sequence_parameter_set, sps_size,16);
-                logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror sps size = %d",  sps_size);		
-                logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror h264 Sequence Parameter Set:\n%s", str);
-                free(str);
-                str = utils_data_to_string(picture_parameter_set, pps_size, 16);
+                int data_size = 6;
+                logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror: sps/pps header size = %d", data_size);
+                logger_log_lazy(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror h264 sps/pps header:\n",
+                                utils_format_hex, payload, data_size);
+                logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror sps size = %d",  sps_size);
+                logger_log_lazy(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror h264 Sequence Parameter Set:\n",
+                                utils_format_hex, sequence_parameter_set, sps_size);
                 logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror pps size = %d", pps_size);
-                logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror h264 Picture Parameter Set:\n%s", str);
-                free(str);
-                data_size = payload_size - sps_size - pps_size - 11; 
+                logger_log_lazy(raop_rtp_mirror->logger, LOGGER_DEBUG, "raop_rtp_mirror h264 Picture Parameter Set:\n",
+                                utils_format_hex, picture_parameter_set, pps_size);
+                data_size = payload_size - sps_size - pps_size - 11;
                 if (data_size > 0) {
-                    str = utils_data_to_string (picture_parameter_set + pps_size, data_size, 16);
                     logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "remainder size = %d", data_size);
-                    logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "remainder of sps+pps packet:\n%s", str);
-                    free(str);
+                    logger_log_lazy(raop_rtp_mirror->logger, LOGGER_DEBUG, "remainder of sps+pps packet:\n",
+                                    utils_format_hex, picture_parameter_set + pps_size, data_size);
                 } else if (data_size < 0) {
                     logger_log(raop_rtp_mirror->logger, LOGGER_ERR, " pps_sps error: packet remainder size = %d < 0", data_size);
                 }
@@ -566,9 +665,8 @@ raop_rtp_mirror_thread(void *arg)
                     int plist_size = payload_size;
                     if (payload_size > 25000) {
 		        plist_size = payload_size - 25000;
-                        char *str = utils_data_to_string(payload + plist_size, 16, 16);
-                        logger_log(raop_rtp_mirror->logger, LOGGER_DEBUG, "video_info packet had 25kB trailer; first 16 bytes are:\n%s", str);
-                        free(str);
+                        logger_log_lazy(raop_rtp_mirror->logger, LOGGER_DEBUG, "video_info packet had 25kB trailer; first 16 bytes are:\n",
+                                        utils_format_hex, payload + plist_size, 16);
                     }
                     if (plist_size) {
                         char *plist_xml;
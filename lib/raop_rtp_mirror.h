@@ -19,6 +19,7 @@
 #define RAOP_RTP_MIRROR_H
 
 #include <stdint.h>
+#include <stdbool.h>
 #include "raop.h"
 #include "logger.h"
 
@@ -31,4 +32,5 @@ void raop_rtp_init_mirror_aes(raop_rtp_mirror_t *raop_rtp_mirror, uint64_t *stre
 void raop_rtp_start_mirror(raop_rtp_mirror_t *raop_rtp_mirror, int use_udp, unsigned short *mirror_data_lport,  uint8_t show_client_FPS_data);
 void raop_rtp_mirror_stop(raop_rtp_mirror_t *raop_rtp_mirror);
 void raop_rtp_mirror_destroy(raop_rtp_mirror_t *raop_rtp_mirror);
+bool raop_rtp_mirror_nal_to_annexb(logger_t *logger, unsigned char *data, int datalen, int *nal_count);
 #endif //RAOP_RTP_MIRROR_H
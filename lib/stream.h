@@ -27,6 +27,7 @@ typedef struct {
     int data_len;
     uint64_t ntp_time_local;
     uint64_t ntp_time_remote;
+    void *buffer;          /* from video_get_buffer (data points into it), or NULL */
 } h264_decode_struct;
 
 typedef struct {
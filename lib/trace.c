@@ -0,0 +1,230 @@
+/**
+ *  Copyright (C) 2026 UxPlay contributors
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#include "trace.h"
+#include "threads.h"
+#include "utils.h"
+
+#ifdef UXPLAY_TRACE
+
+#define TRACE_RING_EVENTS  8192     /* per thread, power of two */
+#define TRACE_RING_MASK    (TRACE_RING_EVENTS - 1)
+#define TRACE_NAME_SIZE    32
+
+typedef struct trace_record_s {
+    uint64_t time_ns;
+    const char *name;
+    int64_t value;
+    uint32_t tid;
+    char phase;
+} trace_record_t;
+
+typedef struct trace_ring_s {
+    struct trace_ring_s *next;
+    atomic_uint_fast64_t head;
+    atomic_int in_use;
+    uint32_t tid;
+    char thread_name[TRACE_NAME_SIZE];
+    trace_record_t records[TRACE_RING_EVENTS];
+} trace_ring_t;
+
+/* Rings are never freed: a ring left by an exited thread (keeping its
+ * events for the dump) is taken over by the next new thread */
+static pthread_mutex_t trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+static trace_ring_t *_Atomic trace_rings = NULL;
+static atomic_uint trace_next_tid = 1;
+static pthread_key_t trace_key;
+static pthread_once_t trace_once = PTHREAD_ONCE_INIT;
+static _Thread_local trace_ring_t *trace_ring = NULL;
+
+static void
+trace_thread_exit(void *arg)
+{
+    trace_ring_t *ring = arg;
+    atomic_store_explicit(&ring->in_use, 0, memory_order_release);
+}
+
+static void
+trace_key_create(void)
+{
+    pthread_key_create(&trace_key, trace_thread_exit);
+}
+
+static trace_ring_t *
+trace_get_ring(void)
+{
+    trace_ring_t *ring;
+
+    pthread_once(&trace_once, trace_key_create);
+    pthread_mutex_lock(&trace_mutex);
+    for (ring = atomic_load(&trace_rings); ring; ring = ring->next) {
+        if (!atomic_load_explicit(&ring->in_use, memory_order_acquire)) {
+            break;
+        }
+    }
+    if (!ring) {
+        ring = calloc(1, sizeof(trace_ring_t));
+        if (!ring) {
+            pthread_mutex_unlock(&trace_mutex);
+            return NULL;
+        }
+        ring->next = atomic_load(&trace_rings);
+        atomic_store(&trace_rings, ring);
+    }
+    atomic_store(&ring->in_use, 1);
+    /* older events in a reused ring keep the tid of their own thread; the
+     * name was that thread's, and the new one may never set its own */
+    ring->tid = atomic_fetch_add(&trace_next_tid, 1);
+    ring->thread_name[0] = '\0';
+    pthread_mutex_unlock(&trace_mutex);
+
+    pthread_setspecific(trace_key, ring);
+    return ring;
+}
+
+void
+trace_event(const char *name, char phase, int64_t value)
+{
+    trace_ring_t *ring = trace_ring;
+    trace_record_t *record;
+    uint64_t head;
+
+    if (!ring) {
+        ring = trace_ring = trace_get_ring();
+        if (!ring) {
+            return;
+        }
+    }
+    head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    record = &ring->records[head & TRACE_RING_MASK];
+    record->time_ns = utils_monotonic_ns();
+    record->name = name;
+    record->value = value;
+    record->tid = ring->tid;
+    record->phase = phase;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+void
+trace_thread_name(const char *name)
+{
+    trace_ring_t *ring = trace_ring;
+
+    if (!ring) {
+        ring = trace_ring = trace_get_ring();
+        if (!ring) {
+            return;
+        }
+    }
+    pthread_mutex_lock(&trace_mutex);
+    snprintf(ring->thread_name, sizeof(ring->thread_name), "%s", name);
+    pthread_mutex_unlock(&trace_mutex);
+}
+
+static void
+trace_write_string(FILE *file, const char *str)
+{
+    fputc('"', file);
+    for (; *str; str++) {
+        if (*str == '"' || *str == '\\') {
+            fputc('\\', file);
+        }
+        fputc(*str, file);
+    }
+    fputc('"', file);
+}
+
+int
+trace_dump(const char *path)
+{
+    FILE *file = fopen(path, "w");
+    const char *sep = "";
+    int count = 0;
+
+    if (!file) {
+        return -1;
+    }
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+
+    pthread_mutex_lock(&trace_mutex);
+    for (trace_ring_t *ring = atomic_load(&trace_rings); ring; ring = ring->next) {
+        uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        uint64_t start = (head > TRACE_RING_EVENTS ? head - TRACE_RING_EVENTS : 0);
+
+        if (ring->thread_name[0]) {
+            fprintf(file, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":",
+                    sep, ring->tid);
+            trace_write_string(file, ring->thread_name);
+            fprintf(file, "}}");
+            sep = ",";
+        }
+        for (uint64_t i = start; i < head; i++) {
+            trace_record_t record = ring->records[i & TRACE_RING_MASK];
+            /* the owner keeps writing: skip anything overwritten meanwhile */
+            atomic_thread_fence(memory_order_acquire);
+            uint64_t now = atomic_load_explicit(&ring->head, memory_order_relaxed);
+            if (now >= TRACE_RING_EVENTS && i <= now - TRACE_RING_EVENTS) {
+                continue;
+            }
+            fprintf(file, "%s\n{\"name\":", sep);
+            trace_write_string(file, record.name);
+            fprintf(file, ",\"ph\":\"%c\",\"ts\":%llu.%03u,\"pid\":1,\"tid\":%u",
+                    record.phase, (unsigned long long) (record.time_ns / 1000),
+                    (unsigned int) (record.time_ns % 1000), record.tid);
+            if (record.phase == TRACE_PHASE_INSTANT) {
+                fprintf(file, ",\"s\":\"t\",\"args\":{\"value\":%lld}", (long long) record.value);
+            }
+            fprintf(file, "}");
+            sep = ",";
+            count++;
+        }
+    }
+    pthread_mutex_unlock(&trace_mutex);
+
+    fprintf(file, "\n]}\n");
+    if (fclose(file)) {
+        return -1;
+    }
+    return count;
+}
+
+#else
+
+void
+trace_event(const char *name, char phase, int64_t value)
+{
+    (void) name;
+    (void) phase;
+    (void) value;
+}
+
+void
+trace_thread_name(const char *name)
+{
+    (void) name;
+}
+
+int
+trace_dump(const char *path)
+{
+    (void) path;
+    return 0;
+}
+
+#endif
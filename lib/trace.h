@@ -0,0 +1,59 @@
+/**
+ *  Copyright (C) 2026 UxPlay contributors
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ */
+
+/* Session timeline tracing.  Each thread records timestamped begin/end/
+ * instant events into its own ring (a flight recorder: the newest events
+ * are kept); trace_dump() writes all rings as Chrome trace JSON, which
+ * can be opened in Perfetto (ui.perfetto.dev) or chrome://tracing.
+ *
+ * The TRACE_* macros compile to nothing unless UXPLAY_TRACE is defined
+ * (cmake -DUXPLAY_TRACE=ON).  Event names must be string literals. */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TRACE_PHASE_BEGIN   'B'
+#define TRACE_PHASE_END     'E'
+#define TRACE_PHASE_INSTANT 'i'
+
+void trace_event(const char *name, char phase, int64_t value);
+void trace_thread_name(const char *name);
+
+/* Returns the number of events written, -1 if the file can't be written,
+ * 0 if tracing is not compiled in */
+int trace_dump(const char *path);
+
+#ifdef UXPLAY_TRACE
+#define TRACE_BEGIN(name)          trace_event(name, TRACE_PHASE_BEGIN, 0)
+#define TRACE_END(name)            trace_event(name, TRACE_PHASE_END, 0)
+#define TRACE_INSTANT(name, value) trace_event(name, TRACE_PHASE_INSTANT, (int64_t) (value))
+#define TRACE_THREAD_NAME(name)    trace_thread_name(name)
+#else
+#define TRACE_BEGIN(name)          do { } while (0)
+#define TRACE_END(name)            do { } while (0)
+#define TRACE_INSTANT(name, value) do { } while (0)
+#define TRACE_THREAD_NAME(name)    do { } while (0)
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -218,6 +218,15 @@ char *utils_data_to_text(const char *data, int datalen) {
     return ptr;
 }
 
+/* logger_formatter_t adaptors, for dumps that are built only when logged */
+char *utils_format_hex(const void *data, int datalen) {
+    return utils_data_to_string((const unsigned char *) data, datalen, 16);
+}
+
+char *utils_format_text(const void *data, int datalen) {
+    return utils_data_to_text((const char *) data, datalen);
+}
+
 void ntp_timestamp_to_time(uint64_t ntp_timestamp, char *timestamp, size_t maxsize) {
     time_t rawtime = (time_t) (ntp_timestamp / SECOND_IN_NSECS);
     struct tm ts = *localtime(&rawtime);
@@ -237,3 +246,12 @@ void ntp_timestamp_to_seconds(uint64_t ntp_timestamp, char *timestamp, size_t ma
     strftime(timestamp, 3, "%S", &ts);
     snprintf(timestamp + 2, 11,".%9.9lu", (unsigned long) ntp_timestamp % SECOND_IN_NSECS);
 }
+
+/* monotonic clock for measuring intervals (not related to NTP time) */
+uint64_t
+utils_monotonic_ns(void)
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return ((uint64_t) time.tv_sec) * SECOND_IN_NSECS + (uint64_t) time.tv_nsec;
+}
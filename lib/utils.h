@@ -27,6 +27,9 @@ int utils_hwaddr_airplay(char *str, int strlen, const char *hwaddr, int hwaddrle
 char *utils_parse_hex(const char *str, int str_len, int *data_len);
 char *utils_data_to_string(const unsigned char *data, int datalen, int chars_per_line);
 char *utils_data_to_text(const char *data, int datalen);
+char *utils_format_hex(const void *data, int datalen);
+char *utils_format_text(const void *data, int datalen);
 void ntp_timestamp_to_time(uint64_t ntp_timestamp, char *timestamp, size_t maxsize);
 void ntp_timestamp_to_seconds(uint64_t ntp_timestamp, char *timestamp, size_t maxsize);
+uint64_t utils_monotonic_ns(void);
 #endif
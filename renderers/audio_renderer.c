@@ -0,0 +1,88 @@
+/**
+ * UxPlay - An open-source AirPlay mirroring server
+ * Copyright (C) 2026 UxPlay contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+#include <string.h>
+#include "audio_renderer.h"
+
+static const audio_renderer_funcs_t *const backends[] = {
+    &audio_renderer_null,
+    NULL
+};
+
+static audio_renderer_t *renderer = NULL;   /* the instance used by the functions below */
+
+const audio_renderer_funcs_t *audio_renderer_backend(const char *audiosink) {
+    for (int i = 0; backends[i]; i++) {
+        if (audiosink && strcmp(audiosink, backends[i]->name) == 0) {
+            return backends[i];
+        }
+    }
+    return &audio_renderer_gstreamer;
+}
+
+void audio_renderer_init(logger_t *logger, const char* audiosink, const bool *audio_sync, const bool *video_sync,
+                         unsigned int latency_budget) {
+    const audio_renderer_funcs_t *funcs = audio_renderer_backend(audiosink);
+    renderer = funcs->create(logger, audiosink, audio_sync, video_sync, latency_budget);
+}
+
+audio_renderer_t *audio_renderer_instance() {
+    return renderer;
+}
+
+void audio_renderer_start(unsigned char *compression_type) {
+    if (renderer) {
+        renderer->funcs->start(renderer, compression_type);
+    }
+}
+
+void audio_renderer_stop() {
+    if (renderer) {
+        renderer->funcs->stop(renderer);
+    }
+}
+
+void audio_renderer_render_buffer(unsigned char* data, int *data_len, unsigned short *seqnum, uint64_t *ntp_time) {
+    if (renderer) {
+        renderer->funcs->render_buffer(renderer, data, data_len, seqnum, ntp_time);
+    }
+}
+
+void audio_renderer_set_volume(float volume) {
+    if (renderer) {
+        renderer->funcs->set_volume(renderer, volume);
+    }
+}
+
+void audio_renderer_flush() {
+    if (renderer) {
+        renderer->funcs->flush(renderer);
+    }
+}
+
+bool audio_renderer_congested() {
+    return renderer ? renderer->funcs->congested(renderer) : false;
+}
+
+void audio_renderer_destroy() {
+    if (renderer) {
+        renderer->funcs->destroy(renderer);
+        renderer = NULL;
+    }
+}
@@ -32,13 +32,48 @@ extern "C" {
 #include <stdbool.h>
 #include "../lib/logger.h"
 
+typedef struct audio_renderer_s audio_renderer_t;
+
+/* An audio renderer backend: as for video_renderer_funcs_t, create() returns an instance     *
+ * whose first member is an audio_renderer_t pointing back at these funcs, and every entry    *
+ * must be set.  start() selects the format for compression type *ct.                        */
+typedef struct audio_renderer_funcs_s {
+    const char *name;
+    audio_renderer_t *(*create)(logger_t *logger, const char *audiosink, const bool *audio_sync,
+                                const bool *video_sync, unsigned int latency_budget);
+    void (*start)(audio_renderer_t *renderer, unsigned char *ct);
+    void (*stop)(audio_renderer_t *renderer);
+    void (*render_buffer)(audio_renderer_t *renderer, unsigned char *data, int *data_len, unsigned short *seqnum,
+                          uint64_t *ntp_time);
+    void (*set_volume)(audio_renderer_t *renderer, float volume);
+    void (*flush)(audio_renderer_t *renderer);
+    bool (*congested)(audio_renderer_t *renderer);
+    void (*destroy)(audio_renderer_t *renderer);
+} audio_renderer_funcs_t;
+
+struct audio_renderer_s {
+    const audio_renderer_funcs_t *funcs;
+};
+
+extern const audio_renderer_funcs_t audio_renderer_gstreamer;
+extern const audio_renderer_funcs_t audio_renderer_null;
+
+/* the backend named by audiosink if there is one ("null"), otherwise GStreamer with audiosink */
+const audio_renderer_funcs_t *audio_renderer_backend(const char *audiosink);
+
 bool gstreamer_init();
-void audio_renderer_init(logger_t *logger, const char* audiosink, const bool *audio_sync, const bool *video_sync);
+
+/* The functions below drive a single process-wide instance, created by audio_renderer_init() *
+ * with audio_renderer_backend(audiosink).  Further instances can be made with the funcs.     */
+void audio_renderer_init(logger_t *logger, const char* audiosink, const bool *audio_sync, const bool *video_sync,
+                         unsigned int latency_budget);
+audio_renderer_t *audio_renderer_instance();
 void audio_renderer_start(unsigned char* compression_type);
 void audio_renderer_stop();
 void audio_renderer_render_buffer(unsigned char* data, int *data_len, unsigned short *seqnum, uint64_t *ntp_time);
 void audio_renderer_set_volume(float volume);
 void audio_renderer_flush();
+bool audio_renderer_congested();
 void audio_renderer_destroy();
 
 #ifdef __cplusplus
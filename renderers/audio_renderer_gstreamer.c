@@ -24,22 +24,46 @@
 #include <gst/gst.h>
 #include <gst/app/gstappsrc.h>
 #include "audio_renderer.h"
+#include "../lib/trace.h"
+#include "../lib/metrics.h"
+#include "renderer_pool.h"
+#include "renderer_bench.h"
+#include "renderer_profile.h"
 #define SECOND_IN_NSECS 1000000000UL
+#define AUDIO_POOL_INITIAL_SIZE 2048   /* larger than an uncompressed ALAC frame (352 x 4 bytes) */
 
 #define NFORMATS 2     /* set to 4 to enable AAC_LD and PCM:  allowed, but  never seen in real-world use */
+#define SWITCH_TARGET_USECS 50000   /* a format switch slower than this is logged as a warning */
 
-static GstClockTime gst_audio_pipeline_base_time = GST_CLOCK_TIME_NONE;
-static logger_t *logger = NULL;
-const char * format[NFORMATS];
+/* timing of the last format switch: the state changes, then the first buffer from appsrc to sink */
+enum { SWITCH_IDLE, SWITCH_WAIT_PUSH, SWITCH_WAIT_SINK };
 
-typedef struct audio_renderer_s {
+/* one pipeline per audio format */
+typedef struct audio_pipeline_s {
     GstElement *appsrc; 
     GstElement *pipeline;
     GstElement *volume;
+    GstElement *queue;
+    renderer_pool_t *pool;
     unsigned char ct;
-} audio_renderer_t ;
-static audio_renderer_t *renderer_type[NFORMATS];
-static audio_renderer_t *renderer = NULL;
+    const char *format;
+    GstClockTime latency_budget;   /* bound on the time queued in audio_queue, 0 = none */
+    gint enough_data;              /* appsrc has signalled enough-data, and not yet need-data */
+    gint congested;                /* audio_queue is (or was recently) near its latency budget */
+} audio_pipeline_t ;
+
+typedef struct audio_renderer_gstreamer_s {
+    audio_renderer_t base;         /* must be first */
+    logger_t *logger;
+    GstClock *clock;
+    GstClockTime base_time;        /* pts are relative to this (clock time when the current pipeline started) */
+    audio_pipeline_t *pipelines[NFORMATS];
+    audio_pipeline_t *current;     /* playing, or NULL; the others are on standby */
+    gint switch_state;
+    gint64 switch_flip_usecs;
+    gint64 switch_push_time;
+    const char *switch_format;
+} audio_renderer_gstreamer_t;
 
 /* GStreamer Caps strings for Airplay-defined audio compression types (ct) */
 
@@ -56,6 +80,42 @@ static const char aac_lc_caps[] ="audio/mpeg,mpegversion=(int)4,channnels=(int)2
 /* ct = 8; codec_data from MPEG v4 ISO 14996-3 Section 1.6.2.1: AAC_ELD 44100/2  spf = 480 */
 static const char aac_eld_caps[] ="audio/mpeg,mpegversion=(int)4,channnels=(int)2,rate=(int)44100,stream-format=raw,codec_data=(buffer)f8e85000";
 
+static GstPadProbeReturn stage_probe (GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    metrics_mark_stage(METRICS_AUDIO, (metrics_stage_t) GPOINTER_TO_INT(user_data), GST_BUFFER_PTS(buffer));
+    return GST_PAD_PROBE_OK;
+}
+
+/* times the stage that ends where buffers enter the named element */
+static void add_stage_probe(GstElement *pipeline, const char *name, metrics_stage_t stage) {
+    GstElement *element = gst_bin_get_by_name (GST_BIN (pipeline), name);
+    if (!element) {
+        return;
+    }
+    GstPad *pad = gst_element_get_static_pad(element, "sink");
+    if (pad) {
+        gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, stage_probe, GINT_TO_POINTER(stage), NULL);
+        gst_object_unref(pad);
+    }
+    gst_object_unref(element);
+}
+
+static GstPadProbeReturn sink_probe (GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    audio_renderer_gstreamer_t *renderer = (audio_renderer_gstreamer_t *) user_data;
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    metrics_mark_sink(METRICS_AUDIO, GST_BUFFER_PTS(buffer));
+    if (g_atomic_int_compare_and_exchange(&renderer->switch_state, SWITCH_WAIT_SINK, SWITCH_IDLE)) {
+        gint64 sink_usecs = g_get_monotonic_time() - renderer->switch_push_time;
+        gint64 total = renderer->switch_flip_usecs + sink_usecs;
+        metrics_set_gauge(METRICS_AUDIO_SWITCH_TIME, total * 1000);
+        logger_log(renderer->logger, total > SWITCH_TARGET_USECS ? LOGGER_WARNING : LOGGER_INFO,
+                   "audio switch to %s took %.1f ms (state change %.1f ms, first buffer to sink %.1f ms)",
+                   renderer->switch_format, (double) total / 1000, (double) renderer->switch_flip_usecs / 1000,
+                   (double) sink_usecs / 1000);
+    }
+    return GST_PAD_PROBE_OK;
+}
+
 static gboolean check_plugins (void)
 {
     int i;
@@ -85,36 +145,94 @@ bool gstreamer_init(){
     return (bool) check_plugins ();
 }
 
-void audio_renderer_init(logger_t *render_logger, const char* audiosink, const bool* audio_sync, const bool* video_sync) {
+static void audio_enough_data(GstAppSrc *appsrc, gpointer user_data) {
+    g_atomic_int_set(&((audio_pipeline_t *) user_data)->enough_data, TRUE);
+}
+
+static void audio_need_data(GstAppSrc *appsrc, guint length, gpointer user_data) {
+    g_atomic_int_set(&((audio_pipeline_t *) user_data)->enough_data, FALSE);
+}
+
+/* the queue is full and drops its oldest buffer (leaky=downstream) */
+static void audio_queue_overrun(GstElement *queue, gpointer user_data) {
+    metrics_count(METRICS_AUDIO_QUEUE_OVERRUNS, 1);
+    g_atomic_int_set(&((audio_pipeline_t *) user_data)->congested, TRUE);
+}
+
+/* Pipelines that are not in use wait in PAUSED with their sink open, so that making one current is  *
+ * only a state change.  Going through READY drops anything still queued and resets the running time */
+static void audio_renderer_standby(audio_renderer_gstreamer_t *renderer, audio_pipeline_t *standby) {
+    if (gst_element_set_state(standby->pipeline, GST_STATE_READY) == GST_STATE_CHANGE_FAILURE) {
+        /* probably an audio device that cannot be opened twice: this pipeline will start cold */
+        logger_log(renderer->logger, LOGGER_DEBUG, "audio pipeline for %s cannot be kept on standby", standby->format);
+        gst_element_set_state(standby->pipeline, GST_STATE_NULL);
+        return;
+    }
+    gst_element_set_state(standby->pipeline, GST_STATE_PAUSED);
+}
+
+/* rebase the pipeline on the current clock time, so pts are relative to the moment it starts playing */
+static GstStateChangeReturn audio_renderer_play(audio_renderer_gstreamer_t *renderer, audio_pipeline_t *next) {
+    renderer->base_time = gst_clock_get_time(renderer->clock);
+    gst_element_set_start_time(next->pipeline, GST_CLOCK_TIME_NONE);
+    gst_element_set_base_time(next->pipeline, renderer->base_time);
+    return gst_element_set_state(next->pipeline, GST_STATE_PLAYING);
+}
+
+static void audio_renderer_activate(audio_renderer_gstreamer_t *renderer, audio_pipeline_t *next, gint64 switch_start) {
+    if (audio_renderer_play(renderer, next) == GST_STATE_CHANGE_FAILURE) {
+        /* the sink may need exclusive use of the audio device: close the standby pipelines and retry */
+        for (int i = 0; i < NFORMATS; i++) {
+            gst_element_set_state(renderer->pipelines[i]->pipeline, GST_STATE_NULL);
+        }
+        if (audio_renderer_play(renderer, next) == GST_STATE_CHANGE_FAILURE) {
+            logger_log(renderer->logger, LOGGER_ERR, "audio pipeline for %s failed to start", next->format);
+        }
+    }
+    renderer->current = next;
+    renderer->switch_format = next->format;
+    renderer->switch_flip_usecs = g_get_monotonic_time() - switch_start;
+    g_atomic_int_set(&renderer->switch_state, SWITCH_WAIT_PUSH);
+}
+
+static audio_renderer_t *audio_gstreamer_create(logger_t *logger, const char* audiosink, const bool* audio_sync,
+                                                const bool* video_sync, unsigned int latency_budget) {
     GError *error = NULL;
     GstCaps *caps = NULL;
-    GstClock *clock = gst_system_clock_obtain();
-    g_object_set(clock, "clock-type", GST_CLOCK_TYPE_REALTIME, NULL);
+    audio_renderer_gstreamer_t *renderer = calloc(1, sizeof(audio_renderer_gstreamer_t));
+    g_assert(renderer);
+    renderer->base.funcs = &audio_renderer_gstreamer;
+    renderer->logger = logger;
+    renderer->base_time = GST_CLOCK_TIME_NONE;
+    renderer->switch_state = SWITCH_IDLE;
+    renderer->clock = gst_system_clock_obtain();
+    g_object_set(renderer->clock, "clock-type", GST_CLOCK_TYPE_REALTIME, NULL);
 
-    logger = render_logger;
+    bool bench = renderer_bench_is_sink(audiosink);
 
     for (int i = 0; i < NFORMATS ; i++) {
-        renderer_type[i] = (audio_renderer_t *)  calloc(1,sizeof(audio_renderer_t));
-        g_assert(renderer_type[i]);
+        renderer->pipelines[i] = (audio_pipeline_t *)  calloc(1,sizeof(audio_pipeline_t));
+        g_assert(renderer->pipelines[i]);
         GString *launch = g_string_new("appsrc name=audio_source ! ");
-        g_string_append(launch, "queue ");
+        g_string_append(launch, "queue name=audio_queue ");
         switch (i) {
         case 0:    /* AAC-ELD */
         case 2:    /* AAC-LC */
-            g_string_append(launch, "! avdec_aac ! ");
+            g_string_append(launch, "! avdec_aac name=audio_decoder ");
             break;
         case 1:    /* ALAC */
-            g_string_append(launch, "! avdec_alac ! ");
+            g_string_append(launch, "! avdec_alac name=audio_decoder ");
             break;
         case 3:   /*PCM*/
             break;
         default:
             break;
         }
-        g_string_append (launch, "audioconvert ! ");
+        g_string_append (launch, "! audioconvert name=audio_converter ! ");
         g_string_append (launch, "audioresample ! ");    /* wasapisink must resample from 44.1 kHz to 48 kHz */
         g_string_append (launch, "volume name=volume ! level ! ");
-        g_string_append (launch, audiosink);
+        g_string_append (launch, bench ? "fakesink" : audiosink);
+        g_string_append (launch, " name=audio_sink");
         switch(i) {
         case 1:  /*ALAC*/
 	    if (*audio_sync) {
@@ -131,99 +249,130 @@ void audio_renderer_init(logger_t *render_logger, const char* audiosink, const b
 	    }
             break;
         }
-        renderer_type[i]->pipeline  = gst_parse_launch(launch->str, &error);
+        renderer->pipelines[i]->pipeline  = gst_parse_launch(launch->str, &error);
 	if (error) {
           g_error ("gst_parse_launch error (audio %d):\n %s\n", i+1, error->message);
           g_clear_error (&error);
         }
 
-        g_assert (renderer_type[i]->pipeline);
-        gst_pipeline_use_clock(GST_PIPELINE_CAST(renderer_type[i]->pipeline), clock);
+        g_assert (renderer->pipelines[i]->pipeline);
+        gst_pipeline_use_clock(GST_PIPELINE_CAST(renderer->pipelines[i]->pipeline), renderer->clock);
+        renderer_profile_apply(renderer->pipelines[i]->pipeline, false);
 
-        renderer_type[i]->appsrc = gst_bin_get_by_name (GST_BIN (renderer_type[i]->pipeline), "audio_source");
-        renderer_type[i]->volume = gst_bin_get_by_name (GST_BIN (renderer_type[i]->pipeline), "volume");
+        renderer->pipelines[i]->appsrc = gst_bin_get_by_name (GST_BIN (renderer->pipelines[i]->pipeline), "audio_source");
+        renderer->pipelines[i]->volume = gst_bin_get_by_name (GST_BIN (renderer->pipelines[i]->pipeline), "volume");
+        renderer->pipelines[i]->queue = gst_bin_get_by_name (GST_BIN (renderer->pipelines[i]->pipeline), "audio_queue");
+        GstElement *sink = gst_bin_get_by_name (GST_BIN (renderer->pipelines[i]->pipeline), "audio_sink");
+        g_assert(sink);
+        GstPad *pad = gst_element_get_static_pad(sink, "sink");
+        if (pad) {
+            gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, sink_probe, renderer, NULL);
+            gst_object_unref(pad);
+        }
+        if (bench) {
+            renderer_bench_attach(logger, RENDERER_BENCH_AUDIO, sink);
+        }
+        /* linear PCM (format 3) has no decoder: its queue stage ends at the converter */
+        add_stage_probe(renderer->pipelines[i]->pipeline, "audio_decoder", METRICS_STAGE_QUEUE);
+        add_stage_probe(renderer->pipelines[i]->pipeline, "audio_converter",
+                        i == 3 ? METRICS_STAGE_QUEUE : METRICS_STAGE_DECODE);
+        gst_object_unref(sink);
+        renderer->pipelines[i]->pool = renderer_pool_new(logger, "audio renderer", AUDIO_POOL_INITIAL_SIZE);
         switch (i) {
         case 0:
             caps =  gst_caps_from_string(aac_eld_caps);
-            renderer_type[i]->ct = 8;
-            format[i] = "AAC-ELD 44100/2";
+            renderer->pipelines[i]->ct = 8;
+            renderer->pipelines[i]->format = "AAC-ELD 44100/2";
             break;
         case 1:
             caps =  gst_caps_from_string(alac_caps);
-            renderer_type[i]->ct = 2;
-            format[i] = "ALAC 44100/16/2";
+            renderer->pipelines[i]->ct = 2;
+            renderer->pipelines[i]->format = "ALAC 44100/16/2";
             break;
         case 2:
             caps =  gst_caps_from_string(aac_lc_caps);
-            renderer_type[i]->ct = 4;
-            format[i] = "AAC-LC 44100/2";
+            renderer->pipelines[i]->ct = 4;
+            renderer->pipelines[i]->format = "AAC-LC 44100/2";
             break;
         case 3:
             caps =  gst_caps_from_string(lpcm_caps);
-            renderer_type[i]->ct = 1;
-            format[i] = "PCM 44100/16/2 S16LE";
+            renderer->pipelines[i]->ct = 1;
+            renderer->pipelines[i]->format = "PCM 44100/16/2 S16LE";
             break;
         default:
             break;
         }
-        logger_log(logger, LOGGER_DEBUG, "Audio format %d: %s",i+1,format[i]);
-        logger_log(logger, LOGGER_DEBUG, "GStreamer audio pipeline %d: \"%s\"", i+1, launch->str);
+        logger_log(renderer->logger, LOGGER_DEBUG, "Audio format %d: %s",i+1,renderer->pipelines[i]->format);
+        logger_log(renderer->logger, LOGGER_DEBUG, "GStreamer audio pipeline %d: \"%s\"", i+1, launch->str);
         g_string_free(launch, TRUE);
-        g_object_set(renderer_type[i]->appsrc, "caps", caps, "stream-type", 0, "is-live", TRUE, "format", GST_FORMAT_TIME, NULL);
+        g_object_set(renderer->pipelines[i]->appsrc, "caps", caps, "stream-type", 0, "is-live", TRUE, "format", GST_FORMAT_TIME, NULL);
         gst_caps_unref(caps);
-        g_object_unref(clock);
+        /* Audio-only ALAC is deliberately buffered ahead of its play time (-async), so only the  *
+         * AAC formats used with mirroring get a latency budget and can ask for frames to be dropped */
+        if (renderer->pipelines[i]->ct != 2) {
+            renderer->pipelines[i]->latency_budget = (GstClockTime) latency_budget * GST_MSECOND;
+            if (renderer->pipelines[i]->latency_budget) {
+                g_object_set(renderer->pipelines[i]->queue, "max-size-time", renderer->pipelines[i]->latency_budget,
+                             "max-size-buffers", 0, "max-size-bytes", 0, "leaky", 2 /* downstream */, NULL);
+                g_signal_connect(renderer->pipelines[i]->queue, "overrun", G_CALLBACK(audio_queue_overrun), renderer->pipelines[i]);
+                g_signal_connect(renderer->pipelines[i]->appsrc, "enough-data", G_CALLBACK(audio_enough_data), renderer->pipelines[i]);
+                g_signal_connect(renderer->pipelines[i]->appsrc, "need-data", G_CALLBACK(audio_need_data), renderer->pipelines[i]);
+            }
+        }
+        audio_renderer_standby(renderer, renderer->pipelines[i]);
     }
+    return &renderer->base;
 }
 
-void audio_renderer_stop() {
-    if (renderer) {
-        gst_app_src_end_of_stream(GST_APP_SRC(renderer->appsrc));
-        gst_element_set_state (renderer->pipeline, GST_STATE_NULL);
-        renderer = NULL;
+static void audio_gstreamer_stop(audio_renderer_t *audio_renderer) {
+    audio_renderer_gstreamer_t *renderer = (audio_renderer_gstreamer_t *) audio_renderer;
+    if (renderer->current) {
+        audio_renderer_standby(renderer, renderer->current);
+        renderer->current = NULL;
     }
 }
 
-void  audio_renderer_start(unsigned char *ct) {
+static void audio_gstreamer_start(audio_renderer_t *audio_renderer, unsigned char *ct) {
+    audio_renderer_gstreamer_t *renderer = (audio_renderer_gstreamer_t *) audio_renderer;
     unsigned char compression_type = 0, id;
     for (int i = 0; i < NFORMATS; i++) {
-        if(renderer_type[i]->ct == *ct) {
+        if(renderer->pipelines[i]->ct == *ct) {
             compression_type = *ct;
 	    id = i;
             break;
         }
     }
-    if (compression_type && renderer) {
-        if(compression_type != renderer->ct) {
-            gst_app_src_end_of_stream(GST_APP_SRC(renderer->appsrc));
-            gst_element_set_state (renderer->pipeline, GST_STATE_NULL);
-            logger_log(logger, LOGGER_INFO, "changed audio connection, format %s", format[id]);
-            renderer = renderer_type[id];
-            gst_element_set_state (renderer->pipeline, GST_STATE_PLAYING);
-            gst_audio_pipeline_base_time = gst_element_get_base_time(renderer->appsrc);
+    gint64 switch_start = g_get_monotonic_time();
+    if (compression_type && renderer->current) {
+        if(compression_type != renderer->current->ct) {
+            logger_log(renderer->logger, LOGGER_INFO, "changed audio connection, format %s", renderer->pipelines[id]->format);
+            audio_renderer_standby(renderer, renderer->current);
+            audio_renderer_activate(renderer, renderer->pipelines[id], switch_start);
         }
     } else if (compression_type) {
-        logger_log(logger, LOGGER_INFO, "start audio connection, format %s", format[id]);
-        renderer = renderer_type[id];
-        gst_element_set_state (renderer->pipeline, GST_STATE_PLAYING);
-        gst_audio_pipeline_base_time = gst_element_get_base_time(renderer->appsrc);
+        logger_log(renderer->logger, LOGGER_INFO, "start audio connection, format %s", renderer->pipelines[id]->format);
+        audio_renderer_activate(renderer, renderer->pipelines[id], switch_start);
     } else {
-        logger_log(logger, LOGGER_ERR, "unknown audio compression type ct = %d", *ct);
+        logger_log(renderer->logger, LOGGER_ERR, "unknown audio compression type ct = %d", *ct);
     }
 }
 
-void audio_renderer_render_buffer(unsigned char* data, int *data_len, unsigned short *seqnum, uint64_t *ntp_time) {
+static void audio_gstreamer_render_buffer(audio_renderer_t *audio_renderer, unsigned char* data, int *data_len,
+                                          unsigned short *seqnum, uint64_t *ntp_time) {
+    audio_renderer_gstreamer_t *renderer = (audio_renderer_gstreamer_t *) audio_renderer;
+    audio_pipeline_t *current = renderer->current;
     GstBuffer *buffer;
     bool valid;
     GstClockTime pts = (GstClockTime) *ntp_time ;    /* now in nsecs */
     //GstClockTimeDiff latency = GST_CLOCK_DIFF(gst_element_get_current_clock_time (renderer->appsrc), pts);
-    if (pts >= gst_audio_pipeline_base_time) {
-        pts -= gst_audio_pipeline_base_time;
+    if (pts >= renderer->base_time) {
+        pts -= renderer->base_time;
     } else {
-        logger_log(logger, LOGGER_ERR, "*** invalid ntp_time < gst_audio_pipeline_base_time\n%8.6f ntp_time\n%8.6f base_time",
-                   ((double) *ntp_time) / SECOND_IN_NSECS, ((double) gst_audio_pipeline_base_time) / SECOND_IN_NSECS);
+        logger_log(renderer->logger, LOGGER_ERR, "*** invalid ntp_time < gst_audio_pipeline_base_time\n%8.6f ntp_time\n%8.6f base_time",
+                   ((double) *ntp_time) / SECOND_IN_NSECS, ((double) renderer->base_time) / SECOND_IN_NSECS);
         return;
     }
-    if (data_len == 0 || renderer == NULL) return;
+    if (data_len == 0 || current == NULL) return;
 
     /* all audio received seems to be either ct = 8 (AAC_ELD 44100/2 spf 460 ) AirPlay Mirror protocol *
      * or ct = 2 (ALAC 44100/16/2 spf 352) AirPlay protocol.                                           *
@@ -232,12 +381,7 @@ void audio_renderer_render_buffer(unsigned char* data, int *data_len, unsigned s
      *                   but is 0x80, 0x81 or 0x82: 0x100000(00,01,10) in ios9, ios10 devices          *
      * first byte of AAC_LC should be 0xff (ADTS) (but has never been  seen).                          */
     
-    buffer = gst_buffer_new_allocate(NULL, *data_len, NULL);
-    g_assert(buffer != NULL);
-    //g_print("audio latency %8.6f\n", (double) latency / SECOND_IN_NSECS);
-    GST_BUFFER_PTS(buffer) = pts;
-    gst_buffer_fill(buffer, 0, data, *data_len);
-    switch (renderer->ct){
+    switch (current->ct){
     case 8: /*AAC-ELD*/
         switch (data[0]){
         case 0x8c:
@@ -264,35 +408,102 @@ void audio_renderer_render_buffer(unsigned char* data, int *data_len, unsigned s
         break;
     }
     if (valid) {
-        gst_app_src_push_buffer(GST_APP_SRC(renderer->appsrc), buffer);
+        if (g_atomic_int_compare_and_exchange(&renderer->switch_state, SWITCH_WAIT_PUSH, SWITCH_WAIT_SINK)) {
+            renderer->switch_push_time = g_get_monotonic_time();
+        }
+        buffer = renderer_pool_acquire(current->pool, *data_len);
+        if (!buffer) {
+            buffer = gst_buffer_new_allocate(NULL, *data_len, NULL);
+        }
+        g_assert(buffer != NULL);
+        //g_print("audio latency %8.6f\n", (double) latency / SECOND_IN_NSECS);
+        GST_BUFFER_PTS(buffer) = pts;
+        gst_buffer_fill(buffer, 0, data, *data_len);
+        metrics_mark_push(METRICS_AUDIO, pts);
+        renderer_bench_push(RENDERER_BENCH_AUDIO, *data_len);
+        TRACE_BEGIN("audio appsrc push");
+        if (gst_app_src_push_buffer(GST_APP_SRC(current->appsrc), buffer) != GST_FLOW_OK) {
+            metrics_count(METRICS_APPSRC_PUSH_FAILURES, 1);
+        }
+        TRACE_END("audio appsrc push");
+        guint level;
+        guint64 level_time;
+        g_object_get(current->queue, "current-level-buffers", &level, "current-level-time", &level_time, NULL);
+        metrics_set_gauge(METRICS_AUDIO_QUEUE_LEVEL, level);
+        metrics_set_gauge(METRICS_AUDIO_QUEUE_TIME, (int64_t) level_time);
     } else {
-        logger_log(logger, LOGGER_ERR, "*** ERROR invalid  audio frame (compression_type %d) skipped ", renderer->ct);
-        logger_log(logger, LOGGER_ERR, "***       first byte of invalid frame was  0x%2.2x ", (unsigned int) data[0]);
+        logger_log(renderer->logger, LOGGER_ERR, "*** ERROR invalid  audio frame (compression_type %d) skipped ", current->ct);
+        metrics_count(METRICS_INVALID_AUDIO_FRAMES, 1);
+        logger_log(renderer->logger, LOGGER_ERR, "***       first byte of invalid frame was  0x%2.2x ", (unsigned int) data[0]);
     }
 }
 
-void audio_renderer_set_volume(float volume) {
+static void audio_gstreamer_set_volume(audio_renderer_t *audio_renderer, float volume) {
+    audio_renderer_gstreamer_t *renderer = (audio_renderer_gstreamer_t *) audio_renderer;
     float avol;
     if (fabs(volume) < 28) {
         avol = floorf(((28 - fabs(volume)) / 28) * 10) / 10;
-        if (renderer != NULL && renderer->volume != NULL) {
-            g_object_set(renderer->volume, "volume", avol, NULL);
+        if (renderer->current != NULL && renderer->current->volume != NULL) {
+            g_object_set(renderer->current->volume, "volume", avol, NULL);
+        }
+    }
+}
+
+/* true while the receive path should drop frames: the appsrc has asked for no more data, or  *
+ * audio_queue has filled to 3/4 of the latency budget (until it has drained below half of it) *
+ * Never true without a latency budget.                                                        */
+static bool audio_gstreamer_congested(audio_renderer_t *audio_renderer) {
+    audio_pipeline_t *current = ((audio_renderer_gstreamer_t *) audio_renderer)->current;
+    if (!current) {
+        return false;
+    }
+    bool congested = false;
+    if (current->latency_budget) {
+        guint64 level_time;
+        g_object_get(current->queue, "current-level-time", &level_time, NULL);
+        if (level_time >= current->latency_budget / 4 * 3) {
+            g_atomic_int_set(&current->congested, TRUE);
+        } else if (level_time < current->latency_budget / 2) {
+            g_atomic_int_set(&current->congested, FALSE);
         }
+        congested = g_atomic_int_get(&current->enough_data) || g_atomic_int_get(&current->congested);
     }
+    metrics_set_gauge(METRICS_AUDIO_CONGESTED, congested ? 1 : 0);
+    return congested;
 }
 
-void audio_renderer_flush() {
+static void audio_gstreamer_flush(audio_renderer_t *audio_renderer) {
 }
 
-void audio_renderer_destroy() {
-    audio_renderer_stop();
+static void audio_gstreamer_destroy(audio_renderer_t *audio_renderer) {
+    audio_renderer_gstreamer_t *renderer = (audio_renderer_gstreamer_t *) audio_renderer;
+    audio_gstreamer_stop(audio_renderer);
     for (int i = 0; i < NFORMATS ; i++ ) {
-        gst_object_unref (renderer_type[i]->volume);
-	renderer_type[i]->volume = NULL;
-        gst_object_unref (renderer_type[i]->appsrc);
-        renderer_type[i]->appsrc = NULL;
-	gst_object_unref (renderer_type[i]->pipeline);
-        renderer_type[i]->pipeline = NULL;
-        free(renderer_type[i]);
+        gst_element_set_state (renderer->pipelines[i]->pipeline, GST_STATE_NULL);
+        gst_object_unref (renderer->pipelines[i]->volume);
+	renderer->pipelines[i]->volume = NULL;
+        gst_object_unref (renderer->pipelines[i]->queue);
+        renderer->pipelines[i]->queue = NULL;
+        gst_object_unref (renderer->pipelines[i]->appsrc);
+        renderer->pipelines[i]->appsrc = NULL;
+        renderer_pool_free(renderer->pipelines[i]->pool);
+        renderer->pipelines[i]->pool = NULL;
+	gst_object_unref (renderer->pipelines[i]->pipeline);
+        renderer->pipelines[i]->pipeline = NULL;
+        free(renderer->pipelines[i]);
     }
+    gst_object_unref(renderer->clock);
+    free(renderer);
 }
+
+const audio_renderer_funcs_t audio_renderer_gstreamer = {
+    .name = "gstreamer",
+    .create = audio_gstreamer_create,
+    .start = audio_gstreamer_start,
+    .stop = audio_gstreamer_stop,
+    .render_buffer = audio_gstreamer_render_buffer,
+    .set_volume = audio_gstreamer_set_volume,
+    .flush = audio_gstreamer_flush,
+    .congested = audio_gstreamer_congested,
+    .destroy = audio_gstreamer_destroy,
+};
@@ -0,0 +1,325 @@
+/**
+ * UxPlay - An open-source AirPlay mirroring server
+ * Copyright (C) 2026 UxPlay contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE    /* memfd_create, accept4 */
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <gst/app/gstappsink.h>
+#include <gst/video/video.h>
+#include "frame_export.h"
+
+#ifdef __linux__
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/eventfd.h>
+
+#define MAX_CONSUMERS 8
+#define RING_HEADER_SIZE 4096      /* slots start page-aligned */
+#define SLOT_HEADER_SIZE 128       /* frame data in a slot starts 128-byte aligned */
+#define SLOT_ALIGN 4096
+
+typedef struct consumer_s {
+    int sock;
+    int event;
+    bool sent;                     /* has the descriptors of the current ring */
+} consumer_t;
+
+struct frame_export_s {
+    logger_t *logger;
+    char *socket_path;
+    int listener;
+    int memfd;
+    unsigned char *map;
+    size_t map_size;
+    frame_export_ring_t *ring;
+    consumer_t consumers[MAX_CONSUMERS];
+    int n_consumers;
+};
+
+frame_export_t *frame_export_new(logger_t *logger, const char *socket_path) {
+    struct sockaddr_un addr;
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        logger_log(logger, LOGGER_ERR, "frame export: socket path %s is too long", socket_path);
+        return NULL;
+    }
+    frame_export_t *frame_export = calloc(1, sizeof(frame_export_t));
+    g_assert(frame_export);
+    frame_export->logger = logger;
+    frame_export->memfd = -1;
+    frame_export->listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+    unlink(socket_path);
+    int bound = (frame_export->listener >= 0 &&
+                 bind(frame_export->listener, (struct sockaddr *) &addr, sizeof(addr)) == 0);
+    /* the frames are the user's screen: only the same user may connect.  Nobody can connect  *
+     * before listen(), so restricting the socket file between the two leaves no window open */
+    if (!bound || chmod(socket_path, S_IRUSR | S_IWUSR) < 0 ||
+        listen(frame_export->listener, MAX_CONSUMERS) < 0) {
+        logger_log(logger, LOGGER_ERR, "frame export: cannot listen on %s: %s", socket_path, strerror(errno));
+        if (bound) {
+            unlink(socket_path);
+        }
+        if (frame_export->listener >= 0) {
+            close(frame_export->listener);
+        }
+        free(frame_export);
+        return NULL;
+    }
+    frame_export->socket_path = strdup(socket_path);
+    logger_log(logger, LOGGER_INFO, "frame export: decoded video frames are published at %s", socket_path);
+    return frame_export;
+}
+
+static void consumer_remove(frame_export_t *frame_export, int i) {
+    close(frame_export->consumers[i].sock);
+    close(frame_export->consumers[i].event);
+    frame_export->consumers[i] = frame_export->consumers[--frame_export->n_consumers];
+    logger_log(frame_export->logger, LOGGER_DEBUG, "frame export: consumer left (%d remaining)",
+               frame_export->n_consumers);
+}
+
+/* sends the memfd and the consumer's eventfd, with a one-byte message */
+static bool consumer_send(frame_export_t *frame_export, consumer_t *consumer) {
+    char byte = 0;
+    struct iovec iov = { .iov_base = &byte, .iov_len = 1 };
+    union {
+        struct cmsghdr header;
+        char buf[CMSG_SPACE(2 * sizeof(int))];
+    } control;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    memset(&control, 0, sizeof(control));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(2 * sizeof(int));
+    int fds[2] = { frame_export->memfd, consumer->event };
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+    if (sendmsg(consumer->sock, &msg, MSG_DONTWAIT | MSG_NOSIGNAL) != 1) {
+        return false;
+    }
+    consumer->sent = true;
+    return true;
+}
+
+/* accept new consumers, drop those that hung up, and send the current ring to any that need it */
+static void consumers_update(frame_export_t *frame_export) {
+    int sock;
+    while ((sock = accept4(frame_export->listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        int event = -1;
+        if (frame_export->n_consumers == MAX_CONSUMERS ||
+            (event = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+            logger_log(frame_export->logger, LOGGER_WARNING, "frame export: consumer refused (at most %d)",
+                       MAX_CONSUMERS);
+            close(sock);
+            continue;
+        }
+        consumer_t *consumer = &frame_export->consumers[frame_export->n_consumers++];
+        consumer->sock = sock;
+        consumer->event = event;
+        consumer->sent = false;
+        logger_log(frame_export->logger, LOGGER_INFO, "frame export: consumer connected (%d)",
+                   frame_export->n_consumers);
+    }
+    for (int i = frame_export->n_consumers - 1; i >= 0; i--) {
+        char byte;
+        ssize_t n = recv(frame_export->consumers[i].sock, &byte, 1, MSG_DONTWAIT | MSG_PEEK);
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+            consumer_remove(frame_export, i);
+        } else if (frame_export->ring && !frame_export->consumers[i].sent &&
+                   !consumer_send(frame_export, &frame_export->consumers[i])) {
+            consumer_remove(frame_export, i);
+        }
+    }
+}
+
+static void ring_close(frame_export_t *frame_export) {
+    if (frame_export->ring) {
+        __atomic_store_n(&frame_export->ring->retired, 1, __ATOMIC_RELEASE);
+        munmap(frame_export->map, frame_export->map_size);
+        close(frame_export->memfd);
+        frame_export->ring = NULL;
+        frame_export->map = NULL;
+        frame_export->memfd = -1;
+    }
+}
+
+/* a new ring with slots for frames of data_size bytes; consumers are sent it on the next update */
+static bool ring_create(frame_export_t *frame_export, size_t data_size) {
+    size_t slot_size = (SLOT_HEADER_SIZE + data_size + SLOT_ALIGN - 1) / SLOT_ALIGN * SLOT_ALIGN;
+    size_t map_size = RING_HEADER_SIZE + FRAME_EXPORT_SLOTS * slot_size;
+    ring_close(frame_export);
+    int memfd = memfd_create("uxplay-frames", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (memfd < 0 || ftruncate(memfd, (off_t) map_size) < 0) {
+        logger_log(frame_export->logger, LOGGER_ERR, "frame export: cannot create a %u byte memfd: %s",
+                   (unsigned int) map_size, strerror(errno));
+        if (memfd >= 0) {
+            close(memfd);
+        }
+        return false;
+    }
+    /* consumers can rely on the size: it is fixed for the life of the memfd */
+    fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL);
+    unsigned char *map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    if (map == MAP_FAILED) {
+        logger_log(frame_export->logger, LOGGER_ERR, "frame export: cannot map the memfd: %s", strerror(errno));
+        close(memfd);
+        return false;
+    }
+    frame_export->memfd = memfd;
+    frame_export->map = map;
+    frame_export->map_size = map_size;
+    frame_export->ring = (frame_export_ring_t *) map;
+    frame_export->ring->magic = FRAME_EXPORT_MAGIC;
+    frame_export->ring->version = FRAME_EXPORT_VERSION;
+    frame_export->ring->header_size = RING_HEADER_SIZE;
+    frame_export->ring->slot_size = (uint32_t) slot_size;
+    frame_export->ring->slot_count = FRAME_EXPORT_SLOTS;
+    for (int i = 0; i < frame_export->n_consumers; i++) {
+        frame_export->consumers[i].sent = false;
+    }
+    logger_log(frame_export->logger, LOGGER_DEBUG, "frame export: ring of %d slots of %u bytes",
+               FRAME_EXPORT_SLOTS, (unsigned int) slot_size);
+    return true;
+}
+
+static void frame_publish(frame_export_t *frame_export, GstVideoFrame *frame, GstClockTime pts) {
+    guint n_planes = GST_VIDEO_FRAME_N_PLANES(frame);
+    guint heights[FRAME_EXPORT_MAX_PLANES] = { 0 };
+    size_t size = 0;
+    for (guint c = 0; c < GST_VIDEO_FRAME_N_COMPONENTS(frame); c++) {
+        heights[GST_VIDEO_FRAME_COMP_PLANE(frame, c)] = GST_VIDEO_FRAME_COMP_HEIGHT(frame, c);
+    }
+    for (guint p = 0; p < n_planes; p++) {
+        size += (size_t) GST_VIDEO_FRAME_PLANE_STRIDE(frame, p) * heights[p];
+    }
+    if (!frame_export->ring || SLOT_HEADER_SIZE + size > frame_export->ring->slot_size) {
+        if (!ring_create(frame_export, size)) {
+            return;
+        }
+        consumers_update(frame_export);
+    }
+
+    frame_export_ring_t *ring = frame_export->ring;
+    uint64_t n = ring->write_count;
+    unsigned char *base = frame_export->map + ring->header_size + (n % ring->slot_count) * ring->slot_size;
+    frame_export_slot_t *slot = (frame_export_slot_t *) base;
+    unsigned char *data = base + SLOT_HEADER_SIZE;
+
+    __atomic_store_n(&slot->sequence, 2 * n + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    slot->pts = pts;
+    slot->width = GST_VIDEO_FRAME_WIDTH(frame);
+    slot->height = GST_VIDEO_FRAME_HEIGHT(frame);
+    memset(slot->format, 0, sizeof(slot->format));
+    strncpy(slot->format, gst_video_format_to_string(GST_VIDEO_FRAME_FORMAT(frame)), sizeof(slot->format) - 1);
+    slot->n_planes = n_planes;
+    slot->size = (uint32_t) size;
+    size_t offset = 0;
+    for (guint p = 0; p < n_planes; p++) {
+        size_t plane_size = (size_t) GST_VIDEO_FRAME_PLANE_STRIDE(frame, p) * heights[p];
+        slot->offset[p] = (uint32_t) offset;
+        slot->stride[p] = (uint32_t) GST_VIDEO_FRAME_PLANE_STRIDE(frame, p);
+        memcpy(data + offset, GST_VIDEO_FRAME_PLANE_DATA(frame, p), plane_size);
+        offset += plane_size;
+    }
+    __atomic_store_n(&slot->sequence, 2 * n + 2, __ATOMIC_RELEASE);
+    __atomic_store_n(&ring->write_count, n + 1, __ATOMIC_RELEASE);
+
+    uint64_t one = 1;
+    for (int i = 0; i < frame_export->n_consumers; i++) {
+        if (write(frame_export->consumers[i].event, &one, sizeof(one)) < 0) {
+            /* the counter can only saturate if the consumer stopped reading: it skips frames anyway */
+        }
+    }
+}
+
+/* runs in the streaming thread of the export branch, which is separate from the display branch */
+static GstFlowReturn frame_export_new_sample(GstAppSink *appsink, gpointer user_data) {
+    frame_export_t *frame_export = (frame_export_t *) user_data;
+    GstSample *sample = gst_app_sink_pull_sample(appsink);
+    if (!sample) {
+        return GST_FLOW_EOS;
+    }
+    consumers_update(frame_export);
+    if (frame_export->n_consumers) {
+        /* nothing is copied while no one is listening */
+        GstVideoInfo info;
+        GstVideoFrame frame;
+        GstBuffer *buffer = gst_sample_get_buffer(sample);
+        if (gst_video_info_from_caps(&info, gst_sample_get_caps(sample)) &&
+            gst_video_frame_map(&frame, &info, buffer, GST_MAP_READ)) {
+            frame_publish(frame_export, &frame, GST_BUFFER_PTS(buffer));
+            gst_video_frame_unmap(&frame);
+        }
+    }
+    gst_sample_unref(sample);
+    return GST_FLOW_OK;
+}
+
+void frame_export_attach(frame_export_t *frame_export, GstElement *appsink) {
+    GstAppSinkCallbacks callbacks;
+    memset(&callbacks, 0, sizeof(callbacks));
+    callbacks.new_sample = frame_export_new_sample;
+    gst_app_sink_set_callbacks(GST_APP_SINK(appsink), &callbacks, frame_export, NULL);
+}
+
+/* call only when the pipeline feeding the appsink has stopped */
+void frame_export_free(frame_export_t *frame_export) {
+    if (frame_export) {
+        while (frame_export->n_consumers) {
+            consumer_remove(frame_export, frame_export->n_consumers - 1);
+        }
+        ring_close(frame_export);
+        close(frame_export->listener);
+        unlink(frame_export->socket_path);
+        free(frame_export->socket_path);
+        free(frame_export);
+    }
+}
+
+#else
+
+frame_export_t *frame_export_new(logger_t *logger, const char *socket_path) {
+    logger_log(logger, LOGGER_ERR, "frame export (memfd, eventfd) is only available on Linux");
+    return NULL;
+}
+
+void frame_export_attach(frame_export_t *frame_export, GstElement *appsink) {
+}
+
+void frame_export_free(frame_export_t *frame_export) {
+}
+
+#endif
@@ -0,0 +1,83 @@
+/**
+ * UxPlay - An open-source AirPlay mirroring server
+ * Copyright (C) 2026 UxPlay contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+
+/*
+ * Decoded-frame export (Linux).  With -export <path>, a tee after the video converter feeds an appsink
+ * that copies each decoded frame into a ring of fixed-size slots in a memfd.  Other processes connect
+ * to the unix socket at <path>, and receive (SCM_RIGHTS, with a one-byte message) two descriptors: the
+ * memfd, to map read-only, and an eventfd that is incremented once per published frame.
+ *
+ * The memfd starts with a frame_export_ring_t; slot i is at header_size + i * slot_size, and starts
+ * with a frame_export_slot_t followed by the frame data.  A consumer woken by the eventfd reads
+ * write_count, takes slot (write_count - 1) % slot_count, and checks that its sequence is even and
+ * unchanged after reading the frame (otherwise it was overwritten, and is skipped).  If the frame size
+ * outgrows the slots, the ring is replaced: retired is set in the old one, and a new memfd and eventfd
+ * pair is sent on the socket.  Integers are in host byte order.
+ */
+
+#ifndef FRAME_EXPORT_H
+#define FRAME_EXPORT_H
+
+#include <stdint.h>
+
+#define FRAME_EXPORT_MAGIC      0x46507855    /* "UxPF" */
+#define FRAME_EXPORT_VERSION    1
+#define FRAME_EXPORT_MAX_PLANES 4
+#define FRAME_EXPORT_SLOTS      4
+
+typedef struct frame_export_ring_s {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t header_size;      /* offset of the first slot */
+    uint32_t slot_size;        /* including the slot header */
+    uint32_t slot_count;
+    uint32_t retired;          /* nonzero once a replacement ring has been sent on the socket */
+    uint64_t write_count;      /* frames published so far */
+} frame_export_ring_t;
+
+typedef struct frame_export_slot_s {
+    uint64_t sequence;         /* odd while the slot is written; 2 * frame number + 2 once complete */
+    uint64_t pts;              /* nsecs, pipeline running time */
+    uint32_t width;
+    uint32_t height;
+    char format[16];           /* GStreamer video format name: "BGRx", "RGBx", "NV12" or "I420" */
+    uint32_t n_planes;
+    uint32_t size;             /* bytes of frame data after this header */
+    uint32_t offset[FRAME_EXPORT_MAX_PLANES];   /* of each plane, from the start of the frame data */
+    uint32_t stride[FRAME_EXPORT_MAX_PLANES];
+} frame_export_slot_t;
+
+#ifndef FRAME_EXPORT_LAYOUT_ONLY   /* consumers can include this header for the layout alone */
+
+#include <gst/gst.h>
+#include "../lib/logger.h"
+
+/* raw formats the export branch converts to, if the decoder output is not one of them already */
+#define FRAME_EXPORT_CAPS "video/x-raw,format=(string){ BGRx, RGBx, NV12, I420 }"
+
+typedef struct frame_export_s frame_export_t;
+
+frame_export_t *frame_export_new(logger_t *logger, const char *socket_path);
+void frame_export_attach(frame_export_t *frame_export, GstElement *appsink);
+void frame_export_free(frame_export_t *frame_export);
+
+#endif
+
+#endif //FRAME_EXPORT_H
@@ -0,0 +1,411 @@
+/**
+ * UxPlay - An open-source AirPlay mirroring server
+ * Copyright (C) 2026 UxPlay contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <gst/gst.h>
+#include <gst/app/gstappsrc.h>
+#include "recorder.h"
+
+#define RECORDER_FRAGMENT_MS 1000            /* mp4 fragment duration: a killed session loses at most this much */
+#define RECORDER_FILE_QUEUE_BYTES 33554432   /* absorbs disk stalls ahead of the filesink */
+#define RECORDER_MAX_QUEUED_BYTES 8388608    /* per appsrc: data is dropped beyond this, if the disk can't keep up */
+#define RECORDER_EOS_TIMEOUT (2 * GST_SECOND)
+
+static const char h264_caps[] = "video/x-h264,stream-format=(string)byte-stream,alignment=(string)au";
+
+/* the audio renderer's caps for ct = 2, 4, 8; the muxers need "channels" spelled correctly */
+static const char alac_caps[] = "audio/x-alac,channels=(int)2,rate=(int)44100,stream-format=raw,codec_data=(buffer)"
+                                "00000024""616c6163""00000000""00000160""0010280a""0e0200ff""00000000""00000000""0000ac44";
+static const char aac_lc_caps[] = "audio/mpeg,mpegversion=(int)4,channels=(int)2,rate=(int)44100,stream-format=raw,codec_data=(buffer)1210";
+static const char aac_eld_caps[] = "audio/mpeg,mpegversion=(int)4,channels=(int)2,rate=(int)44100,stream-format=raw,codec_data=(buffer)f8e85000";
+
+struct recorder_s {
+    logger_t *logger;
+    char *basename;                /* filename without its extension */
+    const char *extension;
+    bool mpegts;
+    int count;                     /* files started so far */
+    bool disabled;                 /* a session failed: don't retry until recorder_stop() */
+    GMutex mutex;                  /* audio and video arrive on different threads */
+    GCond finished;                /* signalled when a finishing session is done */
+    int finishing;                 /* sessions still being finalized on their own threads */
+    GstClock *clock;
+    GstElement *pipeline;          /* NULL between sessions */
+    gchar *location;               /* file of the current session */
+    GstElement *video_src;         /* NULL in an audio-only session */
+    GstElement *audio_src;         /* NULL if the session has no audio track */
+    unsigned char ct;              /* audio compression type of the session */
+    GstClockTime base_time;        /* timestamps in the file are relative to this */
+    bool wait_keyframe;            /* video was dropped: resume at the next keyframe */
+};
+
+static const char *audio_caps(unsigned char ct) {
+    switch (ct) {
+    case 2:
+        return alac_caps;
+    case 4:
+        return aac_lc_caps;
+    case 8:
+        return aac_eld_caps;
+    default:
+        return NULL;
+    }
+}
+
+/* true if the access unit has an SPS (type 7) or an IDR slice (type 5), where a decoder can start.   *
+ * SPS, PPS and SEI NALs precede the slices, so the scan ends at the first slice, near the start.    */
+static bool is_keyframe(const unsigned char *data, int data_len) {
+    for (int i = 0; i + 3 < data_len; i++) {
+        if (data[i] == 0x00 && data[i + 1] == 0x00 && data[i + 2] == 0x01) {
+            int nal_type = data[i + 3] & 0x1f;
+            if (nal_type == 5 || nal_type == 7) {
+                return true;
+            } else if (nal_type == 1) {
+                return false;
+            }
+            i += 3;
+        }
+    }
+    return false;
+}
+
+/* nothing else reads the recorder's bus: keep only the messages that recorder_check() and finish() pop */
+static GstBusSyncReply bus_filter(GstBus *bus, GstMessage *message, gpointer user_data) {
+    switch (GST_MESSAGE_TYPE(message)) {
+    case GST_MESSAGE_ERROR:
+    case GST_MESSAGE_EOS:
+        return GST_BUS_PASS;
+    default:
+        return GST_BUS_DROP;
+    }
+}
+
+static GstElement *recorder_appsrc(recorder_t *recorder, const char *name, const char *caps_string) {
+    GstElement *appsrc = gst_bin_get_by_name(GST_BIN(recorder->pipeline), name);
+    GstCaps *caps = gst_caps_from_string(caps_string);
+    g_object_set(appsrc, "caps", caps, "stream-type", 0, "is-live", TRUE, "format", GST_FORMAT_TIME, NULL);
+    gst_caps_unref(caps);
+    return appsrc;
+}
+
+/* a session handed over to a thread of its own to be finalized */
+typedef struct recorder_finishing_s {
+    recorder_t *recorder;
+    GstElement *pipeline;
+    gchar *location;
+} recorder_finishing_t;
+
+/* waits (up to RECORDER_EOS_TIMEOUT) for the EOS to reach the filesink, so the muxer has written its last fragment */
+static void recorder_finalize(recorder_finishing_t *finishing) {
+    recorder_t *recorder = finishing->recorder;
+    GstBus *bus = gst_element_get_bus(finishing->pipeline);
+    GstMessage *message = gst_bus_timed_pop_filtered(bus, RECORDER_EOS_TIMEOUT,
+                                                     GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+    if (message && GST_MESSAGE_TYPE(message) == GST_MESSAGE_EOS) {
+        logger_log(recorder->logger, LOGGER_INFO, "recorder: finished %s", finishing->location);
+    } else {
+        logger_log(recorder->logger, LOGGER_WARNING, "recorder: %s was not finalized cleanly, it may be "
+                   "missing its last fragment", finishing->location);
+    }
+    if (message) {
+        gst_message_unref(message);
+    }
+    gst_object_unref(bus);
+    gst_element_set_state(finishing->pipeline, GST_STATE_NULL);
+    gst_object_unref(finishing->pipeline);
+    g_free(finishing->location);
+    free(finishing);
+}
+
+static gpointer recorder_finish_thread(gpointer data) {
+    recorder_t *recorder = ((recorder_finishing_t *) data)->recorder;
+    recorder_finalize((recorder_finishing_t *) data);
+    g_mutex_lock(&recorder->mutex);
+    if (--recorder->finishing == 0) {
+        g_cond_broadcast(&recorder->finished);
+    }
+    g_mutex_unlock(&recorder->mutex);
+    return NULL;
+}
+
+/* ends the current session; with eos, its file is finalized on another thread, so that the      *
+ * receive thread never waits for it and a new session can start at once.  Called mutex locked. */
+static void recorder_finish(recorder_t *recorder, bool eos) {
+    if (!recorder->pipeline) {
+        return;
+    }
+    if (eos) {
+        if (recorder->video_src) {
+            gst_app_src_end_of_stream(GST_APP_SRC(recorder->video_src));
+        }
+        if (recorder->audio_src) {
+            gst_app_src_end_of_stream(GST_APP_SRC(recorder->audio_src));
+        }
+        recorder_finishing_t *finishing = calloc(1, sizeof(recorder_finishing_t));
+        g_assert(finishing);
+        finishing->recorder = recorder;
+        finishing->pipeline = recorder->pipeline;
+        finishing->location = recorder->location;
+        GThread *thread = g_thread_try_new("recorder finish", recorder_finish_thread, finishing, NULL);
+        if (thread) {
+            recorder->finishing++;
+            g_thread_unref(thread);
+        } else {
+            recorder_finalize(finishing);
+        }
+    } else {
+        gst_element_set_state(recorder->pipeline, GST_STATE_NULL);
+        gst_object_unref(recorder->pipeline);
+        g_free(recorder->location);
+    }
+    if (recorder->video_src) {
+        gst_object_unref(recorder->video_src);
+        recorder->video_src = NULL;
+    }
+    if (recorder->audio_src) {
+        gst_object_unref(recorder->audio_src);
+        recorder->audio_src = NULL;
+    }
+    recorder->pipeline = NULL;
+    recorder->location = NULL;
+    recorder->base_time = GST_CLOCK_TIME_NONE;
+}
+
+/* a failed session (e.g. the disk is full) is abandoned; the file written so far remains playable */
+static bool recorder_check(recorder_t *recorder) {
+    GstBus *bus = gst_element_get_bus(recorder->pipeline);
+    GstMessage *message = gst_bus_pop_filtered(bus, GST_MESSAGE_ERROR);
+    gst_object_unref(bus);
+    if (!message) {
+        return true;
+    }
+    GError *err;
+    gchar *debug_info;
+    gst_message_parse_error(message, &err, &debug_info);
+    logger_log(recorder->logger, LOGGER_ERR, "recorder: %s, recording stopped", err->message);
+    logger_log(recorder->logger, LOGGER_DEBUG, "recorder: %s", debug_info ? debug_info : "none");
+    g_clear_error(&err);
+    g_free(debug_info);
+    gst_message_unref(message);
+    recorder_finish(recorder, false);
+    recorder->disabled = true;
+    return false;
+}
+
+/* first_ntp is the timestamp of the packet that starts the session */
+static bool recorder_start(recorder_t *recorder, bool video, unsigned char ct, uint64_t first_ntp) {
+    const char *caps = audio_caps(ct);
+    GString *launch = g_string_new(NULL);
+    if (recorder->mpegts) {
+        g_string_append(launch, "mpegtsmux name=mux");
+    } else {
+        g_string_append_printf(launch, "mp4mux name=mux fragment-duration=%d streamable=true", RECORDER_FRAGMENT_MS);
+    }
+    g_string_append_printf(launch, " ! queue max-size-buffers=0 max-size-time=0 max-size-bytes=%d"
+                           " ! filesink name=file sync=false async=false", RECORDER_FILE_QUEUE_BYTES);
+    if (video) {
+        /* h264parse only repacketizes (byte-stream -> avc for mp4, SPS/PPS at every IDR for ts) */
+        g_string_append(launch, " appsrc name=video_src ! h264parse config-interval=-1 ! queue ! mux.");
+    }
+    if (caps) {
+        g_string_append(launch, " appsrc name=audio_src ! ");
+        if (recorder->mpegts) {
+            /* MPEG-TS can carry neither ALAC nor AAC-ELD: this is the only decode, of the audio */
+            g_string_append_printf(launch, "%s ! audioconvert ! audioresample ! avenc_aac ! aacparse ! ",
+                                   ct == 2 ? "avdec_alac" : "avdec_aac");
+        }
+        g_string_append(launch, "queue ! mux.");
+    }
+
+    GError *error = NULL;
+    recorder->pipeline = gst_parse_launch(launch->str, &error);
+    if (error) {
+        logger_log(recorder->logger, LOGGER_ERR, "recorder: error in gst_parse_launch:\n%s\n%s",
+                   launch->str, error->message);
+        g_clear_error(&error);
+    }
+    g_string_free(launch, TRUE);
+    if (!recorder->pipeline) {
+        recorder->disabled = true;
+        return false;
+    }
+
+    recorder->location = g_strdup_printf("%s.%d.%s", recorder->basename, ++recorder->count, recorder->extension);
+    GstElement *filesink = gst_bin_get_by_name(GST_BIN(recorder->pipeline), "file");
+    g_object_set(filesink, "location", recorder->location, NULL);
+    gst_object_unref(filesink);
+    if (video) {
+        recorder->video_src = recorder_appsrc(recorder, "video_src", h264_caps);
+    }
+    if (caps) {
+        recorder->audio_src = recorder_appsrc(recorder, "audio_src", caps);
+    }
+    GstBus *bus = gst_element_get_bus(recorder->pipeline);
+    gst_bus_set_sync_handler(bus, bus_filter, NULL, NULL);
+    gst_object_unref(bus);
+
+    /* the same clock as the renderers, so that the ntp_times they are given convert to the same pts */
+    gst_pipeline_use_clock(GST_PIPELINE_CAST(recorder->pipeline), recorder->clock);
+    gst_element_set_start_time(recorder->pipeline, GST_CLOCK_TIME_NONE);
+    /* the first packet was timestamped before it reached us: start the file no later than it, *
+     * or recorder_push() would reject it (and the video track then waits for the next IDR)   */
+    recorder->base_time = MIN((GstClockTime) first_ntp, gst_clock_get_time(recorder->clock));
+    gst_element_set_base_time(recorder->pipeline, recorder->base_time);
+    recorder->ct = caps ? ct : 0;
+    recorder->wait_keyframe = false;
+    if (gst_element_set_state(recorder->pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+        logger_log(recorder->logger, LOGGER_ERR, "recorder: failed to start writing %s", recorder->location);
+        recorder_finish(recorder, false);
+        recorder->disabled = true;
+        return false;
+    }
+    logger_log(recorder->logger, LOGGER_INFO, "recorder: writing %s%s%s", recorder->location,
+               video ? " (h264 video" : " (", caps ? (video ? ", audio)" : "audio)") : ")");
+    return true;
+}
+
+/* the receive thread only copies the data: muxing and writing happen on the pipeline's threads */
+static bool recorder_push(recorder_t *recorder, GstElement *appsrc, const unsigned char *data, int data_len,
+                          uint64_t ntp_time) {
+    if ((GstClockTime) ntp_time < recorder->base_time) {
+        return false;           /* belongs before the start of the file */
+    }
+    guint64 level;
+    g_object_get(appsrc, "current-level-bytes", &level, NULL);
+    if (level > RECORDER_MAX_QUEUED_BYTES) {
+        return false;
+    }
+    GstBuffer *buffer = gst_buffer_new_allocate(NULL, data_len, NULL);
+    g_assert(buffer);
+    gst_buffer_fill(buffer, 0, data, data_len);
+    /* AirPlay h264 has no B-frames, so dts = pts */
+    GST_BUFFER_PTS(buffer) = (GstClockTime) ntp_time - recorder->base_time;
+    GST_BUFFER_DTS(buffer) = GST_BUFFER_PTS(buffer);
+    return gst_app_src_push_buffer(GST_APP_SRC(appsrc), buffer) == GST_FLOW_OK;
+}
+
+recorder_t *recorder_new(logger_t *logger, const char *filename) {
+    recorder_t *recorder = calloc(1, sizeof(recorder_t));
+    g_assert(recorder);
+    recorder->logger = logger;
+    const char *dot = strrchr(filename, '.');
+    if (dot && !strcmp(dot, ".ts")) {
+        recorder->mpegts = true;
+        recorder->extension = "ts";
+    } else {
+        recorder->extension = "mp4";
+    }
+    if (dot && (!strcmp(dot, ".ts") || !strcmp(dot, ".mp4"))) {
+        recorder->basename = g_strndup(filename, dot - filename);
+    } else {
+        recorder->basename = g_strdup(filename);
+    }
+    g_mutex_init(&recorder->mutex);
+    g_cond_init(&recorder->finished);
+    recorder->clock = gst_system_clock_obtain();
+    g_object_set(recorder->clock, "clock-type", GST_CLOCK_TYPE_REALTIME, NULL);
+    recorder->base_time = GST_CLOCK_TIME_NONE;
+    logger_log(logger, LOGGER_INFO, "recorder: sessions will be written to %s.<n>.%s", recorder->basename,
+               recorder->extension);
+    return recorder;
+}
+
+/* a mirror session starts at the first keyframe; its audio track is the mirror audio, AAC-ELD */
+void recorder_video(recorder_t *recorder, const unsigned char *data, int data_len, uint64_t ntp_time) {
+    if (!recorder || data_len <= 0 || data[0]) {
+        return;                 /* data[0] = 1 marks data that failed decryption */
+    }
+    g_mutex_lock(&recorder->mutex);
+    bool keyframe = is_keyframe(data, data_len);
+    if (recorder->pipeline && !recorder->video_src) {
+        recorder_finish(recorder, true);           /* mirroring started during an audio-only session */
+    }
+    if (!recorder->pipeline) {
+        if (!keyframe || recorder->disabled || !recorder_start(recorder, true, 8, ntp_time)) {
+            goto unlock;
+        }
+    } else if (!recorder_check(recorder)) {
+        goto unlock;
+    }
+    if (recorder->wait_keyframe) {
+        if (!keyframe) {
+            goto unlock;
+        }
+        recorder->wait_keyframe = false;
+    }
+    if (!recorder_push(recorder, recorder->video_src, data, data_len, ntp_time)) {
+        recorder->wait_keyframe = true;
+    }
+  unlock:
+    g_mutex_unlock(&recorder->mutex);
+}
+
+/* without mirroring, an audio-only session starts with the first ALAC or AAC-LC packet, and a   *
+ * change of audio format starts a new file.  Mirror audio before the first keyframe is dropped. */
+void recorder_audio(recorder_t *recorder, unsigned char ct, const unsigned char *data, int data_len, uint64_t ntp_time) {
+    if (!recorder || data_len <= 0) {
+        return;
+    }
+    g_mutex_lock(&recorder->mutex);
+    if (recorder->pipeline && !recorder->video_src && ct != recorder->ct) {
+        recorder_finish(recorder, true);
+    }
+    if (!recorder->pipeline) {
+        if ((ct != 2 && ct != 4) || recorder->disabled || !recorder_start(recorder, false, ct, ntp_time)) {
+            goto unlock;
+        }
+    } else if (!recorder_check(recorder)) {
+        goto unlock;
+    }
+    if (recorder->audio_src && ct == recorder->ct) {
+        recorder_push(recorder, recorder->audio_src, data, data_len, ntp_time);
+    }
+  unlock:
+    g_mutex_unlock(&recorder->mutex);
+}
+
+/* ends the current session (at the end of a connection); its file is finalized in the background */
+void recorder_stop(recorder_t *recorder) {
+    if (!recorder) {
+        return;
+    }
+    g_mutex_lock(&recorder->mutex);
+    recorder_finish(recorder, true);
+    recorder->disabled = false;
+    g_mutex_unlock(&recorder->mutex);
+}
+
+void recorder_free(recorder_t *recorder) {
+    if (recorder) {
+        recorder_stop(recorder);
+        /* don't exit before every file has been finalized */
+        g_mutex_lock(&recorder->mutex);
+        while (recorder->finishing) {
+            g_cond_wait(&recorder->finished, &recorder->mutex);
+        }
+        g_mutex_unlock(&recorder->mutex);
+        gst_object_unref(recorder->clock);
+        g_cond_clear(&recorder->finished);
+        g_mutex_clear(&recorder->mutex);
+        g_free(recorder->basename);
+        free(recorder);
+    }
+}
@@ -0,0 +1,52 @@
+/**
+ * UxPlay - An open-source AirPlay mirroring server
+ * Copyright (C) 2026 UxPlay contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+
+/*
+ * Session recorder: muxes the decrypted h264 access units and the compressed audio into a
+ * fragmented MP4 (or MPEG-TS) file, without decoding the video.  Timestamps are the
+ * presentation times the renderers use, so audio and video stay in sync in the file.
+ * Writes happen on the GStreamer streaming threads, never on the receive threads.
+ * Each session (from the first keyframe until recorder_stop()) is written to its own file.
+ */
+
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "../lib/logger.h"
+
+typedef struct recorder_s recorder_t;
+
+recorder_t *recorder_new(logger_t *logger, const char *filename);
+void recorder_video(recorder_t *recorder, const unsigned char *data, int data_len, uint64_t ntp_time);
+void recorder_audio(recorder_t *recorder, unsigned char ct, const unsigned char *data, int data_len, uint64_t ntp_time);
+void recorder_stop(recorder_t *recorder);
+void recorder_free(recorder_t *recorder);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //RECORDER_H
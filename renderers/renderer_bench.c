@@ -0,0 +1,201 @@
+/**
+ * UxPlay - An open-source AirPlay mirroring server
+ * Copyright (C) 2026 UxPlay contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdatomic.h>
+#include "renderer_bench.h"
+#include "../lib/histogram.h"
+#include "../lib/metrics.h"
+
+typedef struct bench_stream_s {
+    const char *name;
+    metrics_stream_t metrics;
+    metrics_counter_t drops, overruns;
+    atomic_int attached;
+    atomic_uint_fast64_t pushed_frames, pushed_bytes;       /* into the appsrc */
+    atomic_uint_fast64_t sink_frames, sink_bytes;           /* decoded output reaching the sink */
+    atomic_uint_fast64_t early_frames;                      /* reached the sink before their pts */
+    atomic_int_fast64_t first_usecs, last_usecs;            /* monotonic time of the first and last sink buffer */
+    uint64_t drops_base, overruns_base;                     /* metrics counters when the session started */
+    histogram_t lateness;                                   /* usecs by which a buffer reached the sink after its pts */
+} bench_stream_t;
+
+static bench_stream_t bench[RENDERER_BENCH_STREAMS] = {
+    { .name = "audio", .metrics = METRICS_AUDIO, .drops = METRICS_AUDIO_CONGESTION_DROPS,
+      .overruns = METRICS_AUDIO_QUEUE_OVERRUNS },
+    { .name = "video", .metrics = METRICS_VIDEO, .drops = METRICS_VIDEO_CONGESTION_DROPS,
+      .overruns = METRICS_VIDEO_QUEUE_OVERRUNS },
+};
+static const char *report_path = RENDERER_BENCH_REPORT;
+static int report_count = 0;           /* reports written so far: each session gets its own file */
+static logger_t *logger = NULL;
+
+static void bench_reset(bench_stream_t *stream) {
+    atomic_store(&stream->pushed_frames, 0);
+    atomic_store(&stream->pushed_bytes, 0);
+    atomic_store(&stream->sink_frames, 0);
+    atomic_store(&stream->sink_bytes, 0);
+    atomic_store(&stream->early_frames, 0);
+    atomic_store(&stream->first_usecs, 0);
+    atomic_store(&stream->last_usecs, 0);
+    stream->drops_base = metrics_get_counter(stream->drops);
+    stream->overruns_base = metrics_get_counter(stream->overruns);
+    histogram_reset(&stream->lateness);
+}
+
+/* the sink is a fakesink, so this probe on its sink pad sees every decoded buffer as it arrives */
+static GstPadProbeReturn bench_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    bench_stream_t *stream = (bench_stream_t *) user_data;
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    gint64 now = g_get_monotonic_time();
+    int_fast64_t first = 0;
+
+    atomic_fetch_add_explicit(&stream->sink_frames, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&stream->sink_bytes, gst_buffer_get_size(buffer), memory_order_relaxed);
+    atomic_compare_exchange_strong(&stream->first_usecs, &first, now);
+    atomic_store_explicit(&stream->last_usecs, now, memory_order_relaxed);
+
+    GstClockTime pts = GST_BUFFER_PTS(buffer);
+    GstElement *sink = GST_ELEMENT(GST_PAD_PARENT(pad));
+    GstClock *clock = gst_element_get_clock(sink);
+    if (clock && GST_CLOCK_TIME_IS_VALID(pts)) {
+        GstClockTime running_time = gst_clock_get_time(clock) - gst_element_get_base_time(sink);
+        if (running_time >= pts) {
+            histogram_record(&stream->lateness, (running_time - pts) / GST_USECOND);
+        } else {
+            atomic_fetch_add_explicit(&stream->early_frames, 1, memory_order_relaxed);
+        }
+    }
+    if (clock) {
+        gst_object_unref(clock);
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+bool renderer_bench_is_sink(const char *sink) {
+    return sink && strcmp(sink, RENDERER_BENCH_SINK) == 0;
+}
+
+void renderer_bench_set_report(const char *path) {
+    report_path = path;
+}
+
+void renderer_bench_attach(logger_t *render_logger, renderer_bench_stream_t stream, GstElement *sink) {
+    g_assert(stream < RENDERER_BENCH_STREAMS);
+    logger = render_logger;
+    /* counts run on from one pipeline to the next (audio has one per format) until they are reported */
+    if (!atomic_exchange(&bench[stream].attached, 1)) {
+        bench_reset(&bench[stream]);
+        logger_log(logger, LOGGER_INFO, "%s renderer: bench mode, decoded output is discarded", bench[stream].name);
+    }
+    GstPad *pad = gst_element_get_static_pad(sink, "sink");
+    if (pad) {
+        gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, bench_probe, &bench[stream], NULL);
+        gst_object_unref(pad);
+    }
+}
+
+void renderer_bench_push(renderer_bench_stream_t stream, gsize bytes) {
+    if (atomic_load_explicit(&bench[stream].attached, memory_order_relaxed)) {
+        atomic_fetch_add_explicit(&bench[stream].pushed_frames, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&bench[stream].pushed_bytes, bytes, memory_order_relaxed);
+    }
+}
+
+static void bench_write_stream(FILE *fp, bench_stream_t *stream) {
+    histogram_summary_t lateness;
+    metrics_latency_t pipeline;
+    uint64_t sink_frames = atomic_load(&stream->sink_frames);
+    int64_t usecs = atomic_load(&stream->last_usecs) - atomic_load(&stream->first_usecs);
+    double fps = (sink_frames > 1 && usecs > 0) ? (double) (sink_frames - 1) * 1000000 / usecs : 0.0;
+
+    histogram_summarize(&stream->lateness, &lateness);
+    metrics_get_latency(stream->metrics, METRICS_STAGE_SINK, &pipeline);
+    fprintf(fp, "  \"%s\": {\n", stream->name);
+    fprintf(fp, "    \"pushed_frames\": %llu,\n", (unsigned long long) atomic_load(&stream->pushed_frames));
+    fprintf(fp, "    \"pushed_bytes\": %llu,\n", (unsigned long long) atomic_load(&stream->pushed_bytes));
+    fprintf(fp, "    \"decoded_frames\": %llu,\n", (unsigned long long) sink_frames);
+    fprintf(fp, "    \"decoded_bytes\": %llu,\n", (unsigned long long) atomic_load(&stream->sink_bytes));
+    fprintf(fp, "    \"duration_seconds\": %.3f,\n", (double) usecs / 1000000);
+    fprintf(fp, "    \"frames_per_second\": %.2f,\n", fps);
+    fprintf(fp, "    \"congestion_drops\": %llu,\n",
+            (unsigned long long) (metrics_get_counter(stream->drops) - stream->drops_base));
+    fprintf(fp, "    \"queue_overruns\": %llu,\n",
+            (unsigned long long) (metrics_get_counter(stream->overruns) - stream->overruns_base));
+    fprintf(fp, "    \"early_frames\": %llu,\n", (unsigned long long) atomic_load(&stream->early_frames));
+    fprintf(fp, "    \"sink_lateness_usecs\": { \"count\": %llu, \"mean\": %llu, \"p50\": %llu, \"p90\": %llu, "
+            "\"p99\": %llu, \"max\": %llu },\n", (unsigned long long) lateness.count, (unsigned long long) lateness.mean,
+            (unsigned long long) lateness.p50, (unsigned long long) lateness.p90, (unsigned long long) lateness.p99,
+            (unsigned long long) lateness.max);
+    fprintf(fp, "    \"pipeline_latency_usecs\": { \"count\": %llu, \"mean\": %llu, \"p50\": %llu, \"p90\": %llu, "
+            "\"p99\": %llu, \"max\": %llu }\n", (unsigned long long) pipeline.count, (unsigned long long) pipeline.mean,
+            (unsigned long long) pipeline.p50, (unsigned long long) pipeline.p90, (unsigned long long) pipeline.p99,
+            (unsigned long long) pipeline.max);
+    fprintf(fp, "  }");
+}
+
+/* Writes the counts since the last report, if any stream is in bench mode and saw data, and starts a new *
+ * session.  Returns 0, or -1 if the report could not be written.                                         */
+int renderer_bench_report(void) {
+    bool any = false;
+    int ret = 0;
+    for (int i = 0; i < RENDERER_BENCH_STREAMS; i++) {
+        if (atomic_load(&bench[i].attached) && atomic_load(&bench[i].pushed_frames)) {
+            any = true;
+        }
+    }
+    if (!any) {
+        return 0;
+    }
+    /* like -rec: <fn>.json is written as <fn>.<n>.json */
+    const char *dot = strrchr(report_path, '.');
+    int base_len = (dot && !strcmp(dot, ".json")) ? (int) (dot - report_path) : (int) strlen(report_path);
+    gchar *path = g_strdup_printf("%.*s.%d.json", base_len, report_path, ++report_count);
+    FILE *fp = fopen(path, "w");
+    if (!fp) {
+        logger_log(logger, LOGGER_ERR, "bench: could not write report to %s", path);
+        ret = -1;
+    } else {
+        bool first = true;
+        fprintf(fp, "{\n");
+        for (int i = 0; i < RENDERER_BENCH_STREAMS; i++) {
+            if (!atomic_load(&bench[i].attached)) {
+                continue;
+            }
+            fprintf(fp, "%s", first ? "" : ",\n");
+            bench_write_stream(fp, &bench[i]);
+            first = false;
+        }
+        fprintf(fp, "\n}\n");
+        if (fclose(fp)) {
+            logger_log(logger, LOGGER_ERR, "bench: error writing report to %s", path);
+            ret = -1;
+        } else {
+            logger_log(logger, LOGGER_INFO, "bench: wrote report to %s", path);
+        }
+    }
+    g_free(path);
+    for (int i = 0; i < RENDERER_BENCH_STREAMS; i++) {
+        if (atomic_load(&bench[i].attached)) {
+            bench_reset(&bench[i]);
+        }
+    }
+    return ret;
+}
@@ -0,0 +1,59 @@
+/**
+ * UxPlay - An open-source AirPlay mirroring server
+ * Copyright (C) 2026 UxPlay contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+
+/*
+ * Headless benchmarking backend, selected with the videosink or audiosink name "bench".
+ * The renderer then ends its pipeline in an instrumented fakesink: the stream is still
+ * decoded and converted, but discarded.  Frames and bytes are counted on the way in (at
+ * the appsrc) and out (at the sink), and the lateness of each output buffer is measured
+ * against its pts.  renderer_bench_report() writes the counts as JSON at session end.
+ */
+
+#ifndef RENDERER_BENCH_H
+#define RENDERER_BENCH_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <gst/gst.h>
+#include "../lib/logger.h"
+
+#define RENDERER_BENCH_SINK "bench"
+#define RENDERER_BENCH_REPORT "uxplay-bench-report.json"
+
+typedef enum renderer_bench_stream_e {
+    RENDERER_BENCH_AUDIO,
+    RENDERER_BENCH_VIDEO,
+    RENDERER_BENCH_STREAMS
+} renderer_bench_stream_t;
+
+bool renderer_bench_is_sink(const char *sink);
+void renderer_bench_set_report(const char *path);
+void renderer_bench_attach(logger_t *logger, renderer_bench_stream_t stream, GstElement *sink);
+void renderer_bench_push(renderer_bench_stream_t stream, gsize bytes);
+int renderer_bench_report(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //RENDERER_BENCH_H
@@ -0,0 +1,165 @@
+/**
+ * UxPlay - An open-source AirPlay mirroring server
+ * Copyright (C) 2026 UxPlay contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+
+/* Null backends, selected with the videosink or audiosink name "null": frames are accepted and *
+ * dropped without GStreamer, leaving only the cost of the receive path (network, decryption).  */
+
+#include <stdlib.h>
+#include <assert.h>
+#include "video_renderer.h"
+#include "audio_renderer.h"
+
+typedef struct video_renderer_null_s {
+    video_renderer_t base;         /* must be first */
+    logger_t *logger;
+} video_renderer_null_t;
+
+typedef struct audio_renderer_null_s {
+    audio_renderer_t base;         /* must be first */
+    logger_t *logger;
+} audio_renderer_null_t;
+
+static video_renderer_t *video_null_create(logger_t *logger, const char *server_name, videoflip_t videoflip[2],
+                                           const char *parser, const char *decoder, const char *converter,
+                                           const char *videosink, const bool *fullscreen, const bool *video_sync,
+                                           unsigned int latency_budget, const char *frame_export) {
+    video_renderer_null_t *renderer = calloc(1, sizeof(video_renderer_null_t));
+    assert(renderer);
+    renderer->base.funcs = &video_renderer_null;
+    renderer->logger = logger;
+    logger_log(logger, LOGGER_INFO, "video renderer: null, received video is discarded");
+    return &renderer->base;
+}
+
+static void video_null_start(video_renderer_t *renderer) {
+}
+
+static void video_null_stop(video_renderer_t *renderer) {
+}
+
+static void video_null_render_buffer(video_renderer_t *renderer, unsigned char *data, int *data_len, int *nal_count,
+                                     uint64_t *ntp_time) {
+}
+
+/* no buffer to lend: the receive path decrypts into its own, then calls render_buffer() */
+static void *video_null_acquire_buffer(video_renderer_t *renderer, int size, unsigned char **data) {
+    return NULL;
+}
+
+static void video_null_push_buffer(video_renderer_t *renderer, void *buffer, int *data_len, int *nal_count,
+                                   uint64_t *ntp_time) {
+}
+
+static void video_null_release_buffer(video_renderer_t *renderer, void *buffer) {
+}
+
+static bool video_null_congested(video_renderer_t *renderer) {
+    return false;
+}
+
+static void video_null_flush(video_renderer_t *renderer) {
+}
+
+static bool video_null_reset(video_renderer_t *renderer, bool close_window) {
+    return true;
+}
+
+static unsigned int video_null_listen(video_renderer_t *renderer, void *loop) {
+    return 0;
+}
+
+static void video_null_size(video_renderer_t *renderer, float *width_source, float *height_source, float *width,
+                            float *height) {
+    logger_log(((video_renderer_null_t *) renderer)->logger, LOGGER_DEBUG, "begin video stream wxh = %dx%d; source %dx%d",
+               (int) *width, (int) *height, (int) *width_source, (int) *height_source);
+}
+
+static void video_null_update_background(video_renderer_t *renderer, int type) {
+}
+
+static void video_null_destroy(video_renderer_t *renderer) {
+    free(renderer);
+}
+
+const video_renderer_funcs_t video_renderer_null = {
+    .name = "null",
+    .create = video_null_create,
+    .start = video_null_start,
+    .stop = video_null_stop,
+    .render_buffer = video_null_render_buffer,
+    .acquire_buffer = video_null_acquire_buffer,
+    .push_buffer = video_null_push_buffer,
+    .release_buffer = video_null_release_buffer,
+    .congested = video_null_congested,
+    .flush = video_null_flush,
+    .reset = video_null_reset,
+    .listen = video_null_listen,
+    .size = video_null_size,
+    .update_background = video_null_update_background,
+    .destroy = video_null_destroy,
+};
+
+static audio_renderer_t *audio_null_create(logger_t *logger, const char *audiosink, const bool *audio_sync,
+                                           const bool *video_sync, unsigned int latency_budget) {
+    audio_renderer_null_t *renderer = calloc(1, sizeof(audio_renderer_null_t));
+    assert(renderer);
+    renderer->base.funcs = &audio_renderer_null;
+    renderer->logger = logger;
+    logger_log(logger, LOGGER_INFO, "audio renderer: null, received audio is discarded");
+    return &renderer->base;
+}
+
+static void audio_null_start(audio_renderer_t *renderer, unsigned char *ct) {
+    logger_log(((audio_renderer_null_t *) renderer)->logger, LOGGER_INFO, "start audio connection, compression type %d",
+               (int) *ct);
+}
+
+static void audio_null_stop(audio_renderer_t *renderer) {
+}
+
+static void audio_null_render_buffer(audio_renderer_t *renderer, unsigned char *data, int *data_len,
+                                     unsigned short *seqnum, uint64_t *ntp_time) {
+}
+
+static void audio_null_set_volume(audio_renderer_t *renderer, float volume) {
+}
+
+static void audio_null_flush(audio_renderer_t *renderer) {
+}
+
+static bool audio_null_congested(audio_renderer_t *renderer) {
+    return false;
+}
+
+static void audio_null_destroy(audio_renderer_t *renderer) {
+    free(renderer);
+}
+
+const audio_renderer_funcs_t audio_renderer_null = {
+    .name = "null",
+    .create = audio_null_create,
+    .start = audio_null_start,
+    .stop = audio_null_stop,
+    .render_buffer = audio_null_render_buffer,
+    .set_volume = audio_null_set_volume,
+    .flush = audio_null_flush,
+    .congested = audio_null_congested,
+    .destroy = audio_null_destroy,
+};
@@ -0,0 +1,95 @@
+/**
+ * UxPlay - An open-source AirPlay mirroring server
+ * Copyright (C) 2026 UxPlay contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+#include <stdlib.h>
+#include "renderer_pool.h"
+
+#define POOL_MIN_BUFFERS 4         /* preallocated; the pool allocates more if they are all in use */
+#define POOL_SIZE_ALIGN 4096
+
+struct renderer_pool_s {
+    logger_t *logger;
+    const char *name;
+    GstBufferPool *pool;
+    gsize size;
+};
+
+static GstBufferPool *pool_create(gsize size) {
+    GstBufferPool *pool = gst_buffer_pool_new();
+    GstStructure *config = gst_buffer_pool_get_config(pool);
+    gst_buffer_pool_config_set_params(config, NULL, (guint) size, POOL_MIN_BUFFERS, 0);
+    if (!gst_buffer_pool_set_config(pool, config) || !gst_buffer_pool_set_active(pool, TRUE)) {
+        gst_object_unref(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+renderer_pool_t *renderer_pool_new(logger_t *logger, const char *name, gsize initial_size) {
+    renderer_pool_t *pool = calloc(1, sizeof(renderer_pool_t));
+    g_assert(pool);
+    pool->logger = logger;
+    pool->name = name;
+    pool->size = initial_size;
+    pool->pool = pool_create(pool->size);
+    if (!pool->pool) {
+        logger_log(logger, LOGGER_ERR, "%s: failed to create a GstBufferPool of %u byte buffers",
+                   name, (unsigned int) initial_size);
+    }
+    return pool;
+}
+
+/* returns a buffer of exactly size bytes, or NULL */
+GstBuffer *renderer_pool_acquire(renderer_pool_t *pool, gsize size) {
+    GstBuffer *buffer = NULL;
+    if (size > pool->size || !pool->pool) {
+        /* grow by a quarter, so that a slowly growing frame size does not replace the pool every time */
+        gsize new_size = (size + size / 4 + POOL_SIZE_ALIGN - 1) / POOL_SIZE_ALIGN * POOL_SIZE_ALIGN;
+        GstBufferPool *new_pool = pool_create(new_size);
+        if (!new_pool) {
+            logger_log(pool->logger, LOGGER_ERR, "%s: failed to grow the buffer pool to %u bytes",
+                       pool->name, (unsigned int) new_size);
+            return NULL;
+        }
+        logger_log(pool->logger, LOGGER_DEBUG, "%s: buffer pool size %u -> %u bytes", pool->name,
+                   (unsigned int) pool->size, (unsigned int) new_size);
+        if (pool->pool) {
+            gst_buffer_pool_set_active(pool->pool, FALSE);
+            gst_object_unref(pool->pool);
+        }
+        pool->pool = new_pool;
+        pool->size = new_size;
+    }
+    if (gst_buffer_pool_acquire_buffer(pool->pool, &buffer, NULL) != GST_FLOW_OK) {
+        return NULL;
+    }
+    /* the pool restores the full size when the buffer is released */
+    gst_buffer_set_size(buffer, (gssize) size);
+    return buffer;
+}
+
+void renderer_pool_free(renderer_pool_t *pool) {
+    if (pool) {
+        if (pool->pool) {
+            gst_buffer_pool_set_active(pool->pool, FALSE);
+            gst_object_unref(pool->pool);
+        }
+        free(pool);
+    }
+}
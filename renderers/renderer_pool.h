@@ -0,0 +1,39 @@
+/**
+ * UxPlay - An open-source AirPlay mirroring server
+ * Copyright (C) 2026 UxPlay contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+/*
+ * GstBufferPool for the buffers pushed into an appsrc, so that frames are not
+ * allocated one by one.  The pool buffers are as large as the largest frame seen
+ * so far: a larger frame replaces the pool by a bigger one (buffers of the old
+ * pool still in the pipeline are freed when they come back).
+ */
+
+#ifndef RENDERER_POOL_H
+#define RENDERER_POOL_H
+
+#include <gst/gst.h>
+#include "../lib/logger.h"
+
+typedef struct renderer_pool_s renderer_pool_t;
+
+renderer_pool_t *renderer_pool_new(logger_t *logger, const char *name, gsize initial_size);
+GstBuffer *renderer_pool_acquire(renderer_pool_t *pool, gsize size);
+void renderer_pool_free(renderer_pool_t *pool);
+
+#endif //RENDERER_POOL_H
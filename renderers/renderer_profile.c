@@ -0,0 +1,296 @@
+/**
+ * UxPlay - An open-source AirPlay mirroring server
+ * Copyright (C) 2026 UxPlay contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+
+#include <string.h>
+#include <gst/app/gstappsrc.h>
+#include <gst/app/gstappsink.h>
+#include "renderer_profile.h"
+
+#define CALIBRATION_SECONDS 2
+#define CALIBRATION_TIMEOUT (20 * GST_SECOND)
+#define LOW_LATENCY_MAX_LOAD 0.5          /* decode time per frame, as a fraction of the frame interval */
+#define BALANCED_MAX_LOAD 0.8
+
+static const renderer_profile_t profiles[] = {
+    /* drop late frames early, slice threading (no frame of decoder delay), small audio ring buffer */
+    { .name = "low-latency", .latency_budget_ms = 200, .max_lateness_ms = 10, .qos = TRUE,
+      .processing_deadline_ms = 10, .decoder_thread_type = 2, .audio_buffer_time_ms = 50,
+      .audio_latency_time_ms = 10 },
+    /* the GStreamer defaults */
+    { .name = "balanced", .latency_budget_ms = 1000, .max_lateness_ms = 20, .qos = TRUE,
+      .processing_deadline_ms = 20, .decoder_thread_type = 0, .audio_buffer_time_ms = 200,
+      .audio_latency_time_ms = 10 },
+    /* never drop late frames, frame threading for decode throughput, more audio buffering */
+    { .name = "smooth", .latency_budget_ms = 2000, .max_lateness_ms = -1, .qos = FALSE,
+      .processing_deadline_ms = 40, .decoder_thread_type = 1, .audio_buffer_time_ms = 400,
+      .audio_latency_time_ms = 20 },
+};
+#define NPROFILES (sizeof(profiles) / sizeof(profiles[0]))
+#define BALANCED (&profiles[1])
+
+/* h264 encoders for the calibration clip, in order of preference */
+static const char *encoders[][2] = {
+    { "x264enc", "x264enc tune=zerolatency speed-preset=ultrafast bframes=0 bitrate=8000" },
+    { "openh264enc", "openh264enc bitrate=8000000" },
+};
+
+static const char h264_caps[] = "video/x-h264,stream-format=(string)byte-stream,alignment=(string)au";
+
+static const renderer_profile_t *current = BALANCED;
+
+typedef struct decode_timing_s {
+    gint64 first;
+    gint64 last;
+    guint frames;
+} decode_timing_t;
+
+const renderer_profile_t *renderer_profile_find(const char *name) {
+    for (unsigned int i = 0; i < NPROFILES; i++) {
+        if (name && strcmp(name, profiles[i].name) == 0) {
+            return &profiles[i];
+        }
+    }
+    return NULL;
+}
+
+void renderer_profile_set(const renderer_profile_t *profile) {
+    current = profile ? profile : BALANCED;
+}
+
+const renderer_profile_t *renderer_profile_get(void) {
+    return current;
+}
+
+static bool has_property(GstElement *element, const char *name) {
+    return g_object_class_find_property(G_OBJECT_GET_CLASS(element), name) != NULL;
+}
+
+/* only elements that have a property get it: a bin like autovideosink has none of them, its child sink does */
+static void configure_element(GstElement *element, const renderer_profile_t *profile, bool video) {
+    if (GST_OBJECT_FLAG_IS_SET(element, GST_ELEMENT_FLAG_SINK)) {
+        if (video) {
+            if (has_property(element, "max-lateness")) {
+                g_object_set(element, "max-lateness", profile->max_lateness_ms < 0 ? (gint64) -1 :
+                             profile->max_lateness_ms * (gint64) GST_MSECOND, NULL);
+            }
+            if (has_property(element, "qos")) {
+                g_object_set(element, "qos", profile->qos, NULL);
+            }
+            if (has_property(element, "processing-deadline")) {     /* GStreamer >= 1.16 */
+                g_object_set(element, "processing-deadline", profile->processing_deadline_ms * GST_MSECOND, NULL);
+            }
+        } else {
+            if (has_property(element, "buffer-time")) {              /* microseconds */
+                g_object_set(element, "buffer-time", profile->audio_buffer_time_ms * 1000, NULL);
+            }
+            if (has_property(element, "latency-time")) {
+                g_object_set(element, "latency-time", profile->audio_latency_time_ms * 1000, NULL);
+            }
+        }
+    } else if (video && has_property(element, "thread-type")) {      /* avdec_*, GStreamer >= 1.18 */
+        g_object_set(element, "thread-type", profile->decoder_thread_type, NULL);
+    }
+}
+
+static void video_element_added(GstBin *bin, GstBin *sub_bin, GstElement *element, gpointer user_data) {
+    configure_element(element, (const renderer_profile_t *) user_data, true);
+}
+
+static void audio_element_added(GstBin *bin, GstBin *sub_bin, GstElement *element, gpointer user_data) {
+    configure_element(element, (const renderer_profile_t *) user_data, false);
+}
+
+static void apply_profile(GstElement *pipeline, const renderer_profile_t *profile, bool video) {
+    GstIterator *iter = gst_bin_iterate_recurse(GST_BIN(pipeline));
+    GValue item = G_VALUE_INIT;
+    while (gst_iterator_next(iter, &item) == GST_ITERATOR_OK) {
+        configure_element(GST_ELEMENT(g_value_get_object(&item)), profile, video);
+        g_value_reset(&item);
+    }
+    g_value_unset(&item);
+    gst_iterator_free(iter);
+    /* autovideosink and decodebin only create their elements on the way to PLAYING */
+    g_signal_connect(pipeline, "deep-element-added",
+                     video ? G_CALLBACK(video_element_added) : G_CALLBACK(audio_element_added), (gpointer) profile);
+}
+
+void renderer_profile_apply(GstElement *pipeline, bool video) {
+    apply_profile(pipeline, current, video);
+}
+
+/* waits for the end of a calibration pipeline; false on error or timeout */
+static bool wait_for_eos(logger_t *logger, GstElement *pipeline) {
+    GstBus *bus = gst_element_get_bus(pipeline);
+    GstMessage *message = gst_bus_timed_pop_filtered(bus, CALIBRATION_TIMEOUT, GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+    bool eos = message && GST_MESSAGE_TYPE(message) == GST_MESSAGE_EOS;
+    if (!message) {
+        logger_log(logger, LOGGER_WARNING, "profile calibration timed out");
+    } else if (!eos) {
+        GError *err;
+        gchar *debug_info;
+        gst_message_parse_error(message, &err, &debug_info);
+        logger_log(logger, LOGGER_WARNING, "profile calibration: %s", err->message);
+        g_clear_error(&err);
+        g_free(debug_info);
+    }
+    if (message) {
+        gst_message_unref(message);
+    }
+    gst_object_unref(bus);
+    return eos;
+}
+
+/* encodes a moving test pattern at the stream size and rate; NULL if no encoder is installed */
+static GPtrArray *encode_clip(logger_t *logger, unsigned short width, unsigned short height, unsigned short fps) {
+    const char *encoder = NULL;
+    for (unsigned int i = 0; i < sizeof(encoders) / sizeof(encoders[0]) && !encoder; i++) {
+        GstElementFactory *factory = gst_element_factory_find(encoders[i][0]);
+        if (factory) {
+            encoder = encoders[i][1];
+            gst_object_unref(factory);
+        }
+    }
+    if (!encoder) {
+        logger_log(logger, LOGGER_INFO, "profile calibration needs an h264 encoder (x264enc or openh264enc)");
+        return NULL;
+    }
+    gchar *launch = g_strdup_printf("videotestsrc num-buffers=%u horizontal-speed=8 ! video/x-raw,format=I420,"
+                                    "width=%u,height=%u,framerate=%u/1 ! %s ! h264parse ! %s ! "
+                                    "appsink name=clip sync=false", (unsigned int) fps * CALIBRATION_SECONDS,
+                                    width, height, fps, encoder, h264_caps);
+    GError *error = NULL;
+    GstElement *pipeline = gst_parse_launch(launch, &error);
+    g_free(launch);
+    if (error) {
+        logger_log(logger, LOGGER_WARNING, "profile calibration: %s", error->message);
+        g_clear_error(&error);
+        if (pipeline) {
+            gst_object_unref(pipeline);
+        }
+        return NULL;
+    }
+    GPtrArray *clip = g_ptr_array_new_with_free_func((GDestroyNotify) gst_buffer_unref);
+    GstElement *appsink = gst_bin_get_by_name(GST_BIN(pipeline), "clip");
+    gst_element_set_state(pipeline, GST_STATE_PLAYING);
+    if (wait_for_eos(logger, pipeline)) {
+        GstSample *sample;
+        while ((sample = gst_app_sink_try_pull_sample(GST_APP_SINK(appsink), 0))) {
+            g_ptr_array_add(clip, gst_buffer_ref(gst_sample_get_buffer(sample)));
+            gst_sample_unref(sample);
+        }
+    }
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_object_unref(appsink);
+    gst_object_unref(pipeline);
+    if (clip->len < 2) {
+        g_ptr_array_unref(clip);
+        return NULL;
+    }
+    return clip;
+}
+
+static void decoded_frame(GstElement *fakesink, GstBuffer *buffer, GstPad *pad, gpointer user_data) {
+    decode_timing_t *timing = (decode_timing_t *) user_data;
+    timing->last = g_get_monotonic_time();
+    if (!timing->frames++) {
+        timing->first = timing->last;
+    }
+}
+
+/* decodes the clip as fast as possible with the profile applied; msecs per frame, or -1 */
+static double time_decoder(logger_t *logger, GPtrArray *clip, const char *parser, const char *decoder,
+                           const char *converter, const renderer_profile_t *profile) {
+    decode_timing_t timing = { 0 };
+    gchar *launch = g_strdup_printf("appsrc name=src format=time ! %s ! %s ! %s ! "
+                                    "fakesink name=sink sync=false signal-handoffs=true", parser, decoder, converter);
+    GError *error = NULL;
+    GstElement *pipeline = gst_parse_launch(launch, &error);
+    g_free(launch);
+    if (error) {
+        logger_log(logger, LOGGER_WARNING, "profile calibration: %s", error->message);
+        g_clear_error(&error);
+        if (pipeline) {
+            gst_object_unref(pipeline);
+        }
+        return -1;
+    }
+    apply_profile(pipeline, profile, true);
+    GstElement *appsrc = gst_bin_get_by_name(GST_BIN(pipeline), "src");
+    GstElement *sink = gst_bin_get_by_name(GST_BIN(pipeline), "sink");
+    GstCaps *caps = gst_caps_from_string(h264_caps);
+    g_object_set(appsrc, "caps", caps, NULL);
+    gst_caps_unref(caps);
+    g_signal_connect(sink, "handoff", G_CALLBACK(decoded_frame), &timing);
+    gst_element_set_state(pipeline, GST_STATE_PLAYING);
+    for (guint i = 0; i < clip->len; i++) {
+        gst_app_src_push_buffer(GST_APP_SRC(appsrc), gst_buffer_ref((GstBuffer *) g_ptr_array_index(clip, i)));
+    }
+    gst_app_src_end_of_stream(GST_APP_SRC(appsrc));
+    bool done = wait_for_eos(logger, pipeline);
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_object_unref(sink);
+    gst_object_unref(appsrc);
+    gst_object_unref(pipeline);
+    /* from the first decoded frame: decoder startup (e.g. opening a hardware device) is not counted */
+    if (!done || timing.frames < 2) {
+        return -1;
+    }
+    return (double) (timing.last - timing.first) / 1000 / (timing.frames - 1);
+}
+
+const renderer_profile_t *renderer_profile_calibrate(logger_t *logger, const char *parser, const char *decoder,
+                                                     const char *converter, unsigned short width,
+                                                     unsigned short height, unsigned short fps) {
+    const renderer_profile_t *profile = NULL;
+    double interval = 1000.0 / fps;
+    gint64 start = g_get_monotonic_time();
+    logger_log(logger, LOGGER_INFO, "profile calibration: encoding a %d sec test clip and timing the decoder on it "
+               "(each step may take up to %d secs); \"-profile balanced\" skips this at startup",
+               CALIBRATION_SECONDS, (int) (CALIBRATION_TIMEOUT / GST_SECOND));
+    GPtrArray *clip = encode_clip(logger, width, height, fps);
+    if (!clip) {
+        logger_log(logger, LOGGER_INFO, "profile calibration not possible: using the %s profile", BALANCED->name);
+        return BALANCED;
+    }
+    /* each candidate is timed with its own decoder settings (low-latency uses slice threading) */
+    for (unsigned int i = 0; i + 1 < NPROFILES && !profile; i++) {
+        double max_load = (&profiles[i] == BALANCED) ? BALANCED_MAX_LOAD : LOW_LATENCY_MAX_LOAD;
+        double msecs = time_decoder(logger, clip, parser, decoder, converter, &profiles[i]);
+        if (msecs < 0) {
+            /* a decoder that fails here says nothing about its speed */
+            g_ptr_array_unref(clip);
+            logger_log(logger, LOGGER_INFO, "profile calibration failed: using the %s profile", BALANCED->name);
+            return BALANCED;
+        }
+        logger_log(logger, LOGGER_DEBUG, "profile calibration: %s decodes %ux%u in %.2f msecs/frame (%.0f%% of "
+                   "the %.1f msec frame interval)", profiles[i].name, width, height, msecs, 100 * msecs / interval,
+                   interval);
+        if (msecs <= max_load * interval) {
+            profile = &profiles[i];
+        }
+    }
+    g_ptr_array_unref(clip);
+    if (!profile) {
+        profile = &profiles[NPROFILES - 1];
+    }
+    logger_log(logger, LOGGER_INFO, "profile calibration (%.2f secs): using the %s profile for %ux%u at %u fps",
+               (double) (g_get_monotonic_time() - start) / 1000000, profile->name, width, height, fps);
+    return profile;
+}
@@ -0,0 +1,72 @@
+/**
+ * UxPlay - An open-source AirPlay mirroring server
+ * Copyright (C) 2026 UxPlay contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+
+/*
+ * Pipeline profiles: each trades latency against resilience to a slow decoder or display,
+ * by setting the latency budget, videosink lateness/QoS/deadline, the (libav) decoder's
+ * threading, and the audiosink's ring buffer together.  "auto" picks one at startup by
+ * timing the configured parser and decoder on a short synthetic clip.
+ */
+
+#ifndef RENDERER_PROFILE_H
+#define RENDERER_PROFILE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <gst/gst.h>
+#include "../lib/logger.h"
+
+#define RENDERER_PROFILE_AUTO "auto"
+
+typedef struct renderer_profile_s {
+    const char *name;
+    unsigned int latency_budget_ms;      /* default for -lb */
+    gint64 max_lateness_ms;              /* videosink: later frames are dropped, -1 = never */
+    gboolean qos;                        /* videosink: send QoS events upstream, so decoders can skip */
+    guint64 processing_deadline_ms;      /* videosink: time allowed for the pipeline to process a frame */
+    gint decoder_thread_type;            /* libav decoders: 0 = auto, 1 = frame, 2 = slice */
+    gint64 audio_buffer_time_ms;         /* audiosink ring buffer size */
+    gint64 audio_latency_time_ms;        /* audiosink ring buffer segment */
+} renderer_profile_t;
+
+/* NULL if name is not a profile (including "auto") */
+const renderer_profile_t *renderer_profile_find(const char *name);
+
+/* times the decoder; the lowest-latency profile that keeps up with fps at width x height */
+const renderer_profile_t *renderer_profile_calibrate(logger_t *logger, const char *parser, const char *decoder,
+                                                     const char *converter, unsigned short width,
+                                                     unsigned short height, unsigned short fps);
+
+/* the profile the renderers use; "balanced" until one is set */
+void renderer_profile_set(const renderer_profile_t *profile);
+const renderer_profile_t *renderer_profile_get(void);
+
+/* sets the profile's properties on the elements of pipeline that have them, *
+ * including those added later (inside autovideosink, decodebin)            */
+void renderer_profile_apply(GstElement *pipeline, bool video);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //RENDERER_PROFILE_H
@@ -0,0 +1,119 @@
+/**
+ * UxPlay - An open-source AirPlay mirroring server
+ * Copyright (C) 2026 UxPlay contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+ */
+
+#include <string.h>
+#include "video_renderer.h"
+
+static const video_renderer_funcs_t *const backends[] = {
+    &video_renderer_null,
+    NULL
+};
+
+static video_renderer_t *renderer = NULL;   /* the instance used by the functions below */
+
+const video_renderer_funcs_t *video_renderer_backend(const char *videosink) {
+    for (int i = 0; backends[i]; i++) {
+        if (videosink && strcmp(videosink, backends[i]->name) == 0) {
+            return backends[i];
+        }
+    }
+    return &video_renderer_gstreamer;
+}
+
+void video_renderer_init(logger_t *logger, const char *server_name, videoflip_t videoflip[2], const char *parser,
+                         const char *decoder, const char *converter, const char *videosink, const bool *fullscreen,
+                         const bool *video_sync, unsigned int latency_budget, const char *frame_export) {
+    const video_renderer_funcs_t *funcs = video_renderer_backend(videosink);
+    renderer = funcs->create(logger, server_name, videoflip, parser, decoder, converter, videosink, fullscreen,
+                             video_sync, latency_budget, frame_export);
+}
+
+video_renderer_t *video_renderer_instance() {
+    return renderer;
+}
+
+void video_renderer_start() {
+    if (renderer) {
+        renderer->funcs->start(renderer);
+    }
+}
+
+void video_renderer_stop() {
+    if (renderer) {
+        renderer->funcs->stop(renderer);
+    }
+}
+
+void video_renderer_render_buffer(unsigned char* data, int *data_len, int *nal_count, uint64_t *ntp_time) {
+    if (renderer) {
+        renderer->funcs->render_buffer(renderer, data, data_len, nal_count, ntp_time);
+    }
+}
+
+void *video_renderer_acquire_buffer(int size, unsigned char **data) {
+    if (!renderer) {
+        return NULL;
+    }
+    return renderer->funcs->acquire_buffer(renderer, size, data);
+}
+
+void video_renderer_push_buffer(void *buffer, int *data_len, int *nal_count, uint64_t *ntp_time) {
+    renderer->funcs->push_buffer(renderer, buffer, data_len, nal_count, ntp_time);
+}
+
+void video_renderer_release_buffer(void *buffer) {
+    renderer->funcs->release_buffer(renderer, buffer);
+}
+
+bool video_renderer_congested() {
+    return renderer ? renderer->funcs->congested(renderer) : false;
+}
+
+void video_renderer_flush() {
+    if (renderer) {
+        renderer->funcs->flush(renderer);
+    }
+}
+
+bool video_renderer_reset(bool close_window) {
+    return renderer ? renderer->funcs->reset(renderer, close_window) : false;
+}
+
+unsigned int video_renderer_listen(void *loop) {
+    return renderer ? renderer->funcs->listen(renderer, loop) : 0;
+}
+
+void video_renderer_size(float *width_source, float *height_source, float *width, float *height) {
+    if (renderer) {
+        renderer->funcs->size(renderer, width_source, height_source, width, height);
+    }
+}
+
+void video_renderer_update_background(int type) {
+    if (renderer) {
+        renderer->funcs->update_background(renderer, type);
+    }
+}
+
+void video_renderer_destroy() {
+    if (renderer) {
+        renderer->funcs->destroy(renderer);
+        renderer = NULL;
+    }
+}
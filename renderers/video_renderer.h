@@ -21,7 +21,7 @@
  */
 
 /* 
- * H264 renderer using gstreamer
+ * H264 renderer interface, with GStreamer and null backends
 */
 
 #ifndef VIDEO_RENDERER_H
@@ -47,13 +47,59 @@ typedef enum videoflip_e {
 
 typedef struct video_renderer_s video_renderer_t;
 
+/* A video renderer backend.  create() returns an instance whose first member is a           *
+ * video_renderer_t pointing back at these funcs; the other entries take that instance.      *
+ * Every entry must be set (a backend without a use for one supplies an empty function).     *
+ * acquire_buffer() may return NULL, and the caller then decrypts into its own buffer and    *
+ * uses render_buffer(); reset() returns false if the instance must be destroyed and         *
+ * created again; listen() returns a GLib source id, or 0 if there is nothing to watch.      */
+typedef struct video_renderer_funcs_s {
+    const char *name;
+    video_renderer_t *(*create)(logger_t *logger, const char *server_name, videoflip_t videoflip[2],
+                                const char *parser, const char *decoder, const char *converter,
+                                const char *videosink, const bool *fullscreen, const bool *video_sync,
+                                unsigned int latency_budget, const char *frame_export);
+    void (*start)(video_renderer_t *renderer);
+    void (*stop)(video_renderer_t *renderer);
+    void (*render_buffer)(video_renderer_t *renderer, unsigned char *data, int *data_len, int *nal_count,
+                          uint64_t *ntp_time);
+    void *(*acquire_buffer)(video_renderer_t *renderer, int size, unsigned char **data);
+    void (*push_buffer)(video_renderer_t *renderer, void *buffer, int *data_len, int *nal_count, uint64_t *ntp_time);
+    void (*release_buffer)(video_renderer_t *renderer, void *buffer);
+    bool (*congested)(video_renderer_t *renderer);
+    void (*flush)(video_renderer_t *renderer);
+    bool (*reset)(video_renderer_t *renderer, bool close_window);
+    unsigned int (*listen)(video_renderer_t *renderer, void *loop);
+    void (*size)(video_renderer_t *renderer, float *width_source, float *height_source, float *width, float *height);
+    void (*update_background)(video_renderer_t *renderer, int type);
+    void (*destroy)(video_renderer_t *renderer);
+} video_renderer_funcs_t;
+
+struct video_renderer_s {
+    const video_renderer_funcs_t *funcs;
+};
+
+extern const video_renderer_funcs_t video_renderer_gstreamer;
+extern const video_renderer_funcs_t video_renderer_null;
+
+/* the backend named by videosink if there is one ("null"), otherwise GStreamer with videosink */
+const video_renderer_funcs_t *video_renderer_backend(const char *videosink);
+
+/* The functions below drive a single process-wide instance, created by video_renderer_init() *
+ * with video_renderer_backend(videosink).  Further instances can be made with the funcs.     */
 void video_renderer_init (logger_t *logger, const char *server_name, videoflip_t videoflip[2], const char *parser,
                           const char *decoder, const char *converter, const char *videosink, const bool *fullscreen,
-                          const bool *video_sync);
+                          const bool *video_sync, unsigned int latency_budget, const char *frame_export);
+video_renderer_t *video_renderer_instance ();
 void video_renderer_start ();
 void video_renderer_stop ();
 void video_renderer_render_buffer (unsigned char* data, int *data_len, int *nal_count, uint64_t *ntp_time);
+void *video_renderer_acquire_buffer (int size, unsigned char **data);
+void video_renderer_push_buffer (void *buffer, int *data_len, int *nal_count, uint64_t *ntp_time);
+void video_renderer_release_buffer (void *buffer);
+bool video_renderer_congested ();
 void video_renderer_flush ();
+bool video_renderer_reset (bool close_window);
 unsigned int video_renderer_listen(void *loop);
 void video_renderer_destroy ();
 void video_renderer_size(float *width_source, float *height_source, float *width, float *height);
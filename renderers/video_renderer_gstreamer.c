@@ -24,32 +24,47 @@
 #include <gst/gst.h>
 #include <gst/app/gstappsrc.h>
 #include "../uxplay-renderer.h"
+#include "../lib/trace.h"
+#include "../lib/metrics.h"
+#include "renderer_pool.h"
+#include "renderer_bench.h"
+#include "renderer_profile.h"
+#include "frame_export.h"
 
 #define SECOND_IN_NSECS 1000000000UL
+#define VIDEO_POOL_INITIAL_SIZE (256 * 1024)   /* grows to the largest frame seen */
+#define VIDEO_APPSRC_MAX_BYTES (2 * 1024 * 1024) /* enough-data threshold: the default 200000 is less than a keyframe */
 #ifdef X_DISPLAY_FIX
 #include <gst/video/navigation.h>
 #include "x_display_fix.h"
-static bool fullscreen = false;
-static bool alt_keypress = false;
 #define MAX_X11_SEARCH_ATTEMPTS 200   /*should be less than 256 */
-static unsigned char X11_search_attempts; 
 #endif
 
-static video_renderer_t *renderer = NULL;
-static GstClockTime gst_video_pipeline_base_time = GST_CLOCK_TIME_NONE;
-static logger_t *logger = NULL;
-static unsigned short width, height, width_source, height_source;  /* not currently used */
-static bool first_packet = false;
-
-
-struct video_renderer_s {
-    GstElement *appsrc, *pipeline, *sink;
+typedef struct video_renderer_gstreamer_s {
+    video_renderer_t base;         /* must be first */
+    logger_t *logger;
+    GstClockTime base_time;        /* pts are relative to this (clock time when the pipeline started) */
+    bool first_packet;
+    unsigned short width, height, width_source, height_source;  /* not currently used */
+    GMainLoop *loop;               /* quit by the bus watch on a pipeline error */
+    GstElement *appsrc, *pipeline, *sink, *queue;
     GstBus *bus;
+    frame_export_t *frame_export;  /* publishes decoded frames to other processes, or NULL */
+    renderer_pool_t *pool;
+    GstBuffer *in_place;           /* acquired with video_renderer_acquire_buffer(), not yet pushed */
+    GstMapInfo in_place_map;
+    GstClockTime latency_budget;   /* bound on the time queued in video_queue, 0 = none */
+    gint enough_data;              /* appsrc has signalled enough-data, and not yet need-data */
+    gint congested;                /* video_queue is (or was recently) near its latency budget */
+    bool error;                    /* the pipeline posted an error, and must be rebuilt */
 #ifdef  X_DISPLAY_FIX
     const char * server_name;  
     X11_Window_t * gst_window;
+    bool fullscreen;
+    bool alt_keypress;
+    unsigned char X11_search_attempts;
 #endif
-};
+} video_renderer_gstreamer_t;
 
 static void append_videoflip (GString *launch, const videoflip_t *flip, const videoflip_t *rot) {
     /* videoflip image transform */
@@ -108,6 +123,32 @@ static void append_videoflip (GString *launch, const videoflip_t *flip, const vi
     }
 }	
 
+static GstPadProbeReturn sink_probe (GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    metrics_mark_sink(METRICS_VIDEO, GST_BUFFER_PTS(buffer));
+    return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn stage_probe (GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    metrics_mark_stage(METRICS_VIDEO, (metrics_stage_t) GPOINTER_TO_INT(user_data), GST_BUFFER_PTS(buffer));
+    return GST_PAD_PROBE_OK;
+}
+
+/* times the stage that ends where buffers enter the named element */
+static void add_stage_probe(GstElement *pipeline, const char *name, metrics_stage_t stage) {
+    GstElement *element = gst_bin_get_by_name (GST_BIN (pipeline), name);
+    if (!element) {
+        return;
+    }
+    GstPad *pad = gst_element_get_static_pad(element, "sink");
+    if (pad) {
+        gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, stage_probe, GINT_TO_POINTER(stage), NULL);
+        gst_object_unref(pad);
+    }
+    gst_object_unref(element);
+}
+
 /* apple uses colorimetry=1:3:5:1                                *
  * (not recognized by v4l2 plugin in Gstreamer  < 1.20.4)        *
  * See .../gst-libs/gst/video/video-color.h in gst-plugins-base  *
@@ -120,24 +161,41 @@ static void append_videoflip (GString *launch, const videoflip_t *flip, const vi
 
 static const char h264_caps[]="video/x-h264,stream-format=(string)byte-stream,alignment=(string)au";
 
-void video_renderer_size(float *f_width_source, float *f_height_source, float *f_width, float *f_height) {
-    width_source = (unsigned short) *f_width_source;
-    height_source = (unsigned short) *f_height_source;
-    width = (unsigned short) *f_width;
-    height = (unsigned short) *f_height;
-    logger_log(logger, LOGGER_DEBUG, "begin video stream wxh = %dx%d; source %dx%d", width, height, width_source, height_source);
+static void video_gstreamer_size(video_renderer_t *video_renderer, float *f_width_source, float *f_height_source,
+                                 float *f_width, float *f_height) {
+    video_renderer_gstreamer_t *renderer = (video_renderer_gstreamer_t *) video_renderer;
+    renderer->width_source = (unsigned short) *f_width_source;
+    renderer->height_source = (unsigned short) *f_height_source;
+    renderer->width = (unsigned short) *f_width;
+    renderer->height = (unsigned short) *f_height;
+    logger_log(renderer->logger, LOGGER_DEBUG, "begin video stream wxh = %dx%d; source %dx%d",
+               renderer->width, renderer->height, renderer->width_source, renderer->height_source);
 }
 
-void  video_renderer_init(logger_t *render_logger, const char *server_name, videoflip_t videoflip[2], const char *parser,
-                          const char *decoder, const char *converter, const char *videosink, const bool *initial_fullscreen,
-                          const bool *video_sync) {
+static void video_enough_data(GstAppSrc *appsrc, gpointer user_data) {
+    g_atomic_int_set(&((video_renderer_gstreamer_t *) user_data)->enough_data, TRUE);
+}
+
+static void video_need_data(GstAppSrc *appsrc, guint length, gpointer user_data) {
+    g_atomic_int_set(&((video_renderer_gstreamer_t *) user_data)->enough_data, FALSE);
+}
+
+/* the queue is full and drops its oldest buffer (leaky=downstream) */
+static void video_queue_overrun(GstElement *queue, gpointer user_data) {
+    metrics_count(METRICS_VIDEO_QUEUE_OVERRUNS, 1);
+    g_atomic_int_set(&((video_renderer_gstreamer_t *) user_data)->congested, TRUE);
+}
+
+static video_renderer_t *video_gstreamer_create(logger_t *logger, const char *server_name, videoflip_t videoflip[2],
+                                                const char *parser, const char *decoder, const char *converter,
+                                                const char *videosink, const bool *initial_fullscreen,
+                                                const bool *video_sync, unsigned int latency_budget,
+                                                const char *frame_export) {
     GError *error = NULL;
     GstCaps *caps = NULL;
     GstClock *clock = gst_system_clock_obtain();
     g_object_set(clock, "clock-type", GST_CLOCK_TYPE_REALTIME, NULL);
 
-    logger = render_logger;
-
     /* this call to g_set_application_name makes server_name appear in the  X11 display window title bar, */
     /* (instead of the program name uxplay taken from (argv[0]). It is only set one time. */
 
@@ -145,26 +203,42 @@ void  video_renderer_init(logger_t *render_logger, const char *server_name, vide
     if (!appname || strcmp(appname,server_name))  g_set_application_name(server_name);
     appname = NULL;
 
-    renderer = calloc(1, sizeof(video_renderer_t));
+    video_renderer_gstreamer_t *renderer = calloc(1, sizeof(video_renderer_gstreamer_t));
     g_assert(renderer);
+    renderer->base.funcs = &video_renderer_gstreamer;
+    renderer->logger = logger;
+    renderer->base_time = GST_CLOCK_TIME_NONE;
+    if (frame_export && *frame_export) {
+        renderer->frame_export = frame_export_new(logger, frame_export);
+    }
 
     GString *launch = g_string_new("appsrc name=video_source ! ");
-    g_string_append(launch, "queue ! ");
+    g_string_append(launch, "queue name=video_queue ! ");
     g_string_append(launch, parser);
-    g_string_append(launch, " ! ");
+    g_string_append(launch, " name=video_parser ! ");
     g_string_append(launch, decoder);
-    g_string_append(launch, " ! ");
+    g_string_append(launch, " name=video_decoder ! ");
     g_string_append(launch, converter);
-    g_string_append(launch, " ! ");    
+    g_string_append(launch, " name=video_converter ! ");
     append_videoflip(launch, &videoflip[0], &videoflip[1]);
-    g_string_append(launch, videosink);
+    if (renderer->frame_export) {
+        g_string_append(launch, "tee name=video_tee ! queue ! ");
+    }
+    bool bench = renderer_bench_is_sink(videosink);
+    g_string_append(launch, bench ? "fakesink" : videosink);
     g_string_append(launch, " name=video_sink");
     if (*video_sync) {
         g_string_append(launch, " sync=true");
     } else {
         g_string_append(launch, " sync=false");
     }
-    logger_log(logger, LOGGER_DEBUG, "GStreamer video pipeline will be:\n\"%s\"", launch->str);
+    if (renderer->frame_export) {
+        /* the export branch never holds up the display: it keeps at most two frames, and drops the oldest */
+        g_string_append(launch, " video_tee. ! queue leaky=downstream max-size-buffers=2 max-size-bytes=0 "
+                        "max-size-time=0 ! videoconvert ! " FRAME_EXPORT_CAPS " ! appsink name=frame_export "
+                        "sync=false async=false drop=true max-buffers=1");
+    }
+    logger_log(renderer->logger, LOGGER_DEBUG, "GStreamer video pipeline will be:\n\"%s\"", launch->str);
     renderer->pipeline = gst_parse_launch(launch->str, &error);
     if (error) {
         g_error ("get_parse_launch error (video) :\n %s\n",error->message);
@@ -172,6 +246,7 @@ void  video_renderer_init(logger_t *render_logger, const char *server_name, vide
     }
     g_assert (renderer->pipeline);
     gst_pipeline_use_clock(GST_PIPELINE_CAST(renderer->pipeline), clock);
+    renderer_profile_apply(renderer->pipeline, true);
 
     renderer->appsrc = gst_bin_get_by_name (GST_BIN (renderer->pipeline), "video_source");
     g_assert(renderer->appsrc);
@@ -183,13 +258,49 @@ void  video_renderer_init(logger_t *render_logger, const char *server_name, vide
 
     renderer->sink = gst_bin_get_by_name (GST_BIN (renderer->pipeline), "video_sink");
     g_assert(renderer->sink);
-    logger_log(logger, LOGGER_INFO, "Try video fix for X11");
+    if (bench) {
+        renderer_bench_attach(logger, RENDERER_BENCH_VIDEO, renderer->sink);
+    }
+    renderer->queue = gst_bin_get_by_name (GST_BIN (renderer->pipeline), "video_queue");
+    g_assert(renderer->queue);
+    if (renderer->frame_export) {
+        GstElement *appsink = gst_bin_get_by_name (GST_BIN (renderer->pipeline), "frame_export");
+        g_assert(appsink);
+        frame_export_attach(renderer->frame_export, appsink);
+        gst_object_unref(appsink);
+    }
+    renderer->pool = renderer_pool_new(logger, "video renderer", VIDEO_POOL_INITIAL_SIZE);
+
+    /* With a latency budget, bound video_queue by time alone, and let it drop its oldest buffer when full  *
+     * instead of blocking the appsrc (which would then queue without limit).  The receive path polls      *
+     * video_renderer_congested(), and drops whole frames up to a keyframe before the queue has to leak.   *
+     * Without a budget (-lb 0) nothing is dropped, and the appsrc keeps its default max-bytes.            */
+    renderer->latency_budget = (GstClockTime) latency_budget * GST_MSECOND;
+    if (renderer->latency_budget) {
+        g_object_set(renderer->queue, "max-size-time", renderer->latency_budget, "max-size-buffers", 0,
+                     "max-size-bytes", 0, "leaky", 2 /* downstream */, NULL);
+        g_signal_connect(renderer->queue, "overrun", G_CALLBACK(video_queue_overrun), renderer);
+        g_object_set(renderer->appsrc, "max-bytes", (guint64) VIDEO_APPSRC_MAX_BYTES, NULL);
+        g_signal_connect(renderer->appsrc, "enough-data", G_CALLBACK(video_enough_data), renderer);
+        g_signal_connect(renderer->appsrc, "need-data", G_CALLBACK(video_need_data), renderer);
+    }
+    logger_log(renderer->logger, LOGGER_DEBUG, "video latency budget %u msecs%s", latency_budget,
+               latency_budget ? "" : " (unbounded)");
+    GstPad *pad = gst_element_get_static_pad(renderer->sink, "sink");
+    if (pad) {
+        gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, sink_probe, NULL, NULL);
+        gst_object_unref(pad);
+    }
+    add_stage_probe(renderer->pipeline, "video_parser", METRICS_STAGE_QUEUE);
+    add_stage_probe(renderer->pipeline, "video_decoder", METRICS_STAGE_PARSE);
+    add_stage_probe(renderer->pipeline, "video_converter", METRICS_STAGE_DECODE);
+    logger_log(renderer->logger, LOGGER_INFO, "Try video fix for X11");
 #ifdef X_DISPLAY_FIX
-    fullscreen = *initial_fullscreen;
+    renderer->fullscreen = *initial_fullscreen;
     renderer->server_name = server_name;
     renderer->gst_window = NULL;
     bool x_display_fix = false;
-    logger_log(logger, LOGGER_INFO, "video is fix for X11 %s", videosink);
+    logger_log(renderer->logger, LOGGER_INFO, "video is fix for X11 %s", videosink);
     /* only include X11 videosinks that provide fullscreen mode, or need ZOOMFIX */
     /* limit searching for X11 Windows in case autovideosink selects an incompatible videosink */
     if (strncmp(videosink,"autovideosink", strlen("autovideosink")) == 0 ||
@@ -199,100 +310,246 @@ void  video_renderer_init(logger_t *render_logger, const char *server_name, vide
         x_display_fix = true;
     }
     if (x_display_fix) {
-        logger_log(logger, LOGGER_INFO, "Apply video fix for X11");
+        logger_log(renderer->logger, LOGGER_INFO, "Apply video fix for X11");
         renderer->gst_window = calloc(1, sizeof(X11_Window_t));
         g_assert(renderer->gst_window);
         get_X11_Display(renderer->gst_window);
         if (!renderer->gst_window->display) {
-            logger_log(logger, LOGGER_INFO, "No display disable fix for X11");
+            logger_log(renderer->logger, LOGGER_INFO, "No display disable fix for X11");
             free(renderer->gst_window);
             renderer->gst_window = NULL;
         }
     }
 #endif
+    return &renderer->base;
 }
 
-void video_renderer_start() {
-    
+static void video_gstreamer_start(video_renderer_t *video_renderer) {
+    video_renderer_gstreamer_t *renderer = (video_renderer_gstreamer_t *) video_renderer;
     gst_element_set_state (renderer->pipeline, GST_STATE_READY);
     GstState state;
     if (gst_element_get_state (renderer->pipeline, &state, NULL, 0)) {
         if (state == GST_STATE_READY) {
-            logger_log(logger, LOGGER_DEBUG, "Initialized GStreamer video renderer");
+            logger_log(renderer->logger, LOGGER_DEBUG, "Initialized GStreamer video renderer");
         } else {
-            logger_log(logger, LOGGER_ERR, "Failed to initialize GStreamer video renderer");
+            logger_log(renderer->logger, LOGGER_ERR, "Failed to initialize GStreamer video renderer");
         }
     } else {
-        logger_log(logger, LOGGER_ERR, "Failed to initialize GStreamer video renderer");
+        logger_log(renderer->logger, LOGGER_ERR, "Failed to initialize GStreamer video renderer");
     }
 
     gst_element_set_state (renderer->pipeline, GST_STATE_PLAYING);
-    gst_video_pipeline_base_time = gst_element_get_base_time(renderer->appsrc);
+    renderer->base_time = gst_element_get_base_time(renderer->appsrc);
     renderer->bus = gst_element_get_bus(renderer->pipeline);
-    first_packet = true;
+    renderer->first_packet = true;
 #ifdef X_DISPLAY_FIX
-    X11_search_attempts = 0;
+    renderer->X11_search_attempts = 0;
 #endif
 }
 
-void video_renderer_render_buffer(unsigned char* data, int *data_len, int *nal_count, uint64_t *ntp_time) {
-    GstBuffer *buffer;
+/* converts the ntp time to a pts, or returns GST_CLOCK_TIME_NONE if it precedes the pipeline start */
+static GstClockTime video_renderer_pts(video_renderer_gstreamer_t *renderer, uint64_t *ntp_time) {
     GstClockTime pts = (GstClockTime) *ntp_time; /*now in nsecs */
     //GstClockTimeDiff latency = GST_CLOCK_DIFF(gst_element_get_current_clock_time (renderer->appsrc), pts);
-    if (pts >= gst_video_pipeline_base_time) {
-        pts -= gst_video_pipeline_base_time;
-    } else {
-        logger_log(logger, LOGGER_ERR, "*** invalid ntp_time < gst_video_pipeline_base_time\n%8.6f ntp_time\n%8.6f base_time",
-                   ((double) *ntp_time) / SECOND_IN_NSECS, ((double) gst_video_pipeline_base_time) / SECOND_IN_NSECS);
-        return;
+    if (pts >= renderer->base_time) {
+        return pts - renderer->base_time;
     }
-    g_assert(data_len != 0);
-    /* first four bytes of valid  h264  video data are 0x00, 0x00, 0x00, 0x01.    *
-     * nal_count is the number of NAL units in the data: short SPS, PPS, SEI NALs *
-     * may  precede a VCL NAL. Each NAL starts with 0x00 0x00 0x00 0x01 and is    *
-     * byte-aligned: the first byte of invalid data (decryption failed) is 0x01   */
+    logger_log(renderer->logger, LOGGER_ERR, "*** invalid ntp_time < gst_video_pipeline_base_time\n%8.6f ntp_time\n%8.6f base_time",
+               ((double) *ntp_time) / SECOND_IN_NSECS, ((double) renderer->base_time) / SECOND_IN_NSECS);
+    return GST_CLOCK_TIME_NONE;
+}
+
+/* first four bytes of valid  h264  video data are 0x00, 0x00, 0x00, 0x01.    *
+ * nal_count is the number of NAL units in the data: short SPS, PPS, SEI NALs *
+ * may  precede a VCL NAL. Each NAL starts with 0x00 0x00 0x00 0x01 and is    *
+ * byte-aligned: the first byte of invalid data (decryption failed) is 0x01   */
+static bool video_renderer_check_data(video_renderer_gstreamer_t *renderer, const unsigned char *data) {
     if (data[0]) {
-        logger_log(logger, LOGGER_ERR, "*** ERROR decryption of video packet failed ");
-    } else {
-        if (first_packet) {
-            logger_log(logger, LOGGER_INFO, "Begin streaming to GStreamer video pipeline");
-            first_packet = false;
-        }
-        buffer = gst_buffer_new_allocate(NULL, *data_len, NULL);
-        g_assert(buffer != NULL);
-        //g_print("video latency %8.6f\n", (double) latency / SECOND_IN_NSECS);	
-        GST_BUFFER_PTS(buffer) = pts;
-        gst_buffer_fill(buffer, 0, data, *data_len);
-        gst_app_src_push_buffer (GST_APP_SRC(renderer->appsrc), buffer);
+        logger_log(renderer->logger, LOGGER_ERR, "*** ERROR decryption of video packet failed ");
+        return false;
+    }
+    return true;
+}
+
+/* takes ownership of buffer */
+static void video_renderer_push(video_renderer_gstreamer_t *renderer, GstBuffer *buffer, GstClockTime pts) {
+    if (renderer->first_packet) {
+        logger_log(renderer->logger, LOGGER_INFO, "Begin streaming to GStreamer video pipeline");
+        renderer->first_packet = false;
+    }
+    //g_print("video latency %8.6f\n", (double) latency / SECOND_IN_NSECS);
+    GST_BUFFER_PTS(buffer) = pts;
+    metrics_mark_push(METRICS_VIDEO, pts);
+    renderer_bench_push(RENDERER_BENCH_VIDEO, gst_buffer_get_size(buffer));
+    TRACE_BEGIN("video appsrc push");
+    if (gst_app_src_push_buffer(GST_APP_SRC(renderer->appsrc), buffer) != GST_FLOW_OK) {
+        metrics_count(METRICS_APPSRC_PUSH_FAILURES, 1);
+    }
+    TRACE_END("video appsrc push");
+    guint level;
+    guint64 level_time;
+    g_object_get(renderer->queue, "current-level-buffers", &level, "current-level-time", &level_time, NULL);
+    metrics_set_gauge(METRICS_VIDEO_QUEUE_LEVEL, level);
+    metrics_set_gauge(METRICS_VIDEO_QUEUE_TIME, (int64_t) level_time);
 #ifdef X_DISPLAY_FIX
-        if (renderer->gst_window && !(renderer->gst_window->window) && X11_search_attempts < MAX_X11_SEARCH_ATTEMPTS) {
-            X11_search_attempts++;
-            logger_log(logger, LOGGER_DEBUG, "Looking for X11 UxPlay Window, attempt %d", (int) X11_search_attempts);
-            get_x_window(renderer->gst_window, renderer->server_name);
-	    if (renderer->gst_window->window) {
-                logger_log(logger, LOGGER_INFO, "\n*** X11 Windows: Use key F11 or (left Alt)+Enter to toggle full-screen mode\n");
-                if (fullscreen) {
-                    set_fullscreen(renderer->gst_window, &fullscreen);
-                }
-            } else if (X11_search_attempts == MAX_X11_SEARCH_ATTEMPTS) {
-	      logger_log(logger, LOGGER_DEBUG, "X11 UxPlay Window not found in %d search attempts", MAX_X11_SEARCH_ATTEMPTS);
+    if (renderer->gst_window && !(renderer->gst_window->window) && renderer->X11_search_attempts < MAX_X11_SEARCH_ATTEMPTS) {
+        renderer->X11_search_attempts++;
+        logger_log(renderer->logger, LOGGER_DEBUG, "Looking for X11 UxPlay Window, attempt %d", (int) renderer->X11_search_attempts);
+        get_x_window(renderer->gst_window, renderer->server_name);
+        if (renderer->gst_window->window) {
+            logger_log(renderer->logger, LOGGER_INFO, "\n*** X11 Windows: Use key F11 or (left Alt)+Enter to toggle full-screen mode\n");
+            if (renderer->fullscreen) {
+                set_fullscreen(renderer->gst_window, &renderer->fullscreen);
             }
+        } else if (renderer->X11_search_attempts == MAX_X11_SEARCH_ATTEMPTS) {
+            logger_log(renderer->logger, LOGGER_DEBUG, "X11 UxPlay Window not found in %d search attempts", MAX_X11_SEARCH_ATTEMPTS);
         }
+    }
 #endif
+}
+
+static void video_gstreamer_render_buffer(video_renderer_t *video_renderer, unsigned char* data, int *data_len,
+                                          int *nal_count, uint64_t *ntp_time) {
+    video_renderer_gstreamer_t *renderer = (video_renderer_gstreamer_t *) video_renderer;
+    GstClockTime pts = video_renderer_pts(renderer, ntp_time);
+    if (pts == GST_CLOCK_TIME_NONE) {
+        return;
+    }
+    g_assert(data_len != 0);
+    if (!video_renderer_check_data(renderer, data)) {
+        return;
+    }
+    GstBuffer *buffer = renderer_pool_acquire(renderer->pool, *data_len);
+    if (!buffer) {
+        buffer = gst_buffer_new_allocate(NULL, *data_len, NULL);
+    }
+    g_assert(buffer != NULL);
+    gst_buffer_fill(buffer, 0, data, *data_len);
+    video_renderer_push(renderer, buffer, pts);
+}
+
+/* Write-in-place: returns a pool buffer of size bytes, mapped for writing at *data, for the
+ * receive path to decrypt into.  It must be handed back with push_buffer() or release_buffer().
+ * Only one buffer can be outstanding at a time */
+static void *video_gstreamer_acquire_buffer(video_renderer_t *video_renderer, int size, unsigned char **data) {
+    video_renderer_gstreamer_t *renderer = (video_renderer_gstreamer_t *) video_renderer;
+    if (size <= 0) {
+        return NULL;
+    }
+    g_assert(!renderer->in_place);
+    GstBuffer *buffer = renderer_pool_acquire(renderer->pool, size);
+    if (!buffer) {
+        return NULL;
+    }
+    if (!gst_buffer_map(buffer, &renderer->in_place_map, GST_MAP_WRITE)) {
+        gst_buffer_unref(buffer);
+        return NULL;
     }
+    renderer->in_place = buffer;
+    *data = renderer->in_place_map.data;
+    return buffer;
 }
 
-void video_renderer_flush() {
+static void video_gstreamer_release_buffer(video_renderer_t *video_renderer, void *buffer) {
+    video_renderer_gstreamer_t *renderer = (video_renderer_gstreamer_t *) video_renderer;
+    g_assert(buffer == renderer->in_place);
+    gst_buffer_unmap(renderer->in_place, &renderer->in_place_map);
+    gst_buffer_unref(renderer->in_place);
+    renderer->in_place = NULL;
 }
 
-void video_renderer_stop() {
-  if (renderer) {
-            gst_app_src_end_of_stream (GST_APP_SRC(renderer->appsrc));
-	    gst_element_set_state (renderer->pipeline, GST_STATE_NULL);
-  }   
+static void video_gstreamer_push_buffer(video_renderer_t *video_renderer, void *buffer, int *data_len, int *nal_count,
+                                        uint64_t *ntp_time) {
+    video_renderer_gstreamer_t *renderer = (video_renderer_gstreamer_t *) video_renderer;
+    g_assert(buffer == renderer->in_place);
+    GstClockTime pts = video_renderer_pts(renderer, ntp_time);
+    if (pts == GST_CLOCK_TIME_NONE || !video_renderer_check_data(renderer, renderer->in_place_map.data)) {
+        video_gstreamer_release_buffer(video_renderer, buffer);
+        return;
+    }
+    gst_buffer_unmap(renderer->in_place, &renderer->in_place_map);
+    renderer->in_place = NULL;
+    gst_buffer_set_size((GstBuffer *) buffer, *data_len);
+    video_renderer_push(renderer, (GstBuffer *) buffer, pts);
+}
+
+/* true while the receive path should drop frames: the appsrc has asked for no more data, or  *
+ * video_queue has filled to 3/4 of the latency budget (until it has drained below half of it) *
+ * Never true without a latency budget.                                                        */
+static bool video_gstreamer_congested(video_renderer_t *video_renderer) {
+    video_renderer_gstreamer_t *renderer = (video_renderer_gstreamer_t *) video_renderer;
+    bool congested = false;
+    if (renderer->latency_budget) {
+        guint64 level_time;
+        g_object_get(renderer->queue, "current-level-time", &level_time, NULL);
+        if (level_time >= renderer->latency_budget / 4 * 3) {
+            g_atomic_int_set(&renderer->congested, TRUE);
+        } else if (level_time < renderer->latency_budget / 2) {
+            g_atomic_int_set(&renderer->congested, FALSE);
+        }
+        congested = g_atomic_int_get(&renderer->enough_data) || g_atomic_int_get(&renderer->congested);
+    }
+    metrics_set_gauge(METRICS_VIDEO_CONGESTED, congested ? 1 : 0);
+    return congested;
+}
+
+static void video_gstreamer_flush(video_renderer_t *video_renderer) {
+}
+
+/* Prepare the pipeline for a new connection without rebuilding it.  With close_window, it passes   *
+ * through NULL, which closes the video window but keeps the elements (and the videosink that       *
+ * autovideosink chose).  Otherwise it is flushed in PAUSED (appsrc sends a new segment after the   *
+ * flush), which also keeps the window, the decoder and the negotiated caps: h264parse only         *
+ * renegotiates if the next SPS differs.  Returns false if the pipeline must be rebuilt instead.    */
+static bool video_gstreamer_reset(video_renderer_t *video_renderer, bool close_window) {
+    video_renderer_gstreamer_t *renderer = (video_renderer_gstreamer_t *) video_renderer;
+    if (renderer->error) {
+        return false;
+    }
+    gint64 start = g_get_monotonic_time();
+    if (renderer->in_place) {
+        video_gstreamer_release_buffer(video_renderer, renderer->in_place);
+    }
+    if (close_window) {
+        gst_element_set_state (renderer->pipeline, GST_STATE_NULL);
+#ifdef X_DISPLAY_FIX
+        if (renderer->gst_window) {
+            renderer->gst_window->window = (Window) NULL;
+        }
+        renderer->X11_search_attempts = 0;
+#endif
+    } else {
+        gst_element_set_state (renderer->pipeline, GST_STATE_PAUSED);
+        gst_element_send_event(renderer->appsrc, gst_event_new_flush_start());
+        gst_element_send_event(renderer->appsrc, gst_event_new_flush_stop(TRUE));
+    }
+    g_atomic_int_set(&renderer->enough_data, FALSE);
+    g_atomic_int_set(&renderer->congested, FALSE);
+
+    /* rebase: the running time restarts from the moment the pipeline plays again */
+    GstClock *clock = gst_pipeline_get_clock(GST_PIPELINE(renderer->pipeline));
+    renderer->base_time = gst_clock_get_time(clock);
+    gst_object_unref(clock);
+    gst_element_set_start_time(renderer->pipeline, GST_CLOCK_TIME_NONE);
+    gst_element_set_base_time(renderer->pipeline, renderer->base_time);
+    if (gst_element_set_state (renderer->pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+        logger_log(renderer->logger, LOGGER_ERR, "Failed to restart GStreamer video renderer");
+        return false;
+    }
+    renderer->first_packet = true;
+    logger_log(renderer->logger, LOGGER_DEBUG, "GStreamer video renderer reset (%s) in %.1f ms",
+               close_window ? "window closed" : "flushed", (double) (g_get_monotonic_time() - start) / 1000);
+    return true;
 }
 
-void video_renderer_destroy() {
+static void video_gstreamer_stop(video_renderer_t *video_renderer) {
+    video_renderer_gstreamer_t *renderer = (video_renderer_gstreamer_t *) video_renderer;
+    gst_app_src_end_of_stream (GST_APP_SRC(renderer->appsrc));
+    gst_element_set_state (renderer->pipeline, GST_STATE_NULL);
+}
+
+static void video_gstreamer_destroy(video_renderer_t *video_renderer) {
+    video_renderer_gstreamer_t *renderer = (video_renderer_gstreamer_t *) video_renderer;
     if (renderer) {
         GstState state;
         gst_element_get_state(renderer->pipeline, &state, NULL, 0);
@@ -300,10 +557,16 @@ void video_renderer_destroy() {
             gst_app_src_end_of_stream (GST_APP_SRC(renderer->appsrc));
 	    gst_element_set_state (renderer->pipeline, GST_STATE_NULL);
         }
+        if (renderer->in_place) {
+            video_gstreamer_release_buffer(video_renderer, renderer->in_place);
+        }
+        renderer_pool_free(renderer->pool);
         gst_object_unref(renderer->bus);
         gst_object_unref(renderer->sink);
+        gst_object_unref(renderer->queue);
         gst_object_unref (renderer->appsrc);
         gst_object_unref (renderer->pipeline);
+        frame_export_free(renderer->frame_export);
 #ifdef X_DISPLAY_FIX
         if (renderer->gst_window) {
             free(renderer->gst_window);
@@ -311,24 +574,24 @@ void video_renderer_destroy() {
         }
 #endif    
         free (renderer);
-        renderer = NULL;
     }
 }
 
 /* not implemented for gstreamer */
-void video_renderer_update_background(int type) {
+static void video_gstreamer_update_background(video_renderer_t *video_renderer, int type) {
 }
 
-gboolean gstreamer_pipeline_bus_callback(GstBus *bus, GstMessage *message, gpointer loop) {
+static gboolean gstreamer_pipeline_bus_callback(GstBus *bus, GstMessage *message, gpointer user_data) {
+    video_renderer_gstreamer_t *renderer = (video_renderer_gstreamer_t *) user_data;
     switch (GST_MESSAGE_TYPE (message)) {
     case GST_MESSAGE_ERROR: {
         GError *err;
         gchar *debug;
         gboolean flushing;
         gst_message_parse_error (message, &err, &debug);
-        logger_log(logger, LOGGER_INFO, "GStreamer error: %s", err->message);
+        logger_log(renderer->logger, LOGGER_INFO, "GStreamer error: %s", err->message);
         if (strstr(err->message,"Internal data stream error")) {
-            logger_log(logger, LOGGER_INFO,
+            logger_log(renderer->logger, LOGGER_INFO,
                      "*** This is a generic GStreamer error that usually means that GStreamer\n"
                      "*** was unable to construct a working video pipeline.\n"
                      "*** If you are letting the default autovideosink select the videosink,\n"
@@ -338,17 +601,48 @@ gboolean gstreamer_pipeline_bus_callback(GstBus *bus, GstMessage *message, gpoin
         }
 	g_error_free (err);
         g_free (debug);
+        renderer->error = true;
         gst_app_src_end_of_stream (GST_APP_SRC(renderer->appsrc));
 	flushing = TRUE;
         gst_bus_set_flushing(bus, flushing);
  	gst_element_set_state (renderer->pipeline, GST_STATE_NULL);
-	g_main_loop_quit( (GMainLoop *) loop);
+	g_main_loop_quit(renderer->loop);
+        break;
+    }
+    case GST_MESSAGE_QOS: {
+        /* posted for each buffer dropped for lateness: by the sink, or upstream (decoders) when it asks for QoS */
+        gint64 jitter;
+        gst_message_parse_qos_values(message, &jitter, NULL, NULL);
+        metrics_set_gauge(METRICS_VIDEO_QOS_JITTER, jitter);
+        if (gst_object_has_as_ancestor(GST_MESSAGE_SRC(message), GST_OBJECT(renderer->sink)) ||
+            GST_MESSAGE_SRC(message) == GST_OBJECT(renderer->sink)) {
+            metrics_count(METRICS_VIDEO_SINK_DROPS, 1);
+            TRACE_INSTANT("video sink drop", jitter / 1000);
+        } else {
+            metrics_count(METRICS_VIDEO_QOS_DROPS, 1);
+            TRACE_INSTANT("video qos drop", jitter / 1000);
+        }
+        break;
+    }
+    case GST_MESSAGE_LATENCY: {
+        /* an element's latency changed: redistribute it, then record what the pipeline now reports */
+        gst_bin_recalculate_latency(GST_BIN(renderer->pipeline));
+        GstQuery *query = gst_query_new_latency();
+        if (gst_element_query(renderer->pipeline, query)) {
+            gboolean live;
+            GstClockTime min_latency, max_latency;
+            gst_query_parse_latency(query, &live, &min_latency, &max_latency);
+            metrics_set_gauge(METRICS_VIDEO_PIPELINE_LATENCY, (int64_t) min_latency);
+            logger_log(renderer->logger, LOGGER_DEBUG, "video pipeline latency %.3f msecs",
+                       (double) min_latency / GST_MSECOND);
+        }
+        gst_query_unref(query);
         break;
     }
     case GST_MESSAGE_EOS:
       /* end-of-stream */
-         logger_log(logger, LOGGER_INFO, "GStreamer: End-Of-Stream");
-	//   g_main_loop_quit( (GMainLoop *) loop);
+         logger_log(renderer->logger, LOGGER_INFO, "GStreamer: End-Of-Stream");
+	//   g_main_loop_quit(renderer->loop);
         break;
 #ifdef  X_DISPLAY_FIX
     case GST_MESSAGE_ELEMENT:
@@ -362,19 +656,19 @@ gboolean gstreamer_pipeline_bus_callback(GstBus *bus, GstMessage *message, gpoin
                     switch (event_type) {
                     case GST_NAVIGATION_EVENT_KEY_PRESS:
                         if (gst_navigation_event_parse_key_event (event, &key)) {
-                            logger_log(logger, LOGGER_INFO, "KEY %s", key);
-                            if ((strcmp (key, "F11") == 0) || (alt_keypress && strcmp (key, "Return") == 0)) {
-                                fullscreen = !(fullscreen);
-                                set_fullscreen(renderer->gst_window, &fullscreen);
+                            logger_log(renderer->logger, LOGGER_INFO, "KEY %s", key);
+                            if ((strcmp (key, "F11") == 0) || (renderer->alt_keypress && strcmp (key, "Return") == 0)) {
+                                renderer->fullscreen = !(renderer->fullscreen);
+                                set_fullscreen(renderer->gst_window, &renderer->fullscreen);
                             } else if (strcmp (key, "Alt_L") == 0) {
-                                alt_keypress = true;
+                                renderer->alt_keypress = true;
                             }
                         }
                         break;
                     case GST_NAVIGATION_EVENT_KEY_RELEASE:
                         if (gst_navigation_event_parse_key_event (event, &key)) {
                             if (strcmp (key, "Alt_L") == 0) {
-                                alt_keypress = false;
+                                renderer->alt_keypress = false;
                             }
                         }
                     default:
@@ -395,14 +689,39 @@ gboolean gstreamer_pipeline_bus_callback(GstBus *bus, GstMessage *message, gpoin
     return TRUE;
 }
 
-unsigned int video_renderer_listen(void *loop) {
+static unsigned int video_gstreamer_listen(video_renderer_t *video_renderer, void *loop) {
+    video_renderer_gstreamer_t *renderer = (video_renderer_gstreamer_t *) video_renderer;
+    renderer->loop = (GMainLoop *) loop;
     return (unsigned int) gst_bus_add_watch(renderer->bus, (GstBusFunc)
-                                            gstreamer_pipeline_bus_callback, (gpointer) loop);    
-}  
+                                            gstreamer_pipeline_bus_callback, (gpointer) renderer);
+}
 
+const video_renderer_funcs_t video_renderer_gstreamer = {
+    .name = "gstreamer",
+    .create = video_gstreamer_create,
+    .start = video_gstreamer_start,
+    .stop = video_gstreamer_stop,
+    .render_buffer = video_gstreamer_render_buffer,
+    .acquire_buffer = video_gstreamer_acquire_buffer,
+    .push_buffer = video_gstreamer_push_buffer,
+    .release_buffer = video_gstreamer_release_buffer,
+    .congested = video_gstreamer_congested,
+    .flush = video_gstreamer_flush,
+    .reset = video_gstreamer_reset,
+    .listen = video_gstreamer_listen,
+    .size = video_gstreamer_size,
+    .update_background = video_gstreamer_update_background,
+    .destroy = video_gstreamer_destroy,
+};
 
+
+/* the elements of the instance behind the video_renderer_*() functions, if it is a GStreamer one */
 struct uxplay_video_renderer_info get_uxplay_video_renderer_info() {
-    struct uxplay_video_renderer_info result;
+    struct uxplay_video_renderer_info result = { 0 };
+    video_renderer_gstreamer_t *renderer = (video_renderer_gstreamer_t *) video_renderer_instance();
+    if (!renderer || renderer->base.funcs != &video_renderer_gstreamer) {
+        return result;
+    }
     result.appsrc = renderer->appsrc;
     result.pipeline = renderer->pipeline;
     result.sink = renderer->sink;
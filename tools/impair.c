@@ -0,0 +1,396 @@
+/**
+ *  Copyright (C) 2026 UxPlay contributors
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+
+#include "impair.h"
+#include "utils.h"
+
+#define SECOND_IN_NSECS 1000000000ULL
+#define MSEC_IN_NSECS 1000000ULL
+#define IMPAIR_STREAM_QUEUE_MAX (8 * 1024 * 1024)   /* queued stream bytes before the writer is blocked */
+
+typedef struct impair_packet_s {
+    uint64_t due_ns;
+    uint64_t order;                /* submission order, to keep equal due times in order */
+    uint64_t submitted_ns;
+    int fd;
+    bool stream;
+    struct sockaddr_storage addr;
+    socklen_t addrlen;
+    unsigned char *data;
+    int len;
+} impair_packet_t;
+
+struct impair_s {
+    logger_t *logger;
+    impair_config_t config;
+
+    /* Gilbert-Elliott loss model: every datagram is lost in the "bad" state */
+    double p_enter_burst;
+    double p_leave_burst;
+    bool in_burst;
+    uint64_t rng;
+
+    mutex_handle_t mutex;
+    cond_handle_t cond;            /* wakes the scheduler */
+    cond_handle_t space_cond;      /* wakes a stream writer waiting for queue space */
+    impair_packet_t *heap;         /* min-heap on (due_ns, order) */
+    int heap_count;
+    int heap_size;
+    uint64_t next_order;
+    uint64_t stream_due_ns;        /* a stream write is never due before the previous one */
+    int64_t stream_queued;
+    bool stream_failed;
+
+    impair_stats_t stats;
+
+    thread_handle_t thread;
+    bool running;
+};
+
+bool
+impair_config_active(const impair_config_t *config)
+{
+    return config->loss > 0.0 || config->reorder > 0.0 || config->duplicate > 0.0 ||
+           config->delay_ms > 0 || config->jitter_ms > 0;
+}
+
+/* xorshift64*: fast, and the same sequence for the same seed on every platform */
+static uint64_t
+impair_random(impair_t *impair)
+{
+    impair->rng ^= impair->rng >> 12;
+    impair->rng ^= impair->rng << 25;
+    impair->rng ^= impair->rng >> 27;
+    return impair->rng * 0x2545f4914f6cdd1dULL;
+}
+
+/* uniform in [0, 1) */
+static double
+impair_random_unit(impair_t *impair)
+{
+    return (double) (impair_random(impair) >> 11) / (double) (1ULL << 53);
+}
+
+static bool
+impair_packet_before(const impair_packet_t *a, const impair_packet_t *b)
+{
+    return a->due_ns < b->due_ns || (a->due_ns == b->due_ns && a->order < b->order);
+}
+
+static void
+impair_heap_push(impair_t *impair, const impair_packet_t *packet)
+{
+    if (impair->heap_count == impair->heap_size) {
+        impair->heap_size = impair->heap_size ? 2 * impair->heap_size : 64;
+        impair->heap = realloc(impair->heap, impair->heap_size * sizeof(impair_packet_t));
+        assert(impair->heap);
+    }
+    int i = impair->heap_count++;
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (!impair_packet_before(packet, &impair->heap[parent])) {
+            break;
+        }
+        impair->heap[i] = impair->heap[parent];
+        i = parent;
+    }
+    impair->heap[i] = *packet;
+}
+
+static void
+impair_heap_pop(impair_t *impair, impair_packet_t *packet)
+{
+    assert(impair->heap_count > 0);
+    *packet = impair->heap[0];
+    impair_packet_t last = impair->heap[--impair->heap_count];
+    int i = 0;
+    while (true) {
+        int child = 2 * i + 1;
+        if (child >= impair->heap_count) {
+            break;
+        }
+        if (child + 1 < impair->heap_count && impair_packet_before(&impair->heap[child + 1], &impair->heap[child])) {
+            child++;
+        }
+        if (!impair_packet_before(&impair->heap[child], &last)) {
+            break;
+        }
+        impair->heap[i] = impair->heap[child];
+        i = child;
+    }
+    if (impair->heap_count) {
+        impair->heap[i] = last;
+    }
+}
+
+static void
+impair_wait_until(impair_t *impair, uint64_t due_ns)
+{
+    struct timespec wait_time;
+    uint64_t now = utils_monotonic_ns();
+    uint64_t wait_ns = (due_ns > now ? due_ns - now : 0);
+    clock_gettime(CLOCK_REALTIME, &wait_time);
+    wait_time.tv_sec += wait_ns / SECOND_IN_NSECS;
+    wait_time.tv_nsec += wait_ns % SECOND_IN_NSECS;
+    if (wait_time.tv_nsec >= (long) SECOND_IN_NSECS) {
+        wait_time.tv_sec++;
+        wait_time.tv_nsec -= SECOND_IN_NSECS;
+    }
+    pthread_cond_timedwait(&impair->cond, &impair->mutex, &wait_time);
+}
+
+static int
+impair_send_packet(impair_packet_t *packet)
+{
+    if (!packet->stream) {
+        return sendto(packet->fd, (const char *) packet->data, packet->len, 0,
+                      (struct sockaddr *) &packet->addr, packet->addrlen) == packet->len ? 0 : -1;
+    }
+    const unsigned char *data = packet->data;
+    int len = packet->len;
+    while (len > 0) {
+        int ret = send(packet->fd, (const char *) data, len, 0);
+        if (ret <= 0) {
+            if (ret < 0 && SOCKET_GET_ERROR() == SOCKET_ERRORNAME(EINTR)) continue;
+            return -1;
+        }
+        data += ret;
+        len -= ret;
+    }
+    return 0;
+}
+
+static THREAD_RETVAL
+impair_thread(void *arg)
+{
+    impair_t *impair = arg;
+    impair_packet_t packet;
+
+    MUTEX_LOCK(impair->mutex);
+    while (impair->running) {
+        if (!impair->heap_count) {
+            pthread_cond_wait(&impair->cond, &impair->mutex);
+            continue;
+        }
+        if (impair->heap[0].due_ns > utils_monotonic_ns()) {
+            impair_wait_until(impair, impair->heap[0].due_ns);
+            continue;
+        }
+        impair_heap_pop(impair, &packet);
+        bool skip = packet.stream && impair->stream_failed;
+        MUTEX_UNLOCK(impair->mutex);
+
+        /* sent outside the lock: a blocking stream write must not block the submitters */
+        int ret = skip ? -1 : impair_send_packet(&packet);
+        uint64_t delay = utils_monotonic_ns() - packet.submitted_ns;
+        free(packet.data);
+
+        MUTEX_LOCK(impair->mutex);
+        if (packet.stream) {
+            impair->stream_queued -= packet.len;
+            impair->stream_failed |= (ret < 0);
+            COND_SIGNAL(impair->space_cond);
+        }
+        if (ret < 0) {
+            impair->stats.send_errors++;
+        } else {
+            impair->stats.sent++;
+            impair->stats.total_delay_ns += delay;
+            if (delay > impair->stats.max_delay_ns) {
+                impair->stats.max_delay_ns = delay;
+            }
+        }
+    }
+    MUTEX_UNLOCK(impair->mutex);
+    return 0;
+}
+
+impair_t *
+impair_init(logger_t *logger, const impair_config_t *config)
+{
+    impair_t *impair;
+
+    assert(config);
+    impair = calloc(1, sizeof(impair_t));
+    if (!impair) {
+        return NULL;
+    }
+    impair->logger = logger;
+    impair->config = *config;
+    /* splitmix64 of the seed, so that neighbouring seeds give unrelated sequences */
+    uint64_t z = config->seed + 0x9e3779b97f4a7c15ULL;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    z ^= z >> 31;
+    impair->rng = z ? z : 1;
+
+    /* with a mean burst length b and mean loss l, the bad state is left with
+     * probability 1/b and entered with probability l/(b(1-l)) */
+    if (config->loss > 0.0 && config->loss < 1.0 && config->burst > 1.0) {
+        impair->p_leave_burst = 1.0 / config->burst;
+        impair->p_enter_burst = config->loss * impair->p_leave_burst / (1.0 - config->loss);
+    }
+
+    MUTEX_CREATE(impair->mutex);
+    COND_CREATE(impair->cond);
+    COND_CREATE(impair->space_cond);
+    impair->running = true;
+    THREAD_CREATE(impair->thread, impair_thread, impair);
+    logger_log(logger, LOGGER_DEBUG, "impair: loss %.3f burst %.1f reorder %.3f duplicate %.3f delay %d ms jitter %d ms seed %llu",
+               config->loss, config->burst, config->reorder, config->duplicate, config->delay_ms, config->jitter_ms,
+               (unsigned long long) config->seed);
+    return impair;
+}
+
+/* called with the mutex held */
+static uint64_t
+impair_delay_ns(impair_t *impair)
+{
+    uint64_t delay = (uint64_t) impair->config.delay_ms * MSEC_IN_NSECS;
+    if (impair->config.jitter_ms > 0) {
+        delay += impair_random(impair) % ((uint64_t) impair->config.jitter_ms * MSEC_IN_NSECS + 1);
+    }
+    return delay;
+}
+
+static void
+impair_queue(impair_t *impair, int fd, bool stream, const struct sockaddr *addr, socklen_t addrlen,
+             const unsigned char *data, int len, uint64_t now, uint64_t due_ns)
+{
+    impair_packet_t packet;
+    memset(&packet, 0, sizeof(packet));
+    packet.due_ns = due_ns;
+    packet.order = impair->next_order++;
+    packet.submitted_ns = now;
+    packet.fd = fd;
+    packet.stream = stream;
+    if (addr) {
+        memcpy(&packet.addr, addr, addrlen);
+        packet.addrlen = addrlen;
+    }
+    packet.data = malloc(len);
+    assert(packet.data);
+    memcpy(packet.data, data, len);
+    packet.len = len;
+    bool first = (!impair->heap_count || impair_packet_before(&packet, &impair->heap[0]));
+    impair_heap_push(impair, &packet);
+    if (first) {
+        COND_SIGNAL(impair->cond);
+    }
+}
+
+/* Send a datagram through the impairer.  Returns 1 if it (or a duplicate of it)
+ * will be sent, 0 if it was dropped */
+int
+impair_sendto(impair_t *impair, int fd, const struct sockaddr *addr, socklen_t addrlen,
+              const unsigned char *data, int len)
+{
+    const impair_config_t *config = &impair->config;
+    uint64_t now = utils_monotonic_ns();
+
+    MUTEX_LOCK(impair->mutex);
+    impair->stats.packets++;
+
+    bool lost;
+    if (impair->p_leave_burst > 0.0) {
+        double r = impair_random_unit(impair);
+        impair->in_burst = impair->in_burst ? (r >= impair->p_leave_burst) : (r < impair->p_enter_burst);
+        lost = impair->in_burst;
+    } else {
+        lost = (config->loss > 0.0 && impair_random_unit(impair) < config->loss);
+    }
+    if (lost) {
+        impair->stats.dropped++;
+        MUTEX_UNLOCK(impair->mutex);
+        return 0;
+    }
+
+    uint64_t due = now + impair_delay_ns(impair);
+    if (config->reorder > 0.0 && impair_random_unit(impair) < config->reorder) {
+        due += IMPAIR_REORDER_MS * MSEC_IN_NSECS;
+        impair->stats.reordered++;
+    }
+    impair_queue(impair, fd, false, addr, addrlen, data, len, now, due);
+    if (config->duplicate > 0.0 && impair_random_unit(impair) < config->duplicate) {
+        impair_queue(impair, fd, false, addr, addrlen, data, len, now, due);
+        impair->stats.duplicated++;
+    }
+    MUTEX_UNLOCK(impair->mutex);
+    return 1;
+}
+
+/* Write to a stream socket through the impairer: the data is delayed (with jitter) but
+ * kept in order.  Blocks while too much data is queued.  Returns -1 once a write to the
+ * socket has failed */
+int
+impair_send_stream(impair_t *impair, int fd, const unsigned char *data, int len)
+{
+    uint64_t now = utils_monotonic_ns();
+
+    MUTEX_LOCK(impair->mutex);
+    while (!impair->stream_failed && impair->stream_queued > IMPAIR_STREAM_QUEUE_MAX) {
+        pthread_cond_wait(&impair->space_cond, &impair->mutex);
+    }
+    if (impair->stream_failed) {
+        MUTEX_UNLOCK(impair->mutex);
+        return -1;
+    }
+    impair->stats.packets++;
+    uint64_t due = now + impair_delay_ns(impair);
+    if (due < impair->stream_due_ns) {
+        due = impair->stream_due_ns;
+    }
+    impair->stream_due_ns = due;
+    impair->stream_queued += len;
+    impair_queue(impair, fd, true, NULL, 0, data, len, now, due);
+    MUTEX_UNLOCK(impair->mutex);
+    return 0;
+}
+
+void
+impair_get_stats(impair_t *impair, impair_stats_t *stats)
+{
+    MUTEX_LOCK(impair->mutex);
+    *stats = impair->stats;
+    MUTEX_UNLOCK(impair->mutex);
+}
+
+/* stops the scheduler; data that is still queued is discarded */
+void
+impair_destroy(impair_t *impair)
+{
+    if (impair) {
+        MUTEX_LOCK(impair->mutex);
+        impair->running = false;
+        impair->stream_failed = true;
+        COND_SIGNAL(impair->cond);
+        pthread_cond_broadcast(&impair->space_cond);
+        MUTEX_UNLOCK(impair->mutex);
+        THREAD_JOIN(impair->thread);
+
+        for (int i = 0; i < impair->heap_count; i++) {
+            free(impair->heap[i].data);
+        }
+        free(impair->heap);
+        MUTEX_DESTROY(impair->mutex);
+        COND_DESTROY(impair->cond);
+        COND_DESTROY(impair->space_cond);
+        free(impair);
+    }
+}
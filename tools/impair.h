@@ -0,0 +1,65 @@
+/**
+ *  Copyright (C) 2026 UxPlay contributors
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ */
+
+/* In-process network impairment, in the manner of netem but without root: data
+ * handed to an impair_t is delayed, dropped, reordered or duplicated before being
+ * sent by its own scheduler thread.  All random decisions come from a generator
+ * seeded by the caller, so a run can be repeated exactly.
+ *
+ * Datagrams get the full set of impairments.  A stream (TCP) connection can only
+ * be delayed: it gets delay and jitter, but its bytes are never lost or reordered. */
+
+#ifndef IMPAIR_H
+#define IMPAIR_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "compat.h"
+#include "logger.h"
+
+typedef struct impair_config_s {
+    double loss;                   /* fraction of datagrams lost, 0..1 */
+    double burst;                  /* mean length of a loss burst, in datagrams (<= 1: independent losses) */
+    double reorder;                /* fraction of datagrams held back by IMPAIR_REORDER_MS */
+    double duplicate;              /* fraction of datagrams sent twice */
+    int delay_ms;                  /* constant delay */
+    int jitter_ms;                 /* uniformly distributed extra delay, 0..jitter_ms */
+    uint64_t seed;
+} impair_config_t;
+
+typedef struct impair_stats_s {
+    uint64_t packets;              /* datagrams (or stream writes) handed to the impairer */
+    uint64_t dropped;
+    uint64_t reordered;
+    uint64_t duplicated;
+    uint64_t sent;
+    uint64_t send_errors;
+    uint64_t total_delay_ns;       /* added latency of the sent packets, measured when sent */
+    uint64_t max_delay_ns;
+} impair_stats_t;
+
+#define IMPAIR_REORDER_MS 20
+
+typedef struct impair_s impair_t;
+
+bool impair_config_active(const impair_config_t *config);
+
+impair_t *impair_init(logger_t *logger, const impair_config_t *config);
+int impair_sendto(impair_t *impair, int fd, const struct sockaddr *addr, socklen_t addrlen,
+                  const unsigned char *data, int len);
+int impair_send_stream(impair_t *impair, int fd, const unsigned char *data, int len);
+void impair_get_stats(impair_t *impair, impair_stats_t *stats);
+void impair_destroy(impair_t *impair);
+
+#endif //IMPAIR_H
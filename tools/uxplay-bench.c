@@ -0,0 +1,688 @@
+/**
+ *  Copyright (C) 2026 UxPlay contributors
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ */
+
+/* uxplay-bench: microbenchmarks of the per-packet code paths of the airplay library
+ * (audio buffer and decryption, mirror decryption and NAL rewriting, RTSP parsing,
+ * byte accessors, playfair, ntp time conversion).
+ *
+ * Each benchmark is run for at least -min_time seconds (the iteration count is
+ * scaled up until it is) and reported as JSON in the format written by Google
+ * Benchmark (--benchmark_format=json), so that runs from different commits can be
+ * compared with its tools/compare.py. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+#include "logger.h"
+#include "byteutils.h"
+#include "raop.h"
+#include "raop_buffer.h"
+#include "raop_ntp.h"
+#include "raop_rtp_mirror.h"
+#include "mirror_buffer.h"
+#include "http_request.h"
+#include "playfair/playfair.h"
+#include "utils.h"
+
+#define SECOND_IN_NSECS 1000000000ULL
+#define MAX_ITERATIONS 1000000000ULL
+#define RTP_HEADER_LEN 12
+
+typedef struct bench_state_s {
+    uint64_t iterations;
+    uint64_t start_ns;
+    clock_t start_cpu;
+    uint64_t real_ns;
+    double cpu_ns;
+    bool running;
+} bench_state_t;
+
+typedef void (*bench_func_t)(bench_state_t *state, int arg);
+
+typedef struct bench_case_s {
+    const char *name;
+    bench_func_t func;
+    int arg;
+    uint64_t bytes_per_iteration;    /* 0 if throughput in bytes is not meaningful */
+    uint64_t items_per_iteration;
+} bench_case_t;
+
+/* unlike assert(), checked in release builds too, which are the ones benchmarked */
+#define BENCH_CHECK(cond) do { if (!(cond)) bench_fail(__func__, #cond); } while (0)
+
+static void
+bench_fail(const char *func, const char *cond)
+{
+    fprintf(stderr, "uxplay-bench: %s: check failed: %s\n", func, cond);
+    exit(1);
+}
+
+/* results are stored here so that the compiler cannot discard the benchmarked calls */
+static volatile uint64_t bench_sink;
+static logger_t *bench_logger;
+
+/* timing starts and stops around the measured loop, so that per-case setup is not counted */
+static void
+bench_start(bench_state_t *state)
+{
+    state->running = true;
+    state->start_cpu = clock();
+    state->start_ns = utils_monotonic_ns();
+}
+
+static void
+bench_stop(bench_state_t *state)
+{
+    uint64_t now = utils_monotonic_ns();
+    clock_t cpu = clock();
+    BENCH_CHECK(state->running);
+    state->real_ns = now - state->start_ns;
+    state->cpu_ns = (double) (cpu - state->start_cpu) * SECOND_IN_NSECS / CLOCKS_PER_SEC;
+    state->running = false;
+}
+
+static void
+bench_fill_random(unsigned char *data, size_t len, uint32_t seed)
+{
+    uint32_t x = seed ? seed : 1;
+    for (size_t i = 0; i < len; i++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        data[i] = (unsigned char) x;
+    }
+}
+
+static void
+bench_put_be(unsigned char *data, int offset, uint32_t value, int len)
+{
+    for (int i = len - 1; i >= 0; i--) {
+        data[offset + i] = (unsigned char) value;
+        value >>= 8;
+    }
+}
+
+static const unsigned char bench_aeskey[16] = {
+    0x4e, 0x2a, 0x73, 0x0f, 0x9b, 0xd1, 0x66, 0x38, 0xa5, 0x1c, 0xe0, 0x57, 0x82, 0x3d, 0xf4, 0x19
+};
+static const unsigned char bench_aesiv[16] = {
+    0x10, 0x32, 0x54, 0x76, 0x98, 0xba, 0xdc, 0xfe, 0xef, 0xcd, 0xab, 0x89, 0x67, 0x45, 0x23, 0x01
+};
+
+/* audio: the arg is the reordering: packets arrive in reversed groups of arg packets */
+
+#define AUDIO_PAYLOAD_LEN 368
+
+static void
+bench_raop_buffer_reorder(bench_state_t *state, int arg)
+{
+    raop_buffer_t *buffer = raop_buffer_init(bench_logger, bench_aeskey, bench_aesiv);
+    unsigned char packet[RTP_HEADER_LEN + AUDIO_PAYLOAD_LEN];
+    uint64_t ntp_timestamp = 0, rtp_timestamp = 0;
+    unsigned short seqnum = 0;
+    uint64_t received = 0;
+
+    BENCH_CHECK(buffer);
+    bench_fill_random(packet, sizeof(packet), 1);
+    packet[0] = 0x80;
+    packet[1] = 0x60;
+
+    /* the first packet sets the start of the buffer, later ones then are never "late" */
+    bench_put_be(packet, 2, seqnum++, 2);
+    raop_buffer_enqueue(buffer, packet, sizeof(packet), &ntp_timestamp, &rtp_timestamp, 1);
+
+    state->iterations = (state->iterations + arg - 1) / arg * arg;
+    bench_start(state);
+    for (uint64_t i = 0; i < state->iterations; i += arg) {
+        for (int j = arg - 1; j >= 0; j--) {
+            bench_put_be(packet, 2, (unsigned short) (seqnum + j), 2);
+            rtp_timestamp = (uint64_t) (unsigned short) (seqnum + j) * 352;
+            raop_buffer_enqueue(buffer, packet, sizeof(packet), &ntp_timestamp, &rtp_timestamp, 1);
+        }
+        seqnum += arg;
+        void *payload;
+        unsigned int length;
+        unsigned short seq;
+        uint64_t decrypted_ns;
+        while ((payload = raop_buffer_dequeue(buffer, &length, &ntp_timestamp, &rtp_timestamp, &seq, &decrypted_ns, 0))) {
+            received += length;
+            free(payload);
+        }
+    }
+    bench_stop(state);
+    bench_sink = received;
+    raop_buffer_destroy(buffer);
+}
+
+static void
+bench_raop_buffer_decrypt(bench_state_t *state, int arg)
+{
+    raop_buffer_t *buffer = raop_buffer_init(bench_logger, bench_aeskey, bench_aesiv);
+    unsigned char *packet = malloc(RTP_HEADER_LEN + arg);
+    unsigned char *output = malloc(arg);
+    unsigned int outputlen = 0;
+
+    BENCH_CHECK(buffer && packet && output);
+    bench_fill_random(packet, RTP_HEADER_LEN + arg, 2);
+    bench_start(state);
+    for (uint64_t i = 0; i < state->iterations; i++) {
+        raop_buffer_decrypt(buffer, packet, output, arg, &outputlen);
+    }
+    bench_stop(state);
+    bench_sink = output[0] + outputlen;
+    free(output);
+    free(packet);
+    raop_buffer_destroy(buffer);
+}
+
+/* video */
+
+static void
+bench_mirror_buffer_decrypt(bench_state_t *state, int arg)
+{
+    mirror_buffer_t *buffer = mirror_buffer_init(bench_logger, bench_aeskey);
+    uint64_t stream_connection_id = 0x1122334455667788ULL;
+    unsigned char *input = malloc(arg);
+    unsigned char *output = malloc(arg);
+
+    BENCH_CHECK(buffer && input && output);
+    mirror_buffer_init_aes(buffer, &stream_connection_id);
+    bench_fill_random(input, arg, 3);
+    bench_start(state);
+    for (uint64_t i = 0; i < state->iterations; i++) {
+        mirror_buffer_decrypt(buffer, input, output, arg);
+    }
+    bench_stop(state);
+    bench_sink = output[arg - 1];
+    free(output);
+    free(input);
+    mirror_buffer_destroy(buffer);
+}
+
+/* a 64 kB frame made of an SEI and arg slice NALs, each with a 4-byte length prefix */
+
+#define NAL_FRAME_LEN 65536
+#define NAL_SEI_LEN 24
+
+static void
+bench_nal_to_annexb(bench_state_t *state, int arg)
+{
+    unsigned char *frame = malloc(NAL_FRAME_LEN);
+    int *offsets = calloc(arg + 1, sizeof(int));
+    int *lengths = calloc(arg + 1, sizeof(int));
+    int slice_len = (NAL_FRAME_LEN - NAL_SEI_LEN - 4) / arg - 4;
+    int count = 0, nal_count = 0;
+    bool valid = true;
+
+    BENCH_CHECK(frame && offsets && lengths && slice_len > 1);
+    bench_fill_random(frame, NAL_FRAME_LEN, 4);
+    int offset = 0;
+    for (int i = 0; i <= arg; i++) {
+        int len = (i == 0 ? NAL_SEI_LEN : (i == arg ? NAL_FRAME_LEN - offset - 4 : slice_len));
+        offsets[count] = offset;
+        lengths[count++] = len;
+        frame[offset + 4] = (i == 0 ? 0x06 : 0x01);
+        offset += 4 + len;
+    }
+    BENCH_CHECK(offset == NAL_FRAME_LEN);
+
+    bench_start(state);
+    for (uint64_t i = 0; i < state->iterations; i++) {
+        /* the rewrite is done in place: restore the length prefixes first */
+        for (int j = 0; j < count; j++) {
+            bench_put_be(frame, offsets[j], lengths[j], 4);
+        }
+        valid &= raop_rtp_mirror_nal_to_annexb(bench_logger, frame, NAL_FRAME_LEN, &nal_count);
+    }
+    bench_stop(state);
+    BENCH_CHECK(valid && nal_count == count);
+    bench_sink = nal_count;
+    free(lengths);
+    free(offsets);
+    free(frame);
+}
+
+/* RTSP: requests as sent by an iOS client */
+
+static const char *bench_rtsp_requests[] = {
+    "GET /info RTSP/1.0\r\n"
+    "X-Apple-ProtocolVersion: 1\r\n"
+    "Content-Length: 70\r\n"
+    "Content-Type: application/x-apple-binary-plist\r\n"
+    "CSeq: 0\r\n"
+    "DACP-ID: 14413BE4996FEA4D\r\n"
+    "Active-Remote: 2543110914\r\n"
+    "User-Agent: AirPlay/550.10\r\n"
+    "\r\n"
+    "bplist00\xd1\x01\x02Zqualifier\xa1\x03_\x10\x10txtAirPlay\x08\x0b\x16\x18"
+    "\x00\x00\x00\x00\x00\x00\x01\x01\x00\x00\x00\x00\x00\x00\x00\x04\x00\x00\x00\x00\x00"
+    "\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x2b",
+
+    "POST /fp-setup RTSP/1.0\r\n"
+    "X-Apple-ET: 32\r\n"
+    "Content-Length: 16\r\n"
+    "Content-Type: application/octet-stream\r\n"
+    "CSeq: 3\r\n"
+    "DACP-ID: 14413BE4996FEA4D\r\n"
+    "Active-Remote: 2543110914\r\n"
+    "User-Agent: AirPlay/550.10\r\n"
+    "\r\n"
+    "FPLY\x03\x01\x01\x00\x00\x00\x00\x04\x02\x00\x03\xbb",
+
+    "SET_PARAMETER rtsp://192.168.1.20/2699324803567405959 RTSP/1.0\r\n"
+    "Content-Length: 20\r\n"
+    "Content-Type: text/parameters\r\n"
+    "CSeq: 14\r\n"
+    "DACP-ID: 14413BE4996FEA4D\r\n"
+    "Active-Remote: 2543110914\r\n"
+    "User-Agent: AirPlay/550.10\r\n"
+    "\r\n"
+    "volume: -11.123456\r\n",
+
+    "POST /feedback RTSP/1.0\r\n"
+    "CSeq: 15\r\n"
+    "DACP-ID: 14413BE4996FEA4D\r\n"
+    "Active-Remote: 2543110914\r\n"
+    "User-Agent: AirPlay/550.10\r\n"
+    "\r\n",
+};
+
+static const char *bench_rtsp_names[] = { "info", "fp-setup", "set_parameter", "feedback" };
+
+static size_t
+bench_rtsp_len(int arg)
+{
+    /* binary bodies contain NUL bytes: use the Content-Length */
+    const char *request = bench_rtsp_requests[arg];
+    const char *body = strstr(request, "\r\n\r\n") + 4;
+    const char *length = strstr(request, "Content-Length: ");
+    return (body - request) + (length && length < body ? atoi(length + 16) : 0);
+}
+
+static void
+bench_http_request_parse(bench_state_t *state, int arg)
+{
+    http_request_t *request = http_request_init();
+    const char *data = bench_rtsp_requests[arg];
+    int datalen = (int) bench_rtsp_len(arg);
+    int complete = 0;
+
+    BENCH_CHECK(request);
+    bench_start(state);
+    for (uint64_t i = 0; i < state->iterations; i++) {
+        http_request_add_data(request, data, datalen);
+        complete += http_request_is_complete(request) && !http_request_has_error(request);
+        http_request_reset(request);
+    }
+    bench_stop(state);
+    BENCH_CHECK(complete == (int) state->iterations);
+    bench_sink = complete;
+    http_request_destroy(request);
+}
+
+#define RTSP_REQUEST_COUNT (int) (sizeof(bench_rtsp_requests) / sizeof(bench_rtsp_requests[0]))
+
+static size_t
+bench_rtsp_pipelined_len()
+{
+    size_t len = 0;
+    for (int i = 0; i < RTSP_REQUEST_COUNT; i++) {
+        len += bench_rtsp_len(i);
+    }
+    return len;
+}
+
+/* all the requests above in one buffer, as a client pipelines them: each is parsed
+ * inside the request's inline arena, and any heap allocation fails the benchmark */
+static void
+bench_http_request_pipelined(bench_state_t *state, int arg)
+{
+    http_request_t *request = http_request_init();
+    int datalen = (int) bench_rtsp_pipelined_len();
+    char *data = malloc(datalen);
+    uint64_t complete = 0, allocations = 0;
+
+    BENCH_CHECK(request && data);
+    for (int i = 0, offset = 0; i < RTSP_REQUEST_COUNT; i++) {
+        memcpy(data + offset, bench_rtsp_requests[i], bench_rtsp_len(i));
+        offset += (int) bench_rtsp_len(i);
+    }
+    bench_start(state);
+    for (uint64_t i = 0; i < state->iterations; i++) {
+        int offset = 0;
+        while (offset < datalen) {
+            offset += http_request_add_data(request, data + offset, datalen - offset);
+            complete += http_request_is_complete(request) && !http_request_has_error(request);
+            allocations += http_request_get_allocations(request);
+            http_request_reset(request);
+        }
+    }
+    bench_stop(state);
+    BENCH_CHECK(complete == RTSP_REQUEST_COUNT * state->iterations);
+    BENCH_CHECK(allocations == 0);
+    bench_sink = complete;
+    free(data);
+    http_request_destroy(request);
+}
+
+/* byteutils: arg selects the accessor, each iteration reads (or writes) 256 values */
+
+#define BYTEUTILS_BUFFER_LEN 4096
+#define BYTEUTILS_VALUES 256
+
+static const char *bench_byteutils_names[] = {
+    "get_short_be", "get_int_be", "get_long_be", "get_int", "get_float", "get_ntp_timestamp", "put_ntp_timestamp"
+};
+
+static void
+bench_byteutils(bench_state_t *state, int arg)
+{
+    unsigned char buffer[BYTEUTILS_BUFFER_LEN];
+    uint64_t sum = 0;
+
+    bench_fill_random(buffer, sizeof(buffer), 5);
+    bench_start(state);
+    for (uint64_t i = 0; i < state->iterations; i++) {
+        for (int j = 0; j < BYTEUTILS_VALUES; j++) {
+            int offset = j * 16;
+            switch (arg) {
+            case 0: sum += byteutils_get_short_be(buffer, offset); break;
+            case 1: sum += byteutils_get_int_be(buffer, offset); break;
+            case 2: sum += byteutils_get_long_be(buffer, offset); break;
+            case 3: sum += byteutils_get_int(buffer, offset); break;
+            case 4: sum += (uint64_t) byteutils_get_float(buffer, offset); break;
+            case 5: sum += byteutils_get_ntp_timestamp(buffer, offset); break;
+            default: byteutils_put_ntp_timestamp(buffer, offset, i * SECOND_IN_NSECS + j); break;
+            }
+        }
+    }
+    bench_stop(state);
+    bench_sink = sum + buffer[0];
+}
+
+/* playfair: key message from fp-setup in mode arg, and a 72-byte ekey */
+
+static void
+bench_playfair_decrypt(bench_state_t *state, int arg)
+{
+    static const unsigned char header[12] = { 0x46, 0x50, 0x4c, 0x59, 0x03, 0x01, 0x03, 0x00, 0x00, 0x00, 0x00, 0x98 };
+    unsigned char keymsg[164];
+    unsigned char ekey[72];
+    unsigned char key[16];
+
+    bench_fill_random(keymsg, sizeof(keymsg), 6);
+    bench_fill_random(ekey, sizeof(ekey), 7);
+    memcpy(keymsg, header, sizeof(header));
+    keymsg[12] = (unsigned char) arg;   /* playfair indexes its key tables with the mode */
+    bench_start(state);
+    for (uint64_t i = 0; i < state->iterations; i++) {
+        playfair_decrypt(keymsg, ekey, key);
+    }
+    bench_stop(state);
+    bench_sink = key[0];
+}
+
+/* ntp: conversion of remote (sender) timestamps to local time */
+
+static void
+bench_ntp_convert_remote_time(bench_state_t *state, int arg)
+{
+    raop_callbacks_t callbacks;
+    const unsigned char remote[4] = { 127, 0, 0, 1 };
+    uint64_t sum = 0;
+
+    memset(&callbacks, 0, sizeof(callbacks));
+    raop_ntp_t *ntp = raop_ntp_init(bench_logger, &callbacks, remote, sizeof(remote), 7010);
+    BENCH_CHECK(ntp);
+    uint64_t remote_time = raop_ntp_get_local_time(ntp);
+    bench_start(state);
+    for (uint64_t i = 0; i < state->iterations; i++) {
+        sum += raop_ntp_convert_remote_time(ntp, remote_time + i);
+    }
+    bench_stop(state);
+    bench_sink = sum;
+    raop_ntp_destroy(ntp);
+}
+
+#define MAX_CASES 64
+#define BENCH_NAME_LEN 64
+
+static bench_case_t bench_cases[MAX_CASES];
+static char bench_names[MAX_CASES][BENCH_NAME_LEN];
+static int bench_case_count;
+
+static char *
+bench_add(bench_func_t func, int arg, uint64_t bytes, uint64_t items)
+{
+    BENCH_CHECK(bench_case_count < MAX_CASES);
+    char *name = bench_names[bench_case_count];
+    bench_case_t *bench = &bench_cases[bench_case_count++];
+    bench->name = name;
+    bench->func = func;
+    bench->arg = arg;
+    bench->bytes_per_iteration = bytes;
+    bench->items_per_iteration = items;
+    return name;
+}
+
+static void
+bench_register_all()
+{
+    static const int reorder[] = { 1, 4, 16 };
+    static const int audio_sizes[] = { 256, 1408 };
+    static const int video_sizes[] = { 1024, 16384, 131072, 1048576 };
+    static const int nal_counts[] = { 1, 4, 32 };
+
+    for (int i = 0; i < sizeof(reorder) / sizeof(reorder[0]); i++) {
+        char *name = bench_add(bench_raop_buffer_reorder, reorder[i], AUDIO_PAYLOAD_LEN, 1);
+        snprintf(name, BENCH_NAME_LEN, "raop_buffer_enqueue_dequeue/reorder:%d", reorder[i]);
+    }
+    for (int i = 0; i < sizeof(audio_sizes) / sizeof(audio_sizes[0]); i++) {
+        char *name = bench_add(bench_raop_buffer_decrypt, audio_sizes[i], audio_sizes[i], 1);
+        snprintf(name, BENCH_NAME_LEN, "raop_buffer_decrypt/%d", audio_sizes[i]);
+    }
+    for (int i = 0; i < sizeof(video_sizes) / sizeof(video_sizes[0]); i++) {
+        char *name = bench_add(bench_mirror_buffer_decrypt, video_sizes[i], video_sizes[i], 1);
+        snprintf(name, BENCH_NAME_LEN, "mirror_buffer_decrypt/%d", video_sizes[i]);
+    }
+    for (int i = 0; i < sizeof(nal_counts) / sizeof(nal_counts[0]); i++) {
+        char *name = bench_add(bench_nal_to_annexb, nal_counts[i], 0, nal_counts[i] + 1);
+        snprintf(name, BENCH_NAME_LEN, "raop_rtp_mirror_nal_to_annexb/slices:%d", nal_counts[i]);
+    }
+    for (int i = 0; i < sizeof(bench_rtsp_names) / sizeof(bench_rtsp_names[0]); i++) {
+        char *name = bench_add(bench_http_request_parse, i, bench_rtsp_len(i), 1);
+        snprintf(name, BENCH_NAME_LEN, "http_request_parse/%s", bench_rtsp_names[i]);
+    }
+    char *pipelined = bench_add(bench_http_request_pipelined, 0, bench_rtsp_pipelined_len(), RTSP_REQUEST_COUNT);
+    snprintf(pipelined, BENCH_NAME_LEN, "http_request_parse/pipelined");
+    for (int i = 0; i < sizeof(bench_byteutils_names) / sizeof(bench_byteutils_names[0]); i++) {
+        char *name = bench_add(bench_byteutils, i, 0, BYTEUTILS_VALUES);
+        snprintf(name, BENCH_NAME_LEN, "byteutils_%s", bench_byteutils_names[i]);
+    }
+    for (int mode = 0; mode < 4; mode++) {
+        char *name = bench_add(bench_playfair_decrypt, mode, 0, 1);
+        snprintf(name, BENCH_NAME_LEN, "playfair_decrypt/mode:%d", mode);
+    }
+    char *name = bench_add(bench_ntp_convert_remote_time, 0, 0, 1);
+    snprintf(name, BENCH_NAME_LEN, "raop_ntp_convert_remote_time");
+}
+
+/* run with growing iteration counts until the loop takes at least min_time */
+static void
+bench_run(const bench_case_t *bench, double min_time, bench_state_t *state)
+{
+    uint64_t min_ns = (uint64_t) (min_time * SECOND_IN_NSECS);
+    uint64_t iterations = 1;
+    while (true) {
+        memset(state, 0, sizeof(*state));
+        state->iterations = iterations;
+        bench->func(state, bench->arg);
+        if (state->real_ns >= min_ns || iterations >= MAX_ITERATIONS) {
+            break;
+        }
+        double multiplier = state->real_ns ? 1.4 * min_ns / state->real_ns : 100.0;
+        if (multiplier > 100.0) {
+            multiplier = 100.0;
+        } else if (multiplier < 2.0 && state->real_ns * 10 < min_ns * 9) {
+            multiplier = 2.0;
+        }
+        uint64_t next = (uint64_t) (iterations * multiplier);
+        iterations = (next > iterations ? next : iterations + 1);
+        if (iterations > MAX_ITERATIONS) {
+            iterations = MAX_ITERATIONS;
+        }
+    }
+}
+
+static void
+print_json_string(FILE *out, const char *str)
+{
+    fputc('"', out);
+    for (; *str; str++) {
+        if (*str == '"' || *str == '\\') {
+            fputc('\\', out);
+        }
+        fputc(*str, out);
+    }
+    fputc('"', out);
+}
+
+static void
+print_usage(const char *name)
+{
+    printf("Usage: %s [options]\n", name);
+    printf("Microbenchmarks of the airplay library hot paths, with JSON output\n");
+    printf("(Google Benchmark format, for comparison of results across commits)\n");
+    printf("Options:\n");
+    printf("-filter str   Only run benchmarks whose name contains str\n");
+    printf("-min_time s   Minimum measured time per benchmark in seconds (default 0.5)\n");
+    printf("-r N          Run each benchmark N times (default 1)\n");
+    printf("-o file       Write the JSON report to file (default: stdout)\n");
+    printf("-list         List the benchmarks and exit\n");
+    printf("-h            Show this help\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+    const char *filter = NULL;
+    const char *output = NULL;
+    double min_time = 0.5;
+    int repetitions = 1;
+    bool list = false;
+
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        if (!strcmp(arg, "-filter") && i + 1 < argc) {
+            filter = argv[++i];
+        } else if (!strcmp(arg, "-min_time") && i + 1 < argc) {
+            min_time = atof(argv[++i]);
+        } else if (!strcmp(arg, "-r") && i + 1 < argc) {
+            repetitions = atoi(argv[++i]);
+        } else if (!strcmp(arg, "-o") && i + 1 < argc) {
+            output = argv[++i];
+        } else if (!strcmp(arg, "-list")) {
+            list = true;
+        } else if (!strcmp(arg, "-h") || !strcmp(arg, "--help")) {
+            print_usage(argv[0]);
+            exit(0);
+        } else {
+            fprintf(stderr, "unknown or incomplete option \"%s\"\n", arg);
+            print_usage(argv[0]);
+            exit(1);
+        }
+    }
+    if (min_time <= 0.0 || repetitions < 1) {
+        fprintf(stderr, "invalid option value\n");
+        exit(1);
+    }
+
+    bench_register_all();
+    if (list) {
+        for (int i = 0; i < bench_case_count; i++) {
+            printf("%s\n", bench_cases[i].name);
+        }
+        exit(0);
+    }
+
+    FILE *out = stdout;
+    if (output && !(out = fopen(output, "w"))) {
+        fprintf(stderr, "cannot open %s for writing\n", output);
+        exit(1);
+    }
+
+    /* below debug level, so that logging in the benchmarked code costs no more than in normal use */
+    bench_logger = logger_init();
+    logger_set_level(bench_logger, LOGGER_INFO);
+
+    char date[64];
+    time_t now = time(NULL);
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z", localtime(&now));
+    fprintf(out, "{\n  \"context\": {\n");
+    fprintf(out, "    \"date\": \"%s\",\n", date);
+    fprintf(out, "    \"executable\": ");
+    print_json_string(out, argv[0]);
+    fprintf(out, ",\n    \"min_time\": %g,\n", min_time);
+#ifdef NDEBUG
+    fprintf(out, "    \"library_build_type\": \"release\"\n");
+#else
+    fprintf(out, "    \"library_build_type\": \"debug\"\n");
+#endif
+    fprintf(out, "  },\n  \"benchmarks\": [");
+
+    int count = 0;
+    for (int i = 0; i < bench_case_count; i++) {
+        const bench_case_t *bench = &bench_cases[i];
+        if (filter && !strstr(bench->name, filter)) {
+            continue;
+        }
+        for (int rep = 0; rep < repetitions; rep++) {
+            bench_state_t state;
+            bench_run(bench, min_time, &state);
+            double real_time = (double) state.real_ns / state.iterations;
+            double cpu_time = state.cpu_ns / state.iterations;
+            double seconds = (double) state.real_ns / SECOND_IN_NSECS;
+            fprintf(out, "%s\n    {\n      \"name\": ", count++ ? "," : "");
+            print_json_string(out, bench->name);
+            fprintf(out, ",\n      \"run_name\": ");
+            print_json_string(out, bench->name);
+            fprintf(out, ",\n      \"run_type\": \"iteration\",\n");
+            fprintf(out, "      \"repetitions\": %d,\n", repetitions);
+            fprintf(out, "      \"repetition_index\": %d,\n", rep);
+            fprintf(out, "      \"threads\": 1,\n");
+            fprintf(out, "      \"iterations\": %llu,\n", (unsigned long long) state.iterations);
+            fprintf(out, "      \"real_time\": %.3f,\n", real_time);
+            fprintf(out, "      \"cpu_time\": %.3f,\n", cpu_time);
+            fprintf(out, "      \"time_unit\": \"ns\"");
+            if (bench->bytes_per_iteration) {
+                fprintf(out, ",\n      \"bytes_per_second\": %.1f",
+                        (double) bench->bytes_per_iteration * state.iterations / seconds);
+            }
+            fprintf(out, ",\n      \"items_per_second\": %.1f\n    }",
+                    (double) bench->items_per_iteration * state.iterations / seconds);
+            fflush(out);
+        }
+    }
+    fprintf(out, "\n  ]\n}\n");
+
+    if (out != stdout) {
+        fclose(out);
+    }
+    logger_destroy(bench_logger);
+    return 0;
+}
@@ -0,0 +1,1808 @@
+/**
+ *  Copyright (C) 2026 UxPlay contributors
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ */
+
+/* uxplay-loadgen: a synthetic AirPlay mirroring client for load and latency tests.
+ *
+ * Each session runs the same RTSP sequence as a real sender (/info, /pair-setup,
+ * /pair-verify, /fp-setup, SETUP for timing+mirror+audio, RECORD), answers the
+ * server's NTP timing requests, and then streams AES-CTR encrypted H.264 over the
+ * mirror TCP connection and AES-CBC encrypted audio over RTP/UDP, with rtp sync
+ * packets and answers to resend requests on the audio control channel.
+ *
+ * The FairPlay key exchange is not a real one: the sender runs the server's own
+ * playfair code on the same fp-setup messages to learn which AES key the server
+ * will derive from the ekey it is sent.
+ *
+ * All sender timestamps come from a loadgen_clock_t, which can be given a fixed
+ * offset and a drift (ppm) relative to the system clock, to exercise the server's
+ * NTP and rtp sync handling.
+ *
+ * Everything sent after SETUP can be passed through an impair_t (impair.h), which
+ * adds loss, reordering, duplication, delay and jitter from a seeded generator. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <assert.h>
+#include <strings.h>
+#include <signal.h>
+#include <time.h>
+#include <math.h>
+#include <inttypes.h>
+#include <netinet/tcp.h>
+
+#include <plist/plist.h>
+
+#include "compat.h"
+#include "logger.h"
+#include "netutils.h"
+#include "byteutils.h"
+#include "crypto.h"
+#include "pairing.h"
+#include "fairplay.h"
+#include "mirror_buffer.h"
+#include "utils.h"
+#include "impair.h"
+
+#define SECOND_IN_NSECS 1000000000ULL
+#define DEFAULT_PORT 7000
+#define AUDIO_SAMPLE_RATE 44100
+#define RTSP_BUFFER_SIZE 16384
+#define AUDIO_PACKET_LEN 2048
+#define AUDIO_HISTORY 512          /* sent audio packets kept for resend requests */
+#define FEEDBACK_INTERVAL_MS 2000
+#define MAX_TARGETS 64
+
+#define AUDIO_FORMAT_ALAC_44100_16_2 0x40000
+#define AUDIO_FORMAT_AAC_ELD_44100_2 0x1000000
+
+static const char loadgen_user_agent[] = "AirPlay/550.10";
+
+typedef struct loadgen_clock_s {
+    int64_t offset_ns;
+    double drift_ppm;
+    uint64_t origin_ns;            /* monotonic time from which drift accumulates */
+} loadgen_clock_t;
+
+/* uxplay drops all its clients when a third one connects, so more than two
+ * concurrent sessions must be spread over several servers */
+typedef struct loadgen_target_s {
+    char host[256];
+    unsigned short port;
+    struct sockaddr_storage addr;
+    socklen_t addrlen;
+} loadgen_target_t;
+
+typedef struct loadgen_config_s {
+    loadgen_target_t targets[MAX_TARGETS];
+    int target_count;
+    int sessions;
+    int duration;                  /* seconds, 0 = until interrupted */
+    int stagger_ms;
+
+    bool video;
+    int fps;
+    int video_kbps;
+    int width;
+    int height;
+    int gop;
+    const char *h264_file;
+
+    unsigned char ct;              /* 0 = no audio, 2 = ALAC, 8 = AAC-ELD */
+    int audio_kbps;
+
+    int64_t clock_offset_ns;
+    double clock_drift_ppm;
+
+    impair_config_t impair;        /* session i uses seeds impair.seed + 2i (udp) and + 2i + 1 (mirror) */
+    bool impaired;
+} loadgen_config_t;
+
+typedef struct h264_nal_s {
+    const unsigned char *data;
+    int len;
+} h264_nal_t;
+
+typedef struct h264_frame_s {
+    int first_nal;
+    int nal_count;
+    int sps;                       /* index of the SPS/PPS sent before this frame, or -1 */
+    int pps;
+} h264_frame_t;
+
+/* A loaded Annex-B file, split into access units.  Shared read-only by all sessions */
+typedef struct h264_source_s {
+    unsigned char *data;
+    h264_nal_t *nals;
+    int nal_count;
+    h264_frame_t *frames;
+    int frame_count;
+} h264_source_t;
+
+typedef struct loadgen_stats_s {
+    uint64_t streaming_ns;
+    uint64_t video_frames;
+    uint64_t video_bytes;
+    uint64_t audio_packets;
+    uint64_t audio_bytes;
+    uint64_t sync_packets;
+    uint64_t resent_packets;
+    uint64_t audio_dropped;        /* audio data packets dropped by the impairer */
+    uint64_t audio_recovered;      /* dropped audio data packets that were resent (and not dropped again) */
+    uint64_t ntp_replies;
+    uint64_t max_video_lag_ns;     /* how far the sender fell behind its own schedule */
+    uint64_t max_audio_lag_ns;
+} loadgen_stats_t;
+
+typedef struct loadgen_session_s {
+    int id;
+    const loadgen_config_t *config;
+    const h264_source_t *source;
+    logger_t *logger;
+    loadgen_clock_t clock;
+
+    const loadgen_target_t *target;
+    int use_ipv6;
+
+    int rtsp_fd;
+    int cseq;
+    uint64_t session_id;
+
+    unsigned char ecdh_secret[X25519_KEY_SIZE];
+    unsigned char aeskey[16];
+    unsigned char aesiv[16];
+    uint64_t stream_connection_id;
+
+    int timing_sock;
+    unsigned short timing_lport;
+    int control_sock;
+    unsigned short control_lport;
+    int audio_sock;
+
+    unsigned short video_rport;
+    unsigned short audio_data_rport;
+    unsigned short audio_control_rport;
+
+    impair_t *udp_impair;
+    impair_stats_t udp_impair_stats;
+    impair_stats_t video_impair_stats;
+
+    volatile int running;
+    thread_handle_t session_thread;
+    thread_handle_t ntp_thread;
+    thread_handle_t video_thread;
+    thread_handle_t audio_thread;
+    bool ntp_started, video_started, audio_started;
+
+    loadgen_stats_t stats;
+    const char *error;
+} loadgen_session_t;
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void
+loadgen_signal_handler(int sig)
+{
+    stop_requested = 1;
+}
+
+/* ---- clock ---- */
+
+static uint64_t
+loadgen_monotonic_ns(void)
+{
+    return utils_monotonic_ns();
+}
+
+static void
+loadgen_clock_init(loadgen_clock_t *clock, int64_t offset_ns, double drift_ppm)
+{
+    clock->offset_ns = offset_ns;
+    clock->drift_ppm = drift_ppm;
+    clock->origin_ns = loadgen_monotonic_ns();
+}
+
+/* Sender wall clock in ns since 1970: system time, plus a fixed offset, plus drift
+ * accumulated since the session started */
+static uint64_t
+loadgen_clock_now(const loadgen_clock_t *clock)
+{
+    struct timespec time;
+    clock_gettime(CLOCK_REALTIME, &time);
+    int64_t now = (int64_t) time.tv_sec * SECOND_IN_NSECS + time.tv_nsec + clock->offset_ns;
+    if (clock->drift_ppm != 0.0) {
+        double elapsed = (double) (loadgen_monotonic_ns() - clock->origin_ns);
+        now += (int64_t) (elapsed * clock->drift_ppm * 1e-6);
+    }
+    return (uint64_t) now;
+}
+
+/* Sleep until a monotonic deadline; returns how late we already were (0 if not late) */
+static uint64_t
+loadgen_sleep_until(uint64_t deadline_ns)
+{
+    uint64_t now = loadgen_monotonic_ns();
+    if (now >= deadline_ns) {
+        return now - deadline_ns;
+    }
+    uint64_t wait = deadline_ns - now;
+    struct timespec ts;
+    ts.tv_sec = wait / SECOND_IN_NSECS;
+    ts.tv_nsec = wait % SECOND_IN_NSECS;
+    nanosleep(&ts, NULL);
+    return 0;
+}
+
+/* ---- H.264 bitstream ---- */
+
+typedef struct bitwriter_s {
+    unsigned char *data;
+    int size;
+    int bits;
+} bitwriter_t;
+
+static void
+bits_put(bitwriter_t *bw, uint32_t value, int n)
+{
+    for (int i = n - 1; i >= 0; i--) {
+        assert((bw->bits >> 3) < bw->size);
+        if ((value >> i) & 1) {
+            bw->data[bw->bits >> 3] |= 0x80 >> (bw->bits & 7);
+        }
+        bw->bits++;
+    }
+}
+
+static void
+bits_put_ue(bitwriter_t *bw, uint32_t value)
+{
+    int len = 0;
+    for (uint32_t v = value + 1; v; v >>= 1) {
+        len++;
+    }
+    bits_put(bw, 0, len - 1);
+    bits_put(bw, value + 1, len);
+}
+
+static void
+bits_put_se(bitwriter_t *bw, int32_t value)
+{
+    bits_put_ue(bw, value > 0 ? 2 * value - 1 : -2 * value);
+}
+
+static void
+bits_align_zero(bitwriter_t *bw)
+{
+    bw->bits = (bw->bits + 7) & ~7;
+}
+
+static void
+bits_put_trailing(bitwriter_t *bw)
+{
+    bits_put(bw, 1, 1);
+    bits_align_zero(bw);
+}
+
+/* Append one NAL in AVCC form (4-byte big-endian length) to out, adding emulation
+ * prevention bytes to the rbsp.  out must hold 4 + 1 + 3 * rbsp_len / 2 + 1 bytes */
+static int
+h264_put_nal(unsigned char *out, unsigned char header, const unsigned char *rbsp, int rbsp_len)
+{
+    int len = 0, zeros = 0;
+    unsigned char *nal = out + 4;
+    nal[len++] = header;
+    for (int i = 0; i < rbsp_len; i++) {
+        if (zeros == 2 && rbsp[i] <= 0x03) {
+            nal[len++] = 0x03;
+            zeros = 0;
+        }
+        nal[len++] = rbsp[i];
+        zeros = rbsp[i] ? 0 : zeros + 1;
+    }
+    out[0] = (unsigned char) (len >> 24);
+    out[1] = (unsigned char) (len >> 16);
+    out[2] = (unsigned char) (len >> 8);
+    out[3] = (unsigned char) len;
+    return len + 4;
+}
+
+/* The synthetic stream is constrained baseline, CAVLC, pic_order_cnt_type 2, one reference
+ * frame: IDR pictures are coded as all-I_PCM macroblocks and the other pictures as P slices
+ * in which every macroblock is skipped, then padded with filler data up to the bitrate.
+ * This makes a small but fully decodable stream of any size and rate. */
+
+static int
+h264_synthetic_sps(unsigned char *rbsp, int size, int width, int height)
+{
+    bitwriter_t bw = { rbsp, size, 0 };
+    memset(rbsp, 0, size);
+    bits_put(&bw, 66, 8);               /* profile_idc: baseline */
+    bits_put(&bw, 0xc0, 8);             /* constraint_set0_flag, constraint_set1_flag */
+    bits_put(&bw, 40, 8);               /* level_idc */
+    bits_put_ue(&bw, 0);                /* seq_parameter_set_id */
+    bits_put_ue(&bw, 0);                /* log2_max_frame_num_minus4 */
+    bits_put_ue(&bw, 2);                /* pic_order_cnt_type */
+    bits_put_ue(&bw, 1);                /* max_num_ref_frames */
+    bits_put(&bw, 0, 1);                /* gaps_in_frame_num_value_allowed_flag */
+    bits_put_ue(&bw, width / 16 - 1);   /* pic_width_in_mbs_minus1 */
+    bits_put_ue(&bw, height / 16 - 1);  /* pic_height_in_map_units_minus1 */
+    bits_put(&bw, 1, 1);                /* frame_mbs_only_flag */
+    bits_put(&bw, 1, 1);                /* direct_8x8_inference_flag */
+    bits_put(&bw, 0, 1);                /* frame_cropping_flag */
+    bits_put(&bw, 0, 1);                /* vui_parameters_present_flag */
+    bits_put_trailing(&bw);
+    return bw.bits >> 3;
+}
+
+static int
+h264_synthetic_pps(unsigned char *rbsp, int size)
+{
+    bitwriter_t bw = { rbsp, size, 0 };
+    memset(rbsp, 0, size);
+    bits_put_ue(&bw, 0);                /* pic_parameter_set_id */
+    bits_put_ue(&bw, 0);                /* seq_parameter_set_id */
+    bits_put(&bw, 0, 1);                /* entropy_coding_mode_flag: CAVLC */
+    bits_put(&bw, 0, 1);                /* bottom_field_pic_order_in_frame_present_flag */
+    bits_put_ue(&bw, 0);                /* num_slice_groups_minus1 */
+    bits_put_ue(&bw, 0);                /* num_ref_idx_l0_default_active_minus1 */
+    bits_put_ue(&bw, 0);                /* num_ref_idx_l1_default_active_minus1 */
+    bits_put(&bw, 0, 1);                /* weighted_pred_flag */
+    bits_put(&bw, 0, 2);                /* weighted_bipred_idc */
+    bits_put_se(&bw, 0);                /* pic_init_qp_minus26 */
+    bits_put_se(&bw, 0);                /* pic_init_qs_minus26 */
+    bits_put_se(&bw, 0);                /* chroma_qp_index_offset */
+    bits_put(&bw, 1, 1);                /* deblocking_filter_control_present_flag */
+    bits_put(&bw, 0, 1);                /* constrained_intra_pred_flag */
+    bits_put(&bw, 0, 1);                /* redundant_pic_cnt_present_flag */
+    bits_put_trailing(&bw);
+    return bw.bits >> 3;
+}
+
+static int
+h264_synthetic_idr(unsigned char *rbsp, int size, int width, int height, int idr_count)
+{
+    bitwriter_t bw = { rbsp, size, 0 };
+    int mbs = (width / 16) * (height / 16);
+    memset(rbsp, 0, size);
+    bits_put_ue(&bw, 0);                /* first_mb_in_slice */
+    bits_put_ue(&bw, 7);                /* slice_type: I (all slices) */
+    bits_put_ue(&bw, 0);                /* pic_parameter_set_id */
+    bits_put(&bw, 0, 4);                /* frame_num */
+    bits_put_ue(&bw, idr_count & 0xffff); /* idr_pic_id */
+    bits_put(&bw, 0, 1);                /* no_output_of_prior_pics_flag */
+    bits_put(&bw, 0, 1);                /* long_term_reference_flag */
+    bits_put_se(&bw, 0);                /* slice_qp_delta */
+    bits_put_ue(&bw, 1);                /* disable_deblocking_filter_idc */
+    for (int mb = 0; mb < mbs; mb++) {
+        bits_put_ue(&bw, 25);           /* mb_type: I_PCM */
+        bits_align_zero(&bw);
+        /* luma samples vary with position and picture, never 0 (no start code emulation) */
+        unsigned char luma = (unsigned char) (16 + ((mb % (width / 16)) * 4 + idr_count * 37) % 220);
+        assert((bw.bits >> 3) + 384 < size);
+        memset(rbsp + (bw.bits >> 3), luma, 256);
+        memset(rbsp + (bw.bits >> 3) + 256, 128, 128);
+        bw.bits += 384 * 8;
+    }
+    bits_put_trailing(&bw);
+    return bw.bits >> 3;
+}
+
+static int
+h264_synthetic_p(unsigned char *rbsp, int size, int width, int height, int frame_num)
+{
+    bitwriter_t bw = { rbsp, size, 0 };
+    memset(rbsp, 0, size);
+    bits_put_ue(&bw, 0);                /* first_mb_in_slice */
+    bits_put_ue(&bw, 5);                /* slice_type: P (all slices) */
+    bits_put_ue(&bw, 0);                /* pic_parameter_set_id */
+    bits_put(&bw, frame_num & 0x0f, 4); /* frame_num */
+    bits_put(&bw, 0, 1);                /* num_ref_idx_active_override_flag */
+    bits_put(&bw, 0, 1);                /* ref_pic_list_modification_flag_l0 */
+    bits_put(&bw, 0, 1);                /* adaptive_ref_pic_marking_mode_flag */
+    bits_put_se(&bw, 0);                /* slice_qp_delta */
+    bits_put_ue(&bw, 1);                /* disable_deblocking_filter_idc */
+    bits_put_ue(&bw, (width / 16) * (height / 16)); /* mb_skip_run: the whole picture */
+    bits_put_trailing(&bw);
+    return bw.bits >> 3;
+}
+
+/* filler data NAL (type 12) taking exactly len bytes in AVCC form, len >= 6 */
+static int
+h264_put_filler(unsigned char *out, int len)
+{
+    int nal_len = len - 4;
+    out[0] = (unsigned char) (nal_len >> 24);
+    out[1] = (unsigned char) (nal_len >> 16);
+    out[2] = (unsigned char) (nal_len >> 8);
+    out[3] = (unsigned char) nal_len;
+    out[4] = 0x0c;
+    memset(out + 5, 0xff, nal_len - 2);
+    out[len - 1] = 0x80;
+    return len;
+}
+
+static int
+h264_find_start_code(const unsigned char *data, int len, int pos, int *code_len)
+{
+    for (int i = pos; i + 2 < len; i++) {
+        if (data[i] == 0 && data[i + 1] == 0) {
+            if (data[i + 2] == 1) {
+                *code_len = 3;
+                return i;
+            } else if (data[i + 2] == 0 && i + 3 < len && data[i + 3] == 1) {
+                *code_len = 4;
+                return i;
+            }
+        }
+    }
+    *code_len = 0;
+    return len;
+}
+
+static void
+h264_source_destroy(h264_source_t *source)
+{
+    if (source) {
+        free(source->data);
+        free(source->nals);
+        free(source->frames);
+        free(source);
+    }
+}
+
+/* Load an Annex-B elementary stream and split it into access units.  SPS and PPS NALs
+ * are taken out of the frames: they go in the codec packet sent before the next frame */
+static h264_source_t *
+h264_source_load(const char *filename)
+{
+    FILE *file = fopen(filename, "rb");
+    if (!file) {
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    long len = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    h264_source_t *source = calloc(1, sizeof(h264_source_t));
+    assert(source);
+    source->data = malloc(len > 0 ? len : 1);
+    assert(source->data);
+    if (len <= 0 || fread(source->data, 1, len, file) != (size_t) len) {
+        fclose(file);
+        h264_source_destroy(source);
+        return NULL;
+    }
+    fclose(file);
+
+    int code_len;
+    int pos = h264_find_start_code(source->data, len, 0, &code_len);
+    int nals_size = 0;
+    while (pos < len) {
+        int start = pos + code_len;
+        int next = h264_find_start_code(source->data, len, start, &code_len);
+        int end = next;
+        while (end > start && source->data[end - 1] == 0) {
+            end--;                      /* trailing_zero_8bits */
+        }
+        if (end > start) {
+            if (source->nal_count == nals_size) {
+                nals_size = nals_size ? 2 * nals_size : 1024;
+                source->nals = realloc(source->nals, nals_size * sizeof(h264_nal_t));
+                assert(source->nals);
+            }
+            source->nals[source->nal_count].data = source->data + start;
+            source->nals[source->nal_count].len = end - start;
+            source->nal_count++;
+        }
+        pos = next;
+    }
+
+    source->frames = calloc(source->nal_count + 1, sizeof(h264_frame_t));
+    assert(source->frames);
+    h264_frame_t *frame = NULL;
+    bool frame_has_vcl = false;
+    int sps = -1, pps = -1;
+    for (int i = 0; i < source->nal_count; i++) {
+        int type = source->nals[i].data[0] & 0x1f;
+        bool vcl = (type == 1 || type == 5);
+        /* first_mb_in_slice == 0 is coded as a single '1' bit */
+        bool first_slice = vcl && source->nals[i].len > 1 && (source->nals[i].data[1] & 0x80);
+        bool new_frame = !frame || (frame_has_vcl && (type == 9 || type == 7 || type == 8 || type == 6 || first_slice));
+        if (new_frame) {
+            frame = &source->frames[source->frame_count++];
+            frame->first_nal = i;
+            frame->sps = -1;
+            frame->pps = -1;
+            frame_has_vcl = false;
+        }
+        if (type == 7) {
+            sps = i;
+        } else if (type == 8) {
+            pps = i;
+        }
+        if (type == 7 || type == 8) {
+            /* SPS/PPS open the frame, which keeps starting at the next NAL */
+            frame->first_nal = i + 1;
+            frame->nal_count = 0;
+            if (sps >= 0 && pps >= 0) {
+                frame->sps = sps;
+                frame->pps = pps;
+            }
+            continue;
+        }
+        frame->nal_count = i + 1 - frame->first_nal;
+        frame_has_vcl |= vcl;
+    }
+    if (frame && frame->nal_count == 0) {
+        source->frame_count--;
+    }
+    if (source->frame_count == 0 || source->frames[0].sps < 0) {
+        h264_source_destroy(source);
+        return NULL;
+    }
+    return source;
+}
+
+/* ---- sockets ---- */
+
+static int
+loadgen_send_all(int fd, const unsigned char *data, int len)
+{
+    while (len > 0) {
+        int ret = send(fd, (const char *) data, len, 0);
+        if (ret <= 0) {
+            if (ret < 0 && SOCKET_GET_ERROR() == SOCKET_ERRORNAME(EINTR)) continue;
+            return -1;
+        }
+        data += ret;
+        len -= ret;
+    }
+    return 0;
+}
+
+static int
+loadgen_connect(loadgen_session_t *session, unsigned short port)
+{
+    struct sockaddr_storage addr;
+    memcpy(&addr, &session->target->addr, session->target->addrlen);
+    if (addr.ss_family == AF_INET6) {
+        ((struct sockaddr_in6 *) &addr)->sin6_port = htons(port);
+    } else {
+        ((struct sockaddr_in *) &addr)->sin_port = htons(port);
+    }
+    int fd = socket(addr.ss_family, SOCK_STREAM, IPPROTO_TCP);
+    if (fd == -1) {
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr *) &addr, session->target->addrlen) == -1) {
+        closesocket(fd);
+        return -1;
+    }
+    int nodelay = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (const char *) &nodelay, sizeof(nodelay));
+    return fd;
+}
+
+static void
+loadgen_set_recv_timeout(int fd, int ms)
+{
+    struct timeval tv;
+    tv.tv_sec = ms / 1000;
+    tv.tv_usec = (ms % 1000) * 1000;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, (const char *) &tv, sizeof(tv));
+}
+
+/* returns 0 if the impairer dropped the datagram */
+static int
+loadgen_sendto(loadgen_session_t *session, int fd, const struct sockaddr *addr, socklen_t addrlen,
+               const unsigned char *data, int len)
+{
+    if (session->udp_impair) {
+        return impair_sendto(session->udp_impair, fd, addr, addrlen, data, len);
+    }
+    sendto(fd, (const char *) data, len, 0, addr, addrlen);
+    return 1;
+}
+
+static int
+loadgen_sendto_server(loadgen_session_t *session, int fd, unsigned short port, const unsigned char *data, int len)
+{
+    struct sockaddr_storage addr;
+    memcpy(&addr, &session->target->addr, session->target->addrlen);
+    if (addr.ss_family == AF_INET6) {
+        ((struct sockaddr_in6 *) &addr)->sin6_port = htons(port);
+    } else {
+        ((struct sockaddr_in *) &addr)->sin_port = htons(port);
+    }
+    return loadgen_sendto(session, fd, (struct sockaddr *) &addr, session->target->addrlen, data, len);
+}
+
+/* ---- timing ---- */
+
+static THREAD_RETVAL
+loadgen_ntp_thread(void *arg)
+{
+    loadgen_session_t *session = arg;
+    unsigned char request[128];
+    unsigned char response[32] = { 0x80, 0xd3, 0x00, 0x07, 0x00, 0x00, 0x00, 0x00 };
+    struct sockaddr_storage saddr;
+    socklen_t saddrlen;
+
+    loadgen_set_recv_timeout(session->timing_sock, 100);
+    while (session->running) {
+        saddrlen = sizeof(saddr);
+        int len = recvfrom(session->timing_sock, (char *) request, sizeof(request), 0,
+                           (struct sockaddr *) &saddr, &saddrlen);
+        uint64_t receive_time = loadgen_clock_now(&session->clock);
+        if (len < 32) {
+            continue;
+        }
+        /* origin = the server's transmit timestamp, then our receive and transmit times */
+        memcpy(response + 8, request + 24, 8);
+        byteutils_put_ntp_timestamp(response, 16, receive_time);
+        byteutils_put_ntp_timestamp(response, 24, loadgen_clock_now(&session->clock));
+        loadgen_sendto(session, session->timing_sock, (struct sockaddr *) &saddr, saddrlen,
+                       response, sizeof(response));
+        session->stats.ntp_replies++;
+    }
+    return 0;
+}
+
+/* ---- RTSP ---- */
+
+/* Send one RTSP request and wait for its response.  Returns the status code, or -1
+ * if the connection failed; a response body is returned in a malloc'd buffer */
+static int
+rtsp_request(loadgen_session_t *session, const char *method, const char *url, const char *content_type,
+             const unsigned char *body, int body_len, unsigned char **response_body, int *response_len)
+{
+    char buffer[RTSP_BUFFER_SIZE];
+    int len;
+
+    if (response_body) {
+        *response_body = NULL;
+        *response_len = 0;
+    }
+
+    len = snprintf(buffer, sizeof(buffer),
+                   "%s %s RTSP/1.0\r\n"
+                   "CSeq: %d\r\n"
+                   "User-Agent: %s\r\n"
+                   "X-Apple-ProtocolVersion: 1\r\n",
+                   method, url, ++session->cseq, loadgen_user_agent);
+    if (body_len > 0) {
+        len += snprintf(buffer + len, sizeof(buffer) - len, "Content-Type: %s\r\nContent-Length: %d\r\n",
+                        content_type, body_len);
+    }
+    len += snprintf(buffer + len, sizeof(buffer) - len, "\r\n");
+    if (loadgen_send_all(session->rtsp_fd, (unsigned char *) buffer, len) ||
+        (body_len > 0 && loadgen_send_all(session->rtsp_fd, body, body_len))) {
+        return -1;
+    }
+
+    /* read the response headers */
+    len = 0;
+    char *header_end = NULL;
+    while (!header_end) {
+        if (len == sizeof(buffer) - 1) {
+            return -1;
+        }
+        int ret = recv(session->rtsp_fd, buffer + len, sizeof(buffer) - 1 - len, 0);
+        if (ret <= 0) {
+            return -1;
+        }
+        len += ret;
+        buffer[len] = '\0';
+        header_end = strstr(buffer, "\r\n\r\n");
+    }
+    *header_end = '\0';
+    int status = 0;
+    if (sscanf(buffer, "RTSP/1.0 %d", &status) != 1) {
+        return -1;
+    }
+    int content_length = 0;
+    for (char *line = strstr(buffer, "\r\n"); line; line = strstr(line + 2, "\r\n")) {
+        if (!strncasecmp(line + 2, "Content-Length:", 15)) {
+            content_length = atoi(line + 17);
+        }
+    }
+
+    /* then the body, part of which may already be in the buffer */
+    unsigned char *data = malloc(content_length + 1);
+    assert(data);
+    int have = len - (int) (header_end + 4 - buffer);
+    if (have > content_length) {
+        have = content_length;
+    }
+    memcpy(data, header_end + 4, have);
+    while (have < content_length) {
+        int ret = recv(session->rtsp_fd, (char *) data + have, content_length - have, 0);
+        if (ret <= 0) {
+            free(data);
+            return -1;
+        }
+        have += ret;
+    }
+    if (response_body) {
+        *response_body = data;
+        *response_len = content_length;
+    } else {
+        free(data);
+    }
+    return status;
+}
+
+static int
+rtsp_request_plist(loadgen_session_t *session, const char *method, plist_t request, plist_t *response)
+{
+    char url[64];
+    char *body = NULL;
+    uint32_t body_len = 0;
+    unsigned char *response_body;
+    int response_len;
+
+    snprintf(url, sizeof(url), "rtsp://%s/%" PRIu64, session->target->host, session->session_id);
+    if (request) {
+        plist_to_bin(request, &body, &body_len);
+    }
+    int status = rtsp_request(session, method, url, "application/x-apple-binary-plist",
+                              (unsigned char *) body, body_len, &response_body, &response_len);
+    free(body);
+    if (response) {
+        *response = NULL;
+        if (status == 200 && response_len > 0) {
+            plist_from_bin((char *) response_body, response_len, response);
+        }
+    }
+    free(response_body);
+    return status;
+}
+
+static unsigned short
+plist_get_port(plist_t dict, const char *key)
+{
+    uint64_t port = 0;
+    plist_t node = plist_dict_get_item(dict, key);
+    if (node) {
+        plist_get_uint_val(node, &port);
+    }
+    return (unsigned short) port;
+}
+
+static int
+loadgen_pair(loadgen_session_t *session)
+{
+    unsigned char data[4 + X25519_KEY_SIZE + ED25519_KEY_SIZE];
+    unsigned char *response;
+    int response_len;
+    int status;
+
+    ed25519_key_t *ed_ours = ed25519_key_generate();
+    x25519_key_t *ecdh_ours = x25519_key_generate();
+    unsigned char ed_ours_raw[ED25519_KEY_SIZE];
+    unsigned char ecdh_ours_raw[X25519_KEY_SIZE];
+    ed25519_key_get_raw(ed_ours_raw, ed_ours);
+    x25519_key_get_raw(ecdh_ours_raw, ecdh_ours);
+
+    status = rtsp_request(session, "POST", "/pair-setup", "application/octet-stream",
+                          ed_ours_raw, sizeof(ed_ours_raw), &response, &response_len);
+    free(response);
+    if (status != 200 || response_len != ED25519_KEY_SIZE) {
+        session->error = "pair-setup failed";
+        goto error;
+    }
+
+    memset(data, 0, 4);
+    data[0] = 1;
+    memcpy(data + 4, ecdh_ours_raw, X25519_KEY_SIZE);
+    memcpy(data + 4 + X25519_KEY_SIZE, ed_ours_raw, ED25519_KEY_SIZE);
+    status = rtsp_request(session, "POST", "/pair-verify", "application/octet-stream",
+                          data, sizeof(data), &response, &response_len);
+    if (status != 200 || response_len != X25519_KEY_SIZE + PAIRING_SIG_SIZE) {
+        free(response);
+        session->error = "pair-verify step 1 failed";
+        goto error;
+    }
+
+    /* shared secret, and the AES-CTR key/iv pair-verify signatures are encrypted with */
+    unsigned char *ecdh_secret = session->ecdh_secret;
+    unsigned char hash[64];
+    unsigned char key[16], iv[16];
+    x25519_key_t *ecdh_theirs = x25519_key_from_raw(response);
+    x25519_derive_secret(ecdh_secret, ecdh_ours, ecdh_theirs);
+    x25519_key_destroy(ecdh_theirs);
+
+    sha_ctx_t *ctx = sha_init();
+    sha_update(ctx, (const uint8_t *) "Pair-Verify-AES-Key", strlen("Pair-Verify-AES-Key"));
+    sha_update(ctx, ecdh_secret, X25519_KEY_SIZE);
+    sha_final(ctx, hash, NULL);
+    memcpy(key, hash, 16);
+    sha_reset(ctx);
+    sha_update(ctx, (const uint8_t *) "Pair-Verify-AES-IV", strlen("Pair-Verify-AES-IV"));
+    sha_update(ctx, ecdh_secret, X25519_KEY_SIZE);
+    sha_final(ctx, hash, NULL);
+    memcpy(iv, hash, 16);
+    sha_destroy(ctx);
+
+    /* sign both public ECDH keys, ours first */
+    unsigned char sig_msg[2 * X25519_KEY_SIZE];
+    unsigned char signature[4 + PAIRING_SIG_SIZE];
+    unsigned char skip[PAIRING_SIG_SIZE];
+    memcpy(sig_msg, ecdh_ours_raw, X25519_KEY_SIZE);
+    memcpy(sig_msg + X25519_KEY_SIZE, response, X25519_KEY_SIZE);
+    free(response);
+    memset(signature, 0, 4);
+    ed25519_sign(signature + 4, PAIRING_SIG_SIZE, sig_msg, sizeof(sig_msg), ed_ours);
+
+    /* the keystream continues from the server's encryption of its own signature */
+    aes_ctx_t *aes_ctx = aes_ctr_init(key, iv);
+    memset(skip, 0, sizeof(skip));
+    aes_ctr_encrypt(aes_ctx, skip, skip, PAIRING_SIG_SIZE);
+    aes_ctr_encrypt(aes_ctx, signature + 4, signature + 4, PAIRING_SIG_SIZE);
+    aes_ctr_destroy(aes_ctx);
+
+    status = rtsp_request(session, "POST", "/pair-verify", "application/octet-stream",
+                          signature, sizeof(signature), NULL, NULL);
+    if (status != 200) {
+        session->error = "pair-verify step 2 failed";
+        goto error;
+    }
+
+    ed25519_key_destroy(ed_ours);
+    x25519_key_destroy(ecdh_ours);
+    return 0;
+
+  error:
+    ed25519_key_destroy(ed_ours);
+    x25519_key_destroy(ecdh_ours);
+    return -1;
+}
+
+/* FairPlay setup.  The server's playfair is run locally on the same messages, so that
+ * fairplay_decrypt() gives us the audio key the server will derive from our ekey */
+static int
+loadgen_fairplay(loadgen_session_t *session, unsigned char ekey[72])
+{
+    unsigned char setup[16] = { 0x46, 0x50, 0x4c, 0x59, 0x03, 0x01, 0x01, 0x00, 0x00, 0x00, 0x00, 0x04, 0x02, 0x00, 0x00, 0xbb };
+    unsigned char handshake[164] = { 0x46, 0x50, 0x4c, 0x59, 0x03, 0x01, 0x03, 0x00, 0x00, 0x00, 0x00, 0x98 };
+    unsigned char reply[142];
+    unsigned char *response;
+    int response_len;
+    int status;
+
+    setup[14] = session->id % 4;
+    for (int i = 12; i < (int) sizeof(handshake); i++) {
+        handshake[i] = (unsigned char) rand();
+    }
+    handshake[12] = setup[14];      /* playfair indexes its key tables with the mode */
+    memcpy(ekey, "FPLY", 4);
+    for (int i = 4; i < 72; i++) {
+        ekey[i] = (unsigned char) rand();
+    }
+
+    status = rtsp_request(session, "POST", "/fp-setup", "application/octet-stream",
+                          setup, sizeof(setup), &response, &response_len);
+    free(response);
+    if (status != 200 || response_len != 142) {
+        session->error = "fp-setup step 1 failed";
+        return -1;
+    }
+    status = rtsp_request(session, "POST", "/fp-setup", "application/octet-stream",
+                          handshake, sizeof(handshake), &response, &response_len);
+    free(response);
+    if (status != 200 || response_len != 32) {
+        session->error = "fp-setup step 2 failed";
+        return -1;
+    }
+
+    unsigned char aeskey[64];
+    unsigned char fp_reply[32];
+    unsigned char ekey_copy[72];
+    fairplay_t *fairplay = fairplay_init(session->logger);
+    assert(fairplay);
+    fairplay_setup(fairplay, setup, reply);
+    fairplay_handshake(fairplay, handshake, fp_reply);
+    memcpy(ekey_copy, ekey, sizeof(ekey_copy));     /* playfair works on its input in place */
+    fairplay_decrypt(fairplay, ekey_copy, aeskey);
+    fairplay_destroy(fairplay);
+
+    sha_ctx_t *ctx = sha_init();
+    sha_update(ctx, aeskey, 16);
+    sha_update(ctx, session->ecdh_secret, X25519_KEY_SIZE);
+    sha_final(ctx, aeskey, NULL);
+    sha_destroy(ctx);
+    memcpy(session->aeskey, aeskey, 16);
+    return 0;
+}
+
+static int
+loadgen_setup(loadgen_session_t *session)
+{
+    const loadgen_config_t *config = session->config;
+    unsigned char ekey[72];
+    plist_t request, response, streams, stream;
+    int status;
+
+    if (loadgen_fairplay(session, ekey) < 0) {
+        return -1;
+    }
+    for (int i = 0; i < 16; i++) {
+        session->aesiv[i] = (unsigned char) rand();
+    }
+
+    /* SETUP 1: keys and timing */
+    session->timing_lport = 0;
+    session->timing_sock = netutils_init_socket(&session->timing_lport, session->use_ipv6, 1);
+    if (session->timing_sock == -1) {
+        session->error = "cannot create timing socket";
+        return -1;
+    }
+    /* the server sends its first timing request while handling SETUP */
+    THREAD_CREATE(session->ntp_thread, loadgen_ntp_thread, session);
+    session->ntp_started = true;
+    request = plist_new_dict();
+    plist_dict_set_item(request, "ekey", plist_new_data((const char *) ekey, sizeof(ekey)));
+    plist_dict_set_item(request, "eiv", plist_new_data((const char *) session->aesiv, sizeof(session->aesiv)));
+    plist_dict_set_item(request, "timingProtocol", plist_new_string("NTP"));
+    plist_dict_set_item(request, "timingPort", plist_new_uint(session->timing_lport));
+    plist_dict_set_item(request, "isScreenMirroringSession", plist_new_bool(config->video));
+    status = rtsp_request_plist(session, "SETUP", request, &response);
+    plist_free(request);
+    if (status != 200 || !response) {
+        session->error = "SETUP (timing) failed";
+        return -1;
+    }
+    plist_free(response);
+
+    /* SETUP 110: mirror video */
+    if (config->video) {
+        session->stream_connection_id = ((uint64_t) rand() << 32) ^ (uint64_t) rand();
+        request = plist_new_dict();
+        streams = plist_new_array();
+        stream = plist_new_dict();
+        plist_dict_set_item(stream, "type", plist_new_uint(110));
+        plist_dict_set_item(stream, "streamConnectionID", plist_new_uint(session->stream_connection_id));
+        plist_array_append_item(streams, stream);
+        plist_dict_set_item(request, "streams", streams);
+        status = rtsp_request_plist(session, "SETUP", request, &response);
+        plist_free(request);
+        streams = response ? plist_dict_get_item(response, "streams") : NULL;
+        if (status == 200 && streams && plist_array_get_size(streams) > 0) {
+            session->video_rport = plist_get_port(plist_array_get_item(streams, 0), "dataPort");
+        }
+        plist_free(response);
+        if (!session->video_rport) {
+            session->error = "SETUP (mirror) failed";
+            return -1;
+        }
+    }
+
+    /* SETUP 96: audio over UDP */
+    if (config->ct) {
+        session->control_lport = 0;
+        session->control_sock = netutils_init_socket(&session->control_lport, session->use_ipv6, 1);
+        unsigned short data_lport = 0;
+        session->audio_sock = netutils_init_socket(&data_lport, session->use_ipv6, 1);
+        if (session->control_sock == -1 || session->audio_sock == -1) {
+            session->error = "cannot create audio sockets";
+            return -1;
+        }
+        bool aac = (config->ct == 8);
+        request = plist_new_dict();
+        streams = plist_new_array();
+        stream = plist_new_dict();
+        plist_dict_set_item(stream, "type", plist_new_uint(96));
+        plist_dict_set_item(stream, "ct", plist_new_uint(config->ct));
+        plist_dict_set_item(stream, "spf", plist_new_uint(aac ? 480 : 352));
+        plist_dict_set_item(stream, "audioFormat", plist_new_uint(aac ? AUDIO_FORMAT_AAC_ELD_44100_2 : AUDIO_FORMAT_ALAC_44100_16_2));
+        plist_dict_set_item(stream, "controlPort", plist_new_uint(session->control_lport));
+        plist_dict_set_item(stream, "isMedia", plist_new_bool(1));
+        plist_dict_set_item(stream, "usingScreen", plist_new_bool(config->video));
+        plist_array_append_item(streams, stream);
+        plist_dict_set_item(request, "streams", streams);
+        status = rtsp_request_plist(session, "SETUP", request, &response);
+        plist_free(request);
+        streams = response ? plist_dict_get_item(response, "streams") : NULL;
+        if (status == 200 && streams && plist_array_get_size(streams) > 0) {
+            session->audio_data_rport = plist_get_port(plist_array_get_item(streams, 0), "dataPort");
+            session->audio_control_rport = plist_get_port(plist_array_get_item(streams, 0), "controlPort");
+        }
+        plist_free(response);
+        if (!session->audio_data_rport || !session->audio_control_rport) {
+            session->error = "SETUP (audio) failed";
+            return -1;
+        }
+    }
+
+    if (rtsp_request_plist(session, "RECORD", NULL, NULL) != 200) {
+        session->error = "RECORD failed";
+        return -1;
+    }
+    return 0;
+}
+
+/* ---- streams ---- */
+
+/* mirror packet header timestamps are 32.32 fixed point seconds since 1970 */
+static uint64_t
+loadgen_mirror_timestamp(uint64_t ns)
+{
+    uint64_t seconds = ns / SECOND_IN_NSECS;
+    uint64_t fraction = ((ns % SECOND_IN_NSECS) << 32) / SECOND_IN_NSECS;
+    return (seconds << 32) | fraction;
+}
+
+static int
+loadgen_send_video(impair_t *impair, int fd, const unsigned char *data, int len)
+{
+    return impair ? impair_send_stream(impair, fd, data, len) : loadgen_send_all(fd, data, len);
+}
+
+static int
+loadgen_send_codec(loadgen_session_t *session, impair_t *impair, int fd, uint64_t timestamp,
+                   const unsigned char *sps, int sps_len, const unsigned char *pps, int pps_len)
+{
+    unsigned char header[128];
+    int payload_len = 11 + sps_len + pps_len;
+    unsigned char *payload = malloc(payload_len);
+    assert(payload);
+
+    /* avcC: version, profile, compatibility, level, length size, one SPS, one PPS */
+    payload[0] = 1;
+    payload[1] = sps[1];
+    payload[2] = sps[2];
+    payload[3] = sps[3];
+    payload[4] = 0xff;
+    payload[5] = 0xe1;
+    payload[6] = (unsigned char) (sps_len >> 8);
+    payload[7] = (unsigned char) sps_len;
+    memcpy(payload + 8, sps, sps_len);
+    payload[8 + sps_len] = 1;
+    payload[9 + sps_len] = (unsigned char) (pps_len >> 8);
+    payload[10 + sps_len] = (unsigned char) pps_len;
+    memcpy(payload + 11 + sps_len, pps, pps_len);
+
+    float width = (float) session->config->width;
+    float height = (float) session->config->height;
+    uint32_t size = payload_len;
+    memset(header, 0, sizeof(header));
+    memcpy(header, &size, 4);
+    header[4] = 0x01;
+    header[6] = 0x16;
+    header[7] = 0x01;
+    memcpy(header + 8, &timestamp, 8);
+    for (int offset = 16; offset <= 56; offset += 8) {
+        if (offset == 24 || offset == 32) continue;
+        memcpy(header + offset, &width, 4);
+        memcpy(header + offset + 4, &height, 4);
+    }
+
+    int ret = loadgen_send_video(impair, fd, header, sizeof(header));
+    if (!ret) {
+        ret = loadgen_send_video(impair, fd, payload, payload_len);
+    }
+    free(payload);
+    return ret;
+}
+
+static THREAD_RETVAL
+loadgen_video_thread(void *arg)
+{
+    loadgen_session_t *session = arg;
+    const loadgen_config_t *config = session->config;
+    const h264_source_t *source = session->source;
+    unsigned char header[128];
+
+    int fd = loadgen_connect(session, session->video_rport);
+    if (fd == -1) {
+        session->error = "cannot connect to mirror data port";
+        return 0;
+    }
+    mirror_buffer_t *cipher = mirror_buffer_init(session->logger, session->aeskey);
+    assert(cipher);
+    mirror_buffer_init_aes(cipher, &session->stream_connection_id);
+    impair_t *impair = NULL;
+    if (config->impaired) {
+        impair_config_t impair_config = config->impair;
+        impair_config.seed += 2 * session->id + 1;
+        impair = impair_init(session->logger, &impair_config);
+    }
+
+    /* synthetic stream parameters */
+    int mbs = (config->width / 16) * (config->height / 16);
+    int target_size = (int) ((int64_t) config->video_kbps * 1000 / 8 / config->fps);
+    int rbsp_size = mbs * 390 + 64;
+    unsigned char sps[64], pps[64];
+    int sps_len = 0, pps_len = 0;
+    unsigned char *rbsp = NULL;
+    if (!source) {
+        unsigned char params[64];
+        int len = h264_synthetic_sps(params, sizeof(params), config->width, config->height);
+        sps_len = h264_put_nal(sps, 0x67, params, len) - 4;
+        memmove(sps, sps + 4, sps_len);
+        len = h264_synthetic_pps(params, sizeof(params));
+        pps_len = h264_put_nal(pps, 0x68, params, len) - 4;
+        memmove(pps, pps + 4, pps_len);
+        rbsp = malloc(rbsp_size);
+        assert(rbsp);
+    }
+
+    int buffer_size = 0;
+    unsigned char *frame = NULL;
+    unsigned char *encrypted = NULL;
+    uint64_t period_ns = SECOND_IN_NSECS / config->fps;
+    uint64_t start = loadgen_monotonic_ns();
+    int source_index = 0, idr_count = 0, frame_num = 0;
+    int64_t budget = 0;            /* bytes the synthetic stream is below its bitrate */
+
+    for (uint64_t n = 0; session->running; n++) {
+        uint64_t lag = loadgen_sleep_until(start + n * period_ns);
+        if (lag > session->stats.max_video_lag_ns) {
+            session->stats.max_video_lag_ns = lag;
+        }
+        uint64_t timestamp = loadgen_mirror_timestamp(loadgen_clock_now(&session->clock));
+        bool codec = false;
+        int frame_len = 0;
+
+        if (source) {
+            const h264_frame_t *f = &source->frames[source_index];
+            source_index = (source_index + 1) % source->frame_count;
+            if (f->sps >= 0) {
+                if (loadgen_send_codec(session, impair, fd, timestamp, source->nals[f->sps].data, source->nals[f->sps].len,
+                                       source->nals[f->pps].data, source->nals[f->pps].len)) {
+                    break;
+                }
+                codec = true;
+            }
+            int needed = 0;
+            for (int i = 0; i < f->nal_count; i++) {
+                needed += 4 + source->nals[f->first_nal + i].len;
+            }
+            if (needed > buffer_size) {
+                buffer_size = needed;
+                frame = realloc(frame, buffer_size);
+                encrypted = realloc(encrypted, buffer_size);
+                assert(frame && encrypted);
+            }
+            for (int i = 0; i < f->nal_count; i++) {
+                const h264_nal_t *nal = &source->nals[f->first_nal + i];
+                frame[frame_len] = (unsigned char) (nal->len >> 24);
+                frame[frame_len + 1] = (unsigned char) (nal->len >> 16);
+                frame[frame_len + 2] = (unsigned char) (nal->len >> 8);
+                frame[frame_len + 3] = (unsigned char) nal->len;
+                memcpy(frame + frame_len + 4, nal->data, nal->len);
+                frame_len += 4 + nal->len;
+            }
+        } else {
+            bool idr = (n % config->gop == 0);
+            int needed = 4 + 1 + rbsp_size * 3 / 2 + target_size + 16;
+            if (needed > buffer_size) {
+                buffer_size = needed;
+                frame = realloc(frame, buffer_size);
+                encrypted = realloc(encrypted, buffer_size);
+                assert(frame && encrypted);
+            }
+            if (idr) {
+                if (loadgen_send_codec(session, impair, fd, timestamp, sps, sps_len, pps, pps_len)) {
+                    break;
+                }
+                codec = true;
+                int len = h264_synthetic_idr(rbsp, rbsp_size, config->width, config->height, idr_count++);
+                frame_len = h264_put_nal(frame, 0x65, rbsp, len);
+                frame_num = 0;
+            } else {
+                int len = h264_synthetic_p(rbsp, rbsp_size, config->width, config->height, ++frame_num);
+                frame_len = h264_put_nal(frame, 0x41, rbsp, len);
+            }
+            /* IDR frames overshoot: the following frames get no filler until it is paid back */
+            budget += target_size;
+            if (budget - frame_len >= 6) {
+                frame_len += h264_put_filler(frame + frame_len, (int) (budget - frame_len));
+            }
+            budget -= frame_len;
+        }
+
+        /* AES-CTR is symmetric: the server's decryptor, run on our side, encrypts */
+        mirror_buffer_decrypt(cipher, frame, encrypted, frame_len);
+
+        uint32_t size = frame_len;
+        memset(header, 0, sizeof(header));
+        memcpy(header, &size, 4);
+        header[5] = codec ? 0x10 : 0x00;
+        memcpy(header + 8, &timestamp, 8);
+        if (loadgen_send_video(impair, fd, header, sizeof(header)) || loadgen_send_video(impair, fd, encrypted, frame_len)) {
+            break;
+        }
+        session->stats.video_frames++;
+        session->stats.video_bytes += sizeof(header) + frame_len;
+    }
+
+    if (session->running) {
+        session->error = "mirror connection closed by server";
+    }
+    if (impair) {
+        impair_get_stats(impair, &session->video_impair_stats);
+        impair_destroy(impair);
+    }
+    free(rbsp);
+    free(frame);
+    free(encrypted);
+    mirror_buffer_destroy(cipher);
+    closesocket(fd);
+    return 0;
+}
+
+/* An ALAC frame in "escape" (uncompressed) form: stereo element, 352 interleaved
+ * big-endian 16-bit samples, end element.  Returns its length in bytes */
+static int
+loadgen_alac_frame(unsigned char *out, int size, uint64_t first_sample)
+{
+    bitwriter_t bw = { out, size, 0 };
+    memset(out, 0, size);
+    bits_put(&bw, 1, 3);                /* ID_CPE */
+    bits_put(&bw, 0, 4);                /* element instance tag */
+    bits_put(&bw, 0, 12);               /* unused */
+    bits_put(&bw, 0, 1);                /* no sample count: frame holds spf samples */
+    bits_put(&bw, 0, 2);                /* no uncompressed low bytes */
+    bits_put(&bw, 1, 1);                /* escape: samples are not compressed */
+    for (int i = 0; i < 352; i++) {
+        double t = (double) (first_sample + i) / AUDIO_SAMPLE_RATE;
+        int16_t sample = (int16_t) (8000.0 * sin(2.0 * M_PI * 440.0 * t));
+        bits_put(&bw, (uint16_t) sample, 16);
+        bits_put(&bw, (uint16_t) sample, 16);
+    }
+    bits_put(&bw, 7, 3);                /* ID_END */
+    bits_align_zero(&bw);
+    return bw.bits >> 3;
+}
+
+static void
+loadgen_audio_sync(loadgen_session_t *session, bool first, uint32_t rtp, uint32_t latency)
+{
+    unsigned char packet[20];
+    packet[0] = first ? 0x90 : 0x80;
+    packet[1] = 0xd4;
+    packet[2] = 0x00;
+    packet[3] = 0x04;
+    packet[4] = (unsigned char) (rtp >> 24);
+    packet[5] = (unsigned char) (rtp >> 16);
+    packet[6] = (unsigned char) (rtp >> 8);
+    packet[7] = (unsigned char) rtp;
+    byteutils_put_ntp_timestamp(packet, 8, loadgen_clock_now(&session->clock));
+    uint32_t next_rtp = rtp + latency;
+    packet[16] = (unsigned char) (next_rtp >> 24);
+    packet[17] = (unsigned char) (next_rtp >> 16);
+    packet[18] = (unsigned char) (next_rtp >> 8);
+    packet[19] = (unsigned char) next_rtp;
+    loadgen_sendto_server(session, session->control_sock, session->audio_control_rport, packet, sizeof(packet));
+    session->stats.sync_packets++;
+}
+
+/* answer resend requests (type 0x55) from the packets we still have */
+static void
+loadgen_audio_resend(loadgen_session_t *session, unsigned char (*history)[AUDIO_PACKET_LEN], const int *history_len,
+                     bool *history_dropped)
+{
+    unsigned char request[64];
+    unsigned char packet[4 + AUDIO_PACKET_LEN];
+    int len;
+
+    while ((len = recv(session->control_sock, (char *) request, sizeof(request), MSG_DONTWAIT)) > 0) {
+        if (len < 8 || (request[1] & ~0x80) != 0x55) {
+            continue;
+        }
+        unsigned short seqnum = byteutils_get_short_be(request, 4);
+        unsigned short count = byteutils_get_short_be(request, 6);
+        for (unsigned short i = 0; i < count && i < AUDIO_HISTORY; i++) {
+            unsigned short seq = seqnum + i;
+            int slot = seq % AUDIO_HISTORY;
+            if (!history_len[slot] || byteutils_get_short_be(history[slot], 2) != seq) {
+                continue;
+            }
+            packet[0] = 0x80;
+            packet[1] = 0xd6;
+            packet[2] = 0x00;
+            packet[3] = 0x01;
+            memcpy(packet + 4, history[slot], history_len[slot]);
+            if (loadgen_sendto_server(session, session->control_sock, session->audio_control_rport, packet, 4 + history_len[slot]) &&
+                history_dropped[slot]) {
+                history_dropped[slot] = false;
+                session->stats.audio_recovered++;
+            }
+            session->stats.resent_packets++;
+        }
+    }
+}
+
+static THREAD_RETVAL
+loadgen_audio_thread(void *arg)
+{
+    loadgen_session_t *session = arg;
+    const loadgen_config_t *config = session->config;
+    bool aac = (config->ct == 8);
+    int spf = aac ? 480 : 352;
+    uint32_t latency = aac ? 7497 : 77175;    /* next_rtp - sync_rtp, as sent by real clients */
+    unsigned char payload[AUDIO_PACKET_LEN];
+    unsigned char (*history)[AUDIO_PACKET_LEN] = calloc(AUDIO_HISTORY, AUDIO_PACKET_LEN);
+    int *history_len = calloc(AUDIO_HISTORY, sizeof(int));
+    bool *history_dropped = calloc(AUDIO_HISTORY, sizeof(bool));
+    assert(history && history_len && history_dropped);
+
+    aes_ctx_t *aes_ctx = aes_cbc_init(session->aeskey, session->aesiv, AES_ENCRYPT);
+    int aac_size = (int) ((int64_t) config->audio_kbps * 1000 / 8 * spf / AUDIO_SAMPLE_RATE);
+    if (aac_size < 16) aac_size = 16;
+    if (aac_size > AUDIO_PACKET_LEN - 12) aac_size = AUDIO_PACKET_LEN - 12;
+
+    /* packets are paced on the sender's clock, so clock drift also drifts the sample rate */
+    double rate = 1.0 + config->clock_drift_ppm * 1e-6;
+    uint64_t period_ns = (uint64_t) ((double) spf * SECOND_IN_NSECS / AUDIO_SAMPLE_RATE / rate);
+    unsigned short seqnum = (unsigned short) rand();
+    uint32_t rtp_start = (uint32_t) rand();
+    uint64_t start = loadgen_monotonic_ns();
+    uint64_t packets_per_sync = (AUDIO_SAMPLE_RATE + spf - 1) / spf;
+
+    for (uint64_t n = 0; session->running; n++, seqnum++) {
+        /* wait for the next packet time, answering resend requests meanwhile */
+        for (;;) {
+            uint64_t now = loadgen_monotonic_ns();
+            uint64_t deadline = start + n * period_ns;
+            if (now >= deadline) {
+                if (now - deadline > session->stats.max_audio_lag_ns) {
+                    session->stats.max_audio_lag_ns = now - deadline;
+                }
+                break;
+            }
+            fd_set rfds;
+            struct timeval tv;
+            uint64_t wait = deadline - now;
+            tv.tv_sec = wait / SECOND_IN_NSECS;
+            tv.tv_usec = (wait % SECOND_IN_NSECS) / 1000;
+            FD_ZERO(&rfds);
+            FD_SET(session->control_sock, &rfds);
+            if (select(session->control_sock + 1, &rfds, NULL, NULL, &tv) > 0) {
+                loadgen_audio_resend(session, history, history_len, history_dropped);
+            }
+        }
+        uint32_t rtp = rtp_start + (uint32_t) (n * spf);
+        if (n % packets_per_sync == 0) {
+            loadgen_audio_sync(session, n == 0, rtp, latency);
+        }
+
+        int payload_len;
+        if (aac) {
+            /* opaque payload with a valid AAC-ELD first byte: not decodable audio */
+            payload_len = aac_size;
+            for (int i = 0; i < payload_len; i++) {
+                payload[i] = (unsigned char) rand();
+            }
+            payload[0] = 0x8d;
+        } else {
+            payload_len = loadgen_alac_frame(payload, sizeof(payload), n * spf);
+        }
+
+        int slot = seqnum % AUDIO_HISTORY;
+        unsigned char *packet = history[slot];
+        packet[0] = 0x80;
+        packet[1] = 0x60;
+        packet[2] = (unsigned char) (seqnum >> 8);
+        packet[3] = (unsigned char) seqnum;
+        packet[4] = (unsigned char) (rtp >> 24);
+        packet[5] = (unsigned char) (rtp >> 16);
+        packet[6] = (unsigned char) (rtp >> 8);
+        packet[7] = (unsigned char) rtp;
+        memset(packet + 8, 0, 4);
+        /* AES-CBC over whole blocks only, restarting from the iv for every packet */
+        int encrypted_len = payload_len / 16 * 16;
+        aes_cbc_encrypt(aes_ctx, payload, packet + 12, encrypted_len);
+        aes_cbc_reset(aes_ctx);
+        memcpy(packet + 12 + encrypted_len, payload + encrypted_len, payload_len - encrypted_len);
+        history_len[slot] = 12 + payload_len;
+
+        history_dropped[slot] = !loadgen_sendto_server(session, session->audio_sock, session->audio_data_rport,
+                                                       packet, history_len[slot]);
+        if (history_dropped[slot]) {
+            session->stats.audio_dropped++;
+        }
+        session->stats.audio_packets++;
+        session->stats.audio_bytes += history_len[slot];
+    }
+
+    aes_cbc_destroy(aes_ctx);
+    free(history);
+    free(history_len);
+    free(history_dropped);
+    return 0;
+}
+
+/* ---- sessions ---- */
+
+static void
+loadgen_session_stop(loadgen_session_t *session)
+{
+    session->running = 0;
+    if (session->video_started) {
+        THREAD_JOIN(session->video_thread);
+    }
+    if (session->audio_started) {
+        THREAD_JOIN(session->audio_thread);
+    }
+    if (session->ntp_started) {
+        THREAD_JOIN(session->ntp_thread);
+    }
+    session->video_started = session->audio_started = session->ntp_started = false;
+}
+
+static THREAD_RETVAL
+loadgen_session_thread(void *arg)
+{
+    loadgen_session_t *session = arg;
+    const loadgen_config_t *config = session->config;
+    unsigned char *response;
+    int response_len;
+
+    loadgen_clock_init(&session->clock, config->clock_offset_ns, config->clock_drift_ppm);
+    session->session_id = ((uint64_t) rand() << 32) ^ (uint64_t) rand();
+    session->timing_sock = session->control_sock = session->audio_sock = -1;
+
+    session->rtsp_fd = loadgen_connect(session, session->target->port);
+    if (session->rtsp_fd == -1) {
+        session->error = "cannot connect to server";
+        return 0;
+    }
+    if (rtsp_request(session, "GET", "/info", NULL, NULL, 0, &response, &response_len) != 200) {
+        session->error = "GET /info failed";
+        goto done;
+    }
+    free(response);
+    if (loadgen_pair(session) < 0) {
+        goto done;
+    }
+
+    if (config->impaired) {
+        impair_config_t impair_config = config->impair;
+        impair_config.seed += 2 * session->id;
+        session->udp_impair = impair_init(session->logger, &impair_config);
+    }
+    session->running = 1;
+    if (loadgen_setup(session) < 0) {
+        loadgen_session_stop(session);
+        goto done;
+    }
+    if (config->video) {
+        THREAD_CREATE(session->video_thread, loadgen_video_thread, session);
+        session->video_started = true;
+    }
+    if (config->ct) {
+        THREAD_CREATE(session->audio_thread, loadgen_audio_thread, session);
+        session->audio_started = true;
+    }
+    logger_log(session->logger, LOGGER_INFO, "session %d: streaming", session->id);
+
+    uint64_t start = loadgen_monotonic_ns();
+    uint64_t end = start + (uint64_t) config->duration * SECOND_IN_NSECS;
+    uint64_t next_feedback = start;
+    while (!stop_requested && !session->error) {
+        uint64_t now = loadgen_monotonic_ns();
+        if (config->duration && now >= end) {
+            break;
+        }
+        if (now >= next_feedback) {
+            /* keepalive, as sent by real clients */
+            if (rtsp_request(session, "POST", "/feedback", NULL, NULL, 0, NULL, NULL) != 200) {
+                session->error = "RTSP connection lost";
+                break;
+            }
+            next_feedback += FEEDBACK_INTERVAL_MS * 1000000ULL;
+        }
+        sleepms(50);
+    }
+
+    loadgen_session_stop(session);
+    session->stats.streaming_ns = loadgen_monotonic_ns() - start;
+    rtsp_request_plist(session, "TEARDOWN", NULL, NULL);
+
+  done:
+    if (session->udp_impair) {
+        impair_get_stats(session->udp_impair, &session->udp_impair_stats);
+        impair_destroy(session->udp_impair);
+        session->udp_impair = NULL;
+    }
+    closesocket(session->rtsp_fd);
+    if (session->timing_sock != -1) closesocket(session->timing_sock);
+    if (session->control_sock != -1) closesocket(session->control_sock);
+    if (session->audio_sock != -1) closesocket(session->audio_sock);
+    return 0;
+}
+
+/* parse host[:port] and resolve it */
+static int
+loadgen_target_init(loadgen_target_t *target, const char *arg)
+{
+    struct addrinfo hints, *result;
+    char port[8];
+
+    snprintf(target->host, sizeof(target->host), "%s", arg);
+    target->port = DEFAULT_PORT;
+    char *colon = strrchr(target->host, ':');
+    if (colon && strchr(target->host, ':') == colon) {
+        *colon = '\0';
+        target->port = (unsigned short) atoi(colon + 1);
+    }
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    snprintf(port, sizeof(port), "%u", target->port);
+    if (getaddrinfo(target->host, port, &hints, &result) || !result) {
+        return -1;
+    }
+    memcpy(&target->addr, result->ai_addr, result->ai_addrlen);
+    target->addrlen = result->ai_addrlen;
+    freeaddrinfo(result);
+    return 0;
+}
+
+static void
+impair_add_stats(impair_stats_t *total, const impair_stats_t *stats)
+{
+    total->packets += stats->packets;
+    total->dropped += stats->dropped;
+    total->reordered += stats->reordered;
+    total->duplicated += stats->duplicated;
+    total->sent += stats->sent;
+    total->send_errors += stats->send_errors;
+    total->total_delay_ns += stats->total_delay_ns;
+    if (stats->max_delay_ns > total->max_delay_ns) {
+        total->max_delay_ns = stats->max_delay_ns;
+    }
+}
+
+static void
+print_usage(const char *name)
+{
+    printf("Usage: %s [options] [host[:port] ...]   (default 127.0.0.1:%d)\n", name, DEFAULT_PORT);
+    printf("Synthetic AirPlay mirroring sender for load and latency testing\n");
+    printf("Sessions are assigned to the servers given in turn; a uxplay server\n");
+    printf("holds at most two concurrent sessions.\n");
+    printf("Options:\n");
+    printf("-n N         Run N concurrent sessions (default 1)\n");
+    printf("-t secs      Stream for secs seconds, 0 = until interrupted (default 10)\n");
+    printf("-stagger ms  Delay between session starts (default 100)\n");
+    printf("-fps N       Video frame rate (default 30)\n");
+    printf("-vb kbps     Synthetic video bitrate, padded with filler data (default 4000)\n");
+    printf("-s wxh       Synthetic video size, multiples of 16 (default 640x480)\n");
+    printf("-gop N       Frames between synthetic IDR frames (default 60)\n");
+    printf("-h264 file   Stream an Annex-B H.264 file (looped) instead of synthetic video\n");
+    printf("-novideo     Audio only, no mirror stream\n");
+    printf("-audio fmt   Audio format: alac (440 Hz tone), aac-eld (opaque payload), none\n");
+    printf("             (default alac)\n");
+    printf("-ab kbps     AAC-ELD payload bitrate (default 160)\n");
+    printf("-offset ms   Sender clock offset from the system clock (default 0)\n");
+    printf("-drift ppm   Sender clock drift (default 0)\n");
+    printf("Network impairment of everything sent after SETUP (RTP, NTP, mirror stream):\n");
+    printf("-loss pct    Lose pct %% of the UDP packets (default 0)\n");
+    printf("-burst n     Mean length of loss bursts, in packets (default 1: independent)\n");
+    printf("-reorder pct Hold back pct %% of the UDP packets by %d ms (default 0)\n", IMPAIR_REORDER_MS);
+    printf("-dup pct     Send pct %% of the UDP packets twice (default 0)\n");
+    printf("-delay ms    Delay UDP packets and the mirror stream by ms (default 0)\n");
+    printf("-jitter ms   Add a random 0..ms to the delay (default 0)\n");
+    printf("-seed n      Random seed of the impairment, for repeatable runs (default 1)\n");
+    printf("-d           Enable debug logging\n");
+    printf("-h           Show this help\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+    loadgen_config_t config;
+    h264_source_t *source = NULL;
+    bool debug = false;
+    int ret = 0;
+
+    memset(&config, 0, sizeof(config));
+    config.sessions = 1;
+    config.duration = 10;
+    config.stagger_ms = 100;
+    config.video = true;
+    config.fps = 30;
+    config.video_kbps = 4000;
+    config.width = 640;
+    config.height = 480;
+    config.gop = 60;
+    config.ct = 2;
+    config.audio_kbps = 160;
+    config.impair.burst = 1.0;
+    config.impair.seed = 1;
+
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        bool has_value = (i + 1 < argc);
+        if (!strcmp(arg, "-n") && has_value) {
+            config.sessions = atoi(argv[++i]);
+        } else if (!strcmp(arg, "-t") && has_value) {
+            config.duration = atoi(argv[++i]);
+        } else if (!strcmp(arg, "-stagger") && has_value) {
+            config.stagger_ms = atoi(argv[++i]);
+        } else if (!strcmp(arg, "-fps") && has_value) {
+            config.fps = atoi(argv[++i]);
+        } else if (!strcmp(arg, "-vb") && has_value) {
+            config.video_kbps = atoi(argv[++i]);
+        } else if (!strcmp(arg, "-s") && has_value) {
+            if (sscanf(argv[++i], "%dx%d", &config.width, &config.height) != 2) {
+                config.width = 0;
+            }
+        } else if (!strcmp(arg, "-gop") && has_value) {
+            config.gop = atoi(argv[++i]);
+        } else if (!strcmp(arg, "-h264") && has_value) {
+            config.h264_file = argv[++i];
+        } else if (!strcmp(arg, "-novideo")) {
+            config.video = false;
+        } else if (!strcmp(arg, "-audio") && has_value) {
+            const char *fmt = argv[++i];
+            if (!strcmp(fmt, "alac")) {
+                config.ct = 2;
+            } else if (!strcmp(fmt, "aac-eld")) {
+                config.ct = 8;
+            } else if (!strcmp(fmt, "none")) {
+                config.ct = 0;
+            } else {
+                fprintf(stderr, "unknown audio format \"%s\"\n", fmt);
+                exit(1);
+            }
+        } else if (!strcmp(arg, "-ab") && has_value) {
+            config.audio_kbps = atoi(argv[++i]);
+        } else if (!strcmp(arg, "-offset") && has_value) {
+            config.clock_offset_ns = (int64_t) (atof(argv[++i]) * 1000000.0);
+        } else if (!strcmp(arg, "-drift") && has_value) {
+            config.clock_drift_ppm = atof(argv[++i]);
+        } else if (!strcmp(arg, "-loss") && has_value) {
+            config.impair.loss = atof(argv[++i]) / 100.0;
+        } else if (!strcmp(arg, "-burst") && has_value) {
+            config.impair.burst = atof(argv[++i]);
+        } else if (!strcmp(arg, "-reorder") && has_value) {
+            config.impair.reorder = atof(argv[++i]) / 100.0;
+        } else if (!strcmp(arg, "-dup") && has_value) {
+            config.impair.duplicate = atof(argv[++i]) / 100.0;
+        } else if (!strcmp(arg, "-delay") && has_value) {
+            config.impair.delay_ms = atoi(argv[++i]);
+        } else if (!strcmp(arg, "-jitter") && has_value) {
+            config.impair.jitter_ms = atoi(argv[++i]);
+        } else if (!strcmp(arg, "-seed") && has_value) {
+            config.impair.seed = strtoull(argv[++i], NULL, 10);
+        } else if (!strcmp(arg, "-d")) {
+            debug = true;
+        } else if (!strcmp(arg, "-h") || !strcmp(arg, "--help")) {
+            print_usage(argv[0]);
+            exit(0);
+        } else if (arg[0] != '-' && config.target_count < MAX_TARGETS) {
+            if (loadgen_target_init(&config.targets[config.target_count++], arg) < 0) {
+                fprintf(stderr, "cannot resolve %s\n", arg);
+                exit(1);
+            }
+        } else {
+            fprintf(stderr, "unknown or incomplete option \"%s\"\n", arg);
+            print_usage(argv[0]);
+            exit(1);
+        }
+    }
+    if (config.target_count == 0) {
+        loadgen_target_init(&config.targets[config.target_count++], "127.0.0.1");
+    }
+    if (config.sessions < 1 || config.fps < 1 || config.gop < 1 || config.duration < 0 ||
+        config.width < 16 || config.height < 16 || config.width % 16 || config.height % 16 ||
+        config.impair.loss < 0.0 || config.impair.loss >= 1.0 || config.impair.reorder < 0.0 ||
+        config.impair.duplicate < 0.0 || config.impair.delay_ms < 0 || config.impair.jitter_ms < 0) {
+        fprintf(stderr, "invalid option value\n");
+        exit(1);
+    }
+    config.impaired = impair_config_active(&config.impair);
+    if (!config.video && !config.ct) {
+        fprintf(stderr, "nothing to stream: both video and audio are disabled\n");
+        exit(1);
+    }
+    if (config.video && config.h264_file) {
+        source = h264_source_load(config.h264_file);
+        if (!source) {
+            fprintf(stderr, "cannot load H.264 stream (with SPS and PPS) from %s\n", config.h264_file);
+            exit(1);
+        }
+        printf("%s: %d frames\n", config.h264_file, source->frame_count);
+    }
+
+    netutils_init();
+    signal(SIGINT, loadgen_signal_handler);
+    signal(SIGTERM, loadgen_signal_handler);
+    signal(SIGPIPE, SIG_IGN);
+    srand((unsigned int) time(NULL) ^ (unsigned int) getpid());
+
+    logger_t *logger = logger_init();
+    logger_set_level(logger, debug ? LOGGER_DEBUG : LOGGER_INFO);
+
+    loadgen_session_t *sessions = calloc(config.sessions, sizeof(loadgen_session_t));
+    assert(sessions);
+    for (int i = 0; i < config.sessions && !stop_requested; i++) {
+        loadgen_session_t *session = &sessions[i];
+        session->id = i;
+        session->config = &config;
+        session->source = source;
+        session->logger = logger;
+        session->target = &config.targets[i % config.target_count];
+        session->use_ipv6 = (session->target->addr.ss_family == AF_INET6);
+        THREAD_CREATE(session->session_thread, loadgen_session_thread, session);
+        if (config.stagger_ms > 0) {
+            sleepms(config.stagger_ms);
+        }
+    }
+
+    loadgen_stats_t total;
+    impair_stats_t udp_total, video_total;
+    memset(&total, 0, sizeof(total));
+    memset(&udp_total, 0, sizeof(udp_total));
+    memset(&video_total, 0, sizeof(video_total));
+    printf("session  frames  video_kbps  audio_pkts  audio_kbps  syncs  resent  ntp  max_lag_ms(v/a)  status\n");
+    for (int i = 0; i < config.sessions; i++) {
+        loadgen_session_t *session = &sessions[i];
+        if (!session->session_thread) {
+            continue;
+        }
+        THREAD_JOIN(session->session_thread);
+        loadgen_stats_t *stats = &session->stats;
+        double seconds = stats->streaming_ns ? (double) stats->streaming_ns / SECOND_IN_NSECS : 1.0;
+        printf("%7d %7llu %11.0f %11llu %11.0f %6llu %7llu %4llu %8.1f/%-8.1f %s\n", session->id,
+               (unsigned long long) stats->video_frames, stats->video_bytes * 8 / 1000.0 / seconds,
+               (unsigned long long) stats->audio_packets, stats->audio_bytes * 8 / 1000.0 / seconds,
+               (unsigned long long) stats->sync_packets, (unsigned long long) stats->resent_packets,
+               (unsigned long long) stats->ntp_replies,
+               stats->max_video_lag_ns / 1e6, stats->max_audio_lag_ns / 1e6,
+               session->error ? session->error : "ok");
+        total.video_frames += stats->video_frames;
+        total.video_bytes += stats->video_bytes;
+        total.audio_packets += stats->audio_packets;
+        total.audio_bytes += stats->audio_bytes;
+        total.resent_packets += stats->resent_packets;
+        total.audio_dropped += stats->audio_dropped;
+        total.audio_recovered += stats->audio_recovered;
+        impair_add_stats(&udp_total, &session->udp_impair_stats);
+        impair_add_stats(&video_total, &session->video_impair_stats);
+        if (session->error) {
+            ret = 1;
+        }
+    }
+    printf("total: %llu frames, %llu video bytes, %llu audio packets, %llu audio bytes, %llu resent\n",
+           (unsigned long long) total.video_frames, (unsigned long long) total.video_bytes,
+           (unsigned long long) total.audio_packets, (unsigned long long) total.audio_bytes,
+           (unsigned long long) total.resent_packets);
+    if (config.impaired) {
+        printf("impairment: %llu of %llu udp packets dropped (%llu audio data), %llu reordered, %llu duplicated\n",
+               (unsigned long long) udp_total.dropped, (unsigned long long) udp_total.packets,
+               (unsigned long long) total.audio_dropped, (unsigned long long) udp_total.reordered,
+               (unsigned long long) udp_total.duplicated);
+        if (total.audio_dropped) {
+            printf("resend recovery: %llu of %llu dropped audio packets resent (%.1f%%)\n",
+                   (unsigned long long) total.audio_recovered, (unsigned long long) total.audio_dropped,
+                   100.0 * total.audio_recovered / total.audio_dropped);
+        }
+        printf("added latency (mean/max ms): udp %.2f/%.2f, mirror stream %.2f/%.2f\n",
+               udp_total.sent ? udp_total.total_delay_ns / 1e6 / udp_total.sent : 0.0, udp_total.max_delay_ns / 1e6,
+               video_total.sent ? video_total.total_delay_ns / 1e6 / video_total.sent : 0.0, video_total.max_delay_ns / 1e6);
+    }
+
+    free(sessions);
+    h264_source_destroy(source);
+    logger_destroy(logger);
+    netutils_cleanup();
+    return ret;
+}
@@ -51,9 +51,15 @@
 #include "lib/raop.h"
 #include "lib/stream.h"
 #include "lib/logger.h"
+#include "lib/trace.h"
+#include "lib/metrics.h"
+#include "lib/metrics_server.h"
 #include "lib/dnssd.h"
 #include "renderers/video_renderer.h"
 #include "renderers/audio_renderer.h"
+#include "renderers/renderer_bench.h"
+#include "renderers/recorder.h"
+#include "renderers/renderer_profile.h"
 #include "uxplay-lib.h"
 
 #define VERSION "1.63"
@@ -65,24 +71,32 @@
 #define LOWEST_ALLOWED_PORT 1024
 #define HIGHEST_PORT 65535
 #define NTP_TIMEOUT_LIMIT 5
+#define LATENCY_BUDGET_MS 1000   /* the time limit of a GStreamer queue with default settings */
+#define MAX_LATENCY_BUDGET_MS 10000
 #define BT709_FIX "capssetter caps=\"video/x-h264, colorimetry=bt709\""
 
 static std::string server_name = DEFAULT_NAME;
 static dnssd_t *dnssd = NULL;
 static raop_t *raop = NULL;
 static logger_t *render_logger = NULL;
+static metrics_server_t *metrics_server = NULL;
 static bool audio_sync = false;
 static bool video_sync = false;
 static int64_t audio_delay_alac = 0;
 static int64_t audio_delay_aac = 0;
 static bool relaunch_video = false;
 static bool reset_loop = false;
-static unsigned int open_connections= 0;
+static std::atomic_uint open_connections(0);
 static std::string videosink = "autovideosink";
 static videoflip_t videoflip[2] = { NONE , NONE };
 static bool use_video = true;
 static unsigned char compression_type = 0;
 static std::string audiosink = "autoaudiosink";
+static std::string bench_report = RENDERER_BENCH_REPORT;
+static std::string frame_export = "";
+static std::string record_filename = "";
+static std::string profile_name = RENDERER_PROFILE_AUTO;
+static recorder_t *recorder = NULL;
 static int  audiodelay = -1;
 static bool use_audio = true;
 static bool new_window_closing_behavior = true;
@@ -115,9 +129,11 @@ static unsigned short display[5] = {0}, tcp[3] = {0}, udp[3] = {0};
 static bool debug_log = DEFAULT_DEBUG_LOG;
 static bool bt709_fix = false;
 static int max_connections = 2;
+static unsigned int video_latency_budget = LATENCY_BUDGET_MS;
+static unsigned int audio_latency_budget = LATENCY_BUDGET_MS;
 static unsigned short raop_port;
 static unsigned short airplay_port;
-static uint64_t remote_clock_offset = 0;
+static std::atomic<uint64_t> remote_clock_offset(0);
 static struct uxplay_config app_config;
 static std::atomic_bool uxplay_stop_flag;
 
@@ -680,9 +696,10 @@ extern "C" void conn_init (void *cls) {
 
 extern "C" void conn_destroy (void *cls) {
     //video_renderer_update_background(-1);
-    open_connections--;
-    //LOGD("Open connections: %i", open_connections);
-    if (open_connections == 0) {
+    /* conn_init and conn_destroy may run on different threads */
+    unsigned int remaining = --open_connections;
+    //LOGD("Open connections: %i", remaining);
+    if (remaining == 0) {
         remote_clock_offset = 0;
     }
     update_status(uxplay_status_connection_destroy, "");
@@ -709,20 +726,43 @@ extern "C" void conn_teardown(void *cls, bool *teardown_96, bool *teardown_110)
     update_status(uxplay_status_connection_teardown, "");
 }
 
+/* auto: calibrate against the decoder that will be used; audio-only (or no GStreamer video) gets balanced */
+static void select_profile() {
+    const renderer_profile_t *profile = renderer_profile_find(profile_name.c_str());
+    if (!profile && use_video && video_renderer_backend(videosink.c_str()) == &video_renderer_gstreamer) {
+        profile = renderer_profile_calibrate(render_logger, video_parser.c_str(), video_decoder.c_str(),
+                                             video_converter.c_str(), display[0] ? display[0] : 1920,
+                                             display[1] ? display[1] : 1080, display[3] ? display[3] : 30);
+    }
+    renderer_profile_set(profile);
+    LOGI("using the %s pipeline profile", renderer_profile_get()->name);
+}
+
+/* set by whichever of the audio and video threads gets the first packet */
+static uint64_t get_remote_clock_offset (uint64_t ntp_time_local, uint64_t ntp_time_remote) {
+    uint64_t offset = 0;
+    if (remote_clock_offset.compare_exchange_strong(offset, ntp_time_local - ntp_time_remote)) {
+        offset = ntp_time_local - ntp_time_remote;
+    }
+    return offset;
+}
+
 extern "C" void audio_process (void *cls, raop_ntp_t *ntp, audio_decode_struct *data) {
     if (dump_audio) {
         dump_audio_to_file(data->data, data->data_len, (data->data)[0] & 0xf0);
     }
-    if (use_audio) {
-        if (!remote_clock_offset) {
-            remote_clock_offset = data->ntp_time_local - data->ntp_time_remote;
-        }
-        data->ntp_time_remote = data->ntp_time_remote + remote_clock_offset;
+    if (use_audio || recorder) {
+        data->ntp_time_remote = data->ntp_time_remote + get_remote_clock_offset(data->ntp_time_local, data->ntp_time_remote);
         if (data->ct == 2 && audio_delay_alac) {
             data->ntp_time_remote = (uint64_t) ((int64_t) data->ntp_time_remote  + audio_delay_alac);
         } else if (audio_delay_aac) {
             data->ntp_time_remote = (uint64_t) ((int64_t) data->ntp_time_remote + audio_delay_aac);
         }
+    }
+    if (recorder) {
+        recorder_audio(recorder, data->ct, data->data, data->data_len, data->ntp_time_remote);
+    }
+    if (use_audio) {
       audio_renderer_render_buffer(data->data, &(data->data_len), &(data->seqnum), &(data->ntp_time_remote));
     }
 }
@@ -731,15 +771,39 @@ extern "C" void video_process (void *cls, raop_ntp_t *ntp, h264_decode_struct *d
     if (dump_video) {
         dump_video_to_file(data->data, data->data_len);
     }
+    if (use_video || recorder) {
+        data->ntp_time_remote = data->ntp_time_remote + get_remote_clock_offset(data->ntp_time_local, data->ntp_time_remote);
+    }
+    if (recorder) {
+        /* before the push: data may be in a buffer that the renderer then owns */
+        recorder_video(recorder, data->data, data->data_len, data->ntp_time_remote);
+    }
     if (use_video) {
-        if (!remote_clock_offset) {
-            remote_clock_offset = data->ntp_time_local - data->ntp_time_remote;
+        if (data->buffer) {
+            video_renderer_push_buffer(data->buffer, &(data->data_len), &(data->nal_count), &(data->ntp_time_remote));
+        } else {
+            video_renderer_render_buffer(data->data, &(data->data_len), &(data->nal_count), &(data->ntp_time_remote));
         }
-        data->ntp_time_remote = data->ntp_time_remote + remote_clock_offset;
-        video_renderer_render_buffer(data->data, &(data->data_len), &(data->nal_count), &(data->ntp_time_remote));
+    } else if (data->buffer) {
+        video_renderer_release_buffer(data->buffer);
     }
 }
 
+extern "C" void *video_get_buffer (void *cls, int size, unsigned char **data) {
+    if (use_video) {
+        return video_renderer_acquire_buffer(size, data);
+    }
+    return NULL;
+}
+
+extern "C" bool audio_congested (void *cls) {
+    return use_audio && audio_renderer_congested();
+}
+
+extern "C" bool video_congested (void *cls) {
+    return use_video && video_renderer_congested();
+}
+
 extern "C" void audio_flush (void *cls) {
     if (use_audio) {
         audio_renderer_flush();
@@ -879,6 +943,9 @@ int start_raop_server (unsigned short display[5], unsigned short tcp[3], unsigne
     raop_cbs.audio_set_volume = audio_set_volume;
     raop_cbs.audio_get_format = audio_get_format;
     raop_cbs.video_report_size = video_report_size;
+    raop_cbs.video_get_buffer = video_get_buffer;
+    raop_cbs.audio_congested = audio_congested;
+    raop_cbs.video_congested = video_congested;
     raop_cbs.audio_set_metadata = audio_set_metadata;
     raop_cbs.audio_set_coverart = audio_set_coverart;
 
@@ -937,6 +1004,19 @@ static void stop_raop_server () {
     return;
 }
 
+static void start_metrics_server (unsigned short port, bool loopback_only) {
+    metrics_server = metrics_server_init(render_logger);
+    if (!metrics_server) {
+        LOGE("could not create the metrics server");
+        return;
+    }
+    if (metrics_server_start(metrics_server, &port, loopback_only ? 1 : 0) < 0) {
+        LOGE("could not serve metrics on port %u", port);
+        metrics_server_destroy(metrics_server);
+        metrics_server = NULL;
+    }
+}
+
 int uxplay_start (struct uxplay_config config) {
     std::vector<char> server_hw_addr;
     std::string mac_address;
@@ -952,6 +1032,12 @@ int uxplay_start (struct uxplay_config config) {
     videosink = app_config.videosink;
     new_window_closing_behavior = app_config.new_window_closing_behavior;
     debug_log = app_config.debug_log;
+    video_latency_budget = app_config.video_latency_budget;
+    audio_latency_budget = app_config.audio_latency_budget;
+    bench_report = app_config.bench_report;
+    frame_export = app_config.frame_export;
+    record_filename = app_config.record;
+    profile_name = app_config.profile;
 
     LOGI("UxPlay %s: An Open-Source AirPlay mirroring and audio-streaming server.", VERSION);
 
@@ -964,15 +1050,25 @@ int uxplay_start (struct uxplay_config config) {
     logger_set_callback(render_logger, log_callback, NULL);
     logger_set_level(render_logger, debug_log ? LOGGER_DEBUG : LOGGER_INFO);
 
+    if (app_config.metrics_port) {
+        start_metrics_server(app_config.metrics_port, app_config.metrics_loopback_only);
+    }
+
+    renderer_bench_set_report(bench_report.c_str());
+    select_profile();
+    if (record_filename.length()) {
+        recorder = recorder_new(render_logger, record_filename.c_str());
+    }
     if (use_audio) {
-      audio_renderer_init(render_logger, audiosink.c_str(), &audio_sync, &video_sync);
+      audio_renderer_init(render_logger, audiosink.c_str(), &audio_sync, &video_sync, audio_latency_budget);
     } else {
         LOGI("audio_disabled");
     }
 
     if (use_video) {
         video_renderer_init(render_logger, server_name.c_str(), videoflip, video_parser.c_str(),
-                            video_decoder.c_str(), video_converter.c_str(), videosink.c_str(), &fullscreen, &video_sync);
+                            video_decoder.c_str(), video_converter.c_str(), videosink.c_str(), &fullscreen, &video_sync,
+                            video_latency_budget, frame_export.c_str());
         update_status(uxplay_status_video_prepare, "");
         video_renderer_start();
         update_status(uxplay_status_video_ready, "");
@@ -1023,12 +1119,14 @@ int uxplay_start (struct uxplay_config config) {
         } else {
             raop_stop(raop);
         }
+        renderer_bench_report();
+        recorder_stop(recorder);
         if (use_audio) audio_renderer_stop();
-        if (use_video && close_window) {
+        if (use_video && !video_renderer_reset(close_window)) {
             video_renderer_destroy();
             video_renderer_init(render_logger, server_name.c_str(), videoflip, video_parser.c_str(),
                                 video_decoder.c_str(), video_converter.c_str(), videosink.c_str(), &fullscreen,
-                                &video_sync);
+                                &video_sync, video_latency_budget, frame_export.c_str());
             video_renderer_start();
         }
         if (relaunch_video) {
@@ -1049,12 +1147,19 @@ int uxplay_start (struct uxplay_config config) {
         stop_dnssd();
     }
     cleanup:
+    renderer_bench_report();
+    recorder_free(recorder);
+    recorder = NULL;
     if (use_audio) {
         audio_renderer_destroy();
     }
     if (use_video)  {
         video_renderer_destroy();
     }
+    if (metrics_server) {
+        metrics_server_destroy(metrics_server);
+        metrics_server = NULL;
+    }
     logger_destroy(render_logger);
     render_logger = NULL;
     if(audio_dumpfile) {
@@ -1084,4 +1189,64 @@ int uxplay_disconnect_all_clients() {
 int uxplay_set_volume(float volume) {
     audio_set_volume(NULL, volume);
     return 0;
-}
\ No newline at end of file
+}
+
+int uxplay_trace_dump(const char *path) {
+    return trace_dump(path);
+}
+
+int uxplay_get_stats(struct uxplay_stats *stats) {
+    stats->audio_packets = metrics_get_counter(METRICS_AUDIO_PACKETS);
+    stats->audio_bytes = metrics_get_counter(METRICS_AUDIO_BYTES);
+    stats->video_packets = metrics_get_counter(METRICS_VIDEO_PACKETS);
+    stats->video_bytes = metrics_get_counter(METRICS_VIDEO_BYTES);
+    stats->video_frames = metrics_get_counter(METRICS_VIDEO_FRAMES);
+    stats->resend_requests = metrics_get_counter(METRICS_RESEND_REQUESTS);
+    stats->resend_recovered = metrics_get_counter(METRICS_RESEND_RECOVERED);
+    stats->audio_late = metrics_get_counter(METRICS_AUDIO_LATE);
+    stats->audio_duplicate = metrics_get_counter(METRICS_AUDIO_DUPLICATE);
+    stats->audio_out_of_window = metrics_get_counter(METRICS_AUDIO_OUT_OF_WINDOW);
+    stats->decrypt_failures = metrics_get_counter(METRICS_DECRYPT_FAILURES);
+    stats->invalid_audio_frames = metrics_get_counter(METRICS_INVALID_AUDIO_FRAMES);
+    stats->appsrc_push_failures = metrics_get_counter(METRICS_APPSRC_PUSH_FAILURES);
+    stats->ntp_timeouts = metrics_get_counter(METRICS_NTP_TIMEOUTS);
+    stats->audio_congestion_drops = metrics_get_counter(METRICS_AUDIO_CONGESTION_DROPS);
+    stats->video_congestion_drops = metrics_get_counter(METRICS_VIDEO_CONGESTION_DROPS);
+    stats->audio_queue_overruns = metrics_get_counter(METRICS_AUDIO_QUEUE_OVERRUNS);
+    stats->video_queue_overruns = metrics_get_counter(METRICS_VIDEO_QUEUE_OVERRUNS);
+    stats->audio_buffer_fill = (uint64_t) metrics_get_gauge(METRICS_AUDIO_BUFFER_FILL);
+    stats->audio_queue_time = (uint64_t) metrics_get_gauge(METRICS_AUDIO_QUEUE_TIME);
+    stats->video_queue_time = (uint64_t) metrics_get_gauge(METRICS_VIDEO_QUEUE_TIME);
+    stats->audio_switch_time = (uint64_t) metrics_get_gauge(METRICS_AUDIO_SWITCH_TIME);
+    stats->video_sink_drops = metrics_get_counter(METRICS_VIDEO_SINK_DROPS);
+    stats->video_qos_drops = metrics_get_counter(METRICS_VIDEO_QOS_DROPS);
+    stats->video_qos_jitter = metrics_get_gauge(METRICS_VIDEO_QOS_JITTER);
+    stats->video_pipeline_latency = (uint64_t) metrics_get_gauge(METRICS_VIDEO_PIPELINE_LATENCY);
+    stats->log_drops = metrics_get_counter(METRICS_LOG_DROPS);
+    return 0;
+}
+
+static void get_stream_latency(metrics_stream_t stream, struct uxplay_stream_latency *latency) {
+    struct uxplay_latency *stages[METRICS_STAGE_COUNT] = { &latency->network, &latency->decrypt,
+                                                           &latency->appsrc, &latency->sink,
+                                                           &latency->queue, &latency->parse,
+                                                           &latency->decode, &latency->convert };
+    for (int i = 0; i < METRICS_STAGE_COUNT; i++) {
+        metrics_latency_t summary;
+        metrics_get_latency(stream, (metrics_stage_t) i, &summary);
+        stages[i]->count = summary.count;
+        stages[i]->p50 = summary.p50;
+        stages[i]->p90 = summary.p90;
+        stages[i]->p99 = summary.p99;
+        stages[i]->max = summary.max;
+    }
+}
+
+int uxplay_get_latency_stats(struct uxplay_latency_stats *stats, bool reset) {
+    get_stream_latency(METRICS_AUDIO, &stats->audio);
+    get_stream_latency(METRICS_VIDEO, &stats->video);
+    if (reset) {
+        metrics_reset_latency();
+    }
+    return 0;
+}
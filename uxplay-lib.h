@@ -23,6 +23,8 @@
 #ifndef UXPLAYLIB_H
 #define UXPLAYLIB_H
 
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -55,6 +57,15 @@ struct uxplay_config
     char audio_dec_alac[50] = "avdec_alac";
     void  (*status_callback)(uxplay_status_t status, const char *options);
     bool debug_log = true;
+    unsigned short metrics_port = 0;      /* serve GET /metrics on this port, 0 = off */
+    bool metrics_loopback_only = true;    /* listen on 127.0.0.1 only */
+    unsigned int video_latency_budget = 1000; /* msecs queued in the video pipeline before frames are dropped, 0 = unbounded */
+    unsigned int audio_latency_budget = 1000; /* same for mirror-mode (AAC) audio */
+    char bench_report[256] = "uxplay-bench-report.json"; /* "<fn>.<n>.json" written at the end of session n when videosink or audiosink is "bench" */
+    char frame_export[108] = "";          /* unix socket path for decoded-frame export (Linux), "" = off */
+    char record[256] = "";                /* session recording: fn.x.mp4, or fn.x.ts if it ends in ".ts"; "" = off */
+    char profile[16] = "auto";            /* low-latency, balanced, smooth, or auto (calibrated at start); the  *
+                                           * latency budgets above are used as given, whatever the profile      */
 };
 
 int uxplay_start(struct uxplay_config config);
@@ -62,6 +73,75 @@ int uxplay_disconnect_all_clients();
 int uxplay_set_volume(float volume);
 int uxplay_stop();
 
+/* Write the recorded session timeline as Chrome trace JSON (open it in
+ * Perfetto); needs a build with cmake -DUXPLAY_TRACE=ON.  Returns the
+ * number of events written, or -1 on error. */
+int uxplay_trace_dump(const char *path);
+
+/* cumulative since the process started, except audio_buffer_fill and the queue, switch, jitter and latency times */
+struct uxplay_stats {
+    uint64_t audio_packets;
+    uint64_t audio_bytes;
+    uint64_t video_packets;
+    uint64_t video_bytes;
+    uint64_t video_frames;
+    uint64_t resend_requests;         /* audio packets asked for again */
+    uint64_t resend_recovered;        /* resent audio packets that filled a gap */
+    uint64_t audio_late;              /* arrived after their slot was played */
+    uint64_t audio_duplicate;
+    uint64_t audio_out_of_window;     /* too far ahead, the jitter buffer was flushed */
+    uint64_t decrypt_failures;        /* video payloads that did not decrypt to valid h264 */
+    uint64_t invalid_audio_frames;    /* rejected by the audio renderer */
+    uint64_t appsrc_push_failures;
+    uint64_t ntp_timeouts;
+    uint64_t audio_buffer_fill;       /* packets currently held in the audio jitter buffer */
+    uint64_t audio_congestion_drops;  /* frames dropped to keep within the latency budget */
+    uint64_t video_congestion_drops;
+    uint64_t audio_queue_overruns;    /* buffers leaked by a full pipeline queue */
+    uint64_t video_queue_overruns;
+    uint64_t audio_queue_time;        /* nsecs currently queued in the audio pipeline */
+    uint64_t video_queue_time;
+    uint64_t audio_switch_time;       /* nsecs taken by the last audio format switch */
+    uint64_t video_sink_drops;        /* QoS: frames dropped by the videosink for being late */
+    uint64_t video_qos_drops;         /* QoS: frames dropped before the videosink, usually by the decoder */
+    int64_t video_qos_jitter;         /* QoS: nsecs late of the last frame dropped */
+    uint64_t video_pipeline_latency;  /* nsecs, as reported by the video pipeline's latency query */
+    uint64_t log_drops;               /* debug and info messages dropped while the logger fell behind */
+};
+
+/* Take a snapshot of the counters; cheap enough to poll.  Returns 0. */
+int uxplay_get_stats(struct uxplay_stats *stats);
+
+/* latency percentiles in microseconds, since start or the last reset */
+struct uxplay_latency {
+    uint64_t count;
+    uint64_t p50;
+    uint64_t p90;
+    uint64_t p99;
+    uint64_t max;
+};
+
+struct uxplay_stream_latency {
+    struct uxplay_latency network;   /* sender timestamp to arrival (audio: jitter above the lowest transit) */
+    struct uxplay_latency decrypt;   /* arrival to decrypted */
+    struct uxplay_latency appsrc;    /* decrypted to pushed into GStreamer (audio includes the jitter buffer) */
+    struct uxplay_latency sink;      /* pushed into GStreamer to reaching the sink */
+    /* sink, split up: compare decode with convert to tell a slow decoder from a slow display path */
+    struct uxplay_latency queue;     /* waiting in the queue behind the appsrc */
+    struct uxplay_latency parse;     /* through the h264 parser (video only) */
+    struct uxplay_latency decode;    /* through the decoder */
+    struct uxplay_latency convert;   /* decoded to reaching the sink (converter, filters) */
+};
+
+struct uxplay_latency_stats {
+    struct uxplay_stream_latency audio;
+    struct uxplay_stream_latency video;
+};
+
+/* Fill *stats from the per-stage latency histograms; with reset set the
+ * histograms are cleared afterwards.  Returns 0. */
+int uxplay_get_latency_stats(struct uxplay_latency_stats *stats, bool reset);
+
 
 #ifdef __cplusplus
 }
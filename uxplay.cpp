@@ -28,6 +28,7 @@
 #include <string>
 #include <vector>
 #include <fstream>
+#include <atomic>
 
 #ifdef _WIN32  /*modifications for Windows compilation */
 #include <glib.h>
@@ -51,8 +52,12 @@
 #include "lib/stream.h"
 #include "lib/logger.h"
 #include "lib/dnssd.h"
+#include "lib/metrics_server.h"
 #include "renderers/video_renderer.h"
 #include "renderers/audio_renderer.h"
+#include "renderers/renderer_bench.h"
+#include "renderers/recorder.h"
+#include "renderers/renderer_profile.h"
 
 #define VERSION "1.63"
 
@@ -63,6 +68,9 @@
 #define LOWEST_ALLOWED_PORT 1024
 #define HIGHEST_PORT 65535
 #define NTP_TIMEOUT_LIMIT 5
+#define LATENCY_BUDGET_MS 1000   /* the time limit of a GStreamer queue with default settings */
+#define MAX_LATENCY_BUDGET_MS 10000
+#define METRICS_PORT 9464
 #define BT709_FIX "capssetter caps=\"video/x-h264, colorimetry=bt709\""
 
 static std::string server_name = DEFAULT_NAME;
@@ -75,12 +83,16 @@ static int64_t audio_delay_alac = 0;
 static int64_t audio_delay_aac = 0;
 static bool relaunch_video = false;
 static bool reset_loop = false;
-static unsigned int open_connections= 0;
+static std::atomic_uint open_connections(0);
 static std::string videosink = "autovideosink";
 static videoflip_t videoflip[2] = { NONE , NONE };
 static bool use_video = true;
 static unsigned char compression_type = 0;
 static std::string audiosink = "autoaudiosink";
+static std::string bench_report = RENDERER_BENCH_REPORT;
+static std::string frame_export = "";
+static std::string record_filename = "";
+static recorder_t *recorder = NULL;
 static int  audiodelay = -1;
 static bool use_audio = true;
 static bool new_window_closing_behavior = true;
@@ -112,10 +124,17 @@ static bool use_random_hw_addr = false;
 static unsigned short display[5] = {0}, tcp[3] = {0}, udp[3] = {0};
 static bool debug_log = DEFAULT_DEBUG_LOG;
 static bool bt709_fix = false;
+static unsigned short metrics_port = 0;
+static bool metrics_loopback_only = true;
+static metrics_server_t *metrics_server = NULL;
 static int max_connections = 2;
+static unsigned int video_latency_budget = LATENCY_BUDGET_MS;
+static unsigned int audio_latency_budget = LATENCY_BUDGET_MS;
+static bool latency_budget_set = false;
+static std::string profile_name = RENDERER_PROFILE_AUTO;
 static unsigned short raop_port;
 static unsigned short airplay_port;
-static uint64_t remote_clock_offset = 0;
+static std::atomic<uint64_t> remote_clock_offset(0);
 
 /* 95 byte png file with a 1x1 white square (single pixel): placeholder for coverart*/
 static const unsigned char empty_image[] = {
@@ -389,6 +408,9 @@ static void print_info (char *name) {
     printf("          some choices: ximagesink,xvimagesink,vaapisink,glimagesink,\n");
     printf("          gtksink,waylandsink,osximagesink,kmssink,d3d11videosink etc.\n");
     printf("-vs 0     Streamed audio only, with no video display window\n");
+    printf("-vs null  Discard video without GStreamer (-as null: audio)\n");
+    printf("-export <path> Publish decoded video frames to other processes (Linux):\n");
+    printf("          memfd ring + eventfd, handed out on unix socket <path>\n");
     printf("-v4l2     Use Video4Linux2 for GPU hardware h264 decoding\n");
     printf("-bt709    A workaround (bt709 color) that may be needed with -rpi\n"); 
     printf("-rpi      Same as \"-v4l2\" (for RPi=Raspberry Pi).\n");
@@ -399,16 +421,31 @@ static void print_info (char *name) {
     printf("          some choices:pulsesink,alsasink,pipewiresink,jackaudiosink,\n");
     printf("          osssink,oss4sink,osxaudiosink,wasapisink,directsoundsink.\n");
     printf("-as 0     (or -a)  Turn audio off, streamed video only\n");
+    printf("-bench [fn] Headless benchmark: decode audio and video, then discard\n");
+    printf("          them; a JSON report of frame counts and sink latency is\n");
+    printf("          written when each client disconnects, to fn.1.json,\n");
+    printf("          fn.2.json, ... (default fn.json \"%s\").\n", RENDERER_BENCH_REPORT);
+    printf("          \"-vs bench\", \"-as bench\": one stream only.\n");
     printf("-al x     Audio latency in seconds (default 0.25) reported to client.\n");
     printf("-ca <fn>  In Airplay Audio (ALAC) mode, write cover-art to file <fn>\n");
     printf("-reset n  Reset after 3n seconds client silence (default %d, 0=never)\n", NTP_TIMEOUT_LIMIT);
     printf("-nc       do Not Close video window when client stops mirroring\n");
     printf("-nohold   Drop current connection when new client connects.\n");
+    printf("-lb v[,a] Latency budget (millisecs) of the video [audio] pipeline queue:\n");
+    printf("          frames are dropped rather than queued beyond it (default: from\n");
+    printf("          -profile, or %d with -vsync; a = v if not given; 0 = unbounded).\n", LATENCY_BUDGET_MS);
+    printf("          Audio: mirror mode only.\n");
+    printf("-profile p Pipeline profile p = low-latency, balanced or smooth: sets\n");
+    printf("          latency budget, sink lateness/QoS, decoder threading, audio\n");
+    printf("          buffering together. Default auto: choose by timing the decoder.\n");
     printf("-FPSdata  Show video-streaming performance reports sent by client.\n");
     printf("-fps n    Set maximum allowed streaming framerate, default 30\n");
     printf("-f {H|V|I}Horizontal|Vertical flip, or both=Inversion=rotate 180 deg\n");
     printf("-r {R|L}  Rotate 90 degrees Right (cw) or Left (ccw)\n");
     printf("-m        Use random MAC address (use for concurrent UxPlay's)\n");
+    printf("-rec <fn> Record each session, without decoding the video, to fn.x.mp4\n");
+    printf("          (fragmented MP4), or to fn.x.ts (MPEG-TS) if fn ends in \".ts\";\n");
+    printf("          x=1,2,.. increases with each session.\n");
     printf("-vdmp [n] Dump h264 video output to \"fn.h264\"; fn=\"videodump\",change\n");
     printf("          with \"-vdmp [n] filename\". If [n] is given, file fn.x.h264\n");
     printf("          x=1,2,.. opens whenever a new SPS/PPS NAL arrives, and <=n\n");
@@ -417,6 +454,9 @@ static void print_info (char *name) {
     printf("          =1,2,..; fn=\"audiodump\"; change with \"-admp [n] filename\".\n");
     printf("          x increases when audio format changes. If n is given, <= n\n");
     printf("          audio packets are dumped. \"aud\"= unknown format.\n");
+    printf("-metrics [n] Serve Prometheus/OpenMetrics counters on localhost port n\n");
+    printf("          at http://127.0.0.1:n/metrics (default n = %d).\n", METRICS_PORT);
+    printf("-metricsall Same as -metrics, but listen on all network interfaces\n");
     printf("-d        Enable debug logging\n");
     printf("-v        Displays version information\n");
     printf("-h        Displays this help\n");
@@ -674,6 +714,19 @@ static void parse_arguments (int argc, char *argv[]) {
             if (!option_has_value(i, argc, arg, argv[i+1])) exit(1);
             audiosink.erase();
             audiosink.append(argv[++i]);
+        } else if (arg == "-bench") {
+            videosink.erase();
+            videosink.append(RENDERER_BENCH_SINK);
+            audiosink.erase();
+            audiosink.append(RENDERER_BENCH_SINK);
+            if (i < argc - 1 && *argv[i+1] != '-') {
+                bench_report.erase();
+                bench_report.append(argv[++i]);
+            }
+        } else if (arg == "-export") {
+            if (!option_has_value(i, argc, arg, argv[i+1])) exit(1);
+            frame_export.erase();
+            frame_export.append(argv[++i]);
         } else if (arg == "-t") {
             fprintf(stderr,"The uxplay option \"-t\" has been removed: it was a workaround for an  Avahi issue.\n");
             fprintf(stderr,"The correct solution is to open network port UDP 5353 in the firewall for mDNS queries\n");
@@ -729,6 +782,10 @@ static void parse_arguments (int argc, char *argv[]) {
                 fprintf(stderr, "invalid \"-reset %s\"; -reset n must have n >= 0,  default n = %d\n", argv[i], NTP_TIMEOUT_LIMIT);
                 exit(1);
             }
+        } else if (arg == "-rec") {
+            if (!option_has_value(i, argc, arg, argv[i+1])) exit(1);
+            record_filename.erase();
+            record_filename.append(argv[++i]);
         } else if (arg == "-vdmp") {
             dump_video = true;
             if (i < argc - 1 && *argv[i+1] != '-') {
@@ -777,8 +834,47 @@ static void parse_arguments (int argc, char *argv[]) {
             }
         } else if (arg == "-bt709") {
             bt709_fix = true;
+        } else if (arg == "-metrics" || arg == "-metricsall") {
+            metrics_port = METRICS_PORT;
+            metrics_loopback_only = (arg == "-metrics");
+            if (i < argc - 1 && *argv[i+1] != '-') {
+                unsigned int n = HIGHEST_PORT;
+                if (!get_value(argv[++i], &n) || n < LOWEST_ALLOWED_PORT) {
+                    fprintf(stderr, "invalid \"%s %s\": port must be in range [%d,%d]\n", arg.c_str(), argv[i],
+                            LOWEST_ALLOWED_PORT, HIGHEST_PORT);
+                    exit(1);
+                }
+                metrics_port = (unsigned short) n;
+            }
         } else if (arg == "-nohold") {
             max_connections = 3;
+        } else if (arg == "-lb") {
+            if (!option_has_value(i, argc, arg, argv[i+1])) exit(1);
+            std::string value(argv[++i]);
+            std::size_t pos = value.find_first_of(',');
+            unsigned int v = 0, a = 0;
+            bool valid = get_value(value.substr(0, pos).c_str(), &v);
+            if (pos == std::string::npos) {
+                a = v;
+            } else {
+                valid = valid && get_value(value.substr(pos + 1).c_str(), &a);
+            }
+            if (!valid || v > MAX_LATENCY_BUDGET_MS || a > MAX_LATENCY_BUDGET_MS) {
+                fprintf(stderr, "invalid \"-lb %s\"; -lb v[,a] : latency budgets in millisecs, max %d (0 = unbounded)\n",
+                        argv[i], MAX_LATENCY_BUDGET_MS);
+                exit(1);
+            }
+            video_latency_budget = v;
+            audio_latency_budget = a;
+            latency_budget_set = true;
+        } else if (arg == "-profile") {
+            if (!option_has_value(i, argc, arg, argv[i+1])) exit(1);
+            profile_name.erase();
+            profile_name.append(argv[++i]);
+            if (profile_name != RENDERER_PROFILE_AUTO && !renderer_profile_find(profile_name.c_str())) {
+                fprintf(stderr, "invalid \"-profile %s\"; choices are auto, low-latency, balanced, smooth\n", argv[i]);
+                exit(1);
+            }
         } else if (arg == "-al") {
 	    int n;
             char *end;
@@ -999,9 +1095,10 @@ extern "C" void conn_init (void *cls) {
 
 extern "C" void conn_destroy (void *cls) {
     //video_renderer_update_background(-1);
-    open_connections--;
-    //LOGD("Open connections: %i", open_connections);
-    if (open_connections == 0) {
+    /* conn_init and conn_destroy may run on different threads */
+    unsigned int remaining = --open_connections;
+    //LOGD("Open connections: %i", remaining);
+    if (remaining == 0) {
         remote_clock_offset = 0;
     }
 }
@@ -1025,20 +1122,49 @@ extern "C" void conn_teardown(void *cls, bool *teardown_96, bool *teardown_110)
     }
 }
 
+/* auto: calibrate against the decoder that will be used; audio-only (or no GStreamer video) gets balanced */
+static void select_profile() {
+    const renderer_profile_t *profile = renderer_profile_find(profile_name.c_str());
+    if (!profile && use_video && video_renderer_backend(videosink.c_str()) == &video_renderer_gstreamer) {
+        profile = renderer_profile_calibrate(render_logger, video_parser.c_str(), video_decoder.c_str(),
+                                             video_converter.c_str(), display[0] ? display[0] : 1920,
+                                             display[1] ? display[1] : 1080, display[3] ? display[3] : 30);
+    }
+    renderer_profile_set(profile);
+    profile = renderer_profile_get();
+    LOGI("using the %s pipeline profile", profile->name);
+    /* with -vsync, frames wait in the queue until their display time, so keep the default budget */
+    if (!latency_budget_set && !video_sync) {
+        video_latency_budget = profile->latency_budget_ms;
+        audio_latency_budget = profile->latency_budget_ms;
+    }
+}
+
+/* set by whichever of the audio and video threads gets the first packet */
+static uint64_t get_remote_clock_offset (uint64_t ntp_time_local, uint64_t ntp_time_remote) {
+    uint64_t offset = 0;
+    if (remote_clock_offset.compare_exchange_strong(offset, ntp_time_local - ntp_time_remote)) {
+        offset = ntp_time_local - ntp_time_remote;
+    }
+    return offset;
+}
+
 extern "C" void audio_process (void *cls, raop_ntp_t *ntp, audio_decode_struct *data) {
     if (dump_audio) {
         dump_audio_to_file(data->data, data->data_len, (data->data)[0] & 0xf0);
     }
-    if (use_audio) {
-        if (!remote_clock_offset) {
-            remote_clock_offset = data->ntp_time_local - data->ntp_time_remote;
-        }
-        data->ntp_time_remote = data->ntp_time_remote + remote_clock_offset;
+    if (use_audio || recorder) {
+        data->ntp_time_remote = data->ntp_time_remote + get_remote_clock_offset(data->ntp_time_local, data->ntp_time_remote);
         if (data->ct == 2 && audio_delay_alac) {
             data->ntp_time_remote = (uint64_t) ((int64_t) data->ntp_time_remote  + audio_delay_alac);
         } else if (audio_delay_aac) {
             data->ntp_time_remote = (uint64_t) ((int64_t) data->ntp_time_remote + audio_delay_aac);
         }
+    }
+    if (recorder) {
+        recorder_audio(recorder, data->ct, data->data, data->data_len, data->ntp_time_remote);
+    }
+    if (use_audio) {
       audio_renderer_render_buffer(data->data, &(data->data_len), &(data->seqnum), &(data->ntp_time_remote));
     }
 }
@@ -1047,13 +1173,37 @@ extern "C" void video_process (void *cls, raop_ntp_t *ntp, h264_decode_struct *d
     if (dump_video) {
         dump_video_to_file(data->data, data->data_len);
     }
+    if (use_video || recorder) {
+        data->ntp_time_remote = data->ntp_time_remote + get_remote_clock_offset(data->ntp_time_local, data->ntp_time_remote);
+    }
+    if (recorder) {
+        /* before the push: data may be in a buffer that the renderer then owns */
+        recorder_video(recorder, data->data, data->data_len, data->ntp_time_remote);
+    }
     if (use_video) {
-        if (!remote_clock_offset) {
-            remote_clock_offset = data->ntp_time_local - data->ntp_time_remote;
+        if (data->buffer) {
+            video_renderer_push_buffer(data->buffer, &(data->data_len), &(data->nal_count), &(data->ntp_time_remote));
+        } else {
+            video_renderer_render_buffer(data->data, &(data->data_len), &(data->nal_count), &(data->ntp_time_remote));
         }
-        data->ntp_time_remote = data->ntp_time_remote + remote_clock_offset;
-        video_renderer_render_buffer(data->data, &(data->data_len), &(data->nal_count), &(data->ntp_time_remote));
+    } else if (data->buffer) {
+        video_renderer_release_buffer(data->buffer);
+    }
+}
+
+extern "C" void *video_get_buffer (void *cls, int size, unsigned char **data) {
+    if (use_video) {
+        return video_renderer_acquire_buffer(size, data);
     }
+    return NULL;
+}
+
+extern "C" bool audio_congested (void *cls) {
+    return use_audio && audio_renderer_congested();
+}
+
+extern "C" bool video_congested (void *cls) {
+    return use_video && video_renderer_congested();
 }
 
 extern "C" void audio_flush (void *cls) {
@@ -1194,6 +1344,9 @@ int start_raop_server (unsigned short display[5], unsigned short tcp[3], unsigne
     raop_cbs.audio_set_volume = audio_set_volume;
     raop_cbs.audio_get_format = audio_get_format;
     raop_cbs.video_report_size = video_report_size;
+    raop_cbs.video_get_buffer = video_get_buffer;
+    raop_cbs.audio_congested = audio_congested;
+    raop_cbs.video_congested = video_congested;
     raop_cbs.audio_set_metadata = audio_set_metadata;
     raop_cbs.audio_set_coverart = audio_set_coverart;
     
@@ -1337,15 +1490,30 @@ int main (int argc, char *argv[]) {
     logger_set_callback(render_logger, log_callback, NULL);
     logger_set_level(render_logger, debug_log ? LOGGER_DEBUG : LOGGER_INFO);
 
+    if (metrics_port) {
+        metrics_server = metrics_server_init(render_logger);
+        if (!metrics_server || metrics_server_start(metrics_server, &metrics_port, metrics_loopback_only) < 0) {
+            LOGE("could not serve metrics on port %u", metrics_port);
+            metrics_server_destroy(metrics_server);
+            metrics_server = NULL;
+        }
+    }
+
+    renderer_bench_set_report(bench_report.c_str());
+    select_profile();
+    if (record_filename.length()) {
+        recorder = recorder_new(render_logger, record_filename.c_str());
+    }
     if (use_audio) {
-      audio_renderer_init(render_logger, audiosink.c_str(), &audio_sync, &video_sync);
+      audio_renderer_init(render_logger, audiosink.c_str(), &audio_sync, &video_sync, audio_latency_budget);
     } else {
         LOGI("audio_disabled");
     }
 
     if (use_video) {
         video_renderer_init(render_logger, server_name.c_str(), videoflip, video_parser.c_str(),
-                            video_decoder.c_str(), video_converter.c_str(), videosink.c_str(), &fullscreen, &video_sync);
+                            video_decoder.c_str(), video_converter.c_str(), videosink.c_str(), &fullscreen, &video_sync,
+                            video_latency_budget, frame_export.c_str());
         video_renderer_start();
     }
 
@@ -1394,12 +1562,14 @@ int main (int argc, char *argv[]) {
         } else {
             raop_stop(raop);
         }
+        renderer_bench_report();
+        recorder_stop(recorder);
         if (use_audio) audio_renderer_stop();
-        if (use_video && close_window) {
+        if (use_video && !video_renderer_reset(close_window)) {
             video_renderer_destroy();
             video_renderer_init(render_logger, server_name.c_str(), videoflip, video_parser.c_str(),
                                 video_decoder.c_str(), video_converter.c_str(), videosink.c_str(), &fullscreen,
-                                &video_sync);
+                                &video_sync, video_latency_budget, frame_export.c_str());
             video_renderer_start();
         }
         if (relaunch_video) {
@@ -1419,12 +1589,17 @@ int main (int argc, char *argv[]) {
         stop_dnssd();
     }
     cleanup:
+    renderer_bench_report();
+    recorder_free(recorder);
+    recorder = NULL;
     if (use_audio) {
         audio_renderer_destroy();
     }
     if (use_video)  {
         video_renderer_destroy();
     }
+    metrics_server_destroy(metrics_server);
+    metrics_server = NULL;
     logger_destroy(render_logger);
     render_logger = NULL;
     if(audio_dumpfile) {